@@ -0,0 +1,120 @@
+#include "astrolib/block_cache.hpp"
+
+using namespace leapus::osm;
+
+block_cache::block_cache( const osm_file &file, size_type memory_cap, unsigned shard_count ):
+    m_file(file),
+    m_shard_cap( memory_cap / std::max(shard_count, 1u) ),
+    m_shards( std::max(shard_count, 1u) ){}
+
+block_cache::shard &block_cache::shard_for(pos_type pos){
+    //Blob positions are arbitrary file offsets, so mix them up before picking a shard
+    return m_shards[ (pos * 0x9E3779B97F4A7C15ull >> 32) % m_shards.size() ];
+}
+
+block_cache::block_ptr block_cache::get( pos_type pos ){
+    shard &sh=shard_for(pos);
+    std::promise<block_ptr> promise;
+    std::shared_future<block_ptr> cached;
+
+    {
+        std::lock_guard lock(sh.mutex);
+        auto it=sh.entries.find(pos);
+
+        if(it != sh.entries.end()){
+            ++sh.stats.hits;
+            sh.lru.splice(sh.lru.begin(), sh.lru, it->second.lru_pos);
+            cached=it->second.block;
+        }
+        else{
+            ++sh.stats.misses;
+            sh.lru.push_front(pos);
+            sh.entries.emplace(pos, entry{ promise.get_future().share(), 0, sh.lru.begin() });
+        }
+    }
+
+    //Outside the lock, because this might be waiting on another thread's decode
+    if(cached.valid())
+        return cached.get();
+
+    return decode(sh, pos, promise);
+}
+
+block_cache::block_ptr block_cache::decode(shard &sh, pos_type pos, std::promise<block_ptr> &promise){
+    block_ptr result;
+
+    try{
+        auto block=std::make_shared<block_type>();
+        m_file.read_block(pos, *block);
+        result=std::move(block);
+    }
+    catch(...){
+        {
+            std::lock_guard lock(sh.mutex);
+            auto it=sh.entries.find(pos);
+            if(it != sh.entries.end()){
+                sh.lru.erase(it->second.lru_pos);
+                sh.entries.erase(it);
+            }
+        }
+
+        promise.set_exception(std::current_exception());
+        throw;
+    }
+
+    {
+        std::lock_guard lock(sh.mutex);
+
+        //It might have been evicted or cleared while it was being decoded, in which case
+        //it's simply not cached
+        auto it=sh.entries.find(pos);
+        if(it != sh.entries.end()){
+            it->second.size=result->SpaceUsedLong();
+            sh.stats.bytes+=it->second.size;
+            evict(sh, pos);
+        }
+    }
+
+    promise.set_value(result);
+    return result;
+}
+
+void block_cache::evict(shard &sh, pos_type keep){
+
+    //Always keep the newest block, even if it alone exceeds the cap
+    while( sh.stats.bytes > m_shard_cap && sh.lru.size() > 1 ){
+        pos_type victim=sh.lru.back();
+        if(victim == keep)
+            break;
+
+        auto it=sh.entries.find(victim);
+        sh.stats.bytes-=it->second.size;
+        sh.lru.pop_back();
+        sh.entries.erase(it);
+        ++sh.stats.evictions;
+    }
+}
+
+block_cache::statistics_type block_cache::statistics(){
+    statistics_type total;
+
+    for(auto &sh: m_shards){
+        std::lock_guard lock(sh.mutex);
+        total.hits+=sh.stats.hits;
+        total.misses+=sh.stats.misses;
+        total.evictions+=sh.stats.evictions;
+        total.bytes+=sh.stats.bytes;
+        total.blocks+=sh.entries.size();
+    }
+
+    return total;
+}
+
+void block_cache::clear(){
+    for(auto &sh: m_shards){
+        std::lock_guard lock(sh.mutex);
+        sh.entries.clear();
+        sh.lru.clear();
+        sh.stats.bytes=0;
+    }
+}
@@ -0,0 +1,61 @@
+#include "astrolib/byteswap.hpp"
+#include "astrolib/cpu.hpp"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+using namespace leapus;
+using namespace leapus::astrolib;
+
+template<typename T>
+static void byteswap_scalar( const T *from, T *to, ::size_t n ){
+    for( ::size_t i=0; i < n; ++i )
+        to[i]=meta::byteswap(from[i]);
+}
+
+#if defined(__x86_64__)
+
+template<typename T>
+__attribute__((target("avx2")))
+static void byteswap_avx2( const T *from, T *to, ::size_t n ){
+    //A byte shuffle reversing each T, within each 16-byte half of the register,
+    //which is as far as _mm256_shuffle_epi8 reaches
+    alignas(32) char order[32];
+    for( int i=0; i < 32; ++i )
+        order[i]=(char)(i % 16 / sizeof(T) * sizeof(T) + sizeof(T)-1 - i % sizeof(T));
+
+    const __m256i mask=_mm256_load_si256((const __m256i *)order);
+    constexpr ::size_t per_register=sizeof(__m256i) / sizeof(T);
+
+    ::size_t i=0;
+    for(; i+per_register <= n; i+=per_register ){
+        __m256i v=_mm256_loadu_si256((const __m256i *)(from+i));
+        _mm256_storeu_si256((__m256i *)(to+i), _mm256_shuffle_epi8(v, mask));
+    }
+
+    byteswap_scalar(from+i, to+i, n-i);
+}
+
+#endif
+
+template<typename T>
+static void byteswap_any( const T *from, T *to, ::size_t n ){
+#if defined(__x86_64__)
+    if(cpu::have_avx2())
+        return byteswap_avx2(from, to, n);
+#endif
+    byteswap_scalar(from, to, n);
+}
+
+void leapus::astrolib::byteswap( const ::uint16_t *from, ::uint16_t *to, ::size_t n ){
+    byteswap_any(from, to, n);
+}
+
+void leapus::astrolib::byteswap( const ::uint32_t *from, ::uint32_t *to, ::size_t n ){
+    byteswap_any(from, to, n);
+}
+
+void leapus::astrolib::byteswap( const ::uint64_t *from, ::uint64_t *to, ::size_t n ){
+    byteswap_any(from, to, n);
+}
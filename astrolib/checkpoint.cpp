@@ -0,0 +1,136 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <fstream>
+#include <iterator>
+#include <algorithm>
+#include "astrolib/checkpoint.hpp"
+
+using namespace leapus;
+using namespace leapus::astrolib;
+
+static constexpr char state_magic[8]={ 'A', 'S', 'T', 'R', 'C', 'K', 'P', 'T' };
+static constexpr ::uint32_t state_version=2;
+
+//Leads the state file, and covers the state that follows it with its checksum
+struct state_header{
+    char magic[8];
+    ::uint32_t version;
+    ::uint32_t crc;
+    ::uint64_t journal_size;
+    ::uint64_t state_size;
+};
+
+static std::string error_text( const std::string &what, const std::filesystem::path &path ){
+    return what + ": " + path.string() + ": " + ::strerror(errno);
+}
+
+checkpoint_file::checkpoint_file( const std::filesystem::path &path ):
+    m_path(path),
+    m_journal_path(path.string() + ".journal"){
+
+    m_journal_fd=::open(m_journal_path.c_str(), O_RDWR | O_CREAT, 0666);
+    if(m_journal_fd == -1)
+        throw checkpoint_exception(error_text("Error opening checkpoint journal", m_journal_path));
+}
+
+checkpoint_file::~checkpoint_file(){
+    if(m_journal_fd != -1)
+        ::close(m_journal_fd);
+}
+
+std::optional<std::string> checkpoint_file::load(){
+    std::ifstream in(m_path, std::ios::binary);
+    if(!in)
+        return {};
+
+    std::string file{ std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>() };
+
+    state_header header;
+    if(file.size() < sizeof(header))
+        throw checkpoint_exception("Checkpoint is truncated: " + m_path.string());
+
+    std::memcpy(&header, file.data(), sizeof(header));
+    if(std::memcmp(header.magic, state_magic, sizeof(state_magic)))
+        throw checkpoint_exception("Not a checkpoint: " + m_path.string());
+
+    if(header.version != state_version)
+        throw checkpoint_exception("Checkpoint is version " + std::to_string(header.version) +
+            ", but only version " + std::to_string(state_version) + " is supported: " + m_path.string());
+
+    if(file.size() - sizeof(header) != header.state_size)
+        throw checkpoint_exception("Checkpoint is truncated: " + m_path.string());
+
+    std::string state=file.substr(sizeof(header));
+    auto crc=checksum(&header.journal_size, sizeof(header.journal_size));
+    if(checksum(state.data(), state.size(), crc) != header.crc)
+        throw checkpoint_exception("Checkpoint is corrupt: " + m_path.string());
+
+    //The journal can be longer than the state says, if we crashed between appending and committing,
+    //but if it's shorter, then something has been at it
+    auto size=::lseek(m_journal_fd, 0, SEEK_END);
+    if(size < 0 || (::uint64_t)size < header.journal_size)
+        throw checkpoint_exception("Checkpoint journal is shorter than the checkpoint says: " + m_journal_path.string());
+
+    if(::ftruncate(m_journal_fd, header.journal_size) == -1)
+        throw checkpoint_exception(error_text("Error truncating checkpoint journal", m_journal_path));
+
+    m_journal_size=header.journal_size;
+    return state;
+}
+
+void checkpoint_file::append( const journal_writer &records ){
+    const auto &data=records.data();
+
+    for( ::size_t done=0; done < data.size(); ){
+        auto n=::pwrite(m_journal_fd, data.data() + done, data.size() - done, m_journal_size + done);
+        if(n < 0){
+            if(errno == EINTR)
+                continue;
+            throw checkpoint_exception(error_text("Error writing checkpoint journal", m_journal_path));
+        }
+
+        done+=n;
+    }
+
+    m_journal_size+=data.size();
+}
+
+void checkpoint_file::commit( std::string_view state ){
+    if(::fdatasync(m_journal_fd) == -1)
+        throw checkpoint_exception(error_text("Error syncing checkpoint journal", m_journal_path));
+
+    state_header header{};
+    std::memcpy(header.magic, state_magic, sizeof(state_magic));
+    header.version=state_version;
+    header.journal_size=m_journal_size;
+    header.state_size=state.size();
+    header.crc=checksum(state.data(), state.size(), checksum(&header.journal_size, sizeof(header.journal_size)));
+
+    auto temp=m_path.string() + ".new";
+    int fd=::open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if(fd == -1)
+        throw checkpoint_exception(error_text("Error creating checkpoint", temp));
+
+    std::string file( (const char *)&header, sizeof(header) );
+    file.append(state);
+
+    bool ok=::write(fd, file.data(), file.size()) == (::ssize_t)file.size();
+    ok=ok && ::fsync(fd) != -1;
+    ::close(fd);
+
+    if(!ok)
+        throw checkpoint_exception(error_text("Error writing checkpoint", temp));
+
+    if(::rename(temp.c_str(), m_path.c_str()) == -1)
+        throw checkpoint_exception(error_text("Error replacing checkpoint", m_path));
+
+    io::sync_directory(m_path.parent_path());
+}
+
+void checkpoint_file::remove(){
+    std::error_code ec;
+    std::filesystem::remove(m_path, ec);
+    std::filesystem::remove(m_journal_path, ec);
+    m_journal_size=0;
+}
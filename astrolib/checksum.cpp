@@ -0,0 +1,16 @@
+#include <zlib.h>
+#include <algorithm>
+#include "astrolib/checksum.hpp"
+
+::uint32_t leapus::astrolib::checksum( const void *data, ::size_t size, ::uint32_t crc ){
+    //zlib takes the length as a uInt, so big buffers go a piece at a time
+    auto *p=(const Bytef *)data;
+    while(size){
+        uInt n=std::min<::size_t>(size, 1u << 30);
+        crc=::crc32(crc, p, n);
+        p+=n;
+        size-=n;
+    }
+
+    return crc;
+}
@@ -0,0 +1,164 @@
+#include "astrolib/clip.hpp"
+#include "astrolib/geometry.hpp"
+#include "astrolib/cpu.hpp"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+using namespace leapus::astrolib;
+
+static void outcodes_scalar( const coordinate_t *pts, ::size_t n, const box_t &box, outcode_t *codes ){
+    for( ::size_t i=0; i < n; ++i )
+        codes[i]=outcode(pts[i], box);
+}
+
+#if defined(__x86_64__)
+
+//Two points per 256-bit register, since each is a pair of 64-bit ordinates
+__attribute__((target("avx2")))
+static void outcodes_avx2( const coordinate_t *pts, ::size_t n, const box_t &box, outcode_t *codes ){
+    static_assert(sizeof(coordinate_t) == 16, "coordinate_t is expected to be a packed lat, lon pair");
+
+    //Lanes go lat, lon, lat, lon. Strict comparisons only come in "greater than", so
+    //p < sw is sw > p, and p > ne is p > ne.
+    const __m256i sw=_mm256_setr_epi64x(box.sw.lat, box.sw.lon, box.sw.lat, box.sw.lon);
+    const __m256i ne=_mm256_setr_epi64x(box.ne.lat, box.ne.lon, box.ne.lat, box.ne.lon);
+
+    ::size_t i=0;
+    for(; i+2 <= n; i+=2 ){
+        __m256i p=_mm256_loadu_si256( (const __m256i *)(pts+i) );
+        int below=_mm256_movemask_pd( _mm256_castsi256_pd(_mm256_cmpgt_epi64(sw, p)) );
+        int above=_mm256_movemask_pd( _mm256_castsi256_pd(_mm256_cmpgt_epi64(p, ne)) );
+
+        //Bit 0 is lat, bit 1 is lon of the first point, 2 and 3 of the second
+        codes[i]=(below & 1) * out_south | (above & 1) * out_north |
+            (below >> 1 & 1) * out_west | (above >> 1 & 1) * out_east;
+        codes[i+1]=(below >> 2 & 1) * out_south | (above >> 2 & 1) * out_north |
+            (below >> 3 & 1) * out_west | (above >> 3 & 1) * out_east;
+    }
+
+    outcodes_scalar(pts+i, n-i, box, codes+i);
+}
+
+#endif
+
+void leapus::astrolib::outcodes( const coordinate_t *pts, ::size_t n, const box_t &box, outcode_t *codes ){
+#if defined(__x86_64__)
+    if(cpu::have_avx2())
+        return outcodes_avx2(pts, n, box, codes);
+#endif
+    outcodes_scalar(pts, n, box, codes);
+}
+
+bool leapus::astrolib::clip_segment( coordinate_t &a, coordinate_t &b, const box_t &box ){
+    outcode_t ca=outcode(a, box), cb=outcode(b, box);
+
+    //Every pass moves one end onto an edge of the box, so this settles within four passes
+    while(true){
+        if( !(ca | cb) )
+            return true;
+
+        if( ca & cb )
+            return false;
+
+        //Move whichever end is outside, to where the segment crosses the side it's beyond
+        outcode_t c=ca ? ca : cb;
+        coordinate_t &p=ca ? a : b;
+
+        if(c & out_south)
+            p=cross_lat(a, b, box.sw.lat);
+        else if(c & out_north)
+            p=cross_lat(a, b, box.ne.lat);
+        else if(c & out_west)
+            p=cross_lon(a, b, box.sw.lon);
+        else
+            p=cross_lon(a, b, box.ne.lon);
+
+        (ca ? ca : cb)=outcode(p, box);
+    }
+}
+
+//Scratch space for outcodes, so that clipping doesn't allocate for every square
+static outcode_t *scratch_codes( ::size_t n ){
+    thread_local std::vector<outcode_t> codes;
+    if(codes.size() < n)
+        codes.resize(n);
+    return codes.data();
+}
+
+bool leapus::astrolib::intersects( const coordinate_t *pts, ::size_t n, const box_t &box ){
+    if(!n)
+        return false;
+
+    outcode_t *codes=scratch_codes(n);
+    outcodes(pts, n, box, codes);
+
+    for( ::size_t i=0; i < n; ++i )
+        if(!codes[i])
+            return true;
+
+    //All points outside, but a segment could still cut across a corner
+    for( ::size_t i=0; i+1 < n; ++i ){
+        if(codes[i] & codes[i+1])
+            continue;
+
+        coordinate_t a=pts[i], b=pts[i+1];
+        if(clip_segment(a, b, box))
+            return true;
+    }
+
+    return false;
+}
+
+void leapus::astrolib::clip_line( const coordinate_t *pts, ::size_t n, const box_t &box, std::vector<polyline_t> &out ){
+    if(!n)
+        return;
+
+    outcode_t *codes=scratch_codes(n);
+    outcodes(pts, n, box, codes);
+
+    polyline_t *piece=nullptr;
+
+    for( ::size_t i=0; i+1 < n; ++i ){
+        outcode_t ca=codes[i], cb=codes[i+1];
+
+        //Entirely inside, which is the common case, carries on the current piece
+        if( !(ca | cb) ){
+            if(!piece){
+                piece=&out.emplace_back();
+                piece->push_back(pts[i]);
+            }
+            piece->push_back(pts[i+1]);
+            continue;
+        }
+
+        //Entirely beyond one side
+        if(ca & cb){
+            piece=nullptr;
+            continue;
+        }
+
+        coordinate_t a=pts[i], b=pts[i+1];
+        if(!clip_segment(a, b, box)){
+            piece=nullptr;
+            continue;
+        }
+
+        //Entering the box starts a new piece
+        if(ca || !piece){
+            piece=&out.emplace_back();
+            piece->push_back(a);
+        }
+
+        piece->push_back(b);
+
+        //Leaving the box ends it
+        if(cb)
+            piece=nullptr;
+    }
+
+    //A lone point inside the box, as from a one-node way
+    if(n == 1 && !codes[0])
+        out.push_back({ pts[0] });
+}
@@ -1,17 +1,256 @@
-#include <iostream>
 #include <mutex>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <condition_variable>
 #include "astrolib/console.hpp"
 
 using namespace leapus;
 
-std::mutex console::m_mutex={};
+namespace{
+
+using clock_type=std::chrono::steady_clock;
+
+struct record{
+    //Global order of logging, so that lines from different threads come out in the order they were logged
+    ::uint64_t seq;
+    console::level lvl;
+    std::string text;
+};
+
+//Lines a thread can have queued before it has to wait for the writer
+constexpr ::size_t ring_size=1024;
+
+//One thread's queued lines. The thread writes at head, and the writer reads from tail up to head.
+struct ring{
+    record slots[ring_size];
+    std::atomic<::uint64_t> head=0, tail=0;
+
+    //Set when the thread exits, after which the writer drains the ring one last time and drops it
+    std::atomic_bool retired=false;
+
+    //The rate limit's token bucket, and what it has dropped, which only the owning thread touches
+    double tokens=-1;
+    clock_type::time_point refilled;
+    ::size_t suppressed=0;
+};
+
+class logger{
+    std::mutex m_mutex;
+    std::condition_variable m_wake, m_written;
+
+    //Protected by m_mutex
+    std::vector<std::unique_ptr<ring>> m_rings;
+    ::uint64_t m_passes=0;
+    bool m_stop=false;
+
+    std::atomic<::uint64_t> m_seq=0;
+    std::atomic_bool m_asleep=false;
+
+    std::thread m_thread;
+
+    //Take everything queued so far out of the rings, and forget the rings of threads which are gone
+    void drain( std::vector<record> &batch ){
+        for( auto it=m_rings.begin(); it != m_rings.end(); ){
+            auto &r=**it;
+
+            //Once retired, nothing more gets queued, so this drain is the last one it needs
+            bool retired=r.retired.load(std::memory_order_acquire);
+
+            auto h=r.head.load(std::memory_order_acquire);
+            for( auto t=r.tail.load(std::memory_order_relaxed); t < h; ++t )
+                batch.push_back( std::move(r.slots[t % ring_size]) );
+            r.tail.store(h, std::memory_order_release);
+
+            if(retired)
+                it=m_rings.erase(it);
+            else
+                ++it;
+        }
+    }
+
+    void writer(){
+        std::vector<record> batch;
+        std::unique_lock lock(m_mutex);
+
+        while(true){
+            auto seen=m_seq.load();
+            bool stop=m_stop;
+
+            batch.clear();
+            drain(batch);
+            lock.unlock();
+
+            std::sort(batch.begin(), batch.end(), [](auto &a, auto &b){ return a.seq < b.seq; });
+
+            //std::cerr is tied to std::cout, so stdout is flushed before anything goes to stderr,
+            //and the two come out in order
+            for(const auto &r: batch)
+                (r.lvl >= console::level::warning ? std::cerr : std::cout) << r.text << '\n';
+            if(!batch.empty())
+                std::cout.flush();
+
+            lock.lock();
+            ++m_passes;
+            m_written.notify_all();
+
+            //Everything queued before stop was asked for has been written
+            if(stop)
+                break;
+
+            //Loggers only bother to wake us if we're asleep, and the timeout covers the one
+            //who queues a line just as we're dozing off
+            if(batch.empty()){
+                m_asleep=true;
+                if(m_seq.load() == seen && !m_stop)
+                    m_wake.wait_for(lock, std::chrono::milliseconds(20));
+                m_asleep=false;
+            }
+        }
+    }
+
+public:
+    std::atomic<console::level> threshold=console::level::info;
+    std::atomic<double> rate=1000, burst=1000;
+
+    logger():
+        m_thread( [this](){ writer(); } ){}
+
+    ~logger(){
+        {
+            std::lock_guard lock(m_mutex);
+            m_stop=true;
+        }
+
+        m_wake.notify_all();
+        m_thread.join();
+    }
+
+    ring &local_ring();
+
+    void push( ring &r, console::level lvl, const std::string &text ){
+        auto h=r.head.load(std::memory_order_relaxed);
+
+        //Full, so we're logging faster than the terminal takes it, and there's nothing for it but to wait
+        while(h - r.tail.load(std::memory_order_acquire) >= ring_size){
+            m_wake.notify_one();
+            std::this_thread::yield();
+        }
+
+        r.slots[h % ring_size]={ m_seq.fetch_add(1), lvl, text };
+        r.head.store(h+1, std::memory_order_release);
+
+        if(m_asleep.load())
+            m_wake.notify_one();
+    }
+
+    void log( console::level lvl, const std::string &text ){
+        if(lvl < threshold.load(std::memory_order_relaxed))
+            return;
+
+        auto &r=local_ring();
+
+        if(double per_second=rate.load(std::memory_order_relaxed); per_second > 0){
+            auto now=clock_type::now();
+            double cap=std::max(1.0, burst.load(std::memory_order_relaxed));
+
+            if(r.tokens < 0)
+                r.tokens=cap;
+            else
+                r.tokens=std::min(cap, r.tokens + std::chrono::duration<double>(now - r.refilled).count() * per_second);
+            r.refilled=now;
+
+            if(r.tokens < 1){
+                ++r.suppressed;
+                return;
+            }
+
+            r.tokens-=1;
+        }
+
+        if(r.suppressed){
+            push(r, lvl, "(" + std::to_string(r.suppressed) + " lines suppressed by the rate limit)");
+            r.suppressed=0;
+        }
+
+        push(r, lvl, text);
+
+        //An error is often the last thing a program says before it aborts, which would lose
+        //whatever was still queued, so it's waited for
+        if(lvl >= console::level::error)
+            flush();
+    }
+
+    void flush(){
+        std::unique_lock lock(m_mutex);
+
+        //A pass which starts after this one ends will have seen everything queued before now
+        auto target=m_passes + 2;
+        m_wake.notify_one();
+        m_written.wait(lock, [this, target](){ return m_passes >= target || m_stop; });
+    }
+
+    friend struct ring_owner;
+};
+
+//Never destroyed before the threads that might log have finished, since it's constructed
+//before any of them logs, and statics go in the reverse order
+logger &the_logger(){
+    static logger l;
+    return l;
+}
+
+//Hands the ring over to the writer when the thread exits
+struct ring_owner{
+    ring *r;
+
+    ring_owner(){
+        auto &l=the_logger();
+        std::lock_guard lock(l.m_mutex);
+        r=l.m_rings.emplace_back(new ring).get();
+    }
+
+    ~ring_owner(){
+        r->retired.store(true, std::memory_order_release);
+    }
+};
+
+ring &logger::local_ring(){
+    thread_local ring_owner owner;
+    return *owner.r;
+}
+
+}
 
 void console::out(const std::string &line){
-    std::lock_guard guard(m_mutex);
-    std::cout << line << std::endl;
+    the_logger().log(level::info, line);
 }
 
 void console::err(const std::string &line){
-    std::lock_guard guard(m_mutex);
-    std::cerr << line << std::endl;
+    the_logger().log(level::error, line);
+}
+
+void console::log(level lvl, const std::string &line){
+    the_logger().log(lvl, line);
+}
+
+void console::set_level(level lvl){
+    the_logger().threshold=lvl;
+}
+
+console::level console::get_level(){
+    return the_logger().threshold;
+}
+
+void console::set_rate_limit(double lines_per_second, double burst){
+    auto &l=the_logger();
+    l.rate=lines_per_second;
+    l.burst=burst;
+}
+
+void console::flush(){
+    the_logger().flush();
 }
@@ -0,0 +1,146 @@
+#include <utility>
+#include <algorithm>
+#include "astrolib/geometry.hpp"
+
+using namespace leapus::astrolib;
+
+box_t leapus::astrolib::bounds( const ring_t &ring ){
+    box_t box{ ring.front(), ring.front() };
+
+    for(const auto &c: ring){
+        box.sw.lat=std::min(box.sw.lat, c.lat);
+        box.sw.lon=std::min(box.sw.lon, c.lon);
+        box.ne.lat=std::max(box.ne.lat, c.lat);
+        box.ne.lon=std::max(box.ne.lon, c.lon);
+    }
+
+    return box;
+}
+
+double leapus::astrolib::signed_area2( const ring_t &ring ){
+    if(ring.size() < 3)
+        return 0;
+
+    //Relative to the first point, which keeps the products small enough for a double to be exact
+    //for any ring of reasonable size
+    const auto &o=ring.front();
+    double sum=0;
+
+    for( ::size_t i=1; i+1 < ring.size(); ++i ){
+        double x1=ring[i].lon-o.lon, y1=ring[i].lat-o.lat;
+        double x2=ring[i+1].lon-o.lon, y2=ring[i+1].lat-o.lat;
+        sum+=x1*y2 - x2*y1;
+    }
+
+    return sum;
+}
+
+bool leapus::astrolib::point_in_ring( const coordinate_t &pt, const ring_t &ring ){
+    bool inside=false;
+
+    for( ::size_t i=0, j=ring.size()-1; i < ring.size(); j=i++ ){
+        const auto &a=ring[i], &b=ring[j];
+
+        if( (a.lat > pt.lat) != (b.lat > pt.lat) ){
+            //Where the edge crosses the point's latitude, compared without dividing
+            __int128 lhs=(__int128)(pt.lon - a.lon) * (b.lat - a.lat);
+            __int128 rhs=(__int128)(b.lon - a.lon) * (pt.lat - a.lat);
+            if( b.lat > a.lat ? lhs < rhs : lhs > rhs )
+                inside=!inside;
+        }
+    }
+
+    return inside;
+}
+
+void leapus::astrolib::orient( ring_t &ring, bool counterclockwise ){
+    if( (signed_area2(ring) > 0) != counterclockwise )
+        std::reverse(ring.begin(), ring.end());
+}
+
+coordinate_t leapus::astrolib::cross_lat( const coordinate_t &a, const coordinate_t &b, ordinate_t lat ){
+    return { lat, a.lon + (ordinate_t)( (__int128)(b.lon - a.lon) * (lat - a.lat) / (b.lat - a.lat) ) };
+}
+
+coordinate_t leapus::astrolib::cross_lon( const coordinate_t &a, const coordinate_t &b, ordinate_t lon ){
+    return { a.lat + (ordinate_t)( (__int128)(b.lat - a.lat) * (lon - a.lon) / (b.lon - a.lon) ), lon };
+}
+
+//One pass of Sutherland-Hodgman, against one edge of the box
+template<typename Inside, typename Cross>
+static void clip_edge( const ring_t &in, ring_t &out, Inside &&inside, Cross &&cross ){
+    out.clear();
+    if(in.empty())
+        return;
+
+    //The input is closed, so walking edges from each point to the next covers the whole ring
+    for( ::size_t i=0; i+1 < in.size(); ++i ){
+        const auto &a=in[i], &b=in[i+1];
+        bool ia=inside(a), ib=inside(b);
+
+        if(ia)
+            out.push_back(a);
+
+        if(ia != ib)
+            out.push_back(cross(a, b));
+    }
+
+    if(!out.empty())
+        out.push_back(out.front());
+}
+
+ring_t leapus::astrolib::clip_ring( const ring_t &ring, const box_t &box ){
+    auto rb=bounds(ring);
+    if(!intersects(rb, box))
+        return {};
+
+    if(contains(box, rb))
+        return ring;
+
+    ring_t a=ring, b;
+    clip_edge(a, b, [&](auto &c){ return c.lat >= box.sw.lat; }, [&](auto &p, auto &q){ return cross_lat(p, q, box.sw.lat); });
+    clip_edge(b, a, [&](auto &c){ return c.lat <= box.ne.lat; }, [&](auto &p, auto &q){ return cross_lat(p, q, box.ne.lat); });
+    clip_edge(a, b, [&](auto &c){ return c.lon >= box.sw.lon; }, [&](auto &p, auto &q){ return cross_lon(p, q, box.sw.lon); });
+    clip_edge(b, a, [&](auto &c){ return c.lon <= box.ne.lon; }, [&](auto &p, auto &q){ return cross_lon(p, q, box.ne.lon); });
+
+    //A triangle is the least that still encloses anything
+    if(a.size() < 4)
+        a.clear();
+
+    return a;
+}
+
+bool leapus::astrolib::clip_polygon( const polygon_t &poly, const box_t &box, polygon_t &out ){
+    out.outer=clip_ring(poly.outer, box);
+    out.holes.clear();
+
+    if(out.outer.empty())
+        return false;
+
+    for(const auto &hole: poly.holes){
+        auto h=clip_ring(hole, box);
+        if(!h.empty())
+            out.holes.push_back(std::move(h));
+    }
+
+    return true;
+}
+
+::uint64_t leapus::astrolib::hilbert_index( int order, ::uint64_t x, ::uint64_t y ){
+    ::uint64_t n=(::uint64_t)1 << order, d=0;
+    for( ::uint64_t s=n/2; s > 0; s/=2 ){
+        ::uint64_t rx=(x & s) > 0, ry=(y & s) > 0;
+        d+=s * s * ((3 * rx) ^ ry);
+
+        //Rotate the quadrant, so the curve through it joins up with the next
+        if(!ry){
+            if(rx){
+                x=n-1 - x;
+                y=n-1 - y;
+            }
+            std::swap(x, y);
+        }
+    }
+
+    return d;
+}
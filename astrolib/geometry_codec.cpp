@@ -0,0 +1,95 @@
+#include "astrolib/index/geometry_codec.hpp"
+
+using namespace leapus::astrolib;
+using namespace leapus::astrolib::index;
+
+static void put_varint( std::string &out, ::uint64_t v ){
+    while(v >= 0x80){
+        out.push_back( (char)(v | 0x80) );
+        v>>=7;
+    }
+    out.push_back( (char)v );
+}
+
+static ::uint64_t get_varint( const char *&p ){
+    ::uint64_t v=0;
+    int shift=0;
+
+    while(true){
+        ::uint8_t b=*p++;
+        v|=(::uint64_t)(b & 0x7f) << shift;
+        if( !(b & 0x80) )
+            return v;
+        shift+=7;
+    }
+}
+
+static ::uint64_t zigzag( ::int64_t v ){
+    return ((::uint64_t)v << 1) ^ (::uint64_t)(v >> 63);
+}
+
+static ::int64_t unzigzag( ::uint64_t v ){
+    return (::int64_t)(v >> 1) ^ -(::int64_t)(v & 1);
+}
+
+static void put_part( std::string &out, coordinate_t &prev, const coordinate_t *pts, ::size_t n ){
+    put_varint(out, n);
+    for( ::size_t i=0; i < n; ++i ){
+        put_varint(out, zigzag(pts[i].lat - prev.lat));
+        put_varint(out, zigzag(pts[i].lon - prev.lon));
+        prev=pts[i];
+    }
+}
+
+void index::encode_geometry( std::string &out, const coordinate_t &origin, const geometry_parts &parts ){
+    coordinate_t prev=origin;
+
+    put_varint(out, parts.size());
+    for(const auto &part: parts)
+        put_part(out, prev, part.data(), part.size());
+}
+
+void index::encode_geometry( std::string &out, const coordinate_t &origin, const coordinate_t *pts, ::size_t n ){
+    coordinate_t prev=origin;
+
+    put_varint(out, 1);
+    put_part(out, prev, pts, n);
+}
+
+const char *index::decode_geometry( const char *p, const coordinate_t &origin, geometry_parts &parts ){
+    coordinate_t prev=origin;
+
+    parts.resize( get_varint(p) );
+    for(auto &part: parts){
+        part.resize( get_varint(p) );
+        for(auto &pt: part){
+            prev.lat+=unzigzag( get_varint(p) );
+            prev.lon+=unzigzag( get_varint(p) );
+            pt=prev;
+        }
+    }
+
+    return p;
+}
+
+void index::encode_fill( std::string &out, const std::vector<::uint32_t> &triangles ){
+    ::int64_t prev=0;
+
+    put_varint(out, triangles.size() / 3);
+    for(auto i: triangles){
+        put_varint(out, zigzag((::int64_t)i - prev));
+        prev=i;
+    }
+}
+
+const char *index::decode_fill( const char *p, std::vector<::uint32_t> &triangles ){
+    ::int64_t prev=0;
+
+    triangles.resize( get_varint(p) * 3 );
+    for(auto &i: triangles){
+        prev+=unzigzag( get_varint(p) );
+        i=(::uint32_t)prev;
+    }
+
+    return p;
+}
@@ -0,0 +1,255 @@
+#include <cctype>
+#include <cstdio>
+#include <charconv>
+#include <algorithm>
+#include "astrolib/net/http.hpp"
+
+using namespace leapus;
+using namespace leapus::net;
+
+namespace{
+
+bool iequals( std::string_view a, std::string_view b ){
+    return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin(),
+        [](char x, char y){ return std::tolower((unsigned char)x) == std::tolower((unsigned char)y); });
+}
+
+std::string_view trim( std::string_view s ){
+    while(!s.empty() && (s.front() == ' ' || s.front() == '\t'))
+        s.remove_prefix(1);
+    while(!s.empty() && (s.back() == ' ' || s.back() == '\t' || s.back() == '\r'))
+        s.remove_suffix(1);
+    return s;
+}
+
+//Header lines between the start line and the blank line, as name and value
+template<typename Func>
+void for_each_header( std::string_view headers, Func &&func ){
+    while(!headers.empty()){
+        auto eol=headers.find('\n');
+        auto line=headers.substr(0, eol);
+        headers.remove_prefix(eol == std::string_view::npos ? headers.size() : eol+1);
+
+        line=trim(line);
+        if(line.empty())
+            continue;
+
+        auto colon=line.find(':');
+        if(colon == std::string_view::npos)
+            throw http_exception("Malformed HTTP header: " + std::string(line));
+
+        func(trim(line.substr(0, colon)), trim(line.substr(colon+1)));
+    }
+}
+
+//Where the headers end, just past the blank line, or zero if that hasn't arrived yet.
+//The start line is returned in start, and the header lines in headers.
+::size_t split_head( std::string_view buffer, std::string_view &start, std::string_view &headers ){
+    auto end=buffer.find("\r\n\r\n");
+    ::size_t skip=4;
+    if(auto lf=buffer.find("\n\n"); lf < end){
+        end=lf;
+        skip=2;
+    }
+
+    if(end == std::string_view::npos){
+        if(buffer.size() > max_header)
+            throw http_exception("HTTP header is too long");
+        return 0;
+    }
+
+    auto head=buffer.substr(0, end);
+    auto eol=head.find('\n');
+    start=trim(head.substr(0, eol));
+    headers=eol == std::string_view::npos ? std::string_view{} : head.substr(eol+1);
+    return end + skip;
+}
+
+::size_t parse_length( std::string_view v ){
+    ::size_t n=0;
+    auto [p, ec]=std::from_chars(v.data(), v.data()+v.size(), n);
+    if(ec != std::errc{} || p != v.data()+v.size())
+        throw http_exception("Malformed Content-Length: " + std::string(v));
+    if(n > max_body)
+        throw http_exception("HTTP body is too big");
+    return n;
+}
+
+int hex_digit( char c ){
+    if(c >= '0' && c <= '9') return c - '0';
+    if(c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if(c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+}
+
+std::optional<std::string_view> http_request::param( std::string_view name ) const{
+    for(const auto &[k, v]: query)
+        if(k == name)
+            return v;
+
+    return std::nullopt;
+}
+
+::size_t net::parse_request( std::string_view buffer, http_request &req ){
+    std::string_view start, headers;
+    auto head=split_head(buffer, start, headers);
+    if(!head)
+        return 0;
+
+    //METHOD target HTTP/1.x
+    auto sp1=start.find(' '), sp2=start.rfind(' ');
+    if(sp1 == std::string_view::npos || sp2 == sp1)
+        throw http_exception("Malformed HTTP request line: " + std::string(start));
+
+    auto version=start.substr(sp2+1);
+    if(version != "HTTP/1.1" && version != "HTTP/1.0")
+        throw http_exception("Unsupported HTTP version: " + std::string(version));
+
+    ::size_t length=0;
+    bool keep_alive=version == "HTTP/1.1";
+    for_each_header(headers, [&](std::string_view name, std::string_view value){
+        if(iequals(name, "Content-Length"))
+            length=parse_length(value);
+        else if(iequals(name, "Transfer-Encoding"))
+            throw http_exception("Chunked requests aren't supported");
+        else if(iequals(name, "Connection"))
+            keep_alive=iequals(value, "close") ? false : iequals(value, "keep-alive") ? true : keep_alive;
+    });
+
+    if(buffer.size() < head + length)
+        return 0;
+
+    req.method=start.substr(0, sp1);
+    req.keep_alive=keep_alive;
+    req.body=buffer.substr(head, length);
+
+    auto target=start.substr(sp1+1, sp2-sp1-1);
+    auto q=target.find('?');
+    req.path=target.substr(0, q);
+
+    req.query.clear();
+    if(q != std::string_view::npos){
+        auto rest=target.substr(q+1);
+        while(!rest.empty()){
+            auto amp=rest.find('&');
+            auto pair=rest.substr(0, amp);
+            rest.remove_prefix(amp == std::string_view::npos ? rest.size() : amp+1);
+
+            if(pair.empty())
+                continue;
+
+            auto eq=pair.find('=');
+            if(eq == std::string_view::npos)
+                req.query.emplace_back(url_decode(pair), std::string{});
+            else
+                req.query.emplace_back(url_decode(pair.substr(0, eq)), url_decode(pair.substr(eq+1)));
+        }
+    }
+
+    return head + length;
+}
+
+::size_t net::parse_response( std::string_view buffer, http_response &resp ){
+    std::string_view start, headers;
+    auto head=split_head(buffer, start, headers);
+    if(!head)
+        return 0;
+
+    //HTTP/1.x status reason
+    auto sp=start.find(' ');
+    int status=0;
+    if(sp == std::string_view::npos || start.substr(0, 5) != "HTTP/")
+        throw http_exception("Malformed HTTP status line: " + std::string(start));
+
+    auto code=start.substr(sp+1, 3);
+    auto [p, ec]=std::from_chars(code.data(), code.data()+code.size(), status);
+    if(ec != std::errc{})
+        throw http_exception("Malformed HTTP status line: " + std::string(start));
+
+    ::size_t length=0;
+    bool keep_alive=start.substr(0, sp) == "HTTP/1.1";
+    for_each_header(headers, [&](std::string_view name, std::string_view value){
+        if(iequals(name, "Content-Length"))
+            length=parse_length(value);
+        else if(iequals(name, "Transfer-Encoding"))
+            throw http_exception("Chunked responses aren't supported");
+        else if(iequals(name, "Connection"))
+            keep_alive=iequals(value, "close") ? false : iequals(value, "keep-alive") ? true : keep_alive;
+    });
+
+    if(buffer.size() < head + length)
+        return 0;
+
+    resp.status=status;
+    resp.keep_alive=keep_alive;
+    resp.body=buffer.substr(head, length);
+    return head + length;
+}
+
+void net::write_response( std::string &out, int status, std::string_view content_type, std::string_view body, bool keep_alive ){
+    char head[256];
+    int n=std::snprintf(head, sizeof(head),
+        "HTTP/1.1 %d %s\r\nContent-Type: %.*s\r\nContent-Length: %zu\r\nConnection: %s\r\n\r\n",
+        status, status_text(status), (int)content_type.size(), content_type.data(), body.size(),
+        keep_alive ? "keep-alive" : "close");
+
+    out.append(head, n);
+    out.append(body);
+}
+
+void net::write_request( std::string &out, std::string_view target, std::string_view host ){
+    out.append("GET ").append(target).append(" HTTP/1.1\r\nHost: ").append(host).append("\r\n\r\n");
+}
+
+const char *net::status_text( int status ){
+    switch(status){
+        case 200: return "OK";
+        case 400: return "Bad Request";
+        case 404: return "Not Found";
+        case 405: return "Method Not Allowed";
+        case 413: return "Payload Too Large";
+        case 500: return "Internal Server Error";
+        case 503: return "Service Unavailable";
+        default: return "Unknown";
+    }
+}
+
+std::string net::url_decode( std::string_view s ){
+    std::string out;
+    out.reserve(s.size());
+
+    for( ::size_t i=0; i < s.size(); ++i ){
+        if(s[i] == '+')
+            out+=' ';
+        else if(s[i] == '%' && i+2 < s.size() && hex_digit(s[i+1]) >= 0 && hex_digit(s[i+2]) >= 0){
+            out+=(char)(hex_digit(s[i+1]) * 16 + hex_digit(s[i+2]));
+            i+=2;
+        }
+        else
+            out+=s[i];
+    }
+
+    return out;
+}
+
+void net::json_escape( std::string &out, std::string_view s ){
+    for(char c: s){
+        switch(c){
+            case '"': out+="\\\""; break;
+            case '\\': out+="\\\\"; break;
+            case '\n': out+="\\n"; break;
+            case '\r': out+="\\r"; break;
+            case '\t': out+="\\t"; break;
+            default:
+                if((unsigned char)c < 0x20){
+                    char esc[8];
+                    std::snprintf(esc, sizeof(esc), "\\u%04x", c);
+                    out+=esc;
+                }
+                else
+                    out+=c;
+        }
+    }
+}
@@ -0,0 +1,744 @@
+#include <new>
+#include <cstring>
+#include <tuple>
+#include <deque>
+#include <future>
+#include <memory>
+#include <string>
+#include <algorithm>
+#include <functional>
+#include "astrolib/index/builder.hpp"
+#include "astrolib/concurrent.hpp"
+#include "astrolib/triangulate.hpp"
+#include "astrolib/index/geometry_codec.hpp"
+
+using namespace leapus;
+using namespace leapus::astrolib;
+using namespace leapus::astrolib::index;
+using namespace leapus::pointer;
+
+//Address space for the spool. Like the index itself, it only costs what's actually written.
+static constexpr io::mmap_file::size_type spool_mapping_size=(io::mmap_file::size_type)1 << 40;
+
+//The top levels are split up until no square has more than this share of all the items, and each
+//of those is then a subtree, built on its own. It's the share that's fixed, rather than how many
+//threads there are, so that where the top levels stop doesn't depend on that.
+static constexpr ::size_t subtree_share=64;
+
+//Subtrees start at this alignment in their arena, and in the index, so that everything in them
+//is laid out the same in either place
+static constexpr ::size_t subtree_alignment=alignof(::uint64_t);
+
+//Whatever was left behind by a previous run is of no use
+static io::mmap_file fresh_file( const std::filesystem::path &path ){
+    std::filesystem::remove(path);
+    return { path, true, spool_mapping_size };
+}
+
+index_builder::index_builder( const index_config &config, const std::filesystem::path &spool_path, bool keep_spool ):
+    m_config(config),
+    m_spool_path(spool_path),
+    m_keep_spool(keep_spool),
+    m_spool(keep_spool ? io::mmap_file{ spool_path, true, spool_mapping_size } : fresh_file(spool_path)),
+    m_spool_alloc(m_spool){}
+
+//Unlinking the file while it's still mapped is fine, and it goes away for good once the mapping does
+index_builder::~index_builder(){
+    std::error_code ec;
+    if(!m_keep_spool)
+        std::filesystem::remove(m_spool_path, ec);
+}
+
+void index_builder::add( const item &it, const std::vector<const polyline_t *> &parts ){
+    item stored=it;
+    stored.parts=parts.size();
+
+    //Part sizes, then all of the points, in 64-bit words
+    ::size_t words=parts.size();
+    for(auto *part: parts)
+        words+=part->size() * sizeof(coordinate_t) / sizeof(::uint64_t);
+
+    ::uint64_t *p=m_spool_alloc.allocate(words);
+    stored.geometry=m_spool.offset_of(p);
+
+    for(auto *part: parts)
+        *p++=part->size();
+
+    for(auto *part: parts){
+        std::memcpy(p, part->data(), part->size() * sizeof(coordinate_t));
+        p+=part->size() * sizeof(coordinate_t) / sizeof(::uint64_t);
+    }
+
+    std::lock_guard lock(m_mutex);
+    m_items.push_back(stored);
+}
+
+void index_builder::add_point( const osm_address_t &address, index_entry_type type, const coordinate_t &pt,
+    const label_metrics &label ){
+
+    std::lock_guard lock(m_mutex);
+    m_items.push_back({ { pt, pt }, address, type, 0, 0, label });
+}
+
+void index_builder::add_line( const osm_address_t &address, index_entry_type type, const coordinate_t *pts, ::size_t n ){
+    if(!n)
+        return;
+
+    polyline_t line(pts, pts+n);
+    add({ bounds(line), address, type }, { &line });
+}
+
+void index_builder::add_polygon( const osm_address_t &address, const polygon_t &poly ){
+    std::vector<const polyline_t *> parts{ &poly.outer };
+    for(const auto &hole: poly.holes)
+        parts.push_back(&hole);
+
+    add({ bounds(poly.outer), address, idx_poly }, parts);
+}
+
+//The spooled parts of an item
+void index_builder::parts_of( const item &it, std::vector<polyline_t> &out ) const{
+    auto *sizes=(const ::uint64_t *)(m_spool_base + it.geometry);
+    auto *pts=(const coordinate_t *)(sizes + it.parts);
+
+    out.resize(it.parts);
+    for( ::uint32_t i=0; i < it.parts; ++i ){
+        out[i].assign(pts, pts+sizes[i]);
+        pts+=sizes[i];
+    }
+}
+
+bool index_builder::touches( const item &it, const box_t &box ) const{
+    if(!intersects(it.bounds, box))
+        return false;
+
+    if(contains(box, it.bounds) || !it.parts)
+        return true;
+
+    //Only the first part matters, being either the line, or the outer ring of a polygon
+    auto *sizes=(const ::uint64_t *)(m_spool_base + it.geometry);
+    auto *pts=(const coordinate_t *)(sizes + it.parts);
+
+    if(astrolib::intersects(pts, sizes[0], box))
+        return true;
+
+    //A polygon can also swallow the box whole without any of its edges crossing it
+    if(it.type == idx_poly){
+        ring_t outer(pts, pts+sizes[0]);
+        return point_in_ring(box.sw, outer);
+    }
+
+    return false;
+}
+
+void index_builder::order_leaf( build_context &ctx, const box_t &box, std::vector<index_entry> &entries ){
+    if(entries.size() < 2)
+        return;
+
+    //Which cell of the leaf's Hilbert grid a coordinate is in, one way
+    const ordinate_t cells=(ordinate_t)1 << leaf_hilbert_order;
+    auto cell=[cells](ordinate_t v, ordinate_t lo, ordinate_t hi){
+        return hi > lo ? (::uint64_t)std::clamp<ordinate_t>((v - lo) * cells / (hi - lo), 0, cells-1) : 0;
+    };
+
+    //Geometry records are in ctx.encoded in the order the entries were added, so each one runs
+    //up to the start of the next
+    std::vector<::size_t> record_sizes(entries.size());
+    ::size_t next=ctx.encoded.size()+1;
+    for( ::size_t i=entries.size(); i-- > 0; )
+        if(entries[i].reduction_detail){
+            record_sizes[i]=next - entries[i].reduction_detail;
+            next=entries[i].reduction_detail;
+        }
+
+    struct keyed{
+        ::uint64_t key;
+        ::uint32_t index;
+    };
+
+    std::vector<keyed> order(entries.size());
+    for( ::uint32_t i=0; i < entries.size(); ++i ){
+        const box_t &b=entries[i].bounds;
+        ordinate_t lat=b.sw.lat + (b.ne.lat - b.sw.lat)/2, lon=b.sw.lon + (b.ne.lon - b.sw.lon)/2;
+        order[i]={ hilbert_index(leaf_hilbert_order, cell(lon, box.sw.lon, box.ne.lon), cell(lat, box.sw.lat, box.ne.lat)), i };
+    }
+
+    //Entries in the same cell go by address, so the blobs they're in are visited in order
+    std::sort(order.begin(), order.end(), [&entries](const keyed &a, const keyed &b){
+        const auto &x=entries[a.index].address, &y=entries[b.index].address;
+        return std::tie(a.key, x.blob_pos, x.item_pos, a.index) < std::tie(b.key, y.blob_pos, y.item_pos, b.index);
+    });
+
+    std::vector<index_entry> sorted;
+    sorted.reserve(entries.size());
+    std::string encoded;
+    encoded.reserve(ctx.encoded.size());
+
+    for(auto [key, i]: order){
+        index_entry e=entries[i];
+        if(e.reduction_detail){
+            encoded.append(ctx.encoded, e.reduction_detail-1, record_sizes[i]);
+            e.reduction_detail=encoded.size() - record_sizes[i] + 1;
+        }
+        sorted.push_back(e);
+    }
+
+    entries.swap(sorted);
+    ctx.encoded.swap(encoded);
+}
+
+bool index_builder::canonical_less( ::uint32_t a, ::uint32_t b ) const{
+    const item &x=m_items[a], &y=m_items[b];
+    auto key=[](const item &it){
+        return std::tie(it.address.blob_pos, it.address.item_pos, it.type, it.bounds.sw.lat, it.bounds.sw.lon,
+            it.bounds.ne.lat, it.bounds.ne.lon, it.parts);
+    };
+
+    if(key(x) != key(y))
+        return key(x) < key(y);
+
+    //Only the pieces of one multipolygon could get this far, and hardly ever
+    if(!x.parts)
+        return false;
+
+    auto *xs=(const ::uint64_t *)(m_spool_base + x.geometry), *ys=(const ::uint64_t *)(m_spool_base + y.geometry);
+    ::size_t words=x.parts;
+    for( ::uint32_t i=0; i < x.parts; ++i ){
+        if(xs[i] != ys[i])
+            return xs[i] < ys[i];
+        words+=xs[i] * sizeof(coordinate_t) / sizeof(::uint64_t);
+    }
+
+    return std::lexicographical_compare(xs+x.parts, xs+words, ys+y.parts, ys+words);
+}
+
+void index_builder::place_labels( const ref_list &refs ){
+    m_label_level.assign(m_items.size(), unplaced);
+    m_label_rank.assign(m_items.size(), 0);
+
+    std::vector<::uint32_t> order;
+    for(auto i: refs){
+        const item &it=m_items[i];
+        if(!it.parts && (it.type == idx_label || it.type == idx_widget) && (it.label.width || it.label.height))
+            order.push_back(i);
+    }
+
+    //Highest priority first, and otherwise in the canonical order
+    std::stable_sort(order.begin(), order.end(), [this](::uint32_t a, ::uint32_t b){
+        return m_items[a].label.priority > m_items[b].label.priority;
+    });
+
+    for( ::uint32_t k=0; k < order.size(); ++k )
+        m_label_rank[order[k]]=k;
+
+    m_stats.labels=order.size();
+
+    label_grid grid;
+    std::vector<::uint32_t> placed;
+    const ordinate_t world_width=world_bounds.ne.lon - world_bounds.sw.lon;
+
+    for( int level=0; level <= m_config.max_depth && placed.size() < order.size(); ++level ){
+        ordinate_t width=world_width >> level;
+        auto footprint=[this, width](::uint32_t i){
+            return label_footprint(m_items[i].bounds.sw, m_items[i].label, width);
+        };
+
+        //Cells of 64 pixels, which is about a word or two
+        grid.reset(width / label_screen_pixels * 64);
+
+        //Whatever was placed above is placed here too, and is sure not to overlap
+        for(auto i: placed)
+            grid.add(footprint(i));
+
+        ::size_t before=placed.size();
+        for(auto i: order)
+            if(m_label_level[i] == unplaced && grid.place(footprint(i))){
+                m_label_level[i]=level;
+                placed.push_back(i);
+            }
+
+        if(placed.size() > before)
+            m_stats.label_levels=level+1;
+    }
+
+    m_stats.labels_placed=placed.size();
+}
+
+based_span<label_entry> index_builder::square_labels( build_context &ctx, const ref_list &refs, size_type depth, bool leaf ){
+    std::vector<::uint32_t> chosen;
+    for(auto r: refs){
+        auto level=m_label_level[r];
+        if(level == depth || (leaf && level > depth && level != unplaced))
+            chosen.push_back(r);
+    }
+
+    if(chosen.empty())
+        return {};
+
+    //By level, which only matters in a leaf, so that for_each_label() can stop at the first one too far down
+    std::sort(chosen.begin(), chosen.end(), [this](::uint32_t a, ::uint32_t b){
+        return std::tie(m_label_level[a], m_label_rank[a]) < std::tie(m_label_level[b], m_label_rank[b]);
+    });
+
+    label_entry *labels=index_allocator<label_entry>(ctx.alloc).allocate(chosen.size());
+    const ordinate_t world_width=world_bounds.ne.lon - world_bounds.sw.lon;
+    for( ::size_t i=0; i < chosen.size(); ++i ){
+        const item &it=m_items[chosen[i]];
+        auto level=m_label_level[chosen[i]];
+        new(labels+i) label_entry{ label_footprint(it.bounds.sw, it.label, world_width >> level), it.address, it.type, level };
+    }
+
+    return { ctx.base(), labels, chosen.size() };
+}
+
+::uint32_t index_builder::build_leaf( build_context &ctx, const box_t &box, const ref_list &refs, size_type depth ){
+    std::vector<index_entry> entries;
+    ctx.encoded.clear();
+
+    auto add_entry=[&](const item &it, const box_t &b, const geometry_parts *parts, bool clipped){
+        file_offs_t geometry=0;
+        ::uint32_t fill=0;
+
+        //For now, an offset into ctx.encoded, plus one so that it isn't confused with "none"
+        if(parts){
+            geometry=ctx.encoded.size()+1;
+            encode_geometry(ctx.encoded, box.sw, *parts);
+        }
+
+        //The fill record goes straight after, so that order_leaf() moves the two together
+        if(parts && it.type == idx_poly && m_config.triangulate){
+            ctx.triangles.clear();
+            triangulate(*parts, ctx.triangles);
+
+            if(!ctx.triangles.empty()){
+                fill=ctx.encoded.size()+1 - geometry;
+                encode_fill(ctx.encoded, ctx.triangles);
+                ctx.stats.triangles+=ctx.triangles.size() / 3;
+            }
+        }
+
+        entries.push_back({ b, it.address, geometry, it.type, fill });
+        ctx.stats.fragments+=clipped;
+    };
+
+    for(auto r: refs){
+        const item &it=m_items[r];
+
+        if(!it.parts){
+            add_entry(it, label_footprint(it.bounds.sw, it.label, box.ne.lon - box.sw.lon), nullptr, false);
+            continue;
+        }
+
+        parts_of(it, ctx.parts);
+
+        if(contains(box, it.bounds)){
+            add_entry(it, it.bounds, &ctx.parts, false);
+            continue;
+        }
+
+        if(it.type != idx_poly){
+            ctx.clipped.clear();
+            clip_line(ctx.parts[0].data(), ctx.parts[0].size(), box, ctx.clipped);
+
+            for(const auto &piece: ctx.clipped){
+                geometry_parts one{ piece };
+                add_entry(it, bounds(piece), &one, true);
+            }
+
+            continue;
+        }
+
+        polygon_t poly{ std::move(ctx.parts[0]), { ctx.parts.begin()+1, ctx.parts.end() } }, clipped;
+        if( !clip_polygon(poly, box, clipped) || !signed_area2(clipped.outer) )
+            continue;
+
+        geometry_parts rings{ std::move(clipped.outer) };
+        rings.insert(rings.end(), clipped.holes.begin(), clipped.holes.end());
+        add_entry(it, bounds(rings[0]), &rings, true);
+    }
+
+    order_leaf(ctx, box, entries);
+
+    index_allocator<char> alloc=ctx.alloc;
+    index_entry *stored=nullptr;
+    entry_run *runs=nullptr;
+    ::uint32_t run_count=0;
+
+    if(!entries.empty()){
+        file_offs_t base=0;
+        if(!ctx.encoded.empty()){
+            char *bytes=alloc.allocate(ctx.encoded.size());
+            std::memcpy(bytes, ctx.encoded.data(), ctx.encoded.size());
+            base=alloc.file().offset_of(bytes);
+        }
+
+        for(auto &e: entries)
+            if(e.reduction_detail)
+                e.reduction_detail+=base-1;
+
+        stored=index_allocator<index_entry>(alloc).allocate(entries.size());
+        std::copy(entries.begin(), entries.end(), stored);
+    }
+
+    //A leaf with only a run's worth of entries is quicker to look through than to skip around in
+    if(entries.size() > entries_per_run){
+        run_count=(entries.size() + entries_per_run-1) / entries_per_run;
+        runs=index_allocator<entry_run>(alloc).allocate(run_count);
+
+        for( ::uint32_t r=0; r < run_count; ++r ){
+            ::uint32_t first=r * entries_per_run, count=std::min<::uint32_t>(entries_per_run, entries.size() - first);
+            box_t b=entries[first].bounds;
+            for( ::uint32_t i=first+1; i < first+count; ++i ){
+                const box_t &e=entries[i].bounds;
+                b={ { std::min(b.sw.lat, e.sw.lat), std::min(b.sw.lon, e.sw.lon) },
+                    { std::max(b.ne.lat, e.ne.lat), std::max(b.ne.lon, e.ne.lon) } };
+            }
+
+            new(runs+r) entry_run{ b, first, count };
+        }
+    }
+
+    ++ctx.stats.leaves;
+    ++ctx.stats.squares;
+    ctx.stats.entries+=entries.size();
+
+    const char *base=ctx.base();
+    ctx.squares.push_back({ box });
+    auto &record=ctx.squares.back();
+    record.entries={ base, stored, entries.size() };
+    record.runs={ base, runs, run_count };
+    record.labels=square_labels(ctx, refs, depth, true);
+    return ctx.squares.size()-1;
+}
+
+bool index_builder::split( const box_t &box, const ref_list &refs, size_type depth, box_t quadrants[4], ref_list children[4] ) const{
+    if( refs.size() <= (size_type)m_config.node_max_items || depth >= (size_type)m_config.max_depth )
+        return false;
+
+    coordinate_t mid{ box.sw.lat + (box.ne.lat - box.sw.lat)/2, box.sw.lon + (box.ne.lon - box.sw.lon)/2 };
+    quadrants[0]={ { mid.lat, box.sw.lon }, { box.ne.lat, mid.lon } };  //nw
+    quadrants[1]={ mid, box.ne };                                       //ne
+    quadrants[2]={ box.sw, mid };                                       //sw
+    quadrants[3]={ { box.sw.lat, mid.lon }, { mid.lat, box.ne.lon } };  //se
+
+    for(auto r: refs){
+        const item &it=m_items[r];
+        for( int q=0; q < 4; ++q ){
+            if(!touches(it, quadrants[q]))
+                continue;
+
+            children[q].push_back(r);
+
+            //A point on the line between two quadrants goes in just the one
+            if(!it.parts)
+                break;
+        }
+    }
+
+    //If everything touches every quadrant, then splitting would just make four copies
+    return !std::all_of( children, children+4, [&refs](auto &c){ return c.size() == refs.size(); } );
+}
+
+::uint32_t index_builder::build_square( build_context &ctx, const box_t &box, ref_list &refs, size_type depth ){
+    if(refs.empty())
+        return no_square;
+
+    ctx.stats.depth=std::max(ctx.stats.depth, depth+1);
+
+    box_t quadrants[4];
+    ref_list children[4];
+    if(!split(box, refs, depth, quadrants, children))
+        return build_leaf(ctx, box, refs, depth);
+
+    auto labels=square_labels(ctx, refs, depth, false);
+
+    //Nothing more is needed of this level's list, and it can be a big one
+    ref_list{}.swap(refs);
+
+    square_record record{ box };
+    record.labels=labels;
+    for( int q=0; q < 4; ++q )
+        record.quadrants[q]=build_square(ctx, quadrants[q], children[q], depth+1);
+
+    ++ctx.stats.squares;
+    ctx.squares.push_back(record);
+    return ctx.squares.size()-1;
+}
+
+index_builder::top_slot index_builder::plan( build_context &ctx, const box_t &box, ref_list &refs, size_type depth ){
+    if(refs.empty())
+        return {};
+
+    //Small enough to be a subtree, or it would be a leaf anyway
+    box_t quadrants[4];
+    ref_list children[4];
+    if( refs.size() <= std::max<size_type>(m_items.size() / subtree_share, m_config.node_max_items) ||
+        !split(box, refs, depth, quadrants, children) ){
+
+        m_subtrees.push_back({ box, std::move(refs), depth });
+        return { top_slot::sub, (::uint32_t)m_subtrees.size()-1 };
+    }
+
+    ctx.stats.depth=std::max(ctx.stats.depth, depth+1);
+
+    //The labels are already in the index by the time the subtrees are, and the square itself goes in after them
+    auto labels=square_labels(ctx, refs, depth, false);
+    ref_list{}.swap(refs);
+
+    auto index=(::uint32_t)m_top.size();
+    m_top.push_back({ box, depth, labels });
+    for( int q=0; q < 4; ++q ){
+        top_slot slot=plan(ctx, quadrants[q], children[q], depth+1);
+        m_top[index].quadrants[q]=slot;
+    }
+
+    return { top_slot::square, index };
+}
+
+::uint32_t index_builder::stitch( build_context &ctx, top_slot slot, const std::vector<::uint32_t> &first ){
+    if(slot.kind == top_slot::none)
+        return no_square;
+    if(slot.kind == top_slot::sub)
+        return first[slot.index] + m_subtrees[slot.index].root;
+
+    const top_square &top=m_top[slot.index];
+    square_record record{ top.bounds };
+    record.labels=top.labels;
+    for( int q=0; q < 4; ++q )
+        record.quadrants[q]=stitch(ctx, top.quadrants[q], first);
+
+    ++ctx.stats.squares;
+    ctx.squares.push_back(record);
+    return first.back() + ctx.squares.size()-1;
+}
+
+void index_builder::put_squares( quadtree_square *squares, const std::vector<square_record> &records, ::uint32_t first,
+    ::uint32_t shift, const char *base ) const{
+
+    auto quadrant=[squares, shift](::uint32_t q){
+        return q == no_square ? nullptr : squares + q + shift;
+    };
+
+    for( ::size_t i=0; i < records.size(); ++i ){
+        const square_record &r=records[i];
+        auto &sq=*new(squares + first + i) quadtree_square{ r.bounds };
+        sq.nw=quadrant(r.quadrants[0]);
+        sq.ne=quadrant(r.quadrants[1]);
+        sq.sw=quadrant(r.quadrants[2]);
+        sq.se=quadrant(r.quadrants[3]);
+        sq.entries.assign(r.entries.data(base), r.entries.size());
+        sq.runs.assign(r.runs.data(base), r.runs.size());
+        sq.labels.assign(r.labels.data(base), r.labels.size());
+    }
+}
+
+namespace{
+
+class subtree_pool:public concurrent::ThreadPool< std::function<void()>, concurrent::lf_queue<std::function<void()>> >{
+public:
+    using ThreadPool::ThreadPool;
+
+protected:
+    //Tasks hand their exceptions over through their promises
+    void exception_handler( std::exception_ptr ) override{}
+};
+
+//The statistics of building part of the tree, into those of the whole
+void add_tree_statistics( index_builder::statistics_type &to, const index_builder::statistics_type &from ){
+    to.squares+=from.squares;
+    to.leaves+=from.leaves;
+    to.entries+=from.entries;
+    to.fragments+=from.fragments;
+    to.triangles+=from.triangles;
+    to.depth=std::max(to.depth, from.depth);
+}
+
+}
+
+const char *index_builder::build_context::base() const{
+    return std::addressof(*std::as_const(alloc.file()).read(0, 1));
+}
+
+std::vector<const char *> index_builder::build_subtrees( build_context &ctx, int threads ){
+    std::vector<const char *> bases(m_subtrees.size());
+    if(m_subtrees.empty())
+        return bases;
+
+    threads=std::clamp<int>(threads, 1, m_subtrees.size());
+
+    //Removed straight away, and gone for good once they're unmapped. Offset zero is
+    //reserved, as it is in the index, since a subtree's geometry can't go there either.
+    std::deque<io::mmap_file> arenas;
+    for( int i=0; i < threads; ++i ){
+        auto path=m_spool_path;
+        path+=".arena" + std::to_string(i);
+        std::filesystem::remove(path);
+        arenas.emplace_back(path, true, spool_mapping_size);
+        std::filesystem::remove(path);
+        arenas.back().grow(1);
+    }
+
+    //Whoever starts a subtree takes an arena that isn't in use, and there's always one,
+    //with as many as there are workers
+    std::mutex free_mutex;
+    std::vector<size_type> free_arenas;
+    for( int i=threads; i-- > 0; )
+        free_arenas.push_back(i);
+
+    std::vector<std::future<void>> done;
+    {
+        subtree_pool pool(threads);
+        for(auto &sub: m_subtrees){
+            auto promise=std::make_shared<std::promise<void>>();
+            done.push_back(promise->get_future());
+
+            pool.push_front([this, &sub, &arenas, &free_mutex, &free_arenas, promise](){
+                try{
+                    {
+                        std::lock_guard lock(free_mutex);
+                        sub.arena=free_arenas.back();
+                        free_arenas.pop_back();
+                    }
+
+                    //The arena goes back however the subtree ends, or after a throw, the next ones
+                    //would run out. What a failed one left in it is just skipped over.
+                    meta::guard give_back( [&free_mutex, &free_arenas, &sub](){
+                        std::lock_guard lock(free_mutex);
+                        free_arenas.push_back(sub.arena);
+                    } );
+
+                    io::mmap_file &arena=arenas[sub.arena];
+                    if(auto over=arena.size() % subtree_alignment)
+                        arena.grow(subtree_alignment - over);
+
+                    build_context local{ arena };
+                    sub.begin=arena.size();
+                    sub.root=build_square(local, sub.bounds, sub.refs, sub.depth);
+                    sub.end=arena.size();
+                    sub.stats=local.stats;
+                    sub.squares=std::move(local.squares);
+
+                    ref_list{}.swap(sub.refs);
+                    promise->set_value();
+                }
+                catch(...){
+                    promise->set_exception(std::current_exception());
+                }
+            });
+        }
+
+        for(auto &d: done)
+            d.get();
+        pool.shutdown();
+    }
+
+    //Into the index, in the order they were planned in
+    for( size_type i=0; i < m_subtrees.size(); ++i ){
+        const subtree &sub=m_subtrees[i];
+        size_type size=sub.end - sub.begin;
+
+        auto *copy=(char *)index_allocator<::uint64_t>(ctx.alloc).allocate((size + subtree_alignment-1) / subtree_alignment);
+        std::memcpy(copy, std::addressof(*std::as_const(arenas[sub.arena]).read(sub.begin, size)), size);
+
+        //The records count from the start of the arena, which is now wherever the subtree would have
+        //started, if the arena had been copied along with it. Geometry records are found by their
+        //offsets in the file, though, and those have to be moved along.
+        bases[i]=copy - sub.begin;
+        file_offs_t delta=ctx.alloc.file().offset_of(copy) - sub.begin;
+        for(const auto &r: sub.squares){
+            index_entry *entries=r.entries.data(bases[i]);
+            for( ::uint32_t k=0; k < r.entries.size(); ++k )
+                if(entries[k].reduction_detail)
+                    entries[k].reduction_detail+=delta;
+        }
+
+        add_tree_statistics(ctx.stats, sub.stats);
+    }
+
+    return bases;
+}
+
+quadtree_square &index_builder::build( int threads ){
+    m_stats=statistics_type{};
+    m_stats.items=m_items.size();
+
+    if(!threads)
+        threads=std::max(1u, std::thread::hardware_concurrency());
+
+    if(m_spool.size())
+        m_spool_base=std::addressof(*std::as_const(m_spool).read(0, m_spool.size()));
+
+    //Offset zero means "none", to reduction_detail, so nothing that's pointed to can go there
+    index_allocator<char> alloc=m_config.file_allocator;
+    if(!alloc.file().size())
+        alloc.allocate(1);
+
+    //Items are added in whatever order the threads adding them got to it, but that mustn't make any difference
+    ref_list refs(m_items.size());
+    for( ::uint32_t i=0; i < refs.size(); ++i )
+        refs[i]=i;
+    std::sort(refs.begin(), refs.end(), [this](::uint32_t a, ::uint32_t b){ return canonical_less(a, b); });
+
+    place_labels(refs);
+
+    build_context ctx{ alloc };
+    top_slot top=plan(ctx, world_bounds, refs, 0);
+    auto bases=build_subtrees(ctx, threads);
+
+    //The subtrees' squares go first, one after the other, and then those above them
+    std::vector<::uint32_t> first{ 0 };
+    for(const auto &sub: m_subtrees)
+        first.push_back(first.back() + sub.squares.size());
+
+    auto root=stitch(ctx, top, first);
+
+    //An empty index is still a tree, of one empty square
+    if(root == no_square)
+        root=first.back() + build_leaf(ctx, world_bounds, {}, 0);
+
+    auto *squares=index_allocator<quadtree_square>(alloc).allocate(first.back() + ctx.squares.size());
+    for( ::size_t i=0; i < m_subtrees.size(); ++i )
+        put_squares(squares, m_subtrees[i].squares, first[i], first[i], bases[i]);
+    put_squares(squares, ctx.squares, first.back(), 0, ctx.base());
+
+    add_tree_statistics(m_stats, ctx.stats);
+
+    m_spool_base=nullptr;
+    std::vector<subtree>{}.swap(m_subtrees);
+    std::vector<top_square>{}.swap(m_top);
+    std::vector<::uint8_t>{}.swap(m_label_level);
+    std::vector<::uint32_t>{}.swap(m_label_rank);
+    return squares[root];
+}
+
+index_builder::statistics_type index_builder::statistics() const{
+    return m_stats;
+}
+
+index_builder::size_type index_builder::size() const{
+    std::lock_guard lock(m_mutex);
+    return m_items.size();
+}
+
+file_offs_t index_builder::save( journal_writer &journal, size_type from ){
+    m_spool.sync();
+
+    std::lock_guard lock(m_mutex);
+    journal.put_array(m_items.data() + from, m_items.size() - from);
+    return m_spool.size();
+}
+
+void index_builder::truncate_spool( file_offs_t size ){
+    if(m_spool.size() < size)
+        throw checkpoint_exception("Spool is shorter than the checkpoint says: " + m_spool_path.string());
+    m_spool.truncate(size);
+}
+
+void index_builder::restore( journal_reader &journal ){
+    auto [p, n]=journal.get_array<item>();
+
+    std::lock_guard lock(m_mutex);
+    auto first=m_items.size();
+    m_items.resize(first + n);
+    std::memcpy((void *)(m_items.data() + first), p, n * sizeof(item));
+}
@@ -0,0 +1,237 @@
+#include <new>
+#include <cstddef>
+#include <cstring>
+#include <utility>
+#include <algorithm>
+#include <unordered_map>
+#include "astrolib/checksum.hpp"
+#include "astrolib/index/container.hpp"
+#include "astrolib/index/geometry_codec.hpp"
+
+using namespace leapus;
+using namespace leapus::astrolib;
+using namespace leapus::astrolib::index;
+using namespace leapus::pointer;
+
+static ::uint32_t header_checksum( const superblock &sb ){
+    return checksum( &sb, offsetof(superblock, crc) );
+}
+
+static ::uint32_t section_checksum( const char *base, const section_header &s ){
+    return s.size ? checksum( base + s.offset, s.size ) : 0;
+}
+
+index_summary index::write_index( const std::filesystem::path &path, const io::mmap_file &source,
+    const quadtree_square &root, const string_interner &strings, layout_order order, ::size_t page_size ){
+
+    std::filesystem::path temp=path.string() + ".tmp";
+    std::filesystem::remove(temp);
+
+    index_summary summary;
+    superblock sb;
+    std::memset(&sb, 0, sizeof(sb));
+
+    {
+        io::mmap_file out{ temp, true, (io::mmap_file::size_type)1 << 40 };
+        index_allocator<char> alloc{ out };
+
+        //Room for the superblock, which is filled in last
+        out.grow(superblock_size);
+
+        const char *src_base=std::addressof(*source.read(0, source.size()));
+        auto seq=layout_sequence(root, order, page_size);
+
+        //Tree section, with the same order as relayout()
+        quadtree_square *squares=index_allocator<quadtree_square>(alloc).allocate(seq.size());
+
+        std::unordered_map<const quadtree_square *, quadtree_square *> moved;
+        moved.reserve(seq.size());
+        for( ::size_t i=0; i < seq.size(); ++i )
+            moved[seq[i]]=squares+i;
+
+        //Entries section, leaf after leaf, in the same order as the squares
+        ::size_t entry_count=0;
+        for(auto *sq: seq)
+            entry_count+=sq->entries.size();
+
+        index_entry *entries=index_allocator<index_entry>(alloc).allocate(entry_count);
+
+        //Runs, likewise
+        ::size_t run_count=0;
+        for(auto *sq: seq)
+            run_count+=sq->runs.size();
+
+        entry_run *runs=index_allocator<entry_run>(alloc).allocate(run_count);
+
+        //And labels, which have no geometry, so they're copied as they are
+        ::size_t label_count=0;
+        for(auto *sq: seq)
+            label_count+=sq->labels.size();
+
+        label_entry *labels=index_allocator<label_entry>(alloc).allocate(label_count);
+
+        //A record's size is only known by decoding it, and there's no other way to find
+        //its end, so this measures them all before the reduction section is allocated
+        std::vector<::size_t> record_sizes;
+        ::size_t reduction_bytes=0;
+        geometry_parts parts;
+        std::vector<::uint32_t> triangles;
+        for(auto *sq: seq){
+            for(const index_entry &e: sq->entries){
+                if(!e.reduction_detail)
+                    continue;
+
+                //A fill record comes with its geometry record, and both are copied as one
+                const char *record=src_base + e.reduction_detail;
+                const char *end=e.fill ? decode_fill(record + e.fill, triangles) : decode_geometry(record, sq->bounds.sw, parts);
+                auto size=(::size_t)(end - record);
+                record_sizes.push_back(size);
+                reduction_bytes+=size;
+            }
+        }
+
+        char *reduction=alloc.allocate(reduction_bytes);
+
+        auto relocated=[&moved](const quadtree_square *old) -> quadtree_square *{
+            return old ? moved.at(old) : nullptr;
+        };
+
+        index_entry *next_entry=entries;
+        entry_run *next_run=runs;
+        label_entry *next_label=labels;
+        char *next_record=reduction;
+        auto next_size=record_sizes.begin();
+        for( ::size_t i=0; i < seq.size(); ++i ){
+            const quadtree_square &src=*seq[i];
+            auto &dst=*new(squares+i) quadtree_square{ src.bounds };
+            dst.nw=relocated(src.nw.get());
+            dst.ne=relocated(src.ne.get());
+            dst.sw=relocated(src.sw.get());
+            dst.se=relocated(src.se.get());
+
+            //Runs count entries from the start of their leaf's, so they're copied as they are
+            dst.runs.assign(next_run, src.runs.size());
+            next_run=std::copy(src.runs.begin(), src.runs.end(), next_run);
+
+            dst.labels.assign(next_label, src.labels.size());
+            next_label=std::copy(src.labels.begin(), src.labels.end(), next_label);
+
+            dst.entries.assign(next_entry, src.entries.size());
+            for(const index_entry &e: src.entries){
+                index_entry copy=e;
+                if(copy.reduction_detail){
+                    std::memcpy(next_record, src_base + copy.reduction_detail, *next_size);
+                    copy.reduction_detail=out.offset_of(next_record);
+                    next_record+=*next_size++;
+                }
+                *next_entry++=copy;
+            }
+        }
+
+        //The dictionary's writer does its own allocation, and what it's padded out to is its size
+        auto dictionary=strings.write(alloc);
+        auto dictionary_bytes=out.size() - dictionary;
+
+        std::memcpy(sb.magic, index_magic, sizeof(sb.magic));
+        sb.version=index_version;
+        sb.sections[sb.section_count++]={ section_tree, 0, out.offset_of(squares), sizeof(quadtree_square) * seq.size() };
+        sb.sections[sb.section_count++]={ section_entries, 0, out.offset_of(entries), sizeof(index_entry) * entry_count };
+        sb.sections[sb.section_count++]={ section_reduction, 0, out.offset_of(reduction), reduction_bytes };
+        sb.sections[sb.section_count++]={ section_dictionary, 0, dictionary, dictionary_bytes };
+        sb.sections[sb.section_count++]={ section_runs, 0, out.offset_of(runs), sizeof(entry_run) * run_count };
+        sb.sections[sb.section_count++]={ section_labels, 0, out.offset_of(labels), sizeof(label_entry) * label_count };
+
+        const char *base=std::addressof(*std::as_const(out).read(0, out.size()));
+        for( ::uint32_t i=0; i < sb.section_count; ++i )
+            sb.sections[i].crc=section_checksum(base, sb.sections[i]);
+
+        sb.file_size=out.size();
+        sb.root=out.offset_of(squares);
+        sb.crc=header_checksum(sb);
+
+        //The contents have to be on the disk before the superblock that vouches for them is, or
+        //a crash in between could leave a valid-looking superblock in front of garbage
+        out.sync();
+        std::memcpy(std::addressof(*out.read(0, sizeof(sb))), &sb, sizeof(sb));
+        out.sync();
+
+        summary={ sb.root, seq.size(), entry_count, run_count, label_count, reduction_bytes, dictionary_bytes, sb.file_size };
+    }
+
+    std::filesystem::rename(temp, path);
+    io::sync_directory(path.parent_path());
+    return summary;
+}
+
+index_file::index_file( const std::filesystem::path &path ){
+    //Opening a mmap_file creates it if need be, which is no way to find out that an index is missing
+    std::error_code ec;
+    auto size=std::filesystem::file_size(path, ec);
+    if(ec)
+        throw index_format_exception("Could not open index: " + path.string() + ": " + ec.message());
+
+    if(size < superblock_size)
+        throw index_format_exception("Not an index file, or an incomplete one: " + path.string());
+
+    m_file=io::mmap_file{ path, false };
+    m_base=std::addressof(*std::as_const(m_file).read(0, m_file.size()));
+    m_super=(const superblock *)m_base;
+
+    auto fail=[&path](const std::string &what){
+        throw index_format_exception(what + ": " + path.string());
+    };
+
+    if(std::memcmp(m_super->magic, index_magic, sizeof(index_magic)))
+        fail("Not an index file");
+
+    if(m_super->version != index_version)
+        fail("Index file is version " + std::to_string(m_super->version) + ", not " + std::to_string(index_version));
+
+    if(header_checksum(*m_super) != m_super->crc)
+        fail("Index file header is damaged");
+
+    if(m_super->file_size != m_file.size())
+        fail("Index file is " + std::to_string(m_file.size()) + " bytes, rather than " +
+            std::to_string(m_super->file_size) + ", so it's incomplete");
+
+    if(m_super->section_count > superblock::max_sections)
+        fail("Index file header is damaged");
+
+    for( ::uint32_t i=0; i < m_super->section_count; ++i ){
+        const auto &s=m_super->sections[i];
+        if(s.offset < superblock_size || s.offset > m_super->file_size || s.size > m_super->file_size - s.offset)
+            fail("Index file section " + std::to_string(s.kind) + " is out of bounds");
+    }
+
+    auto *tree=section(section_tree);
+    if(!tree || m_super->root < tree->offset || m_super->root + sizeof(quadtree_square) > tree->offset + tree->size)
+        fail("Index file has no root square");
+
+    auto *dictionary=section(section_dictionary);
+    if(!dictionary || dictionary->size < sizeof(dictionary_header))
+        fail("Index file has no dictionary");
+
+    m_dictionary=string_dictionary{ m_base + dictionary->offset };
+}
+
+const section_header *index_file::section( section_kind kind ) const{
+    for( ::uint32_t i=0; i < m_super->section_count; ++i )
+        if(m_super->sections[i].kind == kind)
+            return m_super->sections + i;
+
+    return nullptr;
+}
+
+void index_file::verify() const{
+    for( ::uint32_t i=0; i < m_super->section_count; ++i ){
+        const auto &s=m_super->sections[i];
+        if(section_checksum(m_base, s) != s.crc)
+            throw index_format_exception("Index file section " + std::to_string(s.kind) + " is damaged");
+    }
+}
+
+void index_file::prefetch() const{
+    for( auto kind: { section_tree, section_entries, section_runs, section_labels, section_dictionary } )
+        if(auto *s=section(kind); s && s->size)
+            m_file.readahead(s->offset, s->size);
+}
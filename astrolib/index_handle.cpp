@@ -0,0 +1,186 @@
+#include <limits>
+#include <algorithm>
+#include "astrolib/index/handle.hpp"
+
+using namespace leapus::astrolib::index;
+
+namespace{
+
+constexpr ::uint64_t not_reading=std::numeric_limits<::uint64_t>::max();
+
+//A thread's posted epoch, on a cache line of its own, since its thread writes it on every query
+struct alignas(64) reader_slot{
+    std::atomic<::uint64_t> epoch=not_reading;
+
+    //Readers this thread holds, of any handle. Only the outermost posts and clears the epoch.
+    unsigned depth=0;
+};
+
+struct registry{
+    std::mutex mutex;
+    std::vector<reader_slot *> slots;
+
+    //Starts above zero, so that anything retired in the first epoch has one to wait for
+    std::atomic<::uint64_t> epoch=1;
+};
+
+//Never destroyed, since threads may exit after static destruction has begun
+registry &the_registry(){
+    static registry *r=new registry;
+    return *r;
+}
+
+struct slot_owner{
+    reader_slot *slot=new reader_slot;
+
+    slot_owner(){
+        auto &reg=the_registry();
+        std::lock_guard lock(reg.mutex);
+        reg.slots.push_back(slot);
+    }
+
+    ~slot_owner(){
+        auto &reg=the_registry();
+        std::lock_guard lock(reg.mutex);
+        reg.slots.erase( std::find(reg.slots.begin(), reg.slots.end(), slot) );
+        delete slot;
+    }
+};
+
+reader_slot &local_slot(){
+    thread_local slot_owner owner;
+    return *owner.slot;
+}
+
+//The earliest epoch any thread is reading in, or not_reading
+::uint64_t oldest_reader(){
+    auto &reg=the_registry();
+    std::lock_guard lock(reg.mutex);
+
+    ::uint64_t oldest=not_reading;
+    for(auto *s: reg.slots)
+        oldest=std::min(oldest, s->epoch.load());
+
+    return oldest;
+}
+
+}
+
+index_handle::reader::reader( const index_handle &handle ):
+    m_handle(&handle){
+
+    auto &slot=local_slot();
+    if(!slot.depth++){
+        //Posting the epoch before loading the pointer is what the whole scheme hangs on. Whoever swaps
+        //the pointer bumps the epoch afterwards, so if we get the old index here, the swapper's scan
+        //is bound to see our epoch, which is no later than the one the old index was retired in.
+        slot.epoch.store( the_registry().epoch.load() );
+    }
+
+    m_snapshot=handle.m_current.load();
+}
+
+index_handle::reader::reader( reader &&rhs ):
+    m_handle(rhs.m_handle),
+    m_snapshot(rhs.m_snapshot){
+
+    rhs.m_handle=nullptr;
+    rhs.m_snapshot=nullptr;
+}
+
+index_handle::reader &index_handle::reader::operator=( reader &&rhs ){
+    if(this != &rhs){
+        release();
+        std::swap(m_handle, rhs.m_handle);
+        std::swap(m_snapshot, rhs.m_snapshot);
+    }
+
+    return *this;
+}
+
+index_handle::reader::~reader(){
+    release();
+}
+
+void index_handle::reader::release(){
+    if(!m_snapshot)
+        return;
+
+    auto &slot=local_slot();
+    if(!--slot.depth)
+        slot.epoch.store(not_reading);
+
+    //The last reader out of a retired index unmaps it, rather than leaving it for the next swap
+    if(m_handle->m_retired_count.load(std::memory_order_relaxed))
+        m_handle->reclaim();
+
+    m_handle=nullptr;
+    m_snapshot=nullptr;
+}
+
+index_handle::index_handle( const std::filesystem::path &path ):
+    m_path(path),
+    m_current( new snapshot{ path, 1 } ){}
+
+index_handle::~index_handle(){
+    std::lock_guard lock(m_mutex);
+    for(auto &r: m_retired)
+        delete r.first;
+
+    delete m_current.load();
+}
+
+void index_handle::reclaim() const{
+    //A reader in the middle of a query shouldn't wait on another's munmap, so if somebody else
+    //is already reclaiming, let them
+    std::unique_lock lock(m_mutex, std::try_to_lock);
+    if(lock)
+        reclaim_locked();
+}
+
+void index_handle::reclaim_locked() const{
+    if(m_retired.empty())
+        return;
+
+    auto oldest=oldest_reader();
+
+    //Anything retired before the oldest reader started can't be in use
+    auto unused=std::stable_partition(m_retired.begin(), m_retired.end(),
+        [oldest](const auto &r){ return r.second >= oldest; });
+
+    for( auto it=unused; it != m_retired.end(); ++it )
+        delete it->first;
+
+    m_retired.erase(unused, m_retired.end());
+    m_retired_count.store(m_retired.size());
+}
+
+::uint64_t index_handle::swap( const std::filesystem::path &path, bool verify ){
+    //All of the slow part happens before anything is swapped, so readers carry on with the old index meanwhile
+    auto *next=new snapshot{ path, 0 };
+    try{
+        if(verify)
+            next->file.verify();
+        next->file.prefetch();
+    }
+    catch(...){
+        delete next;
+        throw;
+    }
+
+    std::lock_guard lock(m_mutex);
+    next->generation=m_current.load()->generation + 1;
+
+    auto *old=m_current.exchange(next);
+    auto retired_in=the_registry().epoch.fetch_add(1);
+    m_retired.emplace_back(old, retired_in);
+    m_retired_count.store(m_retired.size());
+
+    reclaim_locked();
+    return next->generation;
+}
+
+::uint64_t index_handle::generation() const{
+    reader r=acquire();
+    return r.generation();
+}
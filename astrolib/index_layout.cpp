@@ -0,0 +1,139 @@
+#include <new>
+#include <unordered_map>
+#include <algorithm>
+#include "astrolib/index/layout.hpp"
+
+using namespace leapus::astrolib;
+using namespace leapus::astrolib::index;
+using namespace leapus::pointer;
+
+using square_sequence=std::vector<const quadtree_square *>;
+
+template<typename Func>
+static void for_each_child( const quadtree_square &sq, Func &&func ){
+    for( auto *c: { sq.nw.get(), sq.ne.get(), sq.sw.get(), sq.se.get() } )
+        if(c) func(*c);
+}
+
+int index::tree_height( const quadtree_square &root ){
+    int h=0;
+    for_each_child(root, [&h](const quadtree_square &c){ h=std::max(h, tree_height(c)); });
+    return h+1;
+}
+
+//The squares exactly depth levels below sq, left to right
+static void collect_level( const quadtree_square &sq, int depth, square_sequence &out ){
+    if(!depth){
+        out.push_back(&sq);
+        return;
+    }
+
+    for_each_child(sq, [&](const quadtree_square &c){ collect_level(c, depth-1, out); });
+}
+
+//Lay out the tree below sq, pretending that it stops after height levels
+static void emit_veb( const quadtree_square &sq, int height, square_sequence &out ){
+    if(height == 1){
+        out.push_back(&sq);
+        return;
+    }
+
+    int top=height/2;
+    emit_veb(sq, top, out);
+
+    square_sequence bottoms;
+    collect_level(sq, top, bottoms);
+    for(auto *b: bottoms)
+        emit_veb(*b, height-top, out);
+}
+
+static void emit_blocked( const quadtree_square &sq, int block_levels, square_sequence &out ){
+
+    //Breadth-first within the block
+    square_sequence level{ &sq }, next;
+    for( int i=0; i < block_levels && !level.empty(); ++i ){
+        out.insert(out.end(), level.begin(), level.end());
+
+        next.clear();
+        for(auto *s: level)
+            for_each_child(*s, [&next](const quadtree_square &c){ next.push_back(&c); });
+
+        std::swap(level, next);
+    }
+
+    //Whatever is left hanging off the bottom of the block starts a block of its own
+    for(auto *b: level)
+        emit_blocked(*b, block_levels, out);
+}
+
+//How many levels of a full quadtree fit in a page
+static int levels_per_page( ::size_t page_size ){
+    int levels=0;
+    ::size_t width=1, count=0;
+
+    while( (count+width) * sizeof(quadtree_square) <= page_size ){
+        count+=width;
+        width*=4;
+        ++levels;
+    }
+
+    return std::max(levels, 1);
+}
+
+std::vector<const quadtree_square *> index::layout_sequence( const quadtree_square &root,
+    layout_order order, ::size_t page_size){
+
+    square_sequence result;
+
+    switch(order){
+        case layout_order::van_emde_boas:
+            emit_veb(root, tree_height(root), result);
+            break;
+
+        case layout_order::level_blocked:
+            emit_blocked(root, levels_per_page(page_size), result);
+            break;
+
+        //Wherever the squares already sit in the file
+        case layout_order::as_built:
+            emit_blocked(root, tree_height(root), result);
+            std::sort(result.begin(), result.end());
+            break;
+    }
+
+    return result;
+}
+
+quadtree_square &index::relayout( const quadtree_square &root, index_allocator<quadtree_square> alloc,
+    layout_order order, ::size_t page_size ){
+
+    if(order == layout_order::as_built)
+        return const_cast<quadtree_square &>(root);
+
+    auto seq=layout_sequence(root, order, page_size);
+    quadtree_square *run=alloc.allocate(seq.size());
+
+    std::unordered_map<const quadtree_square *, quadtree_square *> moved;
+    moved.reserve(seq.size());
+    for( ::size_t i=0; i < seq.size(); ++i )
+        moved[seq[i]]=run+i;
+
+    auto relocated=[&moved](const quadtree_square *old) -> quadtree_square *{
+        return old ? moved.at(old) : nullptr;
+    };
+
+    //Relative pointers only point anywhere once they're in place, so they can't just be copied
+    for( ::size_t i=0; i < seq.size(); ++i ){
+        const quadtree_square &src=*seq[i];
+        auto &dst=*new(run+i) quadtree_square{ src.bounds };
+        dst.nw=relocated(src.nw.get());
+        dst.ne=relocated(src.ne.get());
+        dst.sw=relocated(src.sw.get());
+        dst.se=relocated(src.se.get());
+        dst.entries.assign(src.entries.data(), src.entries.size());
+        dst.runs.assign(src.runs.data(), src.runs.size());
+        dst.labels.assign(src.labels.data(), src.labels.size());
+    }
+
+    return *run;
+}
@@ -0,0 +1,123 @@
+#include <algorithm>
+#include "astrolib/index/labels.hpp"
+
+using namespace leapus::astrolib;
+using namespace leapus::astrolib::index;
+
+//Past this, a name is cut short on screen anyway
+static constexpr int max_label_pixels=1000;
+
+//Around the text, or the icon, so that neighbours don't quite touch
+static constexpr int label_padding=2;
+
+//Roughly how wide a glyph is in a 12 pixel sans-serif, in tenths of a pixel. There's no font at
+//indexing time, and it only has to be about right, since labels are placed with some room to spare.
+static int glyph_tenths( ::uint32_t c ){
+    switch(c){
+        case ' ': case 'i': case 'l': case 'j': case '.': case ',': case '\'': case '!': case '|': case ':': case ';':
+            return 30;
+        case 'f': case 't': case 'r': case 'I': case '(': case ')': case '-':
+            return 40;
+        case 'm': case 'w': case 'M': case 'W':
+            return 100;
+    }
+
+    if(c >= 'A' && c <= 'Z')
+        return 80;
+    if(c >= '0' && c <= '9')
+        return 70;
+    if(c < 0x80)
+        return 65;
+
+    //Latin, Greek, Cyrillic and the like are about as wide as ASCII, and from the CJK radicals on,
+    //most scripts are a square em
+    return c < 0x2e80 ? 70 : 120;
+}
+
+label_metrics index::measure_label( std::string_view text, ::int32_t priority ){
+    //Without any text, it's a dot
+    if(text.empty())
+        return { 8, 8, priority };
+
+    int tenths=0;
+    for( ::size_t i=0; i < text.size(); ){
+        ::uint8_t b=text[i];
+
+        //Decoding just enough UTF-8 to know roughly what script it is. Continuation
+        //bytes are skipped, so broken sequences don't count for much either way.
+        int len=b < 0x80 ? 1 : b >= 0xf0 ? 4 : b >= 0xe0 ? 3 : b >= 0xc0 ? 2 : 1;
+        ::uint32_t c=len == 1 ? b : b & (0x7f >> len);
+        for( int k=1; k < len && i+k < text.size(); ++k )
+            c=c << 6 | (text[i+k] & 0x3f);
+
+        tenths+=glyph_tenths(c);
+        i+=len;
+    }
+
+    int width=std::min( (tenths + 9) / 10 + 2*label_padding, max_label_pixels );
+    return { (::uint16_t)width, (::uint16_t)(12 + 2*label_padding), priority };
+}
+
+label_metrics index::measure_widget( ::int32_t priority ){
+    return { 16 + 2*label_padding, 16 + 2*label_padding, priority };
+}
+
+box_t index::label_footprint( const coordinate_t &pt, const label_metrics &metrics, ordinate_t square_width ){
+    ordinate_t half_width=square_width * metrics.width / (2 * label_screen_pixels);
+    ordinate_t half_height=square_width * metrics.height / (2 * label_screen_pixels);
+    return { { pt.lat - half_height, pt.lon - half_width }, { pt.lat + half_height, pt.lon + half_width } };
+}
+
+//Rounding towards minus infinity, so that the cells either side of zero are the same size
+static ordinate_t cell_of( ordinate_t v, ordinate_t cell ){
+    return v >= 0 ? v / cell : -((-v + cell - 1) / cell);
+}
+
+template<typename Func>
+void label_grid::for_each_cell( const box_t &b, Func &&func ){
+    ordinate_t lat0=cell_of(b.sw.lat, m_cell), lat1=cell_of(b.ne.lat, m_cell);
+    ordinate_t lon0=cell_of(b.sw.lon, m_cell), lon1=cell_of(b.ne.lon, m_cell);
+
+    for( ordinate_t lat=lat0; lat <= lat1; ++lat )
+        for( ordinate_t lon=lon0; lon <= lon1; ++lon )
+            func( (::uint64_t)lat << 32 ^ (::uint32_t)lon );
+}
+
+void label_grid::reset( ordinate_t cell ){
+    m_cell=std::max<ordinate_t>(cell, 1);
+    m_placed.clear();
+    m_cells.clear();
+}
+
+bool label_grid::place( const box_t &b ){
+    //Only overlapping counts, and labels which just touch are fine
+    bool clear=true;
+    for_each_cell(b, [this, &b, &clear](::uint64_t key){
+        if(!clear)
+            return;
+
+        auto it=m_cells.find(key);
+        if(it == m_cells.end())
+            return;
+
+        for(auto i: it->second){
+            const box_t &p=m_placed[i];
+            if(b.sw.lat < p.ne.lat && p.sw.lat < b.ne.lat && b.sw.lon < p.ne.lon && p.sw.lon < b.ne.lon){
+                clear=false;
+                return;
+            }
+        }
+    });
+
+    if(clear)
+        add(b);
+    return clear;
+}
+
+void label_grid::add( const box_t &b ){
+    auto i=(::uint32_t)m_placed.size();
+    m_placed.push_back(b);
+    for_each_cell(b, [this, i](::uint64_t key){
+        m_cells[key].push_back(i);
+    });
+}
@@ -0,0 +1,317 @@
+#include <mutex>
+#include <cstdio>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <stdexcept>
+#include <sys/resource.h>
+#include "astrolib/console.hpp"
+#include "astrolib/metrics.hpp"
+
+using namespace leapus;
+using namespace leapus::metrics;
+
+namespace{
+
+struct registry{
+    std::mutex mutex;
+
+    //Gauges live among the counters, and are only told apart when reporting
+    std::vector<std::string> counter_names, histogram_names;
+    std::vector<bool> is_gauge;
+
+    std::vector<thread_slots *> live;
+
+    //Whatever the threads that have exited had counted
+    thread_slots retired;
+};
+
+//Never destroyed, since threads may still be exiting, and folding their counts in, during static destruction
+registry &the_registry(){
+    static registry *r=new registry;
+    return *r;
+}
+
+::size_t register_name( std::vector<std::string> &names, const std::string &name, ::size_t max, bool gauge=false ){
+    auto &reg=the_registry();
+    std::lock_guard lock(reg.mutex);
+
+    //The same name twice is the same metric
+    auto it=std::find(names.begin(), names.end(), name);
+    if(it != names.end())
+        return it - names.begin();
+
+    if(names.size() == max)
+        throw std::length_error("Too many metrics, at: " + name);
+
+    if(&names == &reg.counter_names)
+        reg.is_gauge.push_back(gauge);
+
+    names.push_back(name);
+    return names.size()-1;
+}
+
+void fold( const thread_slots &from, thread_slots &to ){
+    auto add=[](const std::atomic<value_type> &a, std::atomic<value_type> &b){
+        b.store( b.load(std::memory_order_relaxed) + a.load(std::memory_order_relaxed), std::memory_order_relaxed );
+    };
+
+    for( ::size_t i=0; i < max_counters; ++i )
+        add(from.counters[i], to.counters[i]);
+
+    for( ::size_t i=0; i < max_histograms; ++i ){
+        auto &f=from.histograms[i];
+        auto &t=to.histograms[i];
+        add(f.count, t.count);
+        add(f.sum, t.sum);
+        t.max.store( std::max(f.max.load(std::memory_order_relaxed), t.max.load(std::memory_order_relaxed)), std::memory_order_relaxed );
+        for( ::size_t b=0; b < histogram_buckets; ++b )
+            add(f.buckets[b], t.buckets[b]);
+    }
+}
+
+struct slots_owner{
+    thread_slots *slots=new thread_slots{};
+
+    slots_owner(){
+        auto &reg=the_registry();
+        std::lock_guard lock(reg.mutex);
+        reg.live.push_back(slots);
+    }
+
+    ~slots_owner(){
+        auto &reg=the_registry();
+        std::lock_guard lock(reg.mutex);
+        fold(*slots, reg.retired);
+        reg.live.erase( std::find(reg.live.begin(), reg.live.end(), slots) );
+        delete slots;
+    }
+};
+
+//The registry must be locked
+value_type sum_counter( registry &reg, ::size_t id ){
+    value_type v=reg.retired.counters[id].load(std::memory_order_relaxed);
+    for(auto *s: reg.live)
+        v+=s->counters[id].load(std::memory_order_relaxed);
+    return v;
+}
+
+histogram_data sum_histogram( registry &reg, ::size_t id ){
+    thread_slots::histogram_slots total={};
+
+    auto add=[&total](const thread_slots::histogram_slots &h){
+        total.count+=h.count.load(std::memory_order_relaxed);
+        total.sum+=h.sum.load(std::memory_order_relaxed);
+        total.max=std::max(total.max.load(), h.max.load(std::memory_order_relaxed));
+        for( ::size_t b=0; b < histogram_buckets; ++b )
+            total.buckets[b]+=h.buckets[b].load(std::memory_order_relaxed);
+    };
+
+    add(reg.retired.histograms[id]);
+    for(auto *s: reg.live)
+        add(s->histograms[id]);
+
+    histogram_data d;
+    d.count=total.count;
+    d.sum=total.sum;
+    d.max=total.max;
+    for( ::size_t b=0; b < histogram_buckets; ++b )
+        d.buckets[b]=total.buckets[b];
+    return d;
+}
+
+}
+
+thread_slots &leapus::metrics::local_slots(){
+    thread_local slots_owner owner;
+    return *owner.slots;
+}
+
+value_type histogram_data::percentile( double p ) const{
+    if(!count)
+        return 0;
+
+    value_type wanted=std::max<value_type>(1, p * count), seen=0;
+    for( ::size_t b=0; b < histogram_buckets; ++b ){
+        seen+=buckets[b];
+        if(seen >= wanted){
+            //The top of the bucket, but no more than the biggest value actually seen
+            value_type top=b ? (b == 64 ? ~(value_type)0 : ((value_type)1 << b) - 1) : 0;
+            return std::min(top, max);
+        }
+    }
+
+    return max;
+}
+
+counter::counter( const std::string &name ):
+    m_id( register_name(the_registry().counter_names, name, max_counters) ){}
+
+value_type counter::read() const{
+    auto &reg=the_registry();
+    std::lock_guard lock(reg.mutex);
+    return sum_counter(reg, m_id);
+}
+
+gauge::gauge( const std::string &name ):
+    m_id( register_name(the_registry().counter_names, name, max_counters, true) ){}
+
+::int64_t gauge::read() const{
+    auto &reg=the_registry();
+    std::lock_guard lock(reg.mutex);
+    return (::int64_t)sum_counter(reg, m_id);
+}
+
+histogram::histogram( const std::string &name ):
+    m_id( register_name(the_registry().histogram_names, name, max_histograms) ){}
+
+histogram_data histogram::read() const{
+    auto &reg=the_registry();
+    std::lock_guard lock(reg.mutex);
+    return sum_histogram(reg, m_id);
+}
+
+snapshot leapus::metrics::take_snapshot(){
+    snapshot snap;
+    snap.when=std::chrono::steady_clock::now();
+
+    {
+        auto &reg=the_registry();
+        std::lock_guard lock(reg.mutex);
+
+        for( ::size_t i=0; i < reg.counter_names.size(); ++i ){
+            if(reg.is_gauge[i])
+                snap.gauges.emplace_back(reg.counter_names[i], (::int64_t)sum_counter(reg, i));
+            else
+                snap.counters.emplace_back(reg.counter_names[i], sum_counter(reg, i));
+        }
+
+        for( ::size_t i=0; i < reg.histogram_names.size(); ++i )
+            snap.histograms.emplace_back(reg.histogram_names[i], sum_histogram(reg, i));
+    }
+
+    ::rusage usage;
+    if(!::getrusage(RUSAGE_SELF, &usage)){
+        snap.major_faults=usage.ru_majflt;
+        snap.minor_faults=usage.ru_minflt;
+        snap.user_seconds=usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6;
+        snap.system_seconds=usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+    }
+
+    return snap;
+}
+
+//1234567 as 1.23M, for the console
+static std::string human( double v ){
+    const char *units[]={ "", "K", "M", "G", "T", "P" };
+    int u=0;
+    while(std::abs(v) >= 1000 && u < 5){
+        v/=1000;
+        ++u;
+    }
+
+    std::ostringstream out;
+    out << std::setprecision(v < 10 && u ? 3 : 4) << v << units[u];
+    return out.str();
+}
+
+reporter::reporter( std::chrono::milliseconds interval, bool console, const std::string &json_path ):
+    m_interval(interval),
+    m_console(console),
+    m_last(take_snapshot()),
+    m_start(m_last.when){
+
+    if(!json_path.empty()){
+        m_json.open(json_path, std::ios::trunc);
+        if(!m_json)
+            throw std::runtime_error("Could not open metrics file: " + json_path);
+    }
+
+    m_thread=std::thread([this](){
+        std::unique_lock lock(m_mutex);
+        while( !m_cond.wait_for(lock, m_interval, [this](){ return m_stop; }) ){
+            lock.unlock();
+            report(take_snapshot());
+            lock.lock();
+        }
+    });
+}
+
+reporter::~reporter(){
+    stop();
+}
+
+void reporter::stop(){
+    {
+        std::lock_guard lock(m_mutex);
+        if(m_stop)
+            return;
+        m_stop=true;
+    }
+
+    m_cond.notify_all();
+    m_thread.join();
+    report(take_snapshot());
+}
+
+void reporter::report( const snapshot &now ){
+    double elapsed=std::chrono::duration<double>(now.when - m_start).count();
+    double dt=std::chrono::duration<double>(now.when - m_last.when).count();
+    if(dt <= 0)
+        dt=1e-9;
+
+    //Counters and histograms only ever get added, so the last snapshot's are a prefix of these
+    auto last_count=[this](::size_t i){ return i < m_last.counters.size() ? m_last.counters[i].second : 0; };
+
+    if(m_console){
+        std::ostringstream line;
+        line << "[" << std::fixed << std::setprecision(1) << elapsed << "s]" << std::defaultfloat;
+
+        for( ::size_t i=0; i < now.counters.size(); ++i ){
+            auto &[name, v]=now.counters[i];
+            if(v)
+                line << " " << name << "=" << human(v) << " (" << human((v - last_count(i)) / dt) << "/s)";
+        }
+
+        for(auto &[name, v]: now.gauges)
+            line << " " << name << "=" << v;
+
+        for(auto &[name, h]: now.histograms)
+            if(h.count)
+                line << " " << name << "{n=" << human(h.count) << " p50=" << human(h.percentile(0.5)) <<
+                    " p99=" << human(h.percentile(0.99)) << " max=" << human(h.max) << "}";
+
+        line << " faults(major/minor)=" << human(now.major_faults - m_last.major_faults) << "/" <<
+            human(now.minor_faults - m_last.minor_faults) << " cpu=" << std::fixed << std::setprecision(1) <<
+            now.user_seconds << "u+" << now.system_seconds << "s";
+
+        console::out(line.str());
+    }
+
+    if(m_json.is_open()){
+        m_json << std::setprecision(6) << "{\"elapsed\":" << elapsed << ",\"interval\":" << dt << ",\"counters\":{";
+        for( ::size_t i=0; i < now.counters.size(); ++i )
+            m_json << (i ? "," : "") << "\"" << now.counters[i].first << "\":" << now.counters[i].second;
+
+        m_json << "},\"rates\":{";
+        for( ::size_t i=0; i < now.counters.size(); ++i )
+            m_json << (i ? "," : "") << "\"" << now.counters[i].first << "\":" << (now.counters[i].second - last_count(i)) / dt;
+
+        m_json << "},\"gauges\":{";
+        for( ::size_t i=0; i < now.gauges.size(); ++i )
+            m_json << (i ? "," : "") << "\"" << now.gauges[i].first << "\":" << now.gauges[i].second;
+
+        m_json << "},\"histograms\":{";
+        for( ::size_t i=0; i < now.histograms.size(); ++i ){
+            auto &[name, h]=now.histograms[i];
+            m_json << (i ? "," : "") << "\"" << name << "\":{\"count\":" << h.count << ",\"mean\":" << h.mean() <<
+                ",\"p50\":" << h.percentile(0.5) << ",\"p90\":" << h.percentile(0.9) << ",\"p99\":" << h.percentile(0.99) <<
+                ",\"max\":" << h.max << "}";
+        }
+
+        m_json << "},\"major_faults\":" << now.major_faults << ",\"minor_faults\":" << now.minor_faults <<
+            ",\"user_seconds\":" << now.user_seconds << ",\"system_seconds\":" << now.system_seconds << "}" << std::endl;
+    }
+
+    m_last=now;
+}
@@ -0,0 +1,279 @@
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include "astrolib/index/multipolygon.hpp"
+
+using namespace leapus;
+using namespace leapus::astrolib;
+using namespace leapus::astrolib::index;
+using osm::osm_id;
+
+multipolygon_assembler::block_strings::block_strings( const OSMPBF::StringTable &strings ):
+    m_type( osm::find_string(strings, "type") ),
+    m_multipolygon( osm::find_string(strings, "multipolygon") ){}
+
+multipolygon_assembler::multipolygon_assembler( const node_store &nodes, size_type max_batch_members ):
+    m_nodes(nodes),
+    m_max_batch_members(max_batch_members){}
+
+bool multipolygon_assembler::add_relation( const OSMPBF::Relation &rel, const block_strings &strings, const osm_address_t &address ){
+    if(strings.m_type < 0 || strings.m_multipolygon < 0)
+        return false;
+
+    bool is_multipolygon=false;
+    for( int i=0; i < rel.keys_size(); ++i )
+        if( rel.keys(i) == (::uint32_t)strings.m_type && rel.vals(i) == (::uint32_t)strings.m_multipolygon )
+            is_multipolygon=true;
+
+    if(!is_multipolygon)
+        return false;
+
+    multipolygon_relation mp{ rel.id(), address };
+    osm::for_each_member(rel, [&mp](osm_id id, int type, int){
+        if(type == OSMPBF::Relation::WAY)
+            mp.ways.push_back(id);
+    });
+
+    //The same way is sometimes listed twice
+    std::sort(mp.ways.begin(), mp.ways.end());
+    mp.ways.erase( std::unique(mp.ways.begin(), mp.ways.end()), mp.ways.end() );
+
+    std::lock_guard lock(m_mutex);
+    m_relations.push_back(std::move(mp));
+    return true;
+}
+
+multipolygon_assembler::size_type multipolygon_assembler::size(){
+    std::lock_guard lock(m_mutex);
+    return m_relations.size();
+}
+
+void multipolygon_assembler::save( journal_writer &journal, size_type from ){
+    std::lock_guard lock(m_mutex);
+    journal.put<::uint64_t>(m_relations.size() - from);
+
+    for( auto r=from; r < m_relations.size(); ++r ){
+        const auto &rel=m_relations[r];
+        journal.put(rel.id);
+        journal.put(rel.address);
+        journal.put_array(rel.ways.data(), rel.ways.size());
+    }
+}
+
+void multipolygon_assembler::restore( journal_reader &journal ){
+    std::lock_guard lock(m_mutex);
+
+    for( auto n=journal.get<::uint64_t>(); n; --n ){
+        multipolygon_relation rel;
+        rel.id=journal.get<osm_id>();
+        rel.address=journal.get<osm_address_t>();
+
+        auto [p, count]=journal.get_array<osm_id>();
+        rel.ways.resize(count);
+        std::memcpy(rel.ways.data(), p, count * sizeof(osm_id));
+        m_relations.push_back(std::move(rel));
+    }
+}
+
+void multipolygon_assembler::restore_statistics( const statistics_type &stats ){
+    std::lock_guard lock(m_mutex);
+    m_stats=stats;
+}
+
+multipolygon_assembler::size_type multipolygon_assembler::plan_batches(){
+
+    //Relations arrive in whatever order the workers got to them, so put them in ID order
+    //to make batching, and everything downstream of it, the same from one run to the next
+    std::sort(m_relations.begin(), m_relations.end(),
+        [](auto &a, auto &b){ return a.id < b.id; });
+
+    m_batch_starts.clear();
+    size_type members=0;
+
+    for( size_type i=0; i < m_relations.size(); ++i ){
+        auto n=m_relations[i].ways.size();
+        if( m_batch_starts.empty() || (members && members + n > m_max_batch_members) ){
+            m_batch_starts.push_back(i);
+            members=0;
+        }
+
+        members+=n;
+    }
+
+    m_stats.relations=m_relations.size();
+    m_batch_starts.push_back(m_relations.size());
+    return m_batch_starts.size()-1;
+}
+
+void multipolygon_assembler::begin_batch( size_type batch ){
+    m_batch=batch;
+    m_ways.clear();
+
+    for( size_type r=m_batch_starts[batch]; r < m_batch_starts[batch+1]; ++r )
+        for(auto id: m_relations[r].ways)
+            m_ways.try_emplace(id);
+}
+
+multipolygon_assembler::size_type multipolygon_assembler::batch_size() const{
+    return m_batch_starts[m_batch+1] - m_batch_starts[m_batch];
+}
+
+void multipolygon_assembler::add_ways( const OSMPBF::PrimitiveBlock &block ){
+    for(const auto &group: block.primitivegroup())
+        for(const auto &way: group.ways()){
+            auto it=m_ways.find(way.id());
+            if(it != m_ways.end())
+                osm::way_refs(way, it->second);
+        }
+}
+
+void multipolygon_assembler::end_batch(){
+    m_ways.clear();
+    m_ways.rehash(0);
+}
+
+//Join ways end to end into closed rings, which is a hash join of way endpoints against way endpoints.
+//Returns false if anything was left over which couldn't be closed, or had nodes missing.
+bool multipolygon_assembler::stitch( const std::vector<const std::vector<osm_id> *> &ways, std::vector<ring_t> &rings ) const{
+    std::unordered_multimap<osm_id, size_type> ends;
+    std::vector<bool> used(ways.size());
+    bool complete=true;
+
+    for( size_type w=0; w < ways.size(); ++w ){
+        ends.emplace(ways[w]->front(), w);
+        ends.emplace(ways[w]->back(), w);
+    }
+
+    std::vector<osm_id> ids;
+    for( size_type w=0; w < ways.size(); ++w ){
+        if(used[w])
+            continue;
+
+        used[w]=true;
+        ids=*ways[w];
+
+        while(ids.front() != ids.back()){
+            auto [first, last]=ends.equal_range(ids.back());
+            auto next=std::find_if(first, last, [&used](auto &e){ return !used[e.second]; });
+
+            if(next == last)
+                break;
+
+            auto &way=*ways[next->second];
+            used[next->second]=true;
+
+            if(way.front() == ids.back())
+                ids.insert(ids.end(), way.begin()+1, way.end());
+            else
+                ids.insert(ids.end(), way.rbegin()+1, way.rend());
+        }
+
+        if(ids.front() != ids.back() || ids.size() < 4){
+            complete=false;
+            continue;
+        }
+
+        ring_t ring(ids.size());
+        bool found=true;
+        for( size_type i=0; i < ids.size() && found; ++i )
+            found=m_nodes.get(ids[i], ring[i]);
+
+        if(found)
+            rings.push_back(std::move(ring));
+        else
+            complete=false;
+    }
+
+    return complete;
+}
+
+//Is ring a inside ring b? The two are assumed not to cross, but they may well touch,
+//so test with a vertex of a which isn't also a vertex of b.
+static bool ring_inside( const ring_t &a, const ring_t &b ){
+    for(const auto &pt: a){
+        bool shared=std::any_of(b.begin(), b.end(), [&pt](auto &c){ return c.lat == pt.lat && c.lon == pt.lon; });
+        if(!shared)
+            return point_in_ring(pt, b);
+    }
+
+    //Every vertex is shared, so they're the same ring, give or take
+    return false;
+}
+
+bool multipolygon_assembler::assemble( size_type i, multipolygon &out ){
+    const auto &rel=m_relations[ m_batch_starts[m_batch] + i ];
+    bool complete=true;
+
+    std::vector<const std::vector<osm_id> *> ways;
+    for(auto id: rel.ways){
+        auto it=m_ways.find(id);
+        if(it == m_ways.end() || it->second.size() < 2)
+            complete=false;
+        else
+            ways.push_back(&it->second);
+    }
+
+    std::vector<ring_t> rings;
+    complete=stitch(ways, rings) && complete;
+
+    //Nesting depth of each ring, and the smallest ring enclosing it
+    const size_type n=rings.size();
+    std::vector<box_t> boxes(n);
+    std::vector<double> areas(n);
+    std::vector<int> depth(n, 0);
+    std::vector<size_type> parent(n, n);
+
+    for( size_type r=0; r < n; ++r ){
+        boxes[r]=bounds(rings[r]);
+        areas[r]=std::fabs(signed_area2(rings[r]));
+    }
+
+    for( size_type r=0; r < n; ++r )
+        for( size_type e=0; e < n; ++e ){
+            if( e == r || !contains(boxes[e], boxes[r]) || areas[e] < areas[r] || !ring_inside(rings[r], rings[e]) )
+                continue;
+
+            ++depth[r];
+            if(parent[r] == n || areas[e] < areas[parent[r]])
+                parent[r]=e;
+        }
+
+    out.id=rel.id;
+    out.address=rel.address;
+    out.polygons.clear();
+
+    std::vector<size_type> polygon_of(n, n);
+    for( size_type r=0; r < n; ++r ){
+        if(depth[r] % 2)
+            continue;
+
+        orient(rings[r], true);
+        polygon_of[r]=out.polygons.size();
+        out.polygons.push_back({ std::move(rings[r]) });
+    }
+
+    size_type holes=0;
+    for( size_type r=0; r < n; ++r ){
+        if( !(depth[r] % 2) )
+            continue;
+
+        orient(rings[r], false);
+        out.polygons[ polygon_of[parent[r]] ].holes.push_back(std::move(rings[r]));
+        ++holes;
+    }
+
+    std::lock_guard lock(m_mutex);
+    m_stats.incomplete+=!complete;
+    if(!out.polygons.empty()){
+        ++m_stats.assembled;
+        m_stats.polygons+=out.polygons.size();
+        m_stats.holes+=holes;
+    }
+
+    return !out.polygons.empty();
+}
+
+multipolygon_assembler::statistics_type multipolygon_assembler::statistics(){
+    std::lock_guard lock(m_mutex);
+    return m_stats;
+}
@@ -0,0 +1,370 @@
+#include <cmath>
+#include <algorithm>
+#include "astrolib/clip.hpp"
+#include "astrolib/index/mvt.hpp"
+
+using namespace leapus::astrolib;
+using namespace leapus::astrolib::index;
+
+namespace{
+
+//Geometry types and commands, from the spec
+enum : unsigned{ geom_point=1, geom_linestring=2, geom_polygon=3 };
+enum : unsigned{ cmd_move_to=1, cmd_line_to=2, cmd_close_path=7 };
+
+enum : unsigned{ wire_varint=0, wire_length=2 };
+
+//Where Web Mercator gives up, so that the poles don't project to infinity
+constexpr double max_latitude=85.0511287798;
+
+double mercator_x( ordinate_t lon ){
+    return (lon / 1e9 + 180) / 360;
+}
+
+double mercator_y( ordinate_t lat ){
+    double r=std::clamp(lat / 1e9, -max_latitude, max_latitude) * M_PI / 180;
+    return (1 - std::log(std::tan(r) + 1 / std::cos(r)) / M_PI) / 2;
+}
+
+::uint32_t command( unsigned id, ::uint32_t count ){
+    return (id & 7) | (count << 3);
+}
+
+::uint32_t zigzag( ::int32_t n ){
+    return ((::uint32_t)n << 1) ^ (::uint32_t)(n >> 31);
+}
+
+::size_t varint_size( ::uint64_t v ){
+    ::size_t n=1;
+    while(v >= 0x80){
+        v>>=7;
+        ++n;
+    }
+    return n;
+}
+
+void put_varint( std::string &out, ::uint64_t v ){
+    char buf[10];
+    int n=0;
+    while(v >= 0x80){
+        buf[n++]=(char)(v | 0x80);
+        v>>=7;
+    }
+    buf[n++]=(char)v;
+    out.append(buf, n);
+}
+
+void put_key( std::string &out, unsigned field, unsigned wire ){
+    put_varint(out, field << 3 | wire);
+}
+
+void put_bytes( std::string &out, unsigned field, std::string_view s ){
+    put_key(out, field, wire_length);
+    put_varint(out, s.size());
+    out.append(s);
+}
+
+void put_packed( std::string &out, unsigned field, const std::vector<::uint32_t> &values ){
+    ::size_t size=0;
+    for(auto v: values)
+        size+=varint_size(v);
+
+    put_key(out, field, wire_length);
+    put_varint(out, size);
+    for(auto v: values)
+        put_varint(out, v);
+}
+
+//A length-delimited field's size, all told
+::size_t bytes_size( ::size_t n ){
+    return 1 + varint_size(n) + n;
+}
+
+const char *layer_names[]={ "lines", "polygons", "labels", "widgets" };
+
+}
+
+box_t index::tile_bounds( int z, int x, int y ){
+    double n=std::ldexp(1.0, z);
+
+    auto lat=[n](double ty){
+        return (ordinate_t)std::llround(std::atan(std::sinh(M_PI * (1 - 2 * ty / n))) * 180 / M_PI * 1e9);
+    };
+    auto lon=[n](double tx){
+        return (ordinate_t)std::llround((tx / n * 360 - 180) * 1e9);
+    };
+
+    return { { lat(y+1), lon(x) }, { lat(y), lon(x+1) } };
+}
+
+void mvt_encoder::layer::clear(){
+    features.clear();
+    feature_count=0;
+    key_index.clear();
+    value_index.clear();
+    keys.clear();
+    values.clear();
+}
+
+mvt_encoder::mvt_encoder( unsigned extent, unsigned buffer ):
+    m_extent(extent),
+    m_buffer(buffer){
+
+    for( int t=0; t <= idx_widget; ++t )
+        m_layers[t].name=layer_names[t];
+}
+
+void mvt_encoder::begin( const box_t &bounds, const string_dictionary &dictionary ){
+    m_dictionary=&dictionary;
+    for(auto &l: m_layers)
+        l.clear();
+
+    m_x0=mercator_x(bounds.sw.lon);
+    m_y0=mercator_y(bounds.ne.lat);
+    double width=mercator_x(bounds.ne.lon) - m_x0, height=mercator_y(bounds.sw.lat) - m_y0;
+    m_scale_x=width > 0 ? m_extent / width : 0;
+    m_scale_y=height > 0 ? m_extent / height : 0;
+
+    //The buffer, in degrees, near enough, since it only decides how much spills over the edge
+    ordinate_t pad_lon=(bounds.ne.lon - bounds.sw.lon) / m_extent * m_buffer;
+    ordinate_t pad_lat=(bounds.ne.lat - bounds.sw.lat) / m_extent * m_buffer;
+    m_clip={ { std::max<ordinate_t>(bounds.sw.lat - pad_lat, -90000000000), bounds.sw.lon - pad_lon },
+        { std::min<ordinate_t>(bounds.ne.lat + pad_lat, 90000000000), bounds.ne.lon + pad_lon } };
+}
+
+void mvt_encoder::project( const coordinate_t &c, ::int32_t &x, ::int32_t &y ) const{
+    x=(::int32_t)std::lround((mercator_x(c.lon) - m_x0) * m_scale_x);
+    y=(::int32_t)std::lround((mercator_y(c.lat) - m_y0) * m_scale_y);
+}
+
+::size_t mvt_encoder::project_run( const coordinate_t *pts, ::size_t n ){
+    m_points.clear();
+    for( ::size_t i=0; i < n; ++i ){
+        ::int32_t x, y;
+        project(pts[i], x, y);
+
+        auto k=m_points.size();
+        if(k && m_points[k-2] == x && m_points[k-1] == y)
+            continue;
+
+        m_points.push_back(x);
+        m_points.push_back(y);
+    }
+
+    return m_points.size() / 2;
+}
+
+void mvt_encoder::encode_line( const coordinate_t *pts, ::size_t n, ::int32_t &cx, ::int32_t &cy ){
+    auto k=project_run(pts, n);
+    if(k < 2)
+        return;
+
+    for( ::size_t i=0; i < k; ++i ){
+        if(i == 0)
+            m_commands.push_back(command(cmd_move_to, 1));
+        else if(i == 1)
+            m_commands.push_back(command(cmd_line_to, k-1));
+
+        ::int32_t x=m_points[2*i], y=m_points[2*i+1];
+        m_commands.push_back(zigzag(x - cx));
+        m_commands.push_back(zigzag(y - cy));
+        cx=x;
+        cy=y;
+    }
+}
+
+bool mvt_encoder::encode_ring( const ring_t &ring, bool outer, ::int32_t &cx, ::int32_t &cy ){
+    if(ring.size() < 4)
+        return false;
+
+    //Closed, so the last point is the first one again, which ClosePath takes care of
+    auto k=project_run(ring.data(), ring.size() - 1);
+    if(k > 1 && m_points[0] == m_points[2*k-2] && m_points[1] == m_points[2*k-1])
+        --k;
+    if(k < 3)
+        return false;
+
+    //Twice the area, in tile coordinates, which are small enough not to overflow 64 bits.
+    //Positive is clockwise on screen, with y pointing down.
+    ::int64_t area=0;
+    for( ::size_t i=0; i < k; ++i ){
+        ::size_t j=(i+1) % k;
+        area+=(::int64_t)m_points[2*i] * m_points[2*j+1] - (::int64_t)m_points[2*j] * m_points[2*i+1];
+    }
+
+    //Rounded down to a sliver
+    if(!area)
+        return false;
+
+    bool reverse=outer ? area < 0 : area > 0;
+
+    for( ::size_t n=0; n < k; ++n ){
+        ::size_t i=reverse ? (k - n) % k : n;
+
+        if(n == 0)
+            m_commands.push_back(command(cmd_move_to, 1));
+        else if(n == 1)
+            m_commands.push_back(command(cmd_line_to, k-1));
+
+        ::int32_t x=m_points[2*i], y=m_points[2*i+1];
+        m_commands.push_back(zigzag(x - cx));
+        m_commands.push_back(zigzag(y - cy));
+        cx=x;
+        cy=y;
+    }
+
+    m_commands.push_back(command(cmd_close_path, 1));
+    return true;
+}
+
+void mvt_encoder::write_feature( layer &l, unsigned type, ::uint64_t id ){
+    m_feature.clear();
+
+    if(id){
+        put_key(m_feature, 1, wire_varint);
+        put_varint(m_feature, id);
+    }
+
+    if(!m_tags.empty())
+        put_packed(m_feature, 2, m_tags);
+
+    put_key(m_feature, 3, wire_varint);
+    put_varint(m_feature, type);
+    put_packed(m_feature, 4, m_commands);
+
+    put_bytes(l.features, 2, m_feature);
+    ++l.feature_count;
+}
+
+bool mvt_encoder::add( const quadtree_square &sq, const index_entry &e, const char *base,
+    const tag_type *tags, ::size_t tag_count, ::uint64_t id ){
+
+    if(e.type < idx_line || e.type > idx_widget)
+        return false;
+
+    layer &l=m_layers[e.type];
+    m_commands.clear();
+    ::int32_t cx=0, cy=0;
+    unsigned type;
+
+    //Clipping is only worth the trouble for what runs off the tile
+    bool inside=contains(m_clip, e.bounds);
+
+    if(e.reduction_detail){
+        decode_geometry(base + e.reduction_detail, sq.bounds.sw, m_parts);
+
+        if(e.type == idx_poly){
+            type=geom_polygon;
+
+            for( ::size_t p=0; p < m_parts.size(); ++p ){
+                bool ok=inside ? encode_ring(m_parts[p], p == 0, cx, cy) :
+                    encode_ring(clip_ring(m_parts[p], m_clip), p == 0, cx, cy);
+
+                //Without its outer ring, there's nothing for the holes to be holes in
+                if(!ok && p == 0)
+                    return false;
+            }
+        }
+        else{
+            type=geom_linestring;
+
+            for(const auto &part: m_parts){
+                if(inside){
+                    encode_line(part.data(), part.size(), cx, cy);
+                    continue;
+                }
+
+                m_pieces.clear();
+                clip_line(part.data(), part.size(), m_clip, m_pieces);
+                for(const auto &piece: m_pieces)
+                    encode_line(piece.data(), piece.size(), cx, cy);
+            }
+        }
+    }
+    else{
+        //A point, at the middle of its bounds
+        type=geom_point;
+        coordinate_t c{ e.bounds.sw.lat + (e.bounds.ne.lat - e.bounds.sw.lat)/2,
+            e.bounds.sw.lon + (e.bounds.ne.lon - e.bounds.sw.lon)/2 };
+        if(!contains(m_clip, c))
+            return false;
+
+        ::int32_t x, y;
+        project(c, x, y);
+        m_commands.push_back(command(cmd_move_to, 1));
+        m_commands.push_back(zigzag(x));
+        m_commands.push_back(zigzag(y));
+    }
+
+    if(m_commands.empty())
+        return false;
+
+    m_tags.clear();
+    auto index_of=[](std::unordered_map<string_id, ::uint32_t> &index, std::vector<string_id> &ids, string_id s){
+        auto [it, added]=index.try_emplace(s, (::uint32_t)ids.size());
+        if(added)
+            ids.push_back(s);
+        return it->second;
+    };
+
+    for( ::size_t i=0; i < tag_count; ++i ){
+        auto [k, v]=tags[i];
+        if(k == no_string || v == no_string || k >= m_dictionary->size() || v >= m_dictionary->size())
+            continue;
+
+        m_tags.push_back(index_of(l.key_index, l.keys, k));
+        m_tags.push_back(index_of(l.value_index, l.values, v));
+    }
+
+    write_feature(l, type, id);
+    return true;
+}
+
+std::string_view mvt_encoder::finish(){
+    m_tile.clear();
+
+    for(const auto &l: m_layers){
+        if(!l.feature_count)
+            continue;
+
+        //The layer's length comes first, so it's added up before anything is written
+        std::string_view name=l.name;
+        ::size_t size=bytes_size(name.size()) + l.features.size() + 1 + varint_size(m_extent) + 2;
+        for(auto k: l.keys)
+            size+=bytes_size((*m_dictionary)[k].size());
+        for(auto v: l.values)
+            size+=bytes_size(bytes_size((*m_dictionary)[v].size()));
+
+        put_key(m_tile, 3, wire_length);
+        put_varint(m_tile, size);
+
+        put_bytes(m_tile, 1, name);
+        m_tile.append(l.features);
+
+        for(auto k: l.keys)
+            put_bytes(m_tile, 3, (*m_dictionary)[k]);
+
+        //A Value, with just its string_value
+        for(auto v: l.values){
+            auto s=(*m_dictionary)[v];
+            put_key(m_tile, 4, wire_length);
+            put_varint(m_tile, bytes_size(s.size()));
+            put_bytes(m_tile, 1, s);
+        }
+
+        put_key(m_tile, 5, wire_varint);
+        put_varint(m_tile, m_extent);
+
+        put_key(m_tile, 15, wire_varint);
+        put_varint(m_tile, 2);
+    }
+
+    return m_tile;
+}
+
+::size_t mvt_encoder::feature_count() const{
+    ::size_t n=0;
+    for(const auto &l: m_layers)
+        n+=l.feature_count;
+    return n;
+}
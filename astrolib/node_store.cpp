@@ -0,0 +1,365 @@
+#include <new>
+#include <atomic>
+#include <string>
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+#include "astrolib/node_store.hpp"
+#include "astrolib/cpu.hpp"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+using namespace leapus::astrolib;
+
+static constexpr ::int64_t unit=100;
+static constexpr ::int64_t bias=(::int64_t)1 << 31;
+
+static constexpr char compressed_magic[8]={ 'A', 'S', 'T', 'R', 'N', 'O', 'D', '\0' };
+static constexpr ::uint32_t compressed_version=1;
+static constexpr ::size_t header_size=4096;
+
+struct node_store::header{
+    char magic[8];
+    ::uint32_t version;
+    ::uint32_t page_bits;
+    ::uint64_t capacity;
+};
+
+struct node_store::page_header{
+    ::uint64_t present[page_nodes/64];
+
+    //The first present node
+    ::int32_t lat, lon;
+
+    ::uint16_t count;
+    ::uint8_t lat_bits, lon_bits;
+
+    //Followed by count-1 latitude differences, then as many longitude differences, each
+    //bit-packed and padded out to a byte, and then slack, so that unpacking can always load
+    //a whole 64-bit word
+};
+
+static constexpr ::size_t slack=8;
+
+static ::uint64_t zigzag( ::int64_t n ){
+    return ((::uint64_t)n << 1) ^ (::uint64_t)(n >> 63);
+}
+
+static ::int64_t unzigzag( ::uint64_t n ){
+    return (::int64_t)(n >> 1) ^ -(::int64_t)(n & 1);
+}
+
+static ::size_t packed_bytes( ::size_t n, int bits ){
+    return (n * bits + 7) / 8;
+}
+
+static char *pack( char *out, const ::uint64_t *v, ::size_t n, int bits ){
+    ::uint64_t acc=0;
+    int have=0;
+
+    for( ::size_t i=0; i < n; ++i ){
+        acc|=v[i] << have;
+        have+=bits;
+        for(; have >= 8; have-=8 ){
+            *out++=(char)acc;
+            acc>>=8;
+        }
+    }
+
+    if(have)
+        *out++=(char)acc;
+    return out;
+}
+
+//Values are at most 33 bits, so with a shift of up to 7, one unaligned load always holds one
+static void unpack_scalar( const char *in, ::size_t n, int bits, ::uint64_t *out ){
+    const ::uint64_t mask=((::uint64_t)1 << bits) - 1;
+    for( ::size_t i=0; i < n; ++i ){
+        ::size_t pos=i * bits;
+        ::uint64_t word;
+        std::memcpy(&word, in + (pos >> 3), sizeof(word));
+        out[i]=word >> (pos & 7) & mask;
+    }
+}
+
+#if defined(__x86_64__)
+
+//Four values at a time, each gathered from its own byte offset and shifted into place
+__attribute__((target("avx2")))
+static void unpack_avx2( const char *in, ::size_t n, int bits, ::uint64_t *out ){
+    const __m256i mask=_mm256_set1_epi64x(((::uint64_t)1 << bits) - 1);
+    const __m256i step=_mm256_set1_epi64x(4 * (::int64_t)bits);
+    const __m256i seven=_mm256_set1_epi64x(7);
+    __m256i pos=_mm256_setr_epi64x(0, bits, 2 * (::int64_t)bits, 3 * (::int64_t)bits);
+
+    ::size_t i=0;
+    for(; i+4 <= n; i+=4 ){
+        __m256i words=_mm256_i64gather_epi64( (const long long *)in, _mm256_srli_epi64(pos, 3), 1 );
+        __m256i v=_mm256_and_si256( _mm256_srlv_epi64(words, _mm256_and_si256(pos, seven)), mask );
+        _mm256_storeu_si256( (__m256i *)(out+i), v );
+        pos=_mm256_add_epi64(pos, step);
+    }
+
+    //The rest, picking up where the vector loop left off
+    const ::uint64_t scalar_mask=((::uint64_t)1 << bits) - 1;
+    for(; i < n; ++i ){
+        ::size_t p=i * bits;
+        ::uint64_t word;
+        std::memcpy(&word, in + (p >> 3), sizeof(word));
+        out[i]=word >> (p & 7) & scalar_mask;
+    }
+}
+
+#endif
+
+static void unpack( const char *in, ::size_t n, int bits, ::uint64_t *out ){
+#if defined(__x86_64__)
+    if(leapus::cpu::have_avx2())
+        return unpack_avx2(in, n, bits, out);
+#endif
+    unpack_scalar(in, n, bits, out);
+}
+
+static int bits_for( ::uint64_t max ){
+    return max ? 64 - __builtin_clzll(max) : 0;
+}
+
+static std::atomic<::uint64_t> next_serial=1;
+
+node_store::node_store( const std::filesystem::path &path, size_type capacity, bool compressed ):
+    m_file(path, true, capacity*sizeof(location)),
+    m_capacity(capacity),
+    m_compressed(compressed),
+    m_serial(next_serial++){
+
+    //A compressed store starts with its header, where a flat one has node 0, which OSM never uses
+    bool was_compressed=m_file.size() >= sizeof(compressed_magic) &&
+        !std::memcmp(std::addressof(*std::as_const(m_file).read(0, sizeof(compressed_magic))), compressed_magic, sizeof(compressed_magic));
+
+    if(was_compressed != compressed && m_file.size())
+        throw node_store_exception(path.string() + (compressed ? " is a flat node store, not a compressed one" :
+            " is a compressed node store, not a flat one"));
+
+    if(compressed){
+        open_compressed();
+        return;
+    }
+
+    //Extend to the full capacity up front, as a sparse file, so that the store never has to grow
+    //while workers are writing to it
+    if(m_file.size() < capacity*sizeof(location))
+        m_file.grow( capacity*sizeof(location) - m_file.size() );
+
+    m_locations=(location *)std::addressof(*m_file.read(0, capacity*sizeof(location)));
+}
+
+void node_store::open_compressed(){
+    ::size_t pages=(m_capacity + page_nodes-1) / page_nodes;
+    ::size_t directory_bytes=pages * sizeof(file_offs_t);
+
+    bool fresh=!m_file.size();
+    if(fresh)
+        m_file.grow(header_size + directory_bytes);
+
+    m_base=std::addressof(*m_file.read(0, header_size + directory_bytes));
+    m_directory=(file_offs_t *)(m_base + header_size);
+    auto *h=(header *)m_base;
+
+    if(fresh){
+        std::memcpy(h->magic, compressed_magic, sizeof(h->magic));
+        h->version=compressed_version;
+        h->page_bits=page_bits;
+        h->capacity=m_capacity;
+        return;
+    }
+
+    if(h->version != compressed_version || h->page_bits != page_bits || h->capacity != m_capacity)
+        throw node_store_exception("Compressed node store is of a different version, or capacity");
+}
+
+::size_t node_store::decode_page( const page_header *page, ::int32_t *lat, ::int32_t *lon ) const{
+    ::size_t n=page->count;
+    ::uint64_t deltas[page_nodes];
+    const char *packed=(const char *)(page + 1);
+
+    lat[0]=page->lat;
+    unpack(packed, n-1, page->lat_bits, deltas);
+    for( ::size_t i=1; i < n; ++i )
+        lat[i]=lat[i-1] + unzigzag(deltas[i-1]);
+
+    lon[0]=page->lon;
+    unpack(packed + packed_bytes(n-1, page->lat_bits), n-1, page->lon_bits, deltas);
+    for( ::size_t i=1; i < n; ++i )
+        lon[i]=lon[i-1] + unzigzag(deltas[i-1]);
+
+    return n;
+}
+
+void node_store::put_page( ::uint64_t page, const ::uint64_t *present, const ::int32_t *lat, const ::int32_t *lon ){
+    std::lock_guard lock(m_locks[page % lock_stripes]);
+
+    //Present nodes, in order, with what the page already had filled in around them
+    ::uint64_t merged[page_nodes/64];
+    ::int32_t lats[page_nodes], lons[page_nodes];
+    ::size_t n=0;
+
+    if(auto offset=m_directory[page]){
+        auto *old=(const page_header *)(m_base + offset);
+        ::int32_t old_lat[page_nodes], old_lon[page_nodes];
+        decode_page(old, old_lat, old_lon);
+
+        ::size_t k=0;
+        for( ::size_t i=0; i < page_nodes; ++i ){
+            bool in_old=old->present[i/64] >> (i%64) & 1, in_new=present[i/64] >> (i%64) & 1;
+            if(in_new){
+                lats[n]=lat[i];
+                lons[n++]=lon[i];
+            }
+            else if(in_old){
+                lats[n]=old_lat[k];
+                lons[n++]=old_lon[k];
+            }
+            k+=in_old;
+        }
+
+        for( ::size_t w=0; w < page_nodes/64; ++w )
+            merged[w]=present[w] | old->present[w];
+    }
+    else{
+        for( ::size_t i=0; i < page_nodes; ++i )
+            if(present[i/64] >> (i%64) & 1){
+                lats[n]=lat[i];
+                lons[n++]=lon[i];
+            }
+
+        std::copy(present, present + page_nodes/64, merged);
+    }
+
+    if(!n)
+        return;
+
+    ::uint64_t lat_deltas[page_nodes], lon_deltas[page_nodes], lat_max=0, lon_max=0;
+    for( ::size_t i=1; i < n; ++i ){
+        lat_deltas[i-1]=zigzag((::int64_t)lats[i] - lats[i-1]);
+        lon_deltas[i-1]=zigzag((::int64_t)lons[i] - lons[i-1]);
+        lat_max|=lat_deltas[i-1];
+        lon_max|=lon_deltas[i-1];
+    }
+
+    int lat_bits=bits_for(lat_max), lon_bits=bits_for(lon_max);
+    ::size_t bytes=sizeof(page_header) + packed_bytes(n-1, lat_bits) + packed_bytes(n-1, lon_bits) + slack;
+
+    //In words, to keep page headers aligned
+    auto *words=io::mmap_allocator<::uint64_t>(m_file).allocate((bytes + 7) / 8);
+    auto *p=new(words) page_header{};
+    std::copy(merged, merged + page_nodes/64, p->present);
+    p->lat=lats[0];
+    p->lon=lons[0];
+    p->count=n;
+    p->lat_bits=lat_bits;
+    p->lon_bits=lon_bits;
+
+    char *out=pack((char *)(p + 1), lat_deltas, n-1, lat_bits);
+    out=pack(out, lon_deltas, n-1, lon_bits);
+    std::memset(out, 0, slack);
+
+    m_directory[page]=m_file.offset_of(p);
+}
+
+void node_store::set( node_id id, const coordinate_t &loc ){
+    if(id < 0 || (size_type)id >= m_capacity)
+        throw std::range_error("Node ID out of range of the node store: " + std::to_string(id));
+
+    if(m_compressed){
+        writer w(*this);
+        w.set(id, loc);
+        return;
+    }
+
+    m_locations[id]={ (::uint32_t)(loc.lat/unit + bias), (::uint32_t)(loc.lon/unit + bias) };
+}
+
+bool node_store::get( node_id id, coordinate_t &loc ) const{
+    if(id < 0 || (size_type)id >= m_capacity)
+        return false;
+
+    if(!m_compressed){
+        location l=m_locations[id];
+        if(!l.lat && !l.lon)
+            return false;
+
+        loc={ ((::int64_t)l.lat - bias)*unit, ((::int64_t)l.lon - bias)*unit };
+        return true;
+    }
+
+    ::uint64_t page=(::uint64_t)id >> page_bits;
+    auto offset=m_directory[page];
+    if(!offset)
+        return false;
+
+    //A few decoded pages per thread, each of which can only hold pages congruent to it
+    struct cached_page{
+        ::uint64_t serial=0;
+        file_offs_t offset=0;
+        ::uint64_t present[page_nodes/64];
+        ::int32_t lat[page_nodes], lon[page_nodes];
+    };
+    thread_local cached_page cache[8];
+
+    auto &c=cache[page % 8];
+    if(c.serial != m_serial || c.offset != offset){
+        auto *p=(const page_header *)(m_base + offset);
+        decode_page(p, c.lat, c.lon);
+        std::copy(p->present, p->present + page_nodes/64, c.present);
+        c.serial=m_serial;
+        c.offset=offset;
+    }
+
+    ::size_t bit=id & (page_nodes-1), word=bit / 64;
+    ::uint64_t below=c.present[word] & (((::uint64_t)1 << (bit % 64)) - 1);
+    if(!(c.present[word] >> (bit % 64) & 1))
+        return false;
+
+    //The node's rank among those present is where it is in the decoded page
+    ::size_t rank=__builtin_popcountll(below);
+    for( ::size_t w=0; w < word; ++w )
+        rank+=__builtin_popcountll(c.present[w]);
+
+    loc={ (::int64_t)c.lat[rank] * unit, (::int64_t)c.lon[rank] * unit };
+    return true;
+}
+
+node_store::writer::~writer(){
+    flush();
+}
+
+void node_store::writer::set( node_id id, const coordinate_t &loc ){
+    if(!m_store.m_compressed){
+        m_store.set(id, loc);
+        return;
+    }
+
+    if(id < 0 || (size_type)id >= m_store.m_capacity)
+        throw std::range_error("Node ID out of range of the node store: " + std::to_string(id));
+
+    ::uint64_t page=(::uint64_t)id >> page_bits;
+    if(page != m_page){
+        flush();
+        m_page=page;
+    }
+
+    ::size_t bit=id & (page_nodes-1);
+    m_present[bit / 64]|=(::uint64_t)1 << (bit % 64);
+    m_lat[bit]=(::int32_t)(loc.lat / unit);
+    m_lon[bit]=(::int32_t)(loc.lon / unit);
+}
+
+void node_store::writer::flush(){
+    if(m_page != ~(::uint64_t)0)
+        m_store.put_page(m_page, m_present, m_lat, m_lon);
+
+    std::fill(std::begin(m_present), std::end(m_present), 0);
+    m_page=~(::uint64_t)0;
+}
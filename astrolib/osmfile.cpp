@@ -1,10 +1,15 @@
+#include <zlib.h>
 #include "astrolib/osmfile.hpp"
+#include "astrolib/metrics.hpp"
+#include "astrolib/trace.hpp"
 
 
+using namespace leapus;
 using namespace leapus::meta;
 using namespace leapus::osm;
 using namespace leapus::io;
 using namespace google::protobuf;
+using namespace std::string_literals;
 
 
 osm_file::osm_file( const std::filesystem::path &path):
@@ -30,6 +35,59 @@ osm_file::pos_type osm_file::read_blob_header(pos_type pos, OSMPBF::BlobHeader &
     return pos + sz;
 }
 
+void osm_file::read_block( pos_type pos, Message &target ) const{
+    OSMPBF::BlobHeader header;
+    OSMPBF::Blob blob;
+
+    pos=read_blob_header(pos, header);
+    this->read(pos, header.datasize(), blob);
+    decode_blob(blob, target);
+}
+
+void leapus::osm::decode_blob( const OSMPBF::Blob &blob, Message &target ){
+
+    static const metrics::counter blobs("pbf.blobs_decoded"), inflated("pbf.bytes_inflated");
+    static const metrics::histogram decode_ns("pbf.decode_ns");
+    metrics::scoped_timer timer(decode_ns);
+    blobs.add();
+
+    //Blocks are inflated over and over by the same worker threads,
+    //so each thread just keeps its largest buffer around
+    thread_local std::string buffer;
+
+    switch(blob.data_case()){
+        case OSMPBF::Blob::kRaw:{
+            TRACE_SCOPE("parse");
+            if(!target.ParseFromString(blob.raw()))
+                throw pbf::pbf_parse_exception(target, "Failed parsing raw blob");
+            break;
+        }
+
+        case OSMPBF::Blob::kZlibData:{
+            buffer.resize(blob.raw_size());
+            uLongf len=buffer.size();
+            const auto &data=blob.zlib_data();
+
+            {
+                TRACE_SCOPE("inflate");
+                int r=::uncompress( (Bytef *)buffer.data(), &len, (const Bytef *)data.data(), data.size() );
+                if(r != Z_OK || len != buffer.size())
+                    throw pbf::pbf_parse_exception(target, "Failed inflating zlib blob: "s + ::zError(r));
+            }
+
+            inflated.add(len);
+            TRACE_SCOPE("parse");
+            if(!target.ParseFromArray(buffer.data(), len))
+                throw pbf::pbf_parse_exception(target, "Failed parsing inflated blob");
+            break;
+        }
+
+        default:
+            throw pbf::pbf_parse_exception(target, "Unsupported blob compression: " +
+                std::to_string(blob.data_case()));
+    }
+}
+
 osm_file::blob_iterator_type osm_file::begin(){
     return { *this, 0 };
 }
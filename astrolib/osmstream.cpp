@@ -0,0 +1,258 @@
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+#include "astrolib/osmstream.hpp"
+#include "astrolib/pbffile.hpp"
+#include "astrolib/metrics.hpp"
+#include "astrolib/meta.hpp"
+
+using namespace leapus;
+using namespace leapus::osm;
+using namespace leapus::io;
+using namespace std::string_literals;
+
+//The most the PBF format allows for a BlobHeader and a Blob. Anything bigger is
+//a stream that isn't PBF, or has lost its place, and would only run out of memory.
+static constexpr ::size_t max_header_size=64 * 1024, max_blob_size=32 * 1024 * 1024;
+
+//How long the reading thread waits on the stream before checking whether it's still wanted
+static constexpr int poll_ms=200;
+
+static std::string error_text( const std::string &msg, const std::filesystem::path &path ){
+    return msg + ": " + path.string() + ": " + ::strerror(errno);
+}
+
+void stream_blob::parse( OSMPBF::Blob &target ) const{
+    if(!target.ParseFromArray(data.get(), size))
+        throw pbf::pbf_parse_exception(target, "Failed parsing blob at stream offset: " + std::to_string(pos));
+}
+
+osm_stream::osm_stream( int fd, bool owned, const std::filesystem::path &tee_path, size_type chunk_size ):
+    m_fd(fd),
+    m_owned(owned),
+    m_tee_path(tee_path),
+    m_chunk_size(std::max<size_type>(chunk_size, 4096)){
+
+    if(!tee_path.empty()){
+        m_tee_fd=::open(tee_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+        if(m_tee_fd == -1){
+            auto msg=error_text("Could not create stream copy", tee_path);
+            if(m_owned)
+                ::close(m_fd);
+            throw io_exception(msg);
+        }
+    }
+
+    m_reader=std::thread([this](){ reader_proc(); });
+}
+
+static int open_stream( const std::filesystem::path &path ){
+    if(path == "-")
+        return STDIN_FILENO;
+
+    int fd=::open(path.c_str(), O_RDONLY);
+    if(fd == -1)
+        throw io_exception(error_text("Could not open stream", path));
+    return fd;
+}
+
+osm_stream::osm_stream( const std::filesystem::path &path, const std::filesystem::path &tee_path, size_type chunk_size ):
+    osm_stream( open_stream(path), path != "-", tee_path, chunk_size ){}
+
+osm_stream::~osm_stream(){
+    {
+        std::lock_guard lock(m_mut);
+        m_stop=true;
+    }
+    m_cond.notify_all();
+
+    if(m_reader.joinable())
+        m_reader.join();
+
+    if(m_tee_fd != -1)
+        ::close(m_tee_fd);
+    if(m_owned)
+        ::close(m_fd);
+}
+
+void osm_stream::reader_proc(){
+    static const metrics::counter bytes("pbf.stream_bytes");
+
+    auto stopping=[this](){
+        std::lock_guard lock(m_mut);
+        return m_stop;
+    };
+
+    try{
+        bool ended=false;
+        while(!ended){
+            auto chunk=std::make_shared<std::vector<char>>(m_chunk_size);
+            size_type filled=0;
+
+            //A pipe hands over whatever it has, so reads are repeated until the chunk is full
+            while(filled < chunk->size()){
+                pollfd p{ m_fd, POLLIN, 0 };
+                int r=::poll(&p, 1, poll_ms);
+                if(stopping())
+                    return;
+                if(r == 0 || (r == -1 && errno == EINTR))
+                    continue;
+
+                auto n=::read(m_fd, chunk->data() + filled, chunk->size() - filled);
+                if(n == -1 && (errno == EINTR || errno == EAGAIN))
+                    continue;
+                if(n == -1)
+                    throw io_exception("Error reading stream: "s + ::strerror(errno));
+                if(n == 0){
+                    ended=true;
+                    break;
+                }
+
+                filled+=n;
+            }
+
+            chunk->resize(filled);
+            bytes.add(filled);
+
+            for( size_type done=0; m_tee_fd != -1 && done < filled; ){
+                auto n=::write(m_tee_fd, chunk->data() + done, filled - done);
+                if(n == -1 && errno == EINTR)
+                    continue;
+                if(n == -1)
+                    throw io_exception(error_text("Error writing stream copy", m_tee_path));
+                done+=n;
+            }
+
+            //The one before has to have been taken first, so there's only ever one waiting
+            std::unique_lock lock(m_mut);
+            m_cond.wait(lock, [this](){ return m_stop || !m_next; });
+            if(m_stop)
+                return;
+
+            m_next=std::move(chunk);
+            m_cond.notify_all();
+
+            //The end of the stream is an empty chunk, after the last of what it had
+            if(ended && filled){
+                m_cond.wait(lock, [this](){ return m_stop || !m_next; });
+                if(m_stop)
+                    return;
+                m_next=std::make_shared<std::vector<char>>();
+                m_cond.notify_all();
+            }
+        }
+    }
+    catch(...){
+        std::lock_guard lock(m_mut);
+        m_error=std::current_exception();
+        m_cond.notify_all();
+    }
+}
+
+osm_stream::chunk_type osm_stream::take_chunk(){
+    std::unique_lock lock(m_mut);
+    m_cond.wait(lock, [this](){ return m_next || m_error; });
+
+    //Whatever was read before an error is still handed over
+    if(!m_next)
+        std::rethrow_exception(m_error);
+
+    auto chunk=std::move(m_next);
+    m_next.reset();
+    m_cond.notify_all();
+
+    //Once it's ended, it stays ended, with the empty chunk left for whoever asks next
+    if(chunk->empty()){
+        m_next=chunk;
+        return nullptr;
+    }
+
+    return chunk;
+}
+
+std::shared_ptr<const char> osm_stream::take( size_type size ){
+    size_type left=m_chunk ? m_chunk->size() - m_used : 0;
+
+    //Most frames are well within a chunk, and just share it
+    if(left >= size && m_chunk){
+        std::shared_ptr<const char> result( m_chunk, m_chunk->data() + m_used );
+        m_used+=size;
+        m_pos+=size;
+        return result;
+    }
+
+    //Otherwise, it's copied out, from as many chunks as it takes
+    auto buffer=std::make_shared<std::vector<char>>(size);
+    size_type have=left;
+    if(left)
+        std::memcpy(buffer->data(), m_chunk->data() + m_used, left);
+
+    while(have < size){
+        m_chunk=take_chunk();
+        m_used=0;
+
+        if(!m_chunk){
+            if(!have)
+                return nullptr;
+            throw io_exception("Stream ends partway through the frame at " + std::to_string(m_pos));
+        }
+
+        size_type n=std::min(size - have, m_chunk->size());
+        std::memcpy(buffer->data() + have, m_chunk->data(), n);
+        m_used=n;
+        have+=n;
+    }
+
+    m_pos+=size;
+    return { buffer, buffer->data() };
+}
+
+bool osm_stream::next( stream_blob &target ){
+    pos_type pos=m_pos;
+
+    //Framed as in osm_file: a raw int32 in network byte order giving the size of the BlobHeader,
+    //the BlobHeader, then the Blob
+    auto size_bytes=take(sizeof(::int32_t));
+    if(!size_bytes)
+        return false;
+
+    ::int32_t header_size;
+    std::memcpy(&header_size, size_bytes.get(), sizeof(header_size));
+    header_size=meta::endian::convert_endian(header_size);
+    if(header_size <= 0 || (::size_t)header_size > max_header_size)
+        throw io_exception("Stream has a BlobHeader of " + std::to_string(header_size) + " bytes at " + std::to_string(pos));
+
+    auto header=take(header_size);
+    if(!header)
+        throw io_exception("Stream ends partway through the frame at " + std::to_string(pos));
+    if(!target.header.ParseFromArray(header.get(), header_size))
+        throw pbf::pbf_parse_exception(target.header, "Failed parsing blob header at stream offset: " + std::to_string(pos));
+
+    auto blob_size=target.header.datasize();
+    if(blob_size < 0 || (::size_t)blob_size > max_blob_size)
+        throw io_exception("Stream has a Blob of " + std::to_string(blob_size) + " bytes at " + std::to_string(pos));
+
+    target.data=take(blob_size);
+    if(!target.data)
+        throw io_exception("Stream ends partway through the frame at " + std::to_string(pos));
+    target.size=blob_size;
+    target.pos=pos;
+    return true;
+}
+
+void osm_stream::close_tee(){
+    if(m_tee_fd == -1)
+        return;
+
+    //Everything has been written by the time the end was handed over
+    if(m_reader.joinable())
+        m_reader.join();
+
+    int fd=m_tee_fd;
+    m_tee_fd=-1;
+    if(::close(fd) == -1)
+        throw io_exception(error_text("Error writing stream copy", m_tee_path));
+}
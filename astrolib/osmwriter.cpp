@@ -0,0 +1,65 @@
+#include <zlib.h>
+#include "astrolib/meta.hpp"
+#include "astrolib/osmwriter.hpp"
+
+using namespace leapus;
+using namespace leapus::osm;
+using namespace std::string_literals;
+
+std::string leapus::osm::encode_frame( const std::string &type, const google::protobuf::Message &msg, int level ){
+    std::string raw=msg.SerializeAsString();
+
+    OSMPBF::Blob blob;
+    if(level){
+        uLongf len=::compressBound(raw.size());
+        std::string deflated(len, '\0');
+
+        int r=::compress2( (Bytef *)deflated.data(), &len, (const Bytef *)raw.data(), raw.size(), level );
+        if(r != Z_OK)
+            throw io::io_exception("Failed deflating blob: "s + ::zError(r));
+
+        deflated.resize(len);
+        blob.set_raw_size(raw.size());
+        blob.set_zlib_data(std::move(deflated));
+    }
+    else{
+        blob.set_raw(std::move(raw));
+    }
+
+    OSMPBF::BlobHeader header;
+    header.set_type(type);
+    header.set_datasize(blob.ByteSizeLong());
+
+    //The header's size, in network byte order, then the header, then the blob
+    ::int32_t header_size=meta::endian::convert_endian( (::int32_t)header.ByteSizeLong() );
+    std::string frame( (const char *)&header_size, sizeof(header_size) );
+    header.AppendToString(&frame);
+    blob.AppendToString(&frame);
+    return frame;
+}
+
+osm_writer::osm_writer( const std::filesystem::path &path ):
+    m_path(path),
+    m_out(path, std::ios::binary | std::ios::trunc){
+
+    if(!m_out)
+        throw io::io_exception("Could not create OSM file: " + path.string());
+}
+
+void osm_writer::write_header( const OSMPBF::HeaderBlock &header, int level ){
+    write_frame( encode_frame("OSMHeader", header, level) );
+}
+
+void osm_writer::write_block( const OSMPBF::PrimitiveBlock &block, int level ){
+    write_frame( encode_frame("OSMData", block, level) );
+}
+
+void osm_writer::write_frame( const std::string &frame ){
+    m_out.write(frame.data(), frame.size());
+}
+
+void osm_writer::close(){
+    m_out.close();
+    if(m_out.fail())
+        throw io::io_exception("Error writing OSM file: " + m_path.string());
+}
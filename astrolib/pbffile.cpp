@@ -1,4 +1,5 @@
 #include "astrolib/pbffile.hpp"
+#include "astrolib/metrics.hpp"
 
 using namespace leapus::pbf;
 using namespace google::protobuf;
@@ -7,6 +8,10 @@ void protobuf_file::read( pos_type pos, size_type sz, ::google::protobuf::Messag
     //auto sz = size() - pos - 1;
     //auto sz = target.ByteSizeLong();
 
+    static const leapus::metrics::counter messages("pbf.messages_read"), bytes("pbf.bytes_read");
+    messages.add();
+    bytes.add(sz);
+
     if(!target.ParseFromArray( std::addressof(*mmap_file::read(pos, sz)), sz))
     //if(!target.ParseFromString( std::string(get(pos, sz),sz)))
     //if( !target.ParsePartialFromArray(  random_access_file<>::read(pos, sz), sz ) )
@@ -11,6 +11,7 @@
 #include <unistd.h>
 #include <sys/mman.h>
 #include <string>
+#include <algorithm>
 #include "astrolib/meta.hpp"
 #include "astrolib/io/mmap_file.hpp"
 
@@ -26,7 +27,7 @@ public:
 
 static int open_file( const std::filesystem::path &path ){
     //Seems like the file has to be opened RW to get virtual memory paging. See below.
-    int fd=::open( path.c_str(), O_LARGEFILE | O_RDWR | O_CREAT);
+    int fd=::open( path.c_str(), O_LARGEFILE | O_RDWR | O_CREAT, 0666);
 
     //m_fd=::open( path.c_str(), O_LARGEFILE | 
     //    true ? O_RDWR : O_RDONLY );
@@ -49,6 +50,8 @@ static mmap_file::size_type get_size_on_disk( int fd){
 } 
 
 mmap_file::mmap_file( const std::filesystem::path &path, bool writeable, size_type mapping_size){
+    m.m_path=path;
+
     try{
         m.m_fd=open_file(path);
         init(writeable, mapping_size);
@@ -75,7 +78,7 @@ void mmap_file::init(bool writeable, size_type mapping_size){
     //However, if the underlying file descriptor was not opened for writing,
     //you will get EACCESS even if you are not mapping for writing. Oh well.
     m.m_data = (char *)::mmap(NULL, mapping_size, PROT_READ |
-        writeable ? PROT_WRITE : 0,
+        (writeable ? PROT_WRITE : 0),
         MAP_SHARED, m.m_fd, 0);
 
     if(m.m_data == MAP_FAILED)
@@ -166,6 +169,43 @@ mmap_file::pos_type mmap_file::grow(offset_type d){
     return osz;
 }  
 
+void mmap_file::truncate(size_type sz){
+    if(sz > m_size)
+        throw std::range_error("Truncating past the end of: " + m.m_path.string());
+
+    if(::ftruncate64(m.m_fd, sz) == -1)
+        throw posix_io_exception("Error truncating file", m.m_path);
+    m_size=sz;
+}
+
+void mmap_file::sync(){
+    if(m_size && ::msync(m.m_data, std::min<size_type>(m_size, m.m_map_size), MS_SYNC) == -1)
+        throw posix_io_exception("Error syncing memory-mapped file", m.m_path);
+
+    //fdatasync() still syncs the file size, which is the only metadata that matters here
+    if(::fdatasync(m.m_fd) == -1)
+        throw posix_io_exception("Error syncing file", m.m_path);
+}
+
+mmap_file::pos_type mmap_file::offset_of(const void *p) const{
+    auto pos=(const char *)p - m.m_data;
+    if(pos < 0 || pos >= m.m_map_size)
+        throw std::range_error("Address is not inside the mapping of: " + m.m_path.string());
+    return pos;
+}
+
+void leapus::io::sync_directory( const std::filesystem::path &dir ){
+    auto path=dir.empty() ? std::filesystem::path(".") : dir;
+    int fd=::open(path.c_str(), O_RDONLY | O_DIRECTORY);
+    if(fd == -1)
+        throw posix_io_exception("Error opening directory", path);
+
+    int r=::fsync(fd);
+    ::close(fd);
+    if(r == -1)
+        throw posix_io_exception("Error syncing directory", path);
+}
+
 mmap_file mmap_file::null_file = {};
 
 mmap_file &mmap_file::operator=( mmap_file &&rhs ){
@@ -0,0 +1,215 @@
+#include <cstring>
+#include <algorithm>
+#include "astrolib/index/string_dictionary.hpp"
+
+using namespace leapus::astrolib;
+using namespace leapus::astrolib::index;
+
+static constexpr ::size_t min_chunk_size=64*1024;
+
+//Slots hold the top half of the hash as a tag, and the ID + 1
+static inline ::uint32_t slot_tag(::uint64_t slot){ return slot >> 32; }
+static inline string_id slot_id(::uint64_t slot){ return (string_id)slot - 1; }
+static inline ::uint32_t hash_tag(::uint64_t hash){ return hash >> 32; }
+
+string_interner::string_interner():
+    m_shards( new shard[(::size_t)1 << shard_bits] ),
+    m_pages( new std::atomic<std::string_view *>[max_pages] ){
+
+    for( ::size_t i=0; i < max_pages; ++i )
+        m_pages[i]=nullptr;
+}
+
+string_interner::~string_interner(){
+    for( ::size_t i=0; i < max_pages; ++i )
+        delete[] m_pages[i].load();
+}
+
+std::string_view string_interner::shard::store(std::string_view s){
+    if(chunks.empty() || chunk_used + s.size() > chunk_size){
+        chunk_size=std::max(min_chunk_size, s.size());
+        chunks.emplace_back( new char[chunk_size] );
+        chunk_used=0;
+    }
+
+    char *p=chunks.back().get() + chunk_used;
+    std::memcpy(p, s.data(), s.size());
+    chunk_used+=s.size();
+    return { p, s.size() };
+}
+
+std::string_view *string_interner::slot_for(string_id id){
+    auto &page=m_pages[id >> page_bits];
+    std::string_view *p=page.load();
+
+    if(!p){
+        //Two shards might race to create the same page
+        std::string_view *fresh=new std::string_view[(::size_t)1 << page_bits];
+        if(page.compare_exchange_strong(p, fresh))
+            p=fresh;
+        else
+            delete[] fresh;
+    }
+
+    return p + (id & (((string_id)1 << page_bits)-1));
+}
+
+void string_interner::grow(shard &sh){
+    std::vector<::uint64_t> old(std::max<::size_t>(sh.slots.size()*2, 1024), 0);
+    std::swap(old, sh.slots);
+    ::size_t mask=sh.slots.size()-1;
+
+    for(auto slot: old){
+        if(!slot)
+            continue;
+
+        //The tag is the top half of the hash, which is all that's needed to place it again
+        for( ::size_t i=slot_tag(slot) & mask;; i=(i+1) & mask ){
+            if(!sh.slots[i]){
+                sh.slots[i]=slot;
+                break;
+            }
+        }
+    }
+}
+
+//The shard must be locked
+string_id string_interner::insert(shard &sh, std::string_view s, ::uint64_t hash){
+    if( (sh.count+1)*4 > sh.slots.size()*3 )
+        grow(sh);
+
+    ::size_t mask=sh.slots.size()-1;
+    ::uint32_t tag=hash_tag(hash);
+
+    for( ::size_t i=tag & mask;; i=(i+1) & mask ){
+        ::uint64_t slot=sh.slots[i];
+
+        if(!slot){
+            string_id id=m_next_id++;
+            *slot_for(id)=sh.store(s);
+            sh.slots[i]=(::uint64_t)tag << 32 | (id+1);
+            ++sh.count;
+            return id;
+        }
+
+        if( slot_tag(slot) == tag && str(slot_id(slot)) == s )
+            return slot_id(slot);
+    }
+}
+
+string_id string_interner::intern(std::string_view s){
+    auto hash=hash_string(s);
+    shard &sh=m_shards[hash & (((::size_t)1 << shard_bits)-1)];
+
+    std::lock_guard lock(sh.mutex);
+    return insert(sh, s, hash);
+}
+
+std::vector<string_id> string_interner::intern( const OSMPBF::StringTable &strings, const std::vector<bool> *wanted ){
+    const int n=strings.s_size();
+    const ::size_t shard_count=(::size_t)1 << shard_bits;
+    std::vector<string_id> ids(n, no_string);
+
+    //Hash everything up front in one tight loop, then sort the indices by shard (counting sort)
+    //so that each shard gets locked once, for all of its strings together
+    std::vector<::uint64_t> hashes(n);
+    std::vector<::uint32_t> shard_start(shard_count+1, 0);
+
+    for( int i=0; i < n; ++i ){
+        if(wanted && !(*wanted)[i])
+            continue;
+
+        hashes[i]=hash_string(strings.s(i));
+        ++shard_start[ (hashes[i] & (shard_count-1)) + 1 ];
+    }
+
+    for( ::size_t s=0; s < shard_count; ++s )
+        shard_start[s+1]+=shard_start[s];
+
+    std::vector<::uint32_t> by_shard(shard_start[shard_count]), fill(shard_start.begin(), shard_start.end()-1);
+    for( int i=0; i < n; ++i )
+        if( !wanted || (*wanted)[i] )
+            by_shard[ fill[hashes[i] & (shard_count-1)]++ ]=i;
+
+    for( ::size_t s=0; s < shard_count; ++s ){
+        if(shard_start[s] == shard_start[s+1])
+            continue;
+
+        shard &sh=m_shards[s];
+        std::lock_guard lock(sh.mutex);
+        for( auto k=shard_start[s]; k < shard_start[s+1]; ++k ){
+            auto i=by_shard[k];
+            ids[i]=insert(sh, strings.s(i), hashes[i]);
+        }
+    }
+
+    return ids;
+}
+
+std::string_view string_interner::str(string_id id) const{
+    return m_pages[id >> page_bits].load()[ id & (((string_id)1 << page_bits)-1) ];
+}
+
+file_offs_t string_interner::write( index_allocator<char> alloc ) const{
+    const string_id count=size();
+
+    //Half full at most, and a power of two
+    ::uint32_t slot_count=1;
+    while(slot_count < count*2)
+        slot_count*=2;
+
+    ::uint64_t bytes=0;
+    for( string_id id=0; id < count; ++id )
+        bytes+=str(id).size();
+
+    const ::size_t offsets_pos=sizeof(dictionary_header);
+    const ::size_t slots_pos=offsets_pos + sizeof(::uint64_t)*(count+1);
+    const ::size_t strings_pos=slots_pos + sizeof(::uint32_t)*slot_count;
+
+    //Allocated as 64-bit words to get the alignment for the offsets
+    char *base=(char *)index_allocator<::uint64_t>(alloc).allocate( (strings_pos + bytes + 7)/8 );
+
+    *(dictionary_header *)base=dictionary_header{ count, slot_count };
+    auto *offsets=(::uint64_t *)(base + offsets_pos);
+    auto *slots=(::uint32_t *)(base + slots_pos);
+    std::fill(slots, slots+slot_count, 0);
+
+    ::uint64_t pos=strings_pos;
+    for( string_id id=0; id < count; ++id ){
+        auto s=str(id);
+        offsets[id]=pos;
+        std::memcpy(base+pos, s.data(), s.size());
+        pos+=s.size();
+
+        for( ::uint32_t i=hash_tag(hash_string(s)) & (slot_count-1);; i=(i+1) & (slot_count-1) ){
+            if(!slots[i]){
+                slots[i]=id+1;
+                break;
+            }
+        }
+    }
+    offsets[count]=pos;
+
+    return alloc.file().offset_of(base);
+}
+
+string_dictionary::string_dictionary(const char *base):
+    m_base(base),
+    m_header( (const dictionary_header *)base ),
+    m_offsets( (const ::uint64_t *)(base + sizeof(dictionary_header)) ),
+    m_slots( (const ::uint32_t *)(m_offsets + m_header->count + 1) ){}
+
+string_id string_dictionary::find(std::string_view s) const{
+    if(!m_header || !m_header->slot_count)
+        return no_string;
+
+    ::uint32_t mask=m_header->slot_count-1;
+    for( ::uint32_t i=hash_tag(hash_string(s)) & mask;; i=(i+1) & mask ){
+        ::uint32_t slot=m_slots[i];
+        if(!slot)
+            return no_string;
+
+        if( (*this)[slot-1] == s )
+            return slot-1;
+    }
+}
@@ -0,0 +1,364 @@
+#include <cmath>
+#include <cctype>
+#include <deque>
+#include <future>
+#include <random>
+#include <memory>
+#include <algorithm>
+#include <functional>
+#include <unordered_map>
+#include "astrolib/synthetic.hpp"
+#include "astrolib/osmwriter.hpp"
+#include "astrolib/concurrent.hpp"
+
+using namespace leapus;
+using namespace leapus::osm;
+
+namespace{
+
+constexpr double pi=3.14159265358979323846;
+
+const char *highway_types[]={ "residential", "service", "track", "footway", "unclassified", "tertiary", "secondary", "primary" };
+const char *landuse_types[]={ "residential", "farmland", "forest", "meadow", "grass", "industrial", "retail" };
+const char *amenity_types[]={ "bench", "parking", "restaurant", "cafe", "school", "place_of_worship", "bank", "post_box" };
+
+template<typename T, ::size_t N>
+const T &pick( const T (&choices)[N], std::mt19937_64 &rng ){
+    return choices[ std::uniform_int_distribution<::size_t>(0, N-1)(rng) ];
+}
+
+//Zipf by inversion of a precomputed CDF, which is shared by every block with the same vocabulary
+class zipf_distribution{
+    std::vector<double> m_cdf;
+
+public:
+    zipf_distribution( int n, double exponent ):
+        m_cdf( std::max(n, 1) ){
+
+        double sum=0;
+        for( ::size_t k=0; k < m_cdf.size(); ++k )
+            m_cdf[k]=sum+=1.0 / std::pow(k+1, exponent);
+
+        for(auto &c: m_cdf)
+            c/=sum;
+    }
+
+    ::size_t operator()( std::mt19937_64 &rng ) const{
+        double u=std::uniform_real_distribution<double>(0, 1)(rng);
+        return std::lower_bound(m_cdf.begin(), m_cdf.end(), u) - m_cdf.begin();
+    }
+};
+
+const zipf_distribution &vocabulary_of( const synthetic_config &config ){
+    thread_local std::unique_ptr<zipf_distribution> zipf;
+    thread_local std::pair<int, double> key;
+
+    if( !zipf || key != std::pair{ config.vocabulary, config.zipf_exponent } ){
+        zipf=std::make_unique<zipf_distribution>(config.vocabulary, config.zipf_exponent);
+        key={ config.vocabulary, config.zipf_exponent };
+    }
+
+    return *zipf;
+}
+
+//A made-up but stable word for each rank, of varying length, like "Kavobe Street"
+std::string word( ::size_t rank ){
+    static const char *syllables[]={ "ka", "vo", "be", "lin", "dor", "ma", "ri", "sten", "hal", "ur", "ne", "tho", "gra", "pel", "si", "wen" };
+    static const char *suffixes[]={ " Street", " Road", " Lane", " Park", " Hill", "" };
+
+    std::string w;
+    ::size_t r=rank+1;
+    do{
+        w+=syllables[r % 16];
+        r/=16;
+    }while(r);
+
+    w[0]=std::toupper(w[0]);
+    return w + suffixes[rank % 6];
+}
+
+uint64_t mix( uint64_t x ){
+    x^=x >> 33;
+    x*=0xff51afd7ed558ccdULL;
+    x^=x >> 33;
+    x*=0xc4ceb9fe1a85ec53ULL;
+    x^=x >> 33;
+    return x;
+}
+
+//Everything needed to put one block together
+class block_builder{
+    const synthetic_config &m_config;
+    OSMPBF::PrimitiveBlock &m_block;
+    std::mt19937_64 m_rng;
+    std::unordered_map<std::string, int> m_strings;
+
+    OSMPBF::DenseNodes *m_dense;
+    OSMPBF::PrimitiveGroup *m_ways, *m_relations;
+
+    ::int64_t m_next_node, m_next_way, m_next_relation;
+    ::int64_t m_prev_id=0, m_prev_lat=0, m_prev_lon=0;
+    int m_nodes=0;
+
+public:
+    block_builder( const synthetic_config &config, ::size_t index, OSMPBF::PrimitiveBlock &block ):
+        m_config(config),
+        m_block(block),
+        m_rng( mix(config.seed ^ mix(index)) ){
+
+        //Fixed ID ranges per block, which can't overflow since a block never has more ways or relations than nodes
+        ::int64_t base=(::int64_t)index * config.nodes_per_block + 1;
+        m_next_node=m_next_way=m_next_relation=base;
+
+        m_block.Clear();
+        string_index("");
+        m_dense=m_block.add_primitivegroup()->mutable_dense();
+        m_ways=m_block.add_primitivegroup();
+        m_relations=m_block.add_primitivegroup();
+    }
+
+    std::mt19937_64 &rng(){ return m_rng; }
+    int nodes_left() const{ return m_config.nodes_per_block - m_nodes; }
+
+    int string_index( const std::string &s ){
+        auto [it, added]=m_strings.try_emplace(s, m_strings.size());
+        if(added)
+            m_block.mutable_stringtable()->add_s(s);
+        return it->second;
+    }
+
+    //Add a node, with tags as key, value, key, value..., and return its ID
+    ::int64_t add_node( double lat, double lon, const std::vector<std::string> &tags={} ){
+        lat=std::clamp(lat, m_config.min_lat, m_config.max_lat);
+        lon=std::clamp(lon, m_config.min_lon, m_config.max_lon);
+
+        //Default granularity, 100 nanodegrees
+        ::int64_t id=m_next_node++, ilat=std::llround(lat * 1e7), ilon=std::llround(lon * 1e7);
+        m_dense->add_id(id - m_prev_id);
+        m_dense->add_lat(ilat - m_prev_lat);
+        m_dense->add_lon(ilon - m_prev_lon);
+        m_prev_id=id;
+        m_prev_lat=ilat;
+        m_prev_lon=ilon;
+
+        for(const auto &t: tags)
+            m_dense->add_keys_vals(string_index(t));
+        m_dense->add_keys_vals(0);
+
+        ++m_nodes;
+        return id;
+    }
+
+    ::int64_t add_way( const std::vector<::int64_t> &refs, const std::vector<std::string> &tags ){
+        auto *way=m_ways->add_ways();
+        way->set_id(m_next_way++);
+
+        for( ::size_t i=0; i+1 < tags.size(); i+=2 ){
+            way->add_keys(string_index(tags[i]));
+            way->add_vals(string_index(tags[i+1]));
+        }
+
+        ::int64_t prev=0;
+        for(auto r: refs){
+            way->add_refs(r - prev);
+            prev=r;
+        }
+
+        return way->id();
+    }
+
+    void add_multipolygon( const std::vector<std::pair<::int64_t, const char *>> &ways, const std::vector<std::string> &tags ){
+        auto *rel=m_relations->add_relations();
+        rel->set_id(m_next_relation++);
+
+        for( ::size_t i=0; i+1 < tags.size(); i+=2 ){
+            rel->add_keys(string_index(tags[i]));
+            rel->add_vals(string_index(tags[i+1]));
+        }
+
+        ::int64_t prev=0;
+        for(auto [id, role]: ways){
+            rel->add_memids(id - prev);
+            rel->add_types(OSMPBF::Relation::WAY);
+            rel->add_roles_sid(string_index(role));
+            prev=id;
+        }
+    }
+
+    //A ring of n nodes around a centre, closed by repeating the first
+    std::vector<::int64_t> add_ring( double lat, double lon, double radius, int n ){
+        std::vector<::int64_t> refs;
+        std::uniform_real_distribution<double> jitter(0.8, 1.2);
+
+        for( int i=0; i < n; ++i ){
+            double a=2 * pi * i / n, r=radius * jitter(m_rng);
+            refs.push_back( add_node(lat + r * std::sin(a), lon + r * std::cos(a)) );
+        }
+
+        refs.push_back(refs.front());
+        return refs;
+    }
+};
+
+}
+
+void leapus::osm::generate_block( const synthetic_config &config, ::size_t index, OSMPBF::PrimitiveBlock &block ){
+    block_builder b(config, index, block);
+    auto &rng=b.rng();
+    const auto &vocabulary=vocabulary_of(config);
+
+    //The towns are the same for every block, so they come from the seed alone
+    std::mt19937_64 town_rng(config.seed);
+    std::uniform_real_distribution<double> lat_of(config.min_lat, config.max_lat), lon_of(config.min_lon, config.max_lon);
+    std::vector<std::pair<double, double>> towns( std::max(config.clusters, 1) );
+    for(auto &t: towns)
+        t={ lat_of(town_rng), lon_of(town_rng) };
+
+    std::bernoulli_distribution clustered(config.clustering), closed(config.closed_fraction),
+        multipolygon(config.multipolygon_fraction), hole(config.hole_fraction), named(0.5);
+    std::normal_distribution<double> around(0, config.cluster_radius), turn(0, 0.3);
+    std::uniform_real_distribution<double> heading_of(0, 2 * pi);
+    std::geometric_distribution<int> length_of( 1.0 / std::max(config.way_length_mean - 1, 1.0) );
+    std::uniform_int_distribution<int> town_of(0, towns.size()-1), poi(0, std::max(config.tagged_node_interval, 1) - 1);
+
+    auto name=[&](){ return word(vocabulary(rng)); };
+
+    while(b.nodes_left() >= 2){
+        int length=std::min({ 2 + length_of(rng), config.way_length_max, b.nodes_left() });
+
+        double lat, lon;
+        if(clustered(rng)){
+            auto [tlat, tlon]=towns[town_of(rng)];
+            lat=tlat + around(rng);
+            lon=tlon + around(rng);
+        }
+        else{
+            lat=lat_of(rng);
+            lon=lon_of(rng);
+        }
+
+        //Areas, which are rings, and sometimes multipolygons with holes
+        if(length >= 4 && closed(rng)){
+            double radius=config.step * length / (2 * pi);
+            std::vector<std::string> tags{ "landuse", landuse_types[rng() % 7] };
+
+            if(!multipolygon(rng)){
+                auto refs=b.add_ring(lat, lon, radius, length);
+                if(tags[1] == "residential")
+                    tags={ "building", "yes" };
+                b.add_way(refs, tags);
+                continue;
+            }
+
+            //The outer ring in two halves, to give the assembler some stitching to do
+            auto outer=b.add_ring(lat, lon, radius, length);
+            auto half=outer.size() / 2;
+            std::vector<std::pair<::int64_t, const char *>> members{
+                { b.add_way({ outer.begin(), outer.begin() + half + 1 }, {}), "outer" },
+                { b.add_way({ outer.begin() + half, outer.end() }, {}), "outer" }
+            };
+
+            if(hole(rng) && b.nodes_left() >= 4)
+                members.push_back({ b.add_way(b.add_ring(lat, lon, radius / 3, std::min(length, b.nodes_left())), {}), "inner" });
+
+            tags.insert(tags.begin(), { "type", "multipolygon" });
+            b.add_multipolygon(members, tags);
+            continue;
+        }
+
+        //Everything else is a road, wandering off from where it started
+        std::vector<::int64_t> refs;
+        double heading=heading_of(rng);
+        for( int i=0; i < length; ++i ){
+            std::vector<std::string> tags;
+            if(!poi(rng))
+                tags={ "amenity", amenity_types[rng() % 8], "name", name() };
+
+            refs.push_back( b.add_node(lat, lon, tags) );
+            heading+=turn(rng);
+            lat+=config.step * std::sin(heading);
+            lon+=config.step * std::cos(heading);
+        }
+
+        std::vector<std::string> tags{ "highway", pick(highway_types, rng) };
+        if(named(rng)){
+            tags.push_back("name");
+            tags.push_back(name());
+        }
+        b.add_way(refs, tags);
+    }
+
+    //An odd one left over
+    while(b.nodes_left() > 0)
+        b.add_node(lat_of(rng), lon_of(rng), { "amenity", pick(amenity_types, rng) });
+}
+
+namespace{
+
+class generator_pool:public concurrent::ThreadPool< std::function<void()>, concurrent::lf_queue<std::function<void()>> >{
+public:
+    using ThreadPool::ThreadPool;
+
+protected:
+    //Tasks hand their exceptions over through their promises
+    void exception_handler( std::exception_ptr ) override{}
+};
+
+}
+
+::size_t leapus::osm::write_synthetic( const std::filesystem::path &path, const synthetic_config &config, int threads ){
+    if(!threads)
+        threads=std::max(1u, std::thread::hardware_concurrency());
+
+    osm_writer out(path);
+
+    OSMPBF::HeaderBlock header;
+    auto *bbox=header.mutable_bbox();
+    bbox->set_left( std::llround(config.min_lon * 1e9) );
+    bbox->set_right( std::llround(config.max_lon * 1e9) );
+    bbox->set_bottom( std::llround(config.min_lat * 1e9) );
+    bbox->set_top( std::llround(config.max_lat * 1e9) );
+    header.add_required_features("OsmSchema-V0.6");
+    header.add_required_features("DenseNodes");
+    header.set_writingprogram("astrolib synthetic");
+    out.write_header(header, config.compression);
+
+    //Blocks are generated and compressed out of order, but written in order, with a
+    //bounded number of them in flight so that memory doesn't run away
+    generator_pool pool(threads);
+    std::deque<std::future<std::string>> pending;
+    const ::size_t window=threads * 4;
+    ::size_t submitted=0, written=0, bytes=0;
+
+    auto submit=[&](){
+        auto promise=std::make_shared<std::promise<std::string>>();
+        pending.push_back(promise->get_future());
+
+        pool.push_front([&config, promise, index=submitted++](){
+            try{
+                OSMPBF::PrimitiveBlock block;
+                generate_block(config, index, block);
+                promise->set_value( encode_frame("OSMData", block, config.compression) );
+            }
+            catch(...){
+                promise->set_exception(std::current_exception());
+            }
+        });
+    };
+
+    while(written < config.blocks && bytes < config.max_bytes){
+        while(submitted < config.blocks && pending.size() < window)
+            submit();
+
+        auto frame=pending.front().get();
+        pending.pop_front();
+
+        out.write_frame(frame);
+        bytes+=frame.size();
+        ++written;
+    }
+
+    pool.shutdown();
+    out.close();
+    return written;
+}
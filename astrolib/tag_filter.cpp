@@ -0,0 +1,235 @@
+#include <climits>
+#include <charconv>
+#include <sstream>
+#include "astrolib/index/tag_filter.hpp"
+
+using namespace leapus::astrolib;
+using namespace leapus::astrolib::index;
+
+tag_filter::tag_filter( std::vector<tag_rule> rules ):
+    m_rules(std::move(rules)){
+
+    for( int r=0; r < (int)m_rules.size(); ++r ){
+        const auto &rule=m_rules[r];
+        auto [it, added]=m_key_index.try_emplace( rule.key, (int)m_key_rules.size() );
+        if(added)
+            m_key_rules.emplace_back();
+
+        m_key_rules[it->second].push_back(r);
+
+        if(!rule.value.empty())
+            m_value_rules[rule.value].push_back(r);
+    }
+}
+
+tag_filter::resolved tag_filter::resolve( const OSMPBF::StringTable &strings ) const{
+    return { *this, strings };
+}
+
+tag_filter::resolved::resolved( const tag_filter &filter, const OSMPBF::StringTable &strings ):
+    m_filter(&filter),
+    m_key_group(strings.s_size(), -1),
+    m_value_id(filter.m_rules.size(), absent_value){
+
+    for( ::size_t r=0; r < m_value_id.size(); ++r )
+        if(filter.m_rules[r].value.empty())
+            m_value_id[r]=any_value;
+
+    //This is the only place where strings get compared
+    for( int i=0; i < strings.s_size(); ++i ){
+        const auto &s=strings.s(i);
+
+        auto k=filter.m_key_index.find(s);
+        if(k != filter.m_key_index.end())
+            m_key_group[i]=k->second;
+
+        auto v=filter.m_value_rules.find(s);
+        if(v != filter.m_value_rules.end())
+            for(int r: v->second)
+                if(m_value_id[r] == absent_value)
+                    m_value_id[r]=i;
+    }
+}
+
+int tag_filter::resolved::match( element_kind kind, string_id key, string_id val, int best ) const{
+    if(key >= m_key_group.size())
+        return best;
+
+    int g=m_key_group[key];
+    if(g < 0)
+        return best;
+
+    for(int r: m_filter->m_key_rules[g]){
+        if(r >= best)
+            break;
+
+        if( !(m_filter->m_rules[r].kinds & kind) )
+            continue;
+
+        auto v=m_value_id[r];
+        if(v == any_value || v == val)
+            return r;
+    }
+
+    return best;
+}
+
+tag_filter::result_type tag_filter::resolved::result(int best, int *priority) const{
+    if(priority)
+        *priority=best == INT_MAX ? 0 : m_filter->m_rules[best].priority;
+
+    if(best == INT_MAX)
+        return {};
+    else
+        return m_filter->m_rules[best].type;
+}
+
+tag_filter::result_type tag_filter::resolved::classify( element_kind kind,
+    const string_id *keys, const string_id *vals, ::size_t n, int *priority ) const{
+
+    int best=INT_MAX;
+    for( ::size_t i=0; i < n; ++i )
+        best=match(kind, keys[i], vals[i], best);
+
+    return result(best, priority);
+}
+
+tag_filter::result_type tag_filter::resolved::classify_dense( const ::int32_t *&kv, const ::int32_t *end, int *priority ) const{
+    int best=INT_MAX;
+
+    while( kv < end && *kv ){
+        if(kv+1 == end)
+            break;
+
+        best=match(el_node, kv[0], kv[1], best);
+        kv+=2;
+    }
+
+    //Skip the terminator
+    if(kv < end)
+        ++kv;
+
+    return result(best, priority);
+}
+
+static unsigned parse_kinds( const std::string &list ){
+    unsigned kinds=0;
+    std::istringstream in(list);
+    std::string kind;
+
+    while(std::getline(in, kind, ',')){
+        if(kind == "node")
+            kinds|=el_node;
+        else if(kind == "way")
+            kinds|=el_way;
+        else if(kind == "relation")
+            kinds|=el_relation;
+        else if(kind == "any")
+            kinds|=el_any;
+        else
+            return 0;
+    }
+
+    return kinds;
+}
+
+static bool parse_result( const std::string &word, tag_filter::result_type &result ){
+    static const std::pair<const char *, index_entry_type> names[]={
+        { "line", idx_line }, { "poly", idx_poly }, { "label", idx_label }, { "widget", idx_widget } };
+
+    if(word == "drop"){
+        result={};
+        return true;
+    }
+
+    for(auto &[name, type]: names)
+        if(word == name){
+            result=type;
+            return true;
+        }
+
+    return false;
+}
+
+tag_filter tag_filter::parse( std::istream &in, const std::string &source_name ){
+    std::vector<tag_rule> rules;
+    std::string line;
+
+    for( int n=1; std::getline(in, line); ++n ){
+        auto hash=line.find('#');
+        if(hash != std::string::npos)
+            line.erase(hash);
+
+        std::istringstream words(line);
+        std::string kinds, tag, result, priority, extra;
+        if( !(words >> kinds) )
+            continue;
+
+        auto fail=[&](const std::string &why){
+            return style_parse_exception( source_name + ":" + std::to_string(n) + ": " + why );
+        };
+
+        if( !(words >> tag >> result) || (words >> priority && words >> extra) )
+            throw fail("Expected <kinds> <key>[=<value>] <result> [priority]");
+
+        tag_rule rule;
+        if( !(rule.kinds=parse_kinds(kinds)) )
+            throw fail("Unknown element kind in: " + kinds);
+
+        auto eq=tag.find('=');
+        rule.key=tag.substr(0, eq);
+        if(eq != std::string::npos)
+            rule.value=tag.substr(eq+1);
+
+        if(rule.value == "*")
+            rule.value.clear();
+
+        if(rule.key.empty())
+            throw fail("Missing tag key");
+
+        if(!parse_result(result, rule.type))
+            throw fail("Unknown result: " + result);
+
+        if(!priority.empty()){
+            auto [end, ec]=std::from_chars(priority.data(), priority.data() + priority.size(), rule.priority);
+            if(ec != std::errc() || end != priority.data() + priority.size())
+                throw fail("Priority isn't a number: " + priority);
+        }
+
+        rules.push_back(std::move(rule));
+    }
+
+    return { std::move(rules) };
+}
+
+tag_filter tag_filter::default_style(){
+    //area=no says a closed way is a loop of line, like a ring road or a fence, not an area,
+    //so it's a line whatever else it's tagged with
+    static const char style[]=R"(
+        way             area=no             line
+        relation        area=no             drop
+        way,relation    building=no         drop
+        relation        type=multipolygon   poly
+        relation        type=boundary       line
+        way             building            poly
+        way             landuse             poly
+        way             natural=water       poly
+        way             natural=wood        poly
+        way             natural=coastline   line
+        way             leisure=park        poly
+        way             highway             line
+        way             railway             line
+        way             waterway            line
+        way             boundary            line
+        node            place=city          label       100
+        node            place=town          label       80
+        node            place=village       label       60
+        node            place               label       40
+        node            amenity             widget      20
+        node            tourism             widget      20
+        node            shop                widget      10
+    )";
+
+    std::istringstream in(style);
+    return parse(in, "default style");
+}
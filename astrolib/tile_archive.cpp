@@ -0,0 +1,183 @@
+#include <cstddef>
+#include <cstring>
+#include <algorithm>
+#include "astrolib/checksum.hpp"
+#include "astrolib/geometry.hpp"
+#include "astrolib/index/tile_archive.hpp"
+
+using namespace leapus;
+using namespace leapus::astrolib;
+using namespace leapus::astrolib::index;
+
+static ::uint32_t header_checksum( const tile_archive_header &h ){
+    return checksum( &h, offsetof(tile_archive_header, crc) );
+}
+
+::uint64_t index::tile_id( int z, int x, int y ){
+    //(4^z - 1) / 3 tiles in the zooms above
+    ::uint64_t id=(((::uint64_t)1 << 2*z) - 1) / 3;
+
+    //Then its position along the Hilbert curve through this zoom's 2^z by 2^z tiles
+    return id + hilbert_index(z, x, y);
+}
+
+tile_archive_writer::tile_archive_writer( const std::filesystem::path &path, int min_zoom, int max_zoom ):
+    m_path(path),
+    m_temp(path.string() + ".tmp"),
+    m_min_zoom(min_zoom),
+    m_max_zoom(max_zoom){
+
+    if(min_zoom < 0 || max_zoom > 30 || min_zoom > max_zoom)
+        throw tile_archive_exception("Zooms must be from 0 to 30, and the least first");
+
+    std::filesystem::remove(m_temp);
+    m_file=io::mmap_file{ m_temp, true, (io::mmap_file::size_type)1 << 40 };
+    m_alloc=io::mmap_allocator<char>{ m_file };
+
+    //Room for the header, which is filled in last
+    m_file.grow(tile_archive_header_size);
+}
+
+tile_archive_writer::~tile_archive_writer(){
+    //Never finished, so there's nothing worth keeping
+    if(!m_finished){
+        std::error_code ec;
+        std::filesystem::remove(m_temp, ec);
+    }
+}
+
+bool tile_archive_writer::add( int z, int x, int y, std::string_view tile ){
+    tile_entry entry{ tile_id(z, x, y), 0, (::uint32_t)tile.size(), 0 };
+    ::uint64_t key=(::uint64_t)checksum(tile.data(), tile.size()) << 32 | (::uint32_t)tile.size();
+
+    std::lock_guard lock(m_mutex);
+
+    //A matching checksum is only a likely duplicate, so the bytes are compared to make sure
+    auto [first, last]=m_stored.equal_range(key);
+    for(auto it=first; it != last; ++it){
+        bool same=tile.empty() ||
+            !std::memcmp(std::addressof(*std::as_const(m_file).read(it->second.offset, it->second.length)), tile.data(), tile.size());
+        if(same){
+            entry.offset=it->second.offset;
+            m_directory.push_back(entry);
+            return false;
+        }
+    }
+
+    if(!tile.empty()){
+        char *p=m_alloc.allocate(tile.size());
+        std::memcpy(p, tile.data(), tile.size());
+        entry.offset=m_file.offset_of(p);
+    }
+
+    m_stored.emplace(key, entry);
+    m_directory.push_back(entry);
+    ++m_unique;
+    m_data_bytes+=tile.size();
+    return true;
+}
+
+tile_archive_header tile_archive_writer::finish(){
+    std::lock_guard lock(m_mutex);
+
+    std::sort(m_directory.begin(), m_directory.end(), [](const tile_entry &a, const tile_entry &b){
+        return a.id < b.id;
+    });
+
+    auto dup=std::adjacent_find(m_directory.begin(), m_directory.end(), [](const tile_entry &a, const tile_entry &b){
+        return a.id == b.id;
+    });
+    if(dup != m_directory.end())
+        throw tile_archive_exception("The same tile was added twice, tile ID " + std::to_string(dup->id));
+
+    tile_entry *directory=io::mmap_allocator<tile_entry>(m_alloc).allocate(m_directory.size());
+    std::copy(m_directory.begin(), m_directory.end(), directory);
+
+    tile_archive_header h;
+    std::memset(&h, 0, sizeof(h));
+    std::memcpy(h.magic, tile_archive_magic, sizeof(h.magic));
+    h.version=tile_archive_version;
+    h.min_zoom=m_min_zoom;
+    h.max_zoom=m_max_zoom;
+    h.file_size=m_file.size();
+    h.directory=m_file.offset_of(directory);
+    h.tile_count=m_directory.size();
+    h.unique_count=m_unique;
+    h.data_bytes=m_data_bytes;
+    h.directory_crc=checksum(directory, sizeof(tile_entry) * m_directory.size());
+    h.crc=header_checksum(h);
+
+    //The contents have to be on the disk before the header that vouches for them
+    m_file.sync();
+    std::memcpy(std::addressof(*m_file.read(0, sizeof(h))), &h, sizeof(h));
+    m_file.sync();
+    m_file=io::mmap_file{};
+
+    std::filesystem::rename(m_temp, m_path);
+    io::sync_directory(m_path.parent_path());
+    m_finished=true;
+    return h;
+}
+
+tile_archive::tile_archive( const std::filesystem::path &path ){
+    //Opening a mmap_file creates it if need be, which is no way to find out that an archive is missing
+    std::error_code ec;
+    auto size=std::filesystem::file_size(path, ec);
+    if(ec)
+        throw tile_archive_exception("Could not open tile archive: " + path.string() + ": " + ec.message());
+
+    if(size < tile_archive_header_size)
+        throw tile_archive_exception("Not a tile archive, or an incomplete one: " + path.string());
+
+    m_file=io::mmap_file{ path, false };
+    m_base=std::addressof(*std::as_const(m_file).read(0, m_file.size()));
+    m_header=(const tile_archive_header *)m_base;
+
+    auto fail=[&path](const std::string &what){
+        throw tile_archive_exception(what + ": " + path.string());
+    };
+
+    if(std::memcmp(m_header->magic, tile_archive_magic, sizeof(tile_archive_magic)))
+        fail("Not a tile archive");
+
+    if(m_header->version != tile_archive_version)
+        fail("Tile archive is version " + std::to_string(m_header->version) + ", not " + std::to_string(tile_archive_version));
+
+    if(header_checksum(*m_header) != m_header->crc)
+        fail("Tile archive header is damaged");
+
+    if(m_header->file_size != m_file.size())
+        fail("Tile archive is " + std::to_string(m_file.size()) + " bytes, rather than " +
+            std::to_string(m_header->file_size) + ", so it's incomplete");
+
+    auto directory_bytes=m_header->tile_count * sizeof(tile_entry);
+    if(m_header->directory < tile_archive_header_size || m_header->directory > m_header->file_size ||
+        m_header->tile_count > m_header->file_size / sizeof(tile_entry) ||
+        directory_bytes > m_header->file_size - m_header->directory)
+        fail("Tile archive directory is out of bounds");
+
+    m_directory=(const tile_entry *)(m_base + m_header->directory);
+
+    //The directory is small next to the tiles, and every lookup goes through it
+    if(checksum(m_directory, directory_bytes) != m_header->directory_crc)
+        fail("Tile archive directory is damaged");
+}
+
+std::optional<std::string_view> tile_archive::find( int z, int x, int y ) const{
+    if(z < m_header->min_zoom || z > m_header->max_zoom || x < 0 || y < 0 || x >= (1 << z) || y >= (1 << z))
+        return std::nullopt;
+
+    auto id=tile_id(z, x, y);
+    auto *end=m_directory + m_header->tile_count;
+    auto *it=std::lower_bound(m_directory, end, id, [](const tile_entry &e, ::uint64_t id){
+        return e.id < id;
+    });
+
+    if(it == end || it->id != id)
+        return std::nullopt;
+
+    if(it->offset > m_header->file_size || it->length > m_header->file_size - it->offset)
+        throw tile_archive_exception("Tile archive entry is out of bounds, tile ID " + std::to_string(id));
+
+    return std::string_view{ m_base + it->offset, it->length };
+}
@@ -0,0 +1,185 @@
+#include "astrolib/trace.hpp"
+
+#ifdef ASTROLIB_TRACE
+
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <vector>
+#include <cstdio>
+#include <fstream>
+#include <algorithm>
+#include "astrolib/io/random_access.hpp"
+
+using namespace leapus;
+using namespace leapus::trace;
+
+namespace{
+
+struct ring{
+    int tid;
+    const char *name=nullptr;
+
+    //Events ever recorded. The newest ring_size of them are still in there.
+    std::atomic<::uint64_t> head=0;
+    std::unique_ptr<event[]> events{ new event[ring_size] };
+};
+
+struct registry{
+    std::mutex mutex;
+
+    //Rings outlive their threads, so that a pool which has been shut down can still be written out
+    std::vector<std::unique_ptr<ring>> rings;
+
+    //Rings whose threads have exited, for new threads to carry on in, rather than there being
+    //a ring for every thread of every pool ever started
+    std::vector<ring *> free;
+
+    std::atomic_bool recording=false;
+    const std::chrono::steady_clock::time_point epoch=std::chrono::steady_clock::now();
+};
+
+registry &the_registry(){
+    static registry *r=new registry;
+    return *r;
+}
+
+//A thread's ring, which it gives back when it exits. The events in it stay, and the next thread
+//to take it records after them, under its own name from then on.
+struct ring_owner{
+    ring *mine=nullptr;
+
+    ~ring_owner(){
+        if(!mine)
+            return;
+
+        auto &reg=the_registry();
+        std::lock_guard lock(reg.mutex);
+        reg.free.push_back(mine);
+    }
+};
+
+ring &local_ring(){
+    thread_local ring_owner owner;
+    if(owner.mine)
+        return *owner.mine;
+
+    auto &reg=the_registry();
+    std::lock_guard lock(reg.mutex);
+    if(!reg.free.empty()){
+        owner.mine=reg.free.back();
+        reg.free.pop_back();
+    }
+    else{
+        auto &r=reg.rings.emplace_back(new ring);
+        r->tid=reg.rings.size();
+        owner.mine=r.get();
+    }
+
+    return *owner.mine;
+}
+
+//Names are ours, but escape them anyway in case somebody passes a path
+void write_string( std::ostream &out, const char *s ){
+    out << '"';
+    for(; *s; ++s){
+        if(*s == '"' || *s == '\\')
+            out << '\\' << *s;
+        else if((unsigned char)*s < 0x20)
+            out << ' ';
+        else
+            out << *s;
+    }
+    out << '"';
+}
+
+}
+
+::uint64_t leapus::trace::now(){
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() -
+        the_registry().epoch).count();
+}
+
+void leapus::trace::start(){
+    the_registry().recording=true;
+}
+
+void leapus::trace::stop(){
+    the_registry().recording=false;
+}
+
+bool leapus::trace::recording(){
+    return the_registry().recording.load(std::memory_order_relaxed);
+}
+
+void leapus::trace::thread_name( const char *name ){
+    local_ring().name=name;
+}
+
+void leapus::trace::record( const event &e ){
+    auto &r=local_ring();
+    auto h=r.head.load(std::memory_order_relaxed);
+    r.events[h % ring_size]=e;
+    r.head.store(h+1, std::memory_order_release);
+}
+
+::size_t leapus::trace::write( const std::string &path ){
+    auto &reg=the_registry();
+    std::lock_guard lock(reg.mutex);
+
+    std::ofstream out(path, std::ios::trunc);
+    if(!out)
+        throw io::io_exception("Could not create trace file: " + path);
+
+    //Chrome's timestamps are in microseconds, but may have a fraction
+    char ts[64];
+    auto micros=[&ts](::uint64_t ns){
+        std::snprintf(ts, sizeof(ts), "%llu.%03llu", (unsigned long long)(ns / 1000), (unsigned long long)(ns % 1000));
+        return ts;
+    };
+
+    ::size_t written=0;
+    out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n";
+    out << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"astrolib\"}}";
+
+    for(const auto &r: reg.rings){
+        out << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << r->tid << ",\"args\":{\"name\":";
+        if(r->name)
+            write_string(out, (std::string(r->name) + " " + std::to_string(r->tid)).c_str());
+        else
+            out << "\"thread " << r->tid << "\"";
+        out << "}}";
+
+        ::uint64_t head=r->head.load(std::memory_order_acquire);
+        for( ::uint64_t i=head > ring_size ? head - ring_size : 0; i < head; ++i ){
+            const event &e=r->events[i % ring_size];
+
+            out << ",\n{\"name\":";
+            write_string(out, e.name);
+            out << ",\"ph\":\"" << e.phase << "\",\"pid\":1,\"tid\":" << r->tid << ",\"ts\":" << micros(e.begin);
+
+            if(e.phase == 'X')
+                out << ",\"dur\":" << micros(e.duration);
+            else
+                out << ",\"s\":\"t\"";
+
+            if(e.arg_name){
+                out << ",\"args\":{";
+                write_string(out, e.arg_name);
+                out << ":" << e.arg << "}";
+            }
+
+            out << "}";
+            ++written;
+        }
+    }
+
+    out << "\n]}\n";
+    if(!out.flush())
+        throw io::io_exception("Error writing trace file: " + path);
+
+    return written;
+}
+
+#endif
@@ -0,0 +1,559 @@
+#include <deque>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include "astrolib/triangulate.hpp"
+
+using namespace leapus::astrolib;
+
+namespace{
+
+//Polygons with more points than this get the Morton order index
+constexpr ::size_t hashed_points=80;
+
+class ear_clipper{
+    //A point of the ring being clipped, in a circular list. x is longitude and y latitude, in
+    //nanodegrees from the outline's first point, which doubles hold exactly.
+    struct node{
+        ::uint32_t i;
+        double x, y;
+        node *prev=nullptr, *next=nullptr;
+
+        //Morton order, for the ear search
+        ::int32_t z=0;
+        node *prev_z=nullptr, *next_z=nullptr;
+
+        //A hole of one point, which has nothing to clip, but mustn't be filtered away either
+        bool steiner=false;
+    };
+
+    //Stable addresses, since the list is all pointers, and bridges add nodes as they go
+    std::deque<node> m_nodes;
+    std::vector<::uint32_t> &m_triangles;
+    coordinate_t m_origin;
+
+    double m_min_x=0, m_min_y=0, m_inv_size=0;
+
+    node *add_node( ::uint32_t i, double x, double y, node *last ){
+        node *p=&m_nodes.emplace_back();
+        p->i=i;
+        p->x=x;
+        p->y=y;
+
+        if(!last){
+            p->prev=p;
+            p->next=p;
+        }
+        else{
+            p->next=last->next;
+            p->prev=last;
+            last->next->prev=p;
+            last->next=p;
+        }
+        return p;
+    }
+
+    static void remove_node( node *p ){
+        p->next->prev=p->prev;
+        p->prev->next=p->next;
+
+        if(p->prev_z)
+            p->prev_z->next_z=p->next_z;
+        if(p->next_z)
+            p->next_z->prev_z=p->prev_z;
+    }
+
+    //Twice the signed area of the triangle. Negative means p, q, r turn the way the outline winds.
+    static double area( const node *p, const node *q, const node *r ){
+        return (q->y - p->y) * (r->x - q->x) - (q->x - p->x) * (r->y - q->y);
+    }
+
+    static bool equals( const node *a, const node *b ){
+        return a->x == b->x && a->y == b->y;
+    }
+
+    static bool point_in_triangle( double ax, double ay, double bx, double by, double cx, double cy, double px, double py ){
+        return (cx - px) * (ay - py) >= (ax - px) * (cy - py) &&
+            (ax - px) * (by - py) >= (bx - px) * (ay - py) &&
+            (bx - px) * (cy - py) >= (cx - px) * (by - py);
+    }
+
+    static int sign( double v ){
+        return (v > 0) - (v < 0);
+    }
+
+    //q is on segment p-r, given that the three are collinear
+    static bool on_segment( const node *p, const node *q, const node *r ){
+        return q->x <= std::max(p->x, r->x) && q->x >= std::min(p->x, r->x) &&
+            q->y <= std::max(p->y, r->y) && q->y >= std::min(p->y, r->y);
+    }
+
+    static bool intersects( const node *p1, const node *q1, const node *p2, const node *q2 ){
+        int o1=sign(area(p1, q1, p2)), o2=sign(area(p1, q1, q2));
+        int o3=sign(area(p2, q2, p1)), o4=sign(area(p2, q2, q1));
+
+        if(o1 != o2 && o3 != o4)
+            return true;
+
+        return (!o1 && on_segment(p1, p2, q1)) || (!o2 && on_segment(p1, q2, q1)) ||
+            (!o3 && on_segment(p2, p1, q2)) || (!o4 && on_segment(p2, q1, q2));
+    }
+
+    //Does the diagonal a-b cross any edge of the polygon?
+    static bool intersects_polygon( const node *a, const node *b ){
+        const node *p=a;
+        do{
+            if(p->i != a->i && p->next->i != a->i && p->i != b->i && p->next->i != b->i && intersects(p, p->next, a, b))
+                return true;
+            p=p->next;
+        }while(p != a);
+
+        return false;
+    }
+
+    //Does the diagonal a-b leave a on the inside of the polygon?
+    static bool locally_inside( const node *a, const node *b ){
+        return area(a->prev, a, a->next) < 0 ?
+            area(a, b, a->next) >= 0 && area(a, a->prev, b) >= 0 :
+            area(a, b, a->prev) < 0 || area(a, a->next, b) < 0;
+    }
+
+    //Is the middle of the diagonal a-b inside the polygon?
+    static bool middle_inside( const node *a, const node *b ){
+        const node *p=a;
+        bool inside=false;
+        double px=(a->x + b->x) / 2, py=(a->y + b->y) / 2;
+
+        do{
+            if( (p->y > py) != (p->next->y > py) && p->next->y != p->y &&
+                px < (p->next->x - p->x) * (py - p->y) / (p->next->y - p->y) + p->x )
+                inside=!inside;
+            p=p->next;
+        }while(p != a);
+
+        return inside;
+    }
+
+    static bool valid_diagonal( const node *a, const node *b ){
+        if(a->next->i == b->i || a->prev->i == b->i || intersects_polygon(a, b))
+            return false;
+
+        //Inside, and not just touching, or else a zero length diagonal between two corners which are both convex
+        return (locally_inside(a, b) && locally_inside(b, a) && middle_inside(a, b) &&
+                (area(a->prev, a, b->prev) || area(a, b->prev, b))) ||
+            (equals(a, b) && area(a->prev, a, a->next) > 0 && area(b->prev, b, b->next) > 0);
+    }
+
+    //Join a to b by a diagonal, splitting the ring in two, each with its own copy of a and b.
+    //Returns b's copy, in the other half to a.
+    node *split( node *a, node *b ){
+        node *a2=&m_nodes.emplace_back(*a), *b2=&m_nodes.emplace_back(*b);
+        a2->prev_z=a2->next_z=b2->prev_z=b2->next_z=nullptr;
+        node *an=a->next, *bp=b->prev;
+
+        a->next=b;
+        b->prev=a;
+
+        a2->next=an;
+        an->prev=a2;
+
+        b2->next=a2;
+        a2->prev=b2;
+
+        bp->next=b2;
+        b2->prev=bp;
+
+        return b2;
+    }
+
+    //Drop repeated points, and points in the middle of straight lines, from start until end
+    node *filter( node *start, node *end=nullptr ){
+        if(!start)
+            return start;
+        if(!end)
+            end=start;
+
+        node *p=start;
+        bool again;
+        do{
+            again=false;
+
+            if(!p->steiner && (equals(p, p->next) || !area(p->prev, p, p->next))){
+                remove_node(p);
+                p=end=p->prev;
+                if(p == p->next)
+                    break;
+                again=true;
+            }
+            else
+                p=p->next;
+        }while(again || p != end);
+
+        return end;
+    }
+
+    //A ring's points in a circular list, winding clockwise if outline, with y up, or the other way if not
+    node *link( const ring_t &ring, ::uint32_t first, bool outline ){
+        //The repeated closing point isn't part of the list, and nor does it count to the area
+        ::size_t n=ring.size() - 1;
+        if(!n)
+            return nullptr;
+
+        double sum=0;
+        for( ::size_t i=0, j=n-1; i < n; j=i++ )
+            sum+=((double)ring[j].lon - ring[i].lon) * ((double)ring[i].lat - m_origin.lat + (double)ring[j].lat - m_origin.lat);
+
+        auto x=[this](const coordinate_t &c){ return (double)(c.lon - m_origin.lon); };
+        auto y=[this](const coordinate_t &c){ return (double)(c.lat - m_origin.lat); };
+
+        node *last=nullptr;
+        if(outline == (sum > 0)){
+            for( ::size_t i=0; i < n; ++i )
+                last=add_node(first + i, x(ring[i]), y(ring[i]), last);
+        }
+        else{
+            for( ::size_t i=n; i-- > 0; )
+                last=add_node(first + i, x(ring[i]), y(ring[i]), last);
+        }
+
+        if(last && equals(last, last->next)){
+            remove_node(last);
+            last=last->next;
+        }
+
+        return last;
+    }
+
+    ::int32_t z_order( double x, double y ) const{
+        //Coordinates scaled to 15 bits, and interleaved
+        ::uint32_t ix=(::uint32_t)((x - m_min_x) * m_inv_size), iy=(::uint32_t)((y - m_min_y) * m_inv_size);
+
+        auto spread=[](::uint32_t v){
+            v=(v | (v << 8)) & 0x00FF00FF;
+            v=(v | (v << 4)) & 0x0F0F0F0F;
+            v=(v | (v << 2)) & 0x33333333;
+            v=(v | (v << 1)) & 0x55555555;
+            return v;
+        };
+
+        return (::int32_t)(spread(ix) | (spread(iy) << 1));
+    }
+
+    //Merge sort the list through next_z, by z
+    static node *sort_by_z( node *list ){
+        for( ::size_t size=1; ; size*=2 ){
+            node *p=list, *tail=nullptr;
+            list=nullptr;
+            ::size_t merges=0;
+
+            while(p){
+                ++merges;
+                node *q=p;
+                ::size_t p_size=0;
+                for( ::size_t i=0; i < size && q; ++i ){
+                    ++p_size;
+                    q=q->next_z;
+                }
+                ::size_t q_size=size;
+
+                while(p_size || (q_size && q)){
+                    node *e;
+                    if(p_size && (!q_size || !q || p->z <= q->z)){
+                        e=p;
+                        p=p->next_z;
+                        --p_size;
+                    }
+                    else{
+                        e=q;
+                        q=q->next_z;
+                        --q_size;
+                    }
+
+                    if(tail)
+                        tail->next_z=e;
+                    else
+                        list=e;
+
+                    e->prev_z=tail;
+                    tail=e;
+                }
+
+                p=q;
+            }
+
+            tail->next_z=nullptr;
+            if(merges <= 1)
+                return list;
+        }
+    }
+
+    void index_curve( node *start ){
+        node *p=start;
+        do{
+            if(!p->z)
+                p->z=z_order(p->x, p->y);
+            p->prev_z=p->prev;
+            p->next_z=p->next;
+            p=p->next;
+        }while(p != start);
+
+        p->prev_z->next_z=nullptr;
+        p->prev_z=nullptr;
+        sort_by_z(p);
+    }
+
+    //Is the corner at ear convex, with nothing else inside its triangle?
+    static bool is_ear( const node *ear ){
+        const node *a=ear->prev, *b=ear, *c=ear->next;
+        if(area(a, b, c) >= 0)
+            return false;
+
+        double x0=std::min({ a->x, b->x, c->x }), y0=std::min({ a->y, b->y, c->y });
+        double x1=std::max({ a->x, b->x, c->x }), y1=std::max({ a->y, b->y, c->y });
+
+        for( const node *p=c->next; p != a; p=p->next )
+            if(p->x >= x0 && p->x <= x1 && p->y >= y0 && p->y <= y1 &&
+                point_in_triangle(a->x, a->y, b->x, b->y, c->x, c->y, p->x, p->y) && area(p->prev, p, p->next) >= 0)
+                return false;
+
+        return true;
+    }
+
+    //The same, only looking at points whose Morton codes are within the triangle's bounding box's
+    bool is_ear_hashed( const node *ear ) const{
+        const node *a=ear->prev, *b=ear, *c=ear->next;
+        if(area(a, b, c) >= 0)
+            return false;
+
+        double x0=std::min({ a->x, b->x, c->x }), y0=std::min({ a->y, b->y, c->y });
+        double x1=std::max({ a->x, b->x, c->x }), y1=std::max({ a->y, b->y, c->y });
+        ::int32_t min_z=z_order(x0, y0), max_z=z_order(x1, y1);
+
+        auto blocks=[&](const node *p){
+            return p != a && p != c && p->x >= x0 && p->x <= x1 && p->y >= y0 && p->y <= y1 &&
+                point_in_triangle(a->x, a->y, b->x, b->y, c->x, c->y, p->x, p->y) && area(p->prev, p, p->next) >= 0;
+        };
+
+        //Outwards from the ear in both directions at once, which is where anything in the way most likely is
+        const node *p=ear->prev_z, *n=ear->next_z;
+        while(p && p->z >= min_z && n && n->z <= max_z){
+            if(blocks(p) || blocks(n))
+                return false;
+            p=p->prev_z;
+            n=n->next_z;
+        }
+
+        for(; p && p->z >= min_z; p=p->prev_z )
+            if(blocks(p))
+                return false;
+
+        for(; n && n->z <= max_z; n=n->next_z )
+            if(blocks(n))
+                return false;
+
+        return true;
+    }
+
+    void emit( const node *a, const node *b, const node *c ){
+        m_triangles.push_back(a->i);
+        m_triangles.push_back(b->i);
+        m_triangles.push_back(c->i);
+    }
+
+    //Cut off the corners of little self-intersections, where two edges cross one after the other
+    node *cure_local_intersections( node *start ){
+        node *p=start;
+        do{
+            node *a=p->prev, *b=p->next->next;
+            if(!equals(a, b) && intersects(a, p, p->next, b) && locally_inside(a, b) && locally_inside(b, a)){
+                emit(a, p, b);
+                remove_node(p);
+                remove_node(p->next);
+                p=start=b;
+            }
+            p=p->next;
+        }while(p != start);
+
+        return filter(p);
+    }
+
+    //Find any diagonal that splits the polygon in two, and clip the halves separately
+    void split_clip( node *start ){
+        node *a=start;
+        do{
+            for( node *b=a->next->next; b != a->prev; b=b->next ){
+                if(a->i == b->i || !valid_diagonal(a, b))
+                    continue;
+
+                node *c=split(a, b);
+                a=filter(a, a->next);
+                c=filter(c, c->next);
+                clip(a, 0);
+                clip(c, 0);
+                return;
+            }
+            a=a->next;
+        }while(a != start);
+    }
+
+    //Clip ears until one triangle's left, trying harder on each pass that gets stuck
+    void clip( node *ear, int pass ){
+        if(!ear)
+            return;
+
+        if(!pass && m_inv_size)
+            index_curve(ear);
+
+        node *stop=ear;
+        while(ear->prev != ear->next){
+            node *prev=ear->prev, *next=ear->next;
+
+            if(m_inv_size ? is_ear_hashed(ear) : is_ear(ear)){
+                emit(prev, ear, next);
+                remove_node(ear);
+
+                //Skipping the next corner along makes for fewer slivers
+                ear=stop=next->next;
+                continue;
+            }
+
+            ear=next;
+            if(ear != stop)
+                continue;
+
+            //Once round without finding an ear
+            if(pass == 0)
+                clip(filter(ear), 1);
+            else if(pass == 1)
+                clip(cure_local_intersections(filter(ear)), 2);
+            else
+                split_clip(ear);
+            break;
+        }
+    }
+
+    static node *leftmost( node *start ){
+        node *p=start, *best=start;
+        do{
+            if(p->x < best->x || (p->x == best->x && p->y < best->y))
+                best=p;
+            p=p->next;
+        }while(p != start);
+
+        return best;
+    }
+
+    static bool sector_contains_sector( const node *m, const node *p ){
+        return area(m->prev, m, p->prev) < 0 && area(p->next, m, m->next) < 0;
+    }
+
+    //A point of the outline that hole can be joined to by a bridge that crosses nothing, or nullptr
+    static node *find_bridge( node *hole, node *outline ){
+        node *p=outline, *m=nullptr;
+        double hx=hole->x, hy=hole->y, qx=-std::numeric_limits<double>::infinity();
+
+        //The nearest edge to the left of the hole's point, on the same level, and whichever end
+        //of it is further left
+        do{
+            if(hy <= p->y && hy >= p->next->y && p->next->y != p->y){
+                double x=p->x + (hy - p->y) * (p->next->x - p->x) / (p->next->y - p->y);
+                if(x <= hx && x > qx){
+                    qx=x;
+                    m=p->x < p->next->x ? p : p->next;
+                    if(x == hx)
+                        return m;
+                }
+            }
+            p=p->next;
+        }while(p != outline);
+
+        if(!m)
+            return nullptr;
+
+        //Points of the outline inside the triangle between the hole's point, where the level crosses
+        //that edge, and that end of it, would be in the way, so the bridge goes to the one of those at
+        //the shallowest angle instead
+        node *stop=m;
+        double mx=m->x, my=m->y, tan_min=std::numeric_limits<double>::infinity();
+
+        p=m;
+        do{
+            if(hx >= p->x && p->x >= mx && hx != p->x &&
+                point_in_triangle(hy < my ? hx : qx, hy, mx, my, hy < my ? qx : hx, hy, p->x, p->y)){
+
+                double tan=std::abs(hy - p->y) / (hx - p->x);
+                if(locally_inside(p, hole) &&
+                    (tan < tan_min || (tan == tan_min && (p->x > m->x || (p->x == m->x && sector_contains_sector(m, p)))))){
+                    m=p;
+                    tan_min=tan;
+                }
+            }
+            p=p->next;
+        }while(p != stop);
+
+        return m;
+    }
+
+public:
+    ear_clipper( std::vector<::uint32_t> &triangles ):
+        m_triangles(triangles){}
+
+    void run( const std::vector<ring_t> &rings ){
+        if(rings.empty() || rings[0].size() < 4)
+            return;
+
+        m_origin=rings[0][0];
+
+        ::uint32_t first=rings[0].size();
+        node *outline=link(rings[0], 0, true);
+        if(!outline || outline->next == outline->prev)
+            return;
+
+        //Holes go in from left to right, so that each one's bridge only has to avoid those before it
+        std::vector<node *> holes;
+        for( ::size_t h=1; h < rings.size(); ++h ){
+            if(rings[h].size() >= 2)
+                if(node *list=link(rings[h], first, false)){
+                    if(list == list->next)
+                        list->steiner=true;
+                    holes.push_back(leftmost(list));
+                }
+            first+=rings[h].size();
+        }
+
+        std::sort(holes.begin(), holes.end(), [](const node *a, const node *b){
+            return a->x < b->x;
+        });
+
+        for(auto *hole: holes){
+            node *bridge=find_bridge(hole, outline);
+            if(!bridge)
+                continue;
+
+            node *back=split(bridge, hole);
+            filter(back, back->next);
+            outline=filter(bridge, bridge->next);
+        }
+
+        if(m_nodes.size() > hashed_points){
+            double max_x=m_min_x=outline->x, max_y=m_min_y=outline->y;
+            for(const auto &n: m_nodes){
+                m_min_x=std::min(m_min_x, n.x);
+                m_min_y=std::min(m_min_y, n.y);
+                max_x=std::max(max_x, n.x);
+                max_y=std::max(max_y, n.y);
+            }
+
+            double size=std::max(max_x - m_min_x, max_y - m_min_y);
+            m_inv_size=size > 0 ? 32767 / size : 0;
+        }
+
+        clip(outline, 0);
+    }
+};
+
+}
+
+void leapus::astrolib::triangulate( const std::vector<ring_t> &rings, std::vector<::uint32_t> &triangles ){
+    ear_clipper(triangles).run(rings);
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+/*
+*
+* A very small benchmark harness
+*
+* Google Benchmark would do, but it's one more thing to install, and all we need is to time
+* a few hot paths the same way every time so that a change can be compared against the last run.
+* Each benchmark runs a number of times and reports its best run, since anything slower than that
+* was the machine doing something else.
+*
+*/
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include <functional>
+
+namespace leapus::bench{
+
+using clock=std::chrono::steady_clock;
+
+struct measurement{
+    ::size_t ops=0;
+    double seconds=0;
+
+    //Bytes processed, if throughput in bytes means anything for the benchmark
+    ::size_t bytes=0;
+};
+
+//Times one run of func(), which returns how many operations (and bytes) it did
+template<typename Func>
+measurement time_it( Func &&func ){
+    auto start=clock::now();
+    measurement m=func();
+    m.seconds=std::chrono::duration<double>(clock::now() - start).count();
+    return m;
+}
+
+inline void print_header(){
+    std::printf("%-40s %12s %12s %14s %12s\n", "benchmark", "ops", "ns/op", "ops/s", "MB/s");
+}
+
+inline void print_result( const std::string &name, const measurement &m ){
+    double ns=m.ops ? m.seconds * 1e9 / m.ops : 0;
+    double rate=m.seconds > 0 ? m.ops / m.seconds : 0;
+
+    if(m.bytes)
+        std::printf("%-40s %12zu %12.1f %14.0f %12.1f\n", name.c_str(), m.ops, ns, rate, m.bytes / m.seconds / 1e6);
+    else
+        std::printf("%-40s %12zu %12.1f %14.0f %12s\n", name.c_str(), m.ops, ns, rate, "-");
+}
+
+//For benchmarks where the spread matters more than the average, such as queries
+inline void print_latencies( const std::string &name, std::vector<double> &ns ){
+    if(ns.empty())
+        return;
+
+    std::sort(ns.begin(), ns.end());
+    auto pct=[&ns](double p){ return ns[ std::min(ns.size()-1, (::size_t)(p * ns.size())) ]; };
+
+    std::printf("%-40s %12zu  p50 %.0fns  p90 %.0fns  p99 %.0fns  max %.0fns\n", name.c_str(), ns.size(),
+        pct(0.5), pct(0.9), pct(0.99), ns.back());
+}
+
+class registry{
+public:
+    //A benchmark prints its own results, since some report more than one line
+    using function_type=std::function<void(int repeat)>;
+
+private:
+    std::vector<std::pair<std::string, function_type>> m_benchmarks;
+
+public:
+    void add( const std::string &name, function_type func ){
+        m_benchmarks.emplace_back(name, std::move(func));
+    }
+
+    //Run everything whose name contains any of the filters, or everything if there are none
+    void run( const std::vector<std::string> &filters, int repeat ) const{
+        print_header();
+
+        for(const auto &[name, func]: m_benchmarks){
+            bool selected=filters.empty() || std::any_of(filters.begin(), filters.end(),
+                [&name](auto &f){ return name.find(f) != std::string::npos; });
+
+            if(selected)
+                func(repeat);
+        }
+    }
+};
+
+//Run func repeat times and print the best
+template<typename Func>
+void run_best( const std::string &name, int repeat, Func &&func ){
+    measurement best;
+    for( int i=0; i < repeat; ++i ){
+        auto m=time_it(func);
+        if(!i || m.seconds * best.ops < best.seconds * m.ops)
+            best=m;
+    }
+
+    print_result(name, best);
+}
+
+}
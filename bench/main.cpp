@@ -0,0 +1,527 @@
+/*
+*
+* astrolib_bench: timings for the hot paths of the library
+*
+* Usage: astrolib_bench [--blocks N] [--repeat N] [--scratch DIR] [filter...]
+*
+* Everything runs against a synthetic PBF (see synthetic.hpp) written to the scratch directory
+* on startup, so there's nothing to download.
+*
+*/
+
+#include <zlib.h>
+#include <cmath>
+#include <atomic>
+#include <random>
+#include <string>
+#include <thread>
+#include <cstdlib>
+#include <functional>
+
+#include "bench.hpp"
+#include "astrolib/console.hpp"
+#include "astrolib/concurrent.hpp"
+#include "astrolib/osmfile.hpp"
+#include "astrolib/byteswap.hpp"
+#include "astrolib/node_store.hpp"
+#include "astrolib/primitives.hpp"
+#include "astrolib/synthetic.hpp"
+#include "astrolib/index/builder.hpp"
+#include "astrolib/index/layout.hpp"
+#include "astrolib/index/query.hpp"
+#include "astrolib/index/container.hpp"
+#include "astrolib/index/mvt.hpp"
+
+using namespace std::string_literals;
+using namespace leapus;
+using namespace leapus::bench;
+using namespace leapus::concurrent;
+using namespace leapus::astrolib;
+using namespace leapus::astrolib::index;
+
+struct options{
+    int blocks=64;
+    int repeat=3;
+    std::filesystem::path scratch=std::filesystem::temp_directory_path() / "astrolib_bench";
+    std::vector<std::string> filters;
+};
+
+class bench_pool:public ThreadPool< std::function<void()>, lf_queue<std::function<void()>> >{
+public:
+    using ThreadPool::ThreadPool;
+
+protected:
+    void exception_handler( std::exception_ptr ptr ) override{
+        try{
+            std::rethrow_exception(ptr);
+        }
+        catch( const std::exception &ex ){
+            console::err("Benchmark task exception: "s + ex.what());
+        }
+    }
+};
+
+static int hardware_threads(){
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+//1, 2, 4... up to however many threads the machine has, and that many too
+static std::vector<int> thread_counts(){
+    std::vector<int> counts;
+    for( int t=1; t < hardware_threads(); t*=2 )
+        counts.push_back(t);
+
+    counts.push_back(hardware_threads());
+    return counts;
+}
+
+static void bench_queue( registry &reg ){
+    reg.add("queue", [](int repeat){
+        constexpr ::size_t items=1 << 20;
+
+        for( int threads: thread_counts() ){
+            run_best("queue/push_pop/" + std::to_string(threads) + "x" + std::to_string(threads), repeat, [threads](){
+                lf_queue<::size_t> q;
+                std::vector<std::thread> workers;
+                const ::size_t share=items / threads;
+
+                for( int t=0; t < threads; ++t ){
+                    workers.emplace_back([&q, share](){
+                        for( ::size_t i=0; i < share; ++i )
+                            q.push_front(i);
+                    });
+
+                    workers.emplace_back([&q, share](){
+                        for( ::size_t i=0; i < share; ++i )
+                            q.pop_back();
+                    });
+                }
+
+                for(auto &w: workers)
+                    w.join();
+
+                return measurement{ share * threads };
+            });
+        }
+    });
+}
+
+static void bench_thread_pool( registry &reg ){
+    reg.add("pool", [](int repeat){
+        constexpr ::size_t tasks=1 << 19;
+
+        run_best("pool/tasks/" + std::to_string(hardware_threads()), repeat, [](){
+            std::atomic<::size_t> done=0;
+            bench_pool pool;
+
+            for( ::size_t i=0; i < tasks; ++i )
+                pool.push_front([&done](){ ++done; });
+
+            pool.shutdown();
+            return measurement{ done.load() };
+        });
+    });
+}
+
+static void bench_pbf( registry &reg, const std::filesystem::path &pbf ){
+    reg.add("pbf", [pbf](int repeat){
+        const osm::osm_file file(pbf);
+
+        //Walking the frames without touching the blobs themselves
+        run_best("pbf/headers", repeat, [&file](){
+            measurement m;
+            for( auto it=file.begin(); it != file.end(); ++it )
+                ++m.ops;
+            return m;
+        });
+
+        //Which also parses each Blob, copying out its compressed payload (protobuf_file::read)
+        run_best("pbf/blobs", repeat, [&file](){
+            measurement m;
+            for( auto it=file.begin(); it != file.end(); ++it ){
+                m.bytes+=it->first.datasize();
+                ++m.ops;
+            }
+            return m;
+        });
+
+        //Inflating and parsing, separately and together
+        std::vector<OSMPBF::Blob> blobs;
+        std::vector<std::string> inflated;
+        for( auto it=file.begin(); it != file.end(); ++it ){
+            if(it->first.type() != "OSMData")
+                continue;
+
+            blobs.push_back(it->second);
+            auto &raw=inflated.emplace_back(it->second.raw_size(), '\0');
+            uLongf len=raw.size();
+            const auto &z=it->second.zlib_data();
+            ::uncompress( (Bytef *)raw.data(), &len, (const Bytef *)z.data(), z.size() );
+        }
+
+        run_best("pbf/inflate", repeat, [&blobs](){
+            measurement m;
+            std::string raw;
+            for(const auto &blob: blobs){
+                raw.resize(blob.raw_size());
+                uLongf len=raw.size();
+                ::uncompress( (Bytef *)raw.data(), &len, (const Bytef *)blob.zlib_data().data(), blob.zlib_data().size() );
+                m.bytes+=len;
+                ++m.ops;
+            }
+            return m;
+        });
+
+        run_best("pbf/parse", repeat, [&inflated](){
+            measurement m;
+            OSMPBF::PrimitiveBlock block;
+            for(const auto &raw: inflated){
+                block.ParseFromString(raw);
+                m.bytes+=raw.size();
+                ++m.ops;
+            }
+            return m;
+        });
+
+        run_best("pbf/decode", repeat, [&blobs](){
+            measurement m;
+            OSMPBF::PrimitiveBlock block;
+            for(const auto &blob: blobs){
+                osm::decode_blob(blob, block);
+                m.bytes+=blob.raw_size();
+                ++m.ops;
+            }
+            return m;
+        });
+
+        //Small random reads, which is what the block cache and query path do to the index
+        run_best("mmap/read", repeat, [&file](){
+            constexpr ::size_t reads=1 << 22;
+            std::mt19937_64 rng(1);
+            std::uniform_int_distribution<::size_t> pos_of(0, file.size() - 64);
+
+            measurement m{ reads, 0, reads * 64 };
+            unsigned sum=0;
+            for( ::size_t i=0; i < reads; ++i )
+                sum+=*file.read(pos_of(rng), 64);
+
+            //Keep the reads from being optimized away
+            if(sum == 1)
+                console::out("");
+            return m;
+        });
+    });
+}
+
+//Converting arrays of big-endian integers, in bulk and one at a time
+template<typename T>
+static void bench_endian_of( const std::string &name, int repeat ){
+    constexpr ::size_t count=1 << 20;
+    std::vector<T> data(count);
+    std::mt19937_64 rng(1);
+    for(auto &v: data)
+        v=(T)rng();
+
+    run_best("endian/bulk/" + name, repeat, [&data](){
+        convert_endian(data.data(), data.size());
+        return measurement{ data.size(), 0, data.size() * sizeof(T) };
+    });
+
+    run_best("endian/each/" + name, repeat, [&data](){
+        //volatile, so that the compiler doesn't make a bulk conversion of it
+        for(volatile T &v: data)
+            v=meta::endian::convert_endian((T)v);
+        return measurement{ data.size(), 0, data.size() * sizeof(T) };
+    });
+}
+
+static void bench_endian( registry &reg ){
+    reg.add("endian", [](int repeat){
+        bench_endian_of<::uint16_t>("16", repeat);
+        bench_endian_of<::uint32_t>("32", repeat);
+        bench_endian_of<::uint64_t>("64", repeat);
+    });
+}
+
+static void bench_allocation( registry &reg, const std::filesystem::path &scratch ){
+    reg.add("alloc", [scratch](int repeat){
+        constexpr ::size_t allocations=1 << 18;
+
+        for( int threads: thread_counts() ){
+            run_best("alloc/mmap/" + std::to_string(threads), repeat, [&scratch, threads](){
+                auto path=scratch / "alloc.bin";
+                std::filesystem::remove(path);
+                pbf::protobuf_file file{ path, true, (::size_t)1 << 36 };
+                index_allocator<quadtree_square> alloc{ file };
+
+                std::vector<std::thread> workers;
+                for( int t=0; t < threads; ++t )
+                    workers.emplace_back([alloc, threads]() mutable{
+                        for( ::size_t i=0; i < allocations / threads; ++i )
+                            alloc.allocate(1);
+                    });
+
+                for(auto &w: workers)
+                    w.join();
+
+                return measurement{ allocations / threads * threads };
+            });
+        }
+    });
+}
+
+//Writing every node of the synthetic PBF into a node store, flat and compressed, and then
+//looking them up again, in order, as resolving ways mostly does, and at random
+static void bench_nodes( registry &reg, const std::filesystem::path &pbf, const std::filesystem::path &scratch ){
+    reg.add("nodes", [pbf, scratch](int repeat){
+        std::vector<std::pair<osm::osm_id, coordinate_t>> nodes;
+        {
+            const osm::osm_file file(pbf);
+            OSMPBF::PrimitiveBlock block;
+            for( auto it=file.begin(); it != file.end(); ++it ){
+                if(it->first.type() != "OSMData")
+                    continue;
+
+                osm::decode_blob(it->second, block);
+                for(const auto &group: block.primitivegroup())
+                    osm::for_each_node(block, group, [&nodes](osm::osm_id id, const coordinate_t &loc){
+                        nodes.emplace_back(id, loc);
+                    });
+            }
+        }
+
+        std::vector<osm::osm_id> ordered, shuffled;
+        for(const auto &n: nodes)
+            ordered.push_back(n.first);
+        shuffled=ordered;
+        std::shuffle(shuffled.begin(), shuffled.end(), std::mt19937_64(1));
+
+        //Only as many IDs as there are, so that the compressed store's directory doesn't count for much
+        node_store::size_type capacity=1;
+        for(auto id: ordered)
+            capacity=std::max<node_store::size_type>(capacity, id+1);
+
+        auto path=scratch / "nodes.bin";
+        for( bool compressed: { false, true } ){
+            std::string name=compressed ? "compressed" : "flat";
+
+            run_best("nodes/set/" + name, repeat, [&](){
+                std::filesystem::remove(path);
+                node_store store(path, capacity, compressed);
+                node_store::writer writer(store);
+                for(const auto &[id, loc]: nodes)
+                    writer.set(id, loc);
+
+                return measurement{ nodes.size() };
+            });
+
+            node_store store(path, capacity, compressed);
+            for( auto [order, ids]: { std::pair{ "ordered", &ordered }, std::pair{ "random", &shuffled } } ){
+                run_best("nodes/get/" + name + "/" + order, repeat, [&store, ids=ids](){
+                    coordinate_t loc;
+                    measurement m;
+                    for(auto id: *ids)
+                        m.ops+=store.get(id, loc);
+                    return m;
+                });
+            }
+
+            if(compressed)
+                std::printf("%-40s %12zu  %.2f bytes/node\n", "nodes/size/compressed", nodes.size(), (double)store.size() / nodes.size());
+        }
+
+        std::filesystem::remove(path);
+    });
+}
+
+//Points and short lines in clusters, like the synthetic PBF, and optionally small polygons too
+struct clustered_data{
+    std::mt19937_64 rng{ 7 };
+    std::normal_distribution<double> spread{ 0, 0.05 };
+    std::vector<coordinate_t> centres;
+
+    clustered_data(){
+        std::uniform_real_distribution<double> lat_of(30, 60), lon_of(-10, 40);
+        centres.resize(32);
+        for(auto &c: centres)
+            c={ (ordinate_t)(lat_of(rng) * 1e9), (ordinate_t)(lon_of(rng) * 1e9) };
+    }
+
+    coordinate_t near( const coordinate_t &c ){
+        return coordinate_t{ c.lat + (ordinate_t)(spread(rng) * 1e9), c.lon + (ordinate_t)(spread(rng) * 1e9) };
+    }
+
+    void add_to( index_builder &builder, bool polygons ){
+        for( ::size_t i=0; i < 200000; ++i )
+            builder.add_point({ 0, (int)i }, idx_widget, near(centres[i % centres.size()]));
+
+        for( ::size_t i=0; i < 50000; ++i ){
+            auto start=near(centres[i % centres.size()]);
+            std::vector<coordinate_t> line{ start };
+            for( int k=1; k < 8; ++k )
+                line.push_back({ line.back().lat + (ordinate_t)(spread(rng) * 1e8), line.back().lon + (ordinate_t)(spread(rng) * 1e8) });
+            builder.add_line({ 0, (int)i }, idx_line, line.data(), line.size());
+        }
+
+        //Buildings, more or less: small hexagons, counterclockwise and closed
+        for( ::size_t i=0; polygons && i < 50000; ++i ){
+            auto c=near(centres[i % centres.size()]);
+            ordinate_t r=(ordinate_t)(std::abs(spread(rng)) * 1e7) + 10000;
+
+            polygon_t poly;
+            for( int k=0; k <= 6; ++k )
+                poly.outer.push_back({ c.lat + (ordinate_t)(r * std::sin(k % 6 * M_PI / 3)), c.lon + (ordinate_t)(r * std::cos(k % 6 * M_PI / 3)) });
+            builder.add_polygon({ 0, (int)i }, poly);
+        }
+    }
+};
+
+static void bench_query( registry &reg, const std::filesystem::path &scratch ){
+    reg.add("query", [scratch](int){
+        auto path=scratch / "query.idx";
+        std::filesystem::remove(path);
+        pbf::protobuf_file file{ path, true, (::size_t)1 << 36 };
+
+        index_config config;
+        config.file_allocator={ file };
+
+        clustered_data data;
+        auto &centres=data.centres;
+        auto near=[&data](const coordinate_t &c){ return data.near(c); };
+
+        quadtree_square *built;
+        {
+            index_builder builder(config, scratch / "query.spool");
+            data.add_to(builder, false);
+            built=&builder.build();
+        }
+
+        for( auto [order, name]: { std::pair{ layout_order::as_built, "as_built" },
+            std::pair{ layout_order::van_emde_boas, "veb" }, std::pair{ layout_order::level_blocked, "blocked" } } ){
+
+            auto &root=relayout(*built, config.file_allocator, order);
+
+            for( double size: { 0.01, 0.1, 1.0 } ){
+                std::vector<double> latencies;
+                ::size_t found=0;
+
+                for( int q=0; q < 20000; ++q ){
+                    auto c=near(centres[q % centres.size()]);
+                    ordinate_t half=size / 2 * 1e9;
+                    box_t box{ { c.lat - half, c.lon - half }, { c.lat + half, c.lon + half } };
+
+                    auto start=clock::now();
+                    for_each_entry(root, box, [&found](auto &, auto &){ ++found; });
+                    latencies.push_back( std::chrono::duration<double, std::nano>(clock::now() - start).count() );
+                }
+
+                print_latencies("query/"s + name + "/" + std::to_string(size).substr(0, 4) + "deg", latencies);
+            }
+        }
+    });
+}
+
+//Tiles per second, around the clusters, at a few zooms, from an index file as astrolabe would have it
+static void bench_mvt( registry &reg, const std::filesystem::path &scratch ){
+    reg.add("mvt", [scratch](int repeat){
+        auto work=scratch / "mvt.work";
+        std::filesystem::remove(work);
+
+        clustered_data data;
+        {
+            pbf::protobuf_file file{ work, true, (::size_t)1 << 36 };
+            index_config config;
+            config.file_allocator={ file };
+
+            index_builder builder(config, scratch / "mvt.spool");
+            data.add_to(builder, true);
+            auto &built=builder.build();
+
+            string_interner strings;
+            for( auto *s: { "highway", "residential", "building", "yes", "amenity", "bench" } )
+                strings.intern(s);
+
+            write_index(scratch / "mvt.idx", file, built, strings);
+        }
+        std::filesystem::remove(work);
+
+        index_file idx(scratch / "mvt.idx");
+
+        //Two tags for everything, with values varying by type, so the layers' tables get some use
+        const auto &dictionary=idx.dictionary();
+        std::vector<mvt_encoder::tag_type> tags[idx_widget+1];
+        tags[idx_line]={ { dictionary.find("highway"), dictionary.find("residential") } };
+        tags[idx_poly]={ { dictionary.find("building"), dictionary.find("yes") } };
+        tags[idx_widget]={ { dictionary.find("amenity"), dictionary.find("bench") } };
+
+        mvt_encoder encoder;
+
+        for( int z: { 8, 11, 14 } ){
+            //The tile under each cluster's centre, and those around it
+            std::vector<box_t> tiles;
+            double n=std::ldexp(1.0, z);
+            for(const auto &c: data.centres){
+                double r=c.lat / 1e9 * M_PI / 180;
+                int x=(int)((c.lon / 1e9 + 180) / 360 * n);
+                int y=(int)((1 - std::log(std::tan(r) + 1 / std::cos(r)) / M_PI) / 2 * n);
+
+                for( int dy=-1; dy <= 1; ++dy )
+                    for( int dx=-1; dx <= 1; ++dx )
+                        tiles.push_back(tile_bounds(z, x+dx, y+dy));
+            }
+
+            run_best("mvt/z" + std::to_string(z), repeat, [&](){
+                measurement m;
+                for(const auto &box: tiles){
+                    encoder.begin(box, dictionary);
+                    for_each_entry(idx.root(), box, [&](const quadtree_square &sq, const index_entry &e){
+                        encoder.add(sq, e, idx.base(), tags[e.type].data(), tags[e.type].size());
+                    });
+
+                    m.bytes+=encoder.finish().size();
+                    ++m.ops;
+                }
+                return m;
+            });
+        }
+    });
+}
+
+int main( int argc, char *argv[] ){
+    options opts;
+
+    for( int i=1; i < argc; ++i ){
+        std::string arg=argv[i];
+        if(arg == "--blocks" && i+1 < argc)
+            opts.blocks=std::atoi(argv[++i]);
+        else if(arg == "--repeat" && i+1 < argc)
+            opts.repeat=std::atoi(argv[++i]);
+        else if(arg == "--scratch" && i+1 < argc)
+            opts.scratch=argv[++i];
+        else
+            opts.filters.push_back(arg);
+    }
+
+    std::filesystem::create_directories(opts.scratch);
+    auto pbf=opts.scratch / "synthetic.osm.pbf";
+    osm::synthetic_config synthetic;
+    synthetic.blocks=opts.blocks;
+    osm::write_synthetic(pbf, synthetic);
+
+    registry reg;
+    bench_queue(reg);
+    bench_thread_pool(reg);
+    bench_pbf(reg, pbf);
+    bench_endian(reg);
+    bench_allocation(reg, opts.scratch);
+    bench_nodes(reg, pbf, opts.scratch);
+    bench_query(reg, opts.scratch);
+    bench_mvt(reg, opts.scratch);
+
+    reg.run(opts.filters, opts.repeat);
+
+    //Only what we made, in case the scratch directory is somewhere shared
+    for( auto *name: { "synthetic.osm.pbf", "alloc.bin", "query.idx", "mvt.idx" } )
+        std::filesystem::remove(opts.scratch / name);
+    return 0;
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+/*
+*
+* A cache of inflated and parsed OSM PrimitiveBlocks
+*
+* Every index_entry::address points into a compressed blob, so dereferencing a query result
+* means inflating and parsing a whole 128-512kiB block. Results tend to come in clumps from
+* the same few blobs, so the decoded blocks are kept around, keyed by blob position,
+* and evicted least-recently-used first once they exceed a memory cap.
+*
+*/
+
+#include <list>
+#include <mutex>
+#include <memory>
+#include <future>
+#include <vector>
+#include <unordered_map>
+#include "astrolib/types.hpp"
+#include "astrolib/osmfile.hpp"
+
+namespace leapus::osm{
+
+class block_cache{
+public:
+    using block_type=OSMPBF::PrimitiveBlock;
+    using block_ptr=std::shared_ptr<const block_type>;
+    using pos_type=osm_file::pos_type;
+    using size_type=::size_t;
+
+    struct statistics_type{
+        size_type hits=0, misses=0, evictions=0;
+
+        //Approximate memory held by the cache, not counting evicted blocks which are still in use
+        size_type bytes=0;
+        size_type blocks=0;
+    };
+
+private:
+    struct entry{
+        //Other threads asking for a block that is still being decoded wait on this,
+        //rather than decoding it a second time
+        std::shared_future<block_ptr> block;
+        size_type size=0;
+        std::list<pos_type>::iterator lru_pos;
+    };
+
+    //Each shard is an independent LRU, so that threads fetching different blocks seldom contend
+    struct shard{
+        std::mutex mutex;
+        std::unordered_map<pos_type, entry> entries;
+
+        //Most recently used at the front
+        std::list<pos_type> lru;
+
+        statistics_type stats;
+    };
+
+    const osm_file &m_file;
+    size_type m_shard_cap;
+    std::vector<shard> m_shards;
+
+    shard &shard_for(pos_type pos);
+    block_ptr decode(shard &sh, pos_type pos, std::promise<block_ptr> &promise);
+    void evict(shard &sh, pos_type keep);
+
+public:
+    //The memory cap is split evenly among the shards
+    block_cache( const osm_file &file, size_type memory_cap=(size_type)256*1024*1024, unsigned shard_count=16 );
+
+    block_cache(const block_cache &) = delete;
+
+    //Returns the decoded block whose frame begins at blob_pos, decoding it first if it's not cached.
+    //The block remains valid for as long as the pointer is held, even if it gets evicted.
+    block_ptr get( pos_type blob_pos );
+
+    block_ptr get( const astrolib::osm_address_t &addr ){
+        return get(addr.blob_pos);
+    }
+
+    //Totals across all shards
+    statistics_type statistics();
+
+    void clear();
+};
+
+}
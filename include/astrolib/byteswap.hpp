@@ -0,0 +1,44 @@
+#pragma once
+
+/*
+*
+* Swapping the byte order of whole arrays of integers
+*
+* meta::endian does one integer at a time, which is right for the odd header field. For an array of
+* them, like a section of a file written in big-endian order, this does them 32 bytes at a time with
+* AVX2's byte shuffle, where the processor has it, and one at a time with bswap otherwise.
+*
+*/
+
+#include <cstddef>
+#include <algorithm>
+#include <cstdint>
+#include <type_traits>
+#include "astrolib/meta.hpp"
+
+namespace leapus::astrolib{
+
+//Swap the bytes of each of the n integers from from into to, which may be the same array
+void byteswap( const ::uint16_t *from, ::uint16_t *to, ::size_t n );
+void byteswap( const ::uint32_t *from, ::uint32_t *to, ::size_t n );
+void byteswap( const ::uint64_t *from, ::uint64_t *to, ::size_t n );
+
+//Big-endian integers to host order, or the other way around, which is the same thing,
+//from from into to, which may be the same array. On a big-endian host, it's just a copy, if that.
+template<typename T>
+void convert_endian( const T *from, T *to, ::size_t n ){
+    static_assert(std::is_integral_v<T> && sizeof(T) > 1, "Only integers of more than a byte have a byte order");
+    using U=std::make_unsigned_t<T>;
+
+    if constexpr(meta::endian::is_little())
+        byteswap((const U *)from, (U *)to, n);
+    else if(from != to)
+        std::copy(from, from+n, to);
+}
+
+template<typename T>
+void convert_endian( T *data, ::size_t n ){
+    convert_endian((const T *)data, data, n);
+}
+
+}
@@ -0,0 +1,160 @@
+#pragma once
+
+/*
+*
+* Checkpoints, for picking a long job back up where it left off after a crash
+*
+* A checkpoint is two files. The state file is small, whatever the job needs to know about where
+* it was, and it's replaced whole, atomically, by writing a new one beside it and renaming it over.
+* The journal is for things that only ever grow, like the list of everything indexed so far, which
+* would be far too much to rewrite every time, so each checkpoint just appends what's new.
+*
+* commit() makes the journal durable before it replaces the state, and the state records how long
+* the journal was, so whichever state survives a crash, the journal covers it. Anything past that
+* length was appended after the last commit, and is cut off again by load().
+*
+* Everything is in host byte order: a checkpoint is only ever read back by the machine that wrote it.
+*
+*/
+
+#include <string>
+#include <vector>
+#include <cstring>
+#include <optional>
+#include <filesystem>
+#include <string_view>
+#include <type_traits>
+#include "astrolib/exception.hpp"
+#include "astrolib/checksum.hpp"
+#include "astrolib/io/mmap_file.hpp"
+
+namespace leapus::astrolib{
+
+class checkpoint_exception:public exception::exception{
+public:
+    using exception::exception;
+};
+
+//Records to append to a journal
+class journal_writer{
+    std::string m_data;
+
+public:
+    template<typename T>
+    void put( const T &v ){
+        static_assert(std::is_trivially_copyable_v<T>);
+        m_data.append( (const char *)&v, sizeof(T) );
+    }
+
+    //A count, followed by that many Ts
+    template<typename T>
+    void put_array( const T *p, ::size_t n ){
+        static_assert(std::is_trivially_copyable_v<T>);
+        put<::uint64_t>(n);
+        m_data.append( (const char *)p, n * sizeof(T) );
+    }
+
+    void put_string( std::string_view s ){
+        put_array(s.data(), s.size());
+    }
+
+    const std::string &data() const{
+        return m_data;
+    }
+
+    void clear(){
+        m_data.clear();
+    }
+};
+
+//Reading records back, which throws checkpoint_exception if they run off the end
+class journal_reader{
+    const char *m_p, *m_end;
+
+    void need( ::size_t n ) const{
+        if(n > (::size_t)(m_end - m_p))
+            throw checkpoint_exception("Checkpoint journal is truncated");
+    }
+
+public:
+    journal_reader( const char *p, ::size_t size ):
+        m_p(p),
+        m_end(p+size){}
+
+    bool done() const{
+        return m_p == m_end;
+    }
+
+    template<typename T>
+    T get(){
+        static_assert(std::is_trivially_copyable_v<T>);
+        need(sizeof(T));
+        T v;
+        std::memcpy(&v, m_p, sizeof(T));
+        m_p+=sizeof(T);
+        return v;
+    }
+
+    //Whatever put_array() put, as a pointer into the journal, which may not be aligned for T
+    template<typename T>
+    std::pair<const char *, ::size_t> get_array(){
+        auto n=get<::uint64_t>();
+        if(n > (::size_t)(m_end - m_p) / sizeof(T))
+            throw checkpoint_exception("Checkpoint journal is truncated");
+
+        auto *p=m_p;
+        m_p+=n * sizeof(T);
+        return { p, n };
+    }
+
+    std::string_view get_string(){
+        auto [p, n]=get_array<char>();
+        return { p, n };
+    }
+};
+
+class checkpoint_file{
+    std::filesystem::path m_path, m_journal_path;
+    int m_journal_fd=-1;
+    ::uint64_t m_journal_size=0;
+
+public:
+    //The state goes in path, and the journal in path + ".journal"
+    checkpoint_file( const std::filesystem::path &path );
+    ~checkpoint_file();
+
+    checkpoint_file( const checkpoint_file & ) = delete;
+
+    //The last committed state, if there is one, after which the journal is cut back to
+    //what that state covers. Throws checkpoint_exception if either one is damaged.
+    std::optional<std::string> load();
+
+    //Read back the journal, as of the last load() or commit(), by calling func(journal_reader &).
+    //It's mapped rather than read in, since it can be about as big as the job's working set.
+    template<typename Func>
+    void replay( Func &&func ) const;
+
+    //Queue records to be made durable by the next commit()
+    void append( const journal_writer &records );
+
+    //Make everything appended durable, and then atomically replace the state
+    void commit( std::string_view state );
+
+    //For when the job is done
+    void remove();
+};
+
+template<typename Func>
+void checkpoint_file::replay( Func &&func ) const{
+    if(!m_journal_size){
+        journal_reader reader{ nullptr, 0 };
+        func(reader);
+        return;
+    }
+
+    const io::mmap_file journal{ m_journal_path, false };
+    journal_reader reader{ std::addressof(*journal.read(0, m_journal_size)), m_journal_size };
+    func(reader);
+}
+
+}
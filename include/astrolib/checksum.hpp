@@ -0,0 +1,17 @@
+#pragma once
+
+/*
+*
+* CRC-32, the same one as zlib and PNG, for checking that files are intact
+*
+*/
+
+#include <cstdint>
+#include <cstddef>
+
+namespace leapus::astrolib{
+
+//Pass a previous result as crc to carry on from where it left off
+::uint32_t checksum( const void *data, ::size_t size, ::uint32_t crc=0 );
+
+}
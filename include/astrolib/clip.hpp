@@ -0,0 +1,53 @@
+#pragma once
+
+/*
+*
+* Clipping lines to boxes, in integer nanodegrees
+*
+* A long way, like a motorway or a river, crosses hundreds of quadtree squares, and each of them
+* should only store the piece of it that's inside. This is Cohen-Sutherland: every point gets an
+* outcode saying which sides of the box it's beyond, and most segments are then settled by the
+* outcodes alone, either both ends inside, or both beyond the same side. Only segments which
+* actually cross the edge of the box need any arithmetic.
+*
+* Outcodes are computed for a whole way at once, which is the part that's worth vectorizing.
+*
+*/
+
+#include <vector>
+#include <cstdint>
+#include "astrolib/types.hpp"
+
+namespace leapus::astrolib{
+
+using outcode_t=::uint8_t;
+
+enum outcode_bits:outcode_t{
+    out_south=1,
+    out_north=2,
+    out_west=4,
+    out_east=8
+};
+
+inline outcode_t outcode( const coordinate_t &c, const box_t &box ){
+    return (c.lat < box.sw.lat) * out_south | (c.lat > box.ne.lat) * out_north |
+        (c.lon < box.sw.lon) * out_west | (c.lon > box.ne.lon) * out_east;
+}
+
+//Outcodes for n points at once. Uses AVX2 where the CPU has it.
+void outcodes( const coordinate_t *pts, ::size_t n, const box_t &box, outcode_t *codes );
+
+//Clip the segment a-b to the box in place, returning false if none of it is inside
+bool clip_segment( coordinate_t &a, coordinate_t &b, const box_t &box );
+
+//A polyline, as opposed to a closed ring, although it may happen to be closed
+using polyline_t=std::vector<coordinate_t>;
+
+//Does any part of the polyline touch the box?
+bool intersects( const coordinate_t *pts, ::size_t n, const box_t &box );
+
+//Append the pieces of the polyline that are inside the box to out. A line which wanders in and out
+//of the box comes out as several pieces.
+void clip_line( const coordinate_t *pts, ::size_t n, const box_t &box, std::vector<polyline_t> &out );
+
+}
@@ -12,8 +12,11 @@
 #include <condition_variable>
 #include <thread>
 #include <vector>
+#include <cstdint>
 
 #include "meta.hpp"
+#include "metrics.hpp"
+#include "trace.hpp"
 
 namespace leapus::concurrent {
 /*
@@ -29,23 +32,47 @@ namespace leapus::concurrent {
 struct interrupt_exception{};
 
 
+//Shared by every lf_queue, since it's the pipeline as a whole we're watching
+struct queue_metrics{
+    metrics::counter pushes{ "queue.pushes" };
+    metrics::gauge depth{ "queue.depth" };
+
+    //Failed CAS loops, a direct measure of contention
+    metrics::counter cas_retries{ "queue.cas_retries" };
+
+    //Pops which found the queue empty and went to sleep
+    metrics::counter naps{ "queue.naps" };
+
+    static const queue_metrics &get(){
+        static const queue_metrics m;
+        return m;
+    }
+};
+
+
 /*
 Lock-free queue
 
-//m_head points to the last element added so that the next one can be linked from that one.
-//m_tail points to the next element to be popped
+This is the Michael & Scott queue. m_tail always points at a dummy link, the one most recently popped,
+and the next item to be popped is the one after it. m_head points to the last element added
+so that the next one can be linked from that one. m_head is allowed to lag behind by a link, and
+any thread that notices will help it along.
 
 //Two items
-           <-m_head
-nullptr<-I2<-I1<-m_tail
-
-// With one item
-           <-m_head
-nullptr<-I1<-m_tail
+             <-m_head
+nullptr<-I2<-I1<-D<-m_tail
 
 //Or when empty
-                  <-m_head
- nullptr <- m_tail
+       <-m_head
+nullptr<-D<-m_tail
+
+Popping I1 makes it the new dummy, and the old dummy D is recycled.
+
+A thread can be holding on to a link that somebody else has since popped, so links are never
+freed while the queue exists, just recycled through a free list. That way, a straggler reads a stale
+link rather than freed memory. A stale link can also come back around reused, and look identical to the
+one a thread read (the ABA problem), so every link pointer carries a modification count which is
+bumped on every update. Any CAS against a link that has been recycled in the meantime will fail.
 
 There actually is a lock, but only for sleeping the thread when the queue is empty,
 since it would be dumb to spin the processor just because there is nothing to do in the present thread.
@@ -60,31 +87,92 @@ public:
     using value_type = T;
 
 private:
+    struct list_link;
+
+    //A link pointer with the modification count squeezed into the top 16 bits, which user-space
+    //pointers don't use on any 64-bit machine we care about
+    class tagged_ptr{
+        static_assert(sizeof(std::uintptr_t) == 8, "tagged_ptr needs 64-bit pointers");
+        static constexpr int tag_shift=48;
+        static constexpr std::uintptr_t ptr_mask=((std::uintptr_t)1 << tag_shift)-1;
+
+        std::uintptr_t m_bits;
+
+    public:
+        tagged_ptr(list_link *p=nullptr, std::uint16_t tag=0):
+            m_bits( (std::uintptr_t)p | (std::uintptr_t)tag << tag_shift ){}
+
+        list_link *get() const{ return (list_link *)(m_bits & ptr_mask); }
+        list_link *operator->() const{ return get(); }
+        std::uint16_t tag() const{ return m_bits >> tag_shift; }
+
+        //The same slot pointed somewhere else, as one more modification
+        tagged_ptr next(list_link *p) const{ return { p, (std::uint16_t)(tag()+1) }; }
+
+        bool operator==(const tagged_ptr &rhs) const{ return m_bits == rhs.m_bits; }
+        bool operator!=(const tagged_ptr &rhs) const{ return m_bits != rhs.m_bits; }
+    };
+
     struct list_link{
-        value_type value;
-        std::atomic<list_link *> next=nullptr;              
-    } m_tail;
+        std::atomic<tagged_ptr> next;
+
+        //Only the thread which wins popping the link that precedes this one gets to keep the value,
+        //but everyone who tries will have read the pointer
+        std::atomic<value_type *> value=nullptr;
+
+        std::atomic<tagged_ptr> free_next;
+    };
+
+    alignas(64) std::atomic<tagged_ptr> m_head;
+    alignas(64) std::atomic<tagged_ptr> m_tail;
+    alignas(64) std::atomic<tagged_ptr> m_free;
 
     std::mutex m_sleep_mutex;
     std::condition_variable m_sleep_cond;
-    std::atomic<list_link *> m_head=&m_tail;
+    std::atomic_int m_sleepers=0;
     std::atomic_bool m_interrupt=false;
 
-    list_link *nap(){
-        list_link *result;
+    //Take a link from the free list, or make a new one
+    list_link *alloc_link(){
+        tagged_ptr f=m_free.load();
+        while(f.get()){
+            if(m_free.compare_exchange_weak(f, f.next( f->free_next.load().get() )))
+                return f.get();
+        }
+
+        return new list_link{};
+    }
+
+    void free_link(list_link *l){
+        tagged_ptr f=m_free.load();
+        do{
+            l->free_next=tagged_ptr{ f.get() };
+        }while(!m_free.compare_exchange_weak(f, f.next(l)));
+    }
+
+    bool empty() const{
+        return !m_tail.load()->next.load().get();
+    }
+
+    void nap(){
+        queue_metrics::get().naps.add();
+        TRACE_SCOPE("nap");
         std::unique_lock lock(m_sleep_mutex);
 
-        m_sleep_cond.wait(lock, [this, &result](){    
-            if( result=m_tail.next.load() )
-                return true; 
+        //Pushers check this after linking, and we check for an item after bumping it,
+        //so one way or the other, either they see us sleeping or we see their item
+        ++m_sleepers;
+        meta::guard awake( [this](){ --m_sleepers; } );
+
+        m_sleep_cond.wait(lock, [this](){
+            if( !empty() )
+                return true;
 
             if(m_interrupt)
                 throw interrupt_exception();
             else
                 return false;
         });
-
-        return result;
     }
 
     void wake(){
@@ -92,77 +180,130 @@ private:
         m_sleep_cond.notify_all();
     }
 
-    void push_front_impl( list_link *nl ){
+    void push_front_impl( value_type *v ){
 
-        list_link *null;
+        auto &stats=queue_metrics::get();
+        list_link *nl=alloc_link();
+        nl->value=v;
+        nl->next=nl->next.load().next(nullptr);
 
         //be the first to point old-head-link at new-head-link
         //or keep trying if we just barely missed it due to contention
         do{
-            null=nullptr;
-            list_link *h=m_head.load(); //grab a copy of the pointer to old head link
-            //Update that to point to the new head link, while atomically ensuring no other thread beat us to it
-            if(!h->next.compare_exchange_weak( null, nl ))
+            tagged_ptr h=m_head.load(); //grab a copy of the pointer to old head link
+            tagged_ptr n=h->next.load();
+
+            if(h != m_head.load())
                 continue;
 
-            //Now update the head pointer so that other threads won't be stuck spinning here
-            //repeatedly finding that the old head link already points to a newer head.
-            if( m_head.exchange(nl)  == &m_tail ){
+            //m_head is lagging behind a link which somebody else appended, so help it catch up
+            if(n.get()){
+                m_head.compare_exchange_weak(h, h.next(n.get()));
+                continue;
+            }
 
-                //Racing appends will be appending at head, so that's not a problem
-                //Racing pops will not be able to pop because m_tail points to null.
-                //So, this is the only thread which will succeed updating the tail
-                //between the update of head and tail.
-                m_tail.next=nl;
-                wake();
+            //Update that to point to the new head link, while atomically ensuring no other thread beat us to it
+            if(!h->next.compare_exchange_weak( n, n.next(nl) )){
+                stats.cas_retries.add();
+                continue;
             }
 
-            //Also, pushing into the empty queue is the only special case which actually messes with
-            //locks in order to wake idle threads that went to sleep for lack of work.
+            //Now update the head pointer so that other threads won't have to do it for us.
+            //If it fails, then somebody already did.
+            m_head.compare_exchange_strong(h, h.next(nl));
 
             //Success
             break;
-    
+
         } while( true );
+
+        stats.pushes.add();
+        stats.depth.add(1);
+
+        //Also, pushing while anyone is asleep for lack of work is the only case
+        //which actually messes with locks
+        if(m_sleepers.load())
+            wake();
     }
 
 public:
+    lf_queue(){
+        list_link *dummy=new list_link{};
+        m_head=tagged_ptr{ dummy };
+        m_tail=tagged_ptr{ dummy };
+    }
+
+    lf_queue(const lf_queue &) = delete;
+
+    ~lf_queue(){
+        for( list_link *l=m_tail.load().get(), *n; l; l=n ){
+            n=l->next.load().get();
+
+            //The dummy's value was already popped
+            if(l != m_tail.load().get())
+                delete l->value.load();
+            delete l;
+        }
+
+        for( list_link *l=m_free.load().get(), *n; l; l=n ){
+            n=l->free_next.load().get();
+            delete l;
+        }
+    }
+
     void push_front(const value_type &v){
-        list_link *nl= new list_link{ v };
-        push_front_impl(nl);
+        push_front_impl(new value_type{ v });
     }
 
     void push_front(value_type &&v){
-        list_link *nl= new list_link{ std::move(v) };
-        push_front_impl(nl);
+        push_front_impl(new value_type{ std::move(v) });
     }
 
     //Throws interrupt_exception to help shut down a worker thread if the queue is empty and interrupt() has been called
     value_type pop_back(){
 
-        list_link *t, *n;
-        do{
-            //Fetch the next candidate for popping
-            t=m_tail.next.load();
+        tagged_ptr t, h, n;
+        value_type *v;
+
+        while(true){
+            //Fetch the dummy and the next candidate for popping
+            t=m_tail.load();
+            h=m_head.load();
+            n=t->next.load();
+
+            if(t != m_tail.load())
+                continue;
 
             //If the queue is empty, sleep the thread until not empty (or throw if empty following interrupt())
-            if( !t )
-                t=nap();
+            if( !n.get() ){
+                nap();
+                continue;
+            }
 
-            //Get the next item's next item
-            n=t->next.load();
+            //There's an item, but m_head hasn't caught up yet
+            if( t.get() == h.get() ){
+                m_head.compare_exchange_weak(h, h.next(n.get()));
+                continue;
+            }
 
-            //Atomically, if nobody else popped an item, set meta-next as next.
-            //Or, if somebody updated the next-pointer while we were figuring out what ought to be next
+            v=n->value.load();
+
+            //Atomically, if nobody else popped an item, make the popped link the new dummy.
+            //Or, if somebody popped while we were figuring out what ought to be next,
             //then start over and try again.
-        }while(! m_tail.next.compare_exchange_weak(t, n));
+            if(m_tail.compare_exchange_weak(t, t.next(n.get())))
+                break;
 
-        //If n is null, then the list is empty and m_head has only m_tail left to update, 
-        //so that's where it needs to be pointed
-        
+            queue_metrics::get().cas_retries.add();
+        }
+
+        queue_metrics::get().depth.add(-1);
+
+        //Nobody else can reach the old dummy anymore, except stragglers who will fail their CAS
+        free_link(t.get());
 
-        value_type result=std::move(t->value);
-        delete t;
+        value_type result=std::move(*v);
+        delete v;
         return result;
     }
 
@@ -184,6 +325,7 @@ public:
 private:
     queue_type m_queue;
     void thread_proc(){
+        TRACE_THREAD_NAME("worker");
         task_type task;
         while(true){
             try{
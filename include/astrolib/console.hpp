@@ -4,22 +4,51 @@
 *
 * Just so that all of our console notices can go out through a single place, and thread-safe
 *
+* Logging doesn't write anything itself. Each thread queues its lines in a ring buffer of its own,
+* which only it writes to, and a background thread drains all of the rings, in the order the lines
+* were logged, and writes them out a batch at a time. So a worker that logs never waits on the
+* terminal or on any other worker, unless its ring is full because it's logging faster than the
+* terminal can take it.
+*
+* Lines below the level set with set_level() are dropped on the spot, and so are lines over the
+* rate limit, per thread, errors included, which keeps a flood of identical exceptions from a pool
+* from taking the machine down with it. How many were dropped is noted on the thread's next line
+* that gets through.
+*
+* Everything queued is written by the time the program exits normally, or whenever flush() returns.
+* Errors are the exception: err(), and log() at error, wait for the line, and everything queued
+* before it, to be written, so that it isn't lost if the program then aborts.
+*
 */
 
 #include <iostream>
-#include <mutex>
+#include <string>
 
 namespace leapus{
 
 class console final{
 
-protected:
-    static std::mutex m_mutex;
-
 public:
+    enum class level{ debug, info, warning, error };
+
+    //out() is info, to stdout, and err() is error, to stderr
     static void out(const std::string &line);
     static void err(const std::string &line);
 
+    //debug and info go to stdout, warnings and errors to stderr
+    static void log(level lvl, const std::string &line);
+
+    //Lines below this are dropped. The default is info.
+    static void set_level(level lvl);
+    static level get_level();
+
+    //At most lines_per_second per thread on average, with bursts of up to burst.
+    //Zero lines_per_second is unlimited. The default is 1000 a second, in bursts of up to 1000.
+    static void set_rate_limit(double lines_per_second, double burst);
+
+    //Wait for everything already queued, by any thread, to be written
+    static void flush();
+
     friend void out(const std::string &);
     friend void err(const std::string &);
 };
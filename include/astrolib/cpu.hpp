@@ -0,0 +1,22 @@
+#pragma once
+
+/*
+*
+* What the processor we're running on can do, for kernels with a SIMD version and a scalar one
+*
+*/
+
+namespace leapus::cpu{
+
+//Whether AVX2 is there, which is only asked once. Always false off x86-64, where there's
+//no AVX2 version to pick anyway.
+inline bool have_avx2(){
+#if defined(__x86_64__)
+    static const bool result=__builtin_cpu_supports("avx2");
+    return result;
+#else
+    return false;
+#endif
+}
+
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+/*
+*
+* Plane geometry on nanodegree coordinates, treating longitude as x and latitude as y
+*
+* Coordinates are 38-bit numbers, so products of two of them don't fit in 64 bits. Wherever
+* that matters, the arithmetic is done relative to a nearby point, or in 128 bits.
+*
+*/
+
+#include <vector>
+#include "astrolib/types.hpp"
+
+namespace leapus::astrolib{
+
+//A closed ring, whose first and last points are the same
+using ring_t=std::vector<coordinate_t>;
+
+struct polygon_t{
+    ring_t outer;
+    std::vector<ring_t> holes;
+};
+
+box_t bounds( const ring_t &ring );
+
+inline bool contains( const box_t &box, const coordinate_t &c ){
+    return c.lat >= box.sw.lat && c.lat <= box.ne.lat && c.lon >= box.sw.lon && c.lon <= box.ne.lon;
+}
+
+inline bool contains( const box_t &outer, const box_t &inner ){
+    return contains(outer, inner.sw) && contains(outer, inner.ne);
+}
+
+inline bool intersects( const box_t &a, const box_t &b ){
+    return a.sw.lat <= b.ne.lat && b.sw.lat <= a.ne.lat && a.sw.lon <= b.ne.lon && b.sw.lon <= a.ne.lon;
+}
+
+//Twice the signed area, positive when counterclockwise, in square nanodegrees
+double signed_area2( const ring_t &ring );
+
+//Crossing-number test. Points exactly on an edge may go either way.
+bool point_in_ring( const coordinate_t &pt, const ring_t &ring );
+
+//Reverse the ring if needed so that it winds counterclockwise, or clockwise
+void orient( ring_t &ring, bool counterclockwise );
+
+//The point on segment a-b where it crosses the given latitude or longitude, rounded to the nanodegree
+coordinate_t cross_lat( const coordinate_t &a, const coordinate_t &b, ordinate_t lat );
+coordinate_t cross_lon( const coordinate_t &a, const coordinate_t &b, ordinate_t lon );
+
+//Sutherland-Hodgman against the box. The result is closed, or empty if nothing is left.
+//Clipping a concave ring can leave zero-width slivers running along the edge of the box, which
+//are harmless for filling, and the reason why edges along the box are drawn differently anyway.
+ring_t clip_ring( const ring_t &ring, const box_t &box );
+
+//The part of the polygon inside the box, or nothing if the outer ring is entirely outside
+bool clip_polygon( const polygon_t &poly, const box_t &box, polygon_t &out );
+
+//Position of cell x, y along the Hilbert curve through a grid 2^order cells across, which visits
+//every cell once, and never jumps, so cells close along the curve are close on the map
+::uint64_t hilbert_index( int order, ::uint64_t x, ::uint64_t y );
+
+}
@@ -3,6 +3,7 @@
 #include "types.hpp"
 #include "pointer.hpp"
 #include "pbffile.hpp"
+#include "osmfile.hpp"
 
 namespace leapus::astrolib::index{
 
@@ -18,6 +19,8 @@ enum index_entry_type{
     //boolean operations like subtraction (holes). So, I think we will
     //start out just rendering edges (lines). The upshot is that it will
     //be really efficient, and it will have kind of a retro Tron look to it.
+    //For something less retro, an index can be built with triangulate set, and then
+    //every polygon comes with the triangles to fill it, holes and all, see index_entry::fill.
     idx_poly,
 
     //A textual label
@@ -32,8 +35,6 @@ using index_allocator = pbf::protobuf_file::allocator_type<T>;
 
 struct index_entry{
 
-    //TODO: Represent the type of element
-
     //For widgets, like textual labels, icons, markers,
     //these bounds are the coverage of the widget when superimposed over the map
     //if the current spatial tree square represented the entire screen.
@@ -49,7 +50,48 @@ struct index_entry{
     //then this is the offset into the index file (not the OSM file) to find
     //the generated OSM object, otherwise this is 0 for null. "address" can point
     //to an associated OSM object from which the detail reduction was derived.
+    //Lines and polygons clipped to their square are generated objects in this sense,
+    //so for those it's their geometry record, see index/geometry_codec.hpp.
     file_offs_t reduction_detail;
+
+    index_entry_type type;
+
+    //For a polygon in an index built with triangulate set, how far past reduction_detail its fill
+    //record is, with the triangles that fill it, or 0 for none, see index/geometry_codec.hpp.
+    //The fill record always comes straight after the geometry record.
+    ::uint32_t fill;
+};
+
+//A leaf's entries are sorted along a Hilbert curve through the square, by their middles, so those
+//near each other in the leaf are near each other on the map. They're then cut into runs of up to
+//entries_per_run, each with the box around everything in it, and a query which only covers part of
+//the leaf can pass over the runs which are nowhere near it, without looking at their entries.
+//Entries close together on the map mostly come from nearby blobs too, so what a query finds
+//comes out roughly grouped by blob, for whatever it looks up next.
+struct entry_run{
+    box_t bounds;
+
+    //The run's entries, within the leaf's
+    ::uint32_t first, count;
+};
+
+inline constexpr ::uint32_t entries_per_run=16;
+
+//The Hilbert curve's grid across a leaf is 2^leaf_hilbert_order cells across
+inline constexpr int leaf_hilbert_order=8;
+
+//A label or widget, as placed so as not to overlap any other, see index/labels.hpp
+struct label_entry{
+    //Its footprint at the scale of the level it's first placed at, which is the biggest it ever is
+    //while it's shown. It halves about its middle, the anchor, at each level further down.
+    box_t bounds;
+
+    osm_address_t address;
+    index_entry_type type;
+
+    //The level it's first placed at. That's the level of the square it's in, except in a leaf,
+    //which also has the labels that are only placed further down.
+    ::uint32_t level;
 };
 
 //A square in a quadtree representing 1/4-1x of a relevant set for rendering.
@@ -63,8 +105,21 @@ struct quadtree_square{
 
     box_t bounds;
 
-    //The four quadrants in the tree if we should get bisected
-    pointer::relative_ptr<quadtree_square> nw,ne,sw,se;
+    //The four quadrants in the tree if we should get bisected. Squares are always all together,
+    //in one run, so the links between them are short ones.
+    pointer::relative_ptr32<quadtree_square> nw,ne,sw,se;
+
+    //What's in the square, for a leaf. Anything crossing the edge of the square has been clipped to it.
+    //Entries are in Hilbert order of their middles, across the square, see entry_run.
+    pointer::relative_span<index_entry> entries;
+
+    //The leaf's entries, in runs, or none if the leaf is small enough to just look through
+    pointer::relative_span<entry_run> runs;
+
+    //Labels and widgets to show from this square's level down, which don't overlap each other or
+    //those of the squares above, highest priority first. For a leaf, also those that only have room
+    //further down, in order of level, and then priority.
+    pointer::relative_span<label_entry> labels;
 };
 
 struct index_config{
@@ -74,7 +129,15 @@ struct index_config{
     //Maximum number of items permitted in an index node
     //before it is bisected. These are index nodes, not map nodes.
     //We will be using quadtrees, so this would be a quad, whether leaf or not. 
-    int node_max_items;
+    int node_max_items=256;
+
+    //Squares stop being bisected this deep no matter what, because a pile of items
+    //at the same spot could never be split up. At the equator, level 24 is about 2m across.
+    int max_depth=24;
+
+    //Triangulate every polygon at the leaves, after it's been clipped, so that a renderer can fill
+    //it without doing that itself for every frame. The triangles take about three bytes apiece.
+    bool triangulate=false;
 
 };
 
@@ -0,0 +1,231 @@
+#pragma once
+
+/*
+*
+* Building the quadtree
+*
+* Items (points, lines and polygons) are collected from any number of threads while the OSM file
+* is being read, and their geometry is spooled to a scratch file alongside the index, since
+* there is far too much of it to keep in memory. Then the tree is bulk-loaded from the top:
+* a square with more than node_max_items items in it is bisected (well, quadrasected),
+* and each item goes down into whichever quadrants it actually touches. A motorway running
+* diagonally across a square doesn't touch all four quadrants, even though its bounding box does.
+*
+* At the leaves, every line and polygon is clipped to the square, so that a way crossing a
+* hundred squares is stored as a hundred small pieces rather than a hundred copies of the whole
+* thing, and a square never has to draw anything outside of itself. With config.triangulate,
+* the clipped polygons are then cut into triangles, for filling.
+*
+* Before any of that, labels and widgets which were given a size are placed, level by level, so
+* that each square knows which of them to show at its scale (see labels.hpp).
+*
+* The tree is built in parallel. The top levels are split up, single-threaded, until each square
+* has no more than a share of the items, and the subtrees under those are then built on a pool of
+* threads, each one into its worker's own arena, a scratch file next to the spool. Once they're all
+* done, what they have is copied into the index in a fixed order, and the squares above them
+* built on top. Where the top levels stop depends only on the items, and a subtree comes out the
+* same in whichever arena it's built, so the index is byte for byte the same however many threads
+* build it.
+*
+* Squares are only kept track of, as square_records, until the very end, when they all go into
+* one run together, so that the links between them are short enough for 32 bits.
+*
+*/
+
+#include <mutex>
+#include <vector>
+#include <string>
+#include <filesystem>
+#include "astrolib/index.hpp"
+#include "astrolib/geometry.hpp"
+#include "astrolib/clip.hpp"
+#include "astrolib/checkpoint.hpp"
+#include "astrolib/index/labels.hpp"
+
+namespace leapus::astrolib::index{
+
+//The whole world, which is the root square
+inline constexpr box_t world_bounds{ { -90'000'000'000, -180'000'000'000 }, { 90'000'000'000, 180'000'000'000 } };
+
+class index_builder{
+public:
+    using size_type=::size_t;
+
+    struct statistics_type{
+        size_type items=0, squares=0, leaves=0, entries=0, depth=0;
+
+        //Entries which are the piece of something larger that was clipped to their square
+        size_type fragments=0;
+
+        //Filling the polygons, when config.triangulate is set
+        size_type triangles=0;
+
+        //Labels and widgets with a size, how many of those were placed at some level,
+        //and how many levels it took to place all that ever would be
+        size_type labels=0, labels_placed=0, label_levels=0;
+    };
+
+private:
+    struct item{
+        box_t bounds;
+        osm_address_t address;
+        index_entry_type type;
+
+        //Points have no geometry beyond their bounds. Otherwise, this is the spool
+        //offset of the part sizes, which are followed by the points of all of the parts.
+        ::uint32_t parts;
+        file_offs_t geometry;
+
+        //For labels and widgets
+        label_metrics label;
+    };
+
+    using ref_list=std::vector<::uint32_t>;
+
+    //A square, until it's time to put them all together. What it has is counted from the start
+    //of the file it was built in, and its quadrants are other records, by index.
+    static constexpr ::uint32_t no_square=~(::uint32_t)0;
+    struct square_record{
+        box_t bounds;
+        ::uint32_t quadrants[4]={ no_square, no_square, no_square, no_square };
+        pointer::based_span<index_entry> entries;
+        pointer::based_span<entry_run> runs;
+        pointer::based_span<label_entry> labels;
+    };
+
+    //Where squares are being built, and everything needed to build them which can't be shared between threads
+    struct build_context{
+        index_allocator<char> alloc;
+        statistics_type stats;
+        std::vector<square_record> squares;
+
+        //Where the file starts, which is what the records count from
+        const char *base() const;
+
+        std::vector<polyline_t> parts, clipped;
+        std::string encoded;
+        std::vector<::uint32_t> triangles;
+    };
+
+    //A subtree, built on its own, and where it ended up in its worker's arena
+    struct subtree{
+        box_t bounds;
+        ref_list refs;
+        size_type depth;
+
+        size_type arena=0;
+        file_offs_t begin=0, end=0;
+        statistics_type stats;
+
+        //Its squares, and which of them is the root
+        std::vector<square_record> squares;
+        ::uint32_t root=no_square;
+    };
+
+    //A square above the subtrees, and what goes in each of its quadrants,
+    //either another such square, or a subtree, or nothing
+    struct top_slot{
+        enum { none, square, sub } kind=none;
+        ::uint32_t index=0;
+    };
+
+    struct top_square{
+        box_t bounds;
+        size_type depth;
+        pointer::based_span<label_entry> labels;
+        top_slot quadrants[4];
+    };
+
+    const index_config &m_config;
+    std::filesystem::path m_spool_path;
+    bool m_keep_spool;
+    io::mmap_file m_spool;
+    io::mmap_allocator<::uint64_t> m_spool_alloc;
+
+    mutable std::mutex m_mutex;
+    std::vector<item> m_items;
+    statistics_type m_stats;
+
+    //Only valid during build()
+    const char *m_spool_base=nullptr;
+    std::vector<subtree> m_subtrees;
+    std::vector<top_square> m_top;
+
+    //By item, the level that a label or widget is first placed at, or unplaced, and where it comes in order of priority
+    static constexpr ::uint8_t unplaced=0xff;
+    std::vector<::uint8_t> m_label_level;
+    std::vector<::uint32_t> m_label_rank;
+
+    void add( const item &it, const std::vector<const polyline_t *> &parts );
+    void parts_of( const item &it, std::vector<polyline_t> &out ) const;
+    bool touches( const item &it, const box_t &box ) const;
+
+    //Work out a square's quadrants, and which of refs go in each, or return false if it's to be a leaf
+    bool split( const box_t &box, const ref_list &refs, size_type depth, box_t quadrants[4], ref_list children[4] ) const;
+
+    //These return the record of the square they built, in ctx.squares, or no_square for an empty one
+    ::uint32_t build_square( build_context &ctx, const box_t &box, ref_list &refs, size_type depth );
+    ::uint32_t build_leaf( build_context &ctx, const box_t &box, const ref_list &refs, size_type depth );
+
+    //Split up the top levels, down to squares which are small enough to be subtrees of their own,
+    //and then, once the subtrees are built and copied into the index, add the squares above them to
+    //ctx.squares, with their quadrants numbered as they will be once they're all put together, with
+    //subtree i's squares from first[i] on, and ctx.squares from first.back() on
+    top_slot plan( build_context &ctx, const box_t &box, ref_list &refs, size_type depth );
+    ::uint32_t stitch( build_context &ctx, top_slot slot, const std::vector<::uint32_t> &first );
+
+    //Build every subtree, on threads workers, each into its own arena, then copy what they have into
+    //the index, in order. Returns where each one's records now count from.
+    std::vector<const char *> build_subtrees( build_context &ctx, int threads );
+
+    //Write records into squares, from squares[first] on, with their quadrants' indices shifted by shift
+    void put_squares( quadtree_square *squares, const std::vector<square_record> &records, ::uint32_t first,
+        ::uint32_t shift, const char *base ) const;
+
+    //An order of the items that depends only on what they are, and not on when they were added
+    bool canonical_less( ::uint32_t a, ::uint32_t b ) const;
+
+    //Work out which level each label is first placed at, see labels.hpp, with refs in the canonical order
+    void place_labels( const ref_list &refs );
+
+    //The labels among refs to store in a square of the given depth, which are those placed at that
+    //level, or for a leaf, at that level or any below, once they're in the file.
+    pointer::based_span<label_entry> square_labels( build_context &ctx, const ref_list &refs, size_type depth, bool leaf );
+
+    //Sort a leaf's entries into Hilbert order, and its geometry records to match, see entry_run
+    void order_leaf( build_context &ctx, const box_t &box, std::vector<index_entry> &entries );
+
+public:
+    //Geometry is spooled to spool_path, which is removed again when the builder is destroyed.
+    //A kept spool is neither emptied when it's opened nor removed afterwards, so that a checkpointed
+    //build can carry on with it (see restore()), and it's up to the caller to remove it when done.
+    index_builder( const index_config &config, const std::filesystem::path &spool_path, bool keep_spool=false );
+    ~index_builder();
+
+    //For labels and widgets. Thread-safe, as are the other add_*()s. Those with a size are placed so as
+    //not to overlap, and each one's bounds in a leaf are its footprint at the leaf's scale.
+    void add_point( const osm_address_t &address, index_entry_type type, const coordinate_t &pt,
+        const label_metrics &label={} );
+    void add_line( const osm_address_t &address, index_entry_type type, const coordinate_t *pts, ::size_t n );
+    void add_polygon( const osm_address_t &address, const polygon_t &poly );
+
+    //Build the tree out of everything added so far, into config.file_allocator, and return its root,
+    //on threads threads, or one per core for 0. The squares are in one run, in the order they were built,
+    //so this is normally followed by relayout(). The arenas take up as much again as the tree, on the
+    //spool's disk, until it's done.
+    quadtree_square &build( int threads=0 );
+
+    statistics_type statistics() const;
+
+    //For checkpoints, which must be taken while nothing is being added. The items from from onwards
+    //are journaled, and the spool is made durable, and its size is what restore() wants back.
+    size_type size() const;
+    file_offs_t save( journal_writer &journal, size_type from );
+
+    //Cut the spool back to the size save() returned, and add back the items from its journal,
+    //in the order they were saved
+    void truncate_spool( file_offs_t size );
+    void restore( journal_reader &journal );
+};
+
+}
@@ -0,0 +1,138 @@
+#pragma once
+
+/*
+*
+* The index file format
+*
+* Building scatters squares, entries and geometry all over a scratch file, in whatever order
+* the builder got to them, with the garbage of relayout() in between. A finished index is copied
+* out of there into a file of its own, in sections, behind a superblock that says what's where:
+*
+*     superblock                  offset 0, padded out to a page
+*     tree section                every square, in layout order, the root first
+*     entries section             the entries of every leaf, leaf after leaf in tree order
+*     reduction section           the geometry records which entries' reduction_detail point to,
+*                                 each followed by its fill record if it has one
+*     dictionary section          the strings, see string_dictionary.hpp
+*     runs section                each leaf's entry_runs, leaf after leaf in tree order
+*     labels section              each square's labels, square after square in tree order
+*
+* Each section has a checksum, and so does the superblock itself, which also records how long
+* the file is. The superblock is written last, so a file that was cut short, or that is still
+* being written, doesn't pass for an index.
+*
+* An index is written to a temporary file beside its final name, synced, and then renamed over
+* whatever was there. Anybody who has the old index open keeps the old one, and anybody opening
+* it afterwards gets the new one, complete. There's never a moment without an index.
+*
+*/
+
+#include <filesystem>
+#include "astrolib/index.hpp"
+#include "astrolib/exception.hpp"
+#include "astrolib/index/layout.hpp"
+#include "astrolib/index/string_dictionary.hpp"
+
+namespace leapus::astrolib::index{
+
+class index_format_exception:public exception::exception{
+public:
+    using exception::exception;
+};
+
+inline constexpr char index_magic[8]={ 'A', 'S', 'T', 'R', 'I', 'D', 'X', '\0' };
+
+//Bumped whenever anything about the layout of the file or its structures changes
+inline constexpr ::uint32_t index_version=5;
+
+enum section_kind: ::uint32_t{
+    section_tree=1,
+    section_entries,
+    section_reduction,
+    section_dictionary,
+    section_runs,
+    section_labels
+};
+
+struct section_header{
+    ::uint32_t kind;
+    ::uint32_t crc;
+    file_offs_t offset;
+    ::uint64_t size;
+};
+
+struct superblock{
+    char magic[8];
+    ::uint32_t version;
+    ::uint32_t section_count;
+    ::uint64_t file_size;
+
+    //Where the root square is, inside the tree section
+    file_offs_t root;
+
+    static constexpr ::size_t max_sections=8;
+    section_header sections[max_sections];
+
+    //Of everything above
+    ::uint32_t crc;
+};
+
+inline constexpr ::size_t superblock_size=4096;
+static_assert(sizeof(superblock) <= superblock_size);
+
+//What write_index() wrote, for the record
+struct index_summary{
+    file_offs_t root=0;
+    ::uint64_t squares=0, entries=0, runs=0, labels=0, reduction_bytes=0, dictionary_bytes=0, file_size=0;
+};
+
+//Copy the tree below root, with everything it refers to, out of source, where it was built, into a
+//fresh index file at path, laid out in the given order, along with the strings. It goes by way of
+//path + ".tmp", and is only renamed to path once it's completely on the disk.
+index_summary write_index( const std::filesystem::path &path, const io::mmap_file &source,
+    const quadtree_square &root, const string_interner &strings,
+    layout_order order=layout_order::van_emde_boas, ::size_t page_size=4096 );
+
+//An index file, opened and checked. Throws index_format_exception if it isn't one, or if it's
+//for a different version, or incomplete. The sections' own checksums are only checked by verify(),
+//since that means reading the whole thing.
+class index_file{
+    io::mmap_file m_file;
+    const char *m_base=nullptr;
+    const superblock *m_super=nullptr;
+    string_dictionary m_dictionary;
+
+public:
+    explicit index_file( const std::filesystem::path &path );
+
+    index_file( const index_file & ) = delete;
+
+    const superblock &header() const{
+        return *m_super;
+    }
+
+    //The section of the given kind, or nullptr if there isn't one
+    const section_header *section( section_kind kind ) const;
+
+    const quadtree_square &root() const{
+        return *(const quadtree_square *)(m_base + m_super->root);
+    }
+
+    const string_dictionary &dictionary() const{
+        return m_dictionary;
+    }
+
+    //Where file offsets, such as reduction_detail, are relative to
+    const char *base() const{
+        return m_base;
+    }
+
+    //Read every section, and throw index_format_exception if any of them doesn't match its checksum
+    void verify() const;
+
+    //Ask for the tree, the entries, their runs, the labels and the dictionary to be read in ahead of the first queries,
+    //since those are what every query touches. The geometry is left to fault in as it's needed.
+    void prefetch() const;
+};
+
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+/*
+*
+* The compact geometry stored with index entries
+*
+* Every line or polygon entry points (by reduction_detail) at a record of its own geometry, clipped
+* to its square. The record is a varint count of parts, and for each part a varint count of points
+* followed by the points themselves, as zigzag varint deltas from the previous point. The first
+* point of the first part is a delta from the south-west corner of the square, so that even at
+* the top of the tree nothing takes more than a few bytes. A line has one part, and a polygon has
+* its outer ring followed by its holes.
+*
+* This is the same trick PBF itself plays with DenseNodes and way refs.
+*
+* A polygon in an index built with triangulation also has a fill record, straight after its geometry
+* record, with the triangles that fill it (see triangulate.hpp). The points are the geometry record's,
+* numbered through the parts in turn, so the fill record is just the indices: a varint count of
+* triangles, and then three indices apiece, as zigzag varint deltas from the index before. An ear is
+* three points next to each other, so most of those deltas are a byte.
+*
+*/
+
+#include <string>
+#include <vector>
+#include "astrolib/clip.hpp"
+
+namespace leapus::astrolib::index{
+
+//One or more parts, each a polyline or a closed ring
+using geometry_parts=std::vector<polyline_t>;
+
+//Append a record of the parts, relative to origin, to out
+void encode_geometry( std::string &out, const coordinate_t &origin, const geometry_parts &parts );
+
+//The same, for a single part
+void encode_geometry( std::string &out, const coordinate_t &origin, const coordinate_t *pts, ::size_t n );
+
+//Read a record back into parts, and return the address just past it
+const char *decode_geometry( const char *p, const coordinate_t &origin, geometry_parts &parts );
+
+//Append a fill record of the triangles, three indices apiece, to out
+void encode_fill( std::string &out, const std::vector<::uint32_t> &triangles );
+
+//Read a fill record back into triangles, and return the address just past it
+const char *decode_fill( const char *p, std::vector<::uint32_t> &triangles );
+
+}
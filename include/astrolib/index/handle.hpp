@@ -0,0 +1,129 @@
+#pragma once
+
+/*
+*
+* An index that can be replaced while it's being queried
+*
+* A renderer runs for weeks, and the index under it is rebuilt every day. Since write_index()
+* publishes a new index by renaming it over the old one, the renderer only has to open it again,
+* but whatever queries are running at the time are still reading the old mapping, so it can't just
+* be unmapped out from under them.
+*
+* So queries go through a reader, which pins whichever index was current when it was acquired.
+* swap() opens the new one, warms it up, and makes it current for every reader acquired from then on.
+* The old one is retired, and unmapped as soon as the last reader which might still be using it is
+* gone. That's read-copy-update, with epochs telling when a retired index is no longer in use:
+*
+*     Each thread has a slot, shared by every handle, in which it posts the global epoch when it
+*     starts reading, and which it clears again when it's done. A swap bumps the epoch after it has
+*     replaced the current index, and notes which epoch the old one was retired in. Once no slot
+*     holds that epoch or an earlier one, nobody can still be looking at it.
+*
+* Acquiring a reader costs a couple of uncontended stores to the thread's own slot, rather than a
+* reference count that every query in the process would bounce between cores. Readers may nest,
+* on any number of handles, but a reader must be released on the thread which acquired it.
+*
+*/
+
+#include <mutex>
+#include <atomic>
+#include <vector>
+#include <filesystem>
+#include "astrolib/index/container.hpp"
+
+namespace leapus::astrolib::index{
+
+class index_handle{
+    struct snapshot{
+        index_file file;
+        ::uint64_t generation;
+
+        snapshot( const std::filesystem::path &path, ::uint64_t gen ):
+            file(path),
+            generation(gen){}
+    };
+
+    std::filesystem::path m_path;
+    std::atomic<snapshot *> m_current=nullptr;
+
+    //Replaced indexes, each with the epoch it was retired in, waiting for their readers to finish
+    mutable std::mutex m_mutex;
+    mutable std::vector<std::pair<snapshot *, ::uint64_t>> m_retired;
+    mutable std::atomic<::size_t> m_retired_count=0;
+
+    //Unmap whichever retired indexes nobody can be reading any more
+    void reclaim() const;
+
+    //Must be called with m_mutex held
+    void reclaim_locked() const;
+
+public:
+    //A pin on the current index, for the length of a query or so
+    class reader{
+        const index_handle *m_handle=nullptr;
+        const snapshot *m_snapshot=nullptr;
+
+        friend class index_handle;
+        reader( const index_handle &handle );
+
+    public:
+        reader() = default;
+        reader( reader &&rhs );
+        reader &operator=( reader &&rhs );
+        ~reader();
+
+        reader( const reader & ) = delete;
+
+        const index_file &operator*() const{
+            return m_snapshot->file;
+        }
+
+        const index_file *operator->() const{
+            return &m_snapshot->file;
+        }
+
+        explicit operator bool() const{
+            return m_snapshot;
+        }
+
+        //Which index this is, counting from 1 for the one the handle was opened with
+        ::uint64_t generation() const{
+            return m_snapshot->generation;
+        }
+
+        //Unpin, before the reader goes out of scope
+        void release();
+    };
+
+    //Open the index at path, or throw index_format_exception
+    explicit index_handle( const std::filesystem::path &path );
+
+    //There mustn't be any readers left
+    ~index_handle();
+
+    index_handle( const index_handle & ) = delete;
+
+    reader acquire() const{
+        return reader{ *this };
+    }
+
+    //Open the index at path, check it, warm it up, and make it current. If it can't be opened,
+    //or fails its checks, this throws index_format_exception, and the current index stays current.
+    //With verify, every section's checksum is checked, which means reading the whole file.
+    //Returns the new generation.
+    ::uint64_t swap( const std::filesystem::path &path, bool verify=true );
+
+    //swap() in whatever is at the path the handle was opened with, for after a rebuild
+    ::uint64_t reload( bool verify=true ){
+        return swap(m_path, verify);
+    }
+
+    ::uint64_t generation() const;
+
+    //Replaced indexes still mapped because readers might be using them
+    ::size_t retired() const{
+        return m_retired_count.load();
+    }
+};
+
+}
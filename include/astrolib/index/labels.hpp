@@ -0,0 +1,88 @@
+#pragma once
+
+/*
+*
+* Placing labels and widgets so that they don't overlap
+*
+* A map with every place name and every shop icon drawn is a black smudge, so at each zoom, only
+* some of them can be shown, and which ones shouldn't change from one frame to the next, or pop in
+* and out as the map pans. Working that out needs everything nearby, which a renderer drawing one
+* tile doesn't have, so it's done once, for the whole map, while indexing.
+*
+* Each label or widget has a size on screen, in pixels, and a priority (see tag_filter.hpp). A level
+* of the quadtree is shown with one of its squares label_screen_pixels across, which gives each
+* label a footprint in nanodegrees at that level, centred where it's anchored, halving at each level
+* down. Level by level from the top, labels are then placed greedily, highest priority first: a label
+* whose footprint overlaps one already placed is left out, until a level further down, where the
+* footprints are smaller. A label placed at one level is placed at every level below it too, since
+* boxes which didn't overlap still don't once they're halved about their centres, so those go first.
+* Overlaps are found with a spatial hash, a grid of cells about as big as a typical label.
+*
+* Every square then has the labels placed at its own level for the first time, anchored inside it
+* (quadtree_square::labels). What to show at a level is those of the squares from the root down to
+* that level, and a leaf also has all of the labels first placed at levels below it, since there
+* aren't any squares down there, so each label_entry says which level it's from.
+* See for_each_label() in query.hpp.
+*
+*/
+
+#include <vector>
+#include <algorithm>
+#include <string_view>
+#include <unordered_map>
+#include "astrolib/index.hpp"
+
+namespace leapus::astrolib::index{
+
+//How many pixels across a square is when it's the one being shown. A Web Mercator tile, at 512
+//pixels as vector tiles usually are, spans as many degrees of longitude as a square at the level
+//of the tile's zoom does.
+inline constexpr int label_screen_pixels=512;
+
+//How big a label or widget is on screen, in pixels, and which of two that collide wins
+struct label_metrics{
+    ::uint16_t width=0, height=0;
+    ::int32_t priority=0;
+};
+
+//Text, in UTF-8, in a nominal 12 pixel sans-serif, with a little space around it, or a dot
+//if there isn't any text
+label_metrics measure_label( std::string_view text, ::int32_t priority );
+
+//An icon
+label_metrics measure_widget( ::int32_t priority );
+
+//Where a label anchored at pt is on the map, at the scale of a square square_width nanodegrees
+//of longitude across. A label with no size is just its anchor.
+box_t label_footprint( const coordinate_t &pt, const label_metrics &metrics, ordinate_t square_width );
+
+//A placed label's footprint at a level at or below the one it was placed at
+inline box_t label_footprint( const label_entry &label, int level ){
+    const box_t &b=label.bounds;
+    int shift=std::max(level - (int)label.level, 0);
+    ordinate_t half_height=(b.ne.lat - b.sw.lat) / 2 >> shift, half_width=(b.ne.lon - b.sw.lon) / 2 >> shift;
+    coordinate_t mid{ b.sw.lat + (b.ne.lat - b.sw.lat) / 2, b.sw.lon + (b.ne.lon - b.sw.lon) / 2 };
+    return { { mid.lat - half_height, mid.lon - half_width }, { mid.lat + half_height, mid.lon + half_width } };
+}
+
+//Footprints placed so far at one level, in a grid of cells, to find the ones a new footprint overlaps
+class label_grid{
+    ordinate_t m_cell=1;
+    std::vector<box_t> m_placed;
+    std::unordered_map<::uint64_t, std::vector<::uint32_t>> m_cells;
+
+    template<typename Func>
+    void for_each_cell( const box_t &b, Func &&func );
+
+public:
+    //Start over, with cells cell nanodegrees across
+    void reset( ordinate_t cell );
+
+    //Place b, if it doesn't overlap anything already placed, and return whether it did
+    bool place( const box_t &b );
+
+    //Place b, without checking
+    void add( const box_t &b );
+};
+
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+/*
+*
+* On-disk ordering of quadtree squares
+*
+* The allocator bumps squares into the index file in whatever order the builder happened to
+* create them, so a root-to-leaf descent tends to land on a different page at every level.
+* On a cold cache, every one of those is a page fault. The layout pass copies a finished tree
+* into one contiguous run of squares, ordered so that squares which are visited together
+* during a descent are stored together.
+*
+*/
+
+#include <vector>
+#include "astrolib/index.hpp"
+
+namespace leapus::astrolib::index{
+
+enum class layout_order{
+
+    //Leave the squares where the builder put them
+    as_built,
+
+    //Cache-oblivious van Emde Boas order. The tree is cut at half its height, the top half
+    //is laid out recursively, followed by each of the bottom subtrees, also recursively.
+    //Whatever the page (or cache line) size, a descent of height h crosses about
+    //log(h) blocks, rather than h of them.
+    van_emde_boas,
+
+    //Fixed blocks of as many levels as fit in a page, breadth-first within each block,
+    //and the blocks themselves in depth-first order. Tuned for the page size, whereas
+    //van_emde_boas isn't tuned for anything in particular.
+    level_blocked
+};
+
+//The order in which the squares of the tree below root would be laid out.
+//The root comes first, except for as_built, which is simply file order.
+std::vector<const quadtree_square *> layout_sequence( const quadtree_square &root,
+    layout_order order, ::size_t page_size=4096);
+
+//Copy the tree below root into one contiguous run of squares allocated from alloc, in the given order,
+//and return the new root, which is the first square of the run. The old squares are left behind as garbage,
+//since the allocator never frees anything. With layout_order::as_built, nothing is copied and root is returned.
+quadtree_square &relayout( const quadtree_square &root, index_allocator<quadtree_square> alloc,
+    layout_order order=layout_order::van_emde_boas, ::size_t page_size=4096 );
+
+//Number of levels in the tree below root, counting root itself as one
+int tree_height( const quadtree_square &root );
+
+}
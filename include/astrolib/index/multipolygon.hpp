@@ -0,0 +1,119 @@
+#pragma once
+
+/*
+*
+* Assembling multipolygon relations into polygons
+*
+* A type=multipolygon relation is just a bag of member ways. Their ends have to be joined up
+* into closed rings by matching endpoint node IDs, and the rings sorted out into outers and
+* the holes (inners) inside them. Member roles say which is which, but they are wrong often
+* enough that it's decided geometrically instead: a ring nested inside an odd number of others
+* is a hole.
+*
+* Coastlines and administrative boundaries make for gigantic relations, and there are millions
+* of relations overall, so the relations are processed in batches with a cap on the number of
+* member ways per batch. For each batch:
+*
+*   1. begin_batch() lists the member ways it needs
+*   2. add_ways() is fed every way block, from any number of threads, and keeps just those
+*   3. assemble() puts each relation of the batch together, also from any number of threads
+*   4. end_batch() lets go of the ways
+*
+*/
+
+#include <mutex>
+#include <vector>
+#include <unordered_map>
+#include "astrolib/geometry.hpp"
+#include "astrolib/node_store.hpp"
+#include "astrolib/primitives.hpp"
+#include "astrolib/index.hpp"
+#include "astrolib/checkpoint.hpp"
+
+namespace leapus::astrolib::index{
+
+struct multipolygon_relation{
+    osm::osm_id id;
+    osm_address_t address;
+    std::vector<osm::osm_id> ways;
+};
+
+struct multipolygon{
+    osm::osm_id id;
+    osm_address_t address;
+    std::vector<polygon_t> polygons;
+};
+
+class multipolygon_assembler{
+public:
+    using size_type=::size_t;
+
+    struct statistics_type{
+        size_type relations=0, assembled=0, polygons=0, holes=0;
+
+        //Relations with at least one ring that couldn't be closed, or a way or node missing from the file
+        size_type incomplete=0;
+    };
+
+    //A block's string table indices for the few strings we care about
+    class block_strings{
+        int m_type, m_multipolygon;
+        friend class multipolygon_assembler;
+
+    public:
+        block_strings( const OSMPBF::StringTable &strings );
+    };
+
+private:
+    const node_store &m_nodes;
+    size_type m_max_batch_members;
+
+    std::mutex m_mutex;
+    std::vector<multipolygon_relation> m_relations;
+    std::vector<size_type> m_batch_starts;
+
+    //The current batch's member ways, by ID. The keys are all filled in by begin_batch(), so that add_ways()
+    //never changes the table's structure and can run without a lock. Way IDs are unique,
+    //so no two threads ever write the same entry.
+    std::unordered_map<osm::osm_id, std::vector<osm::osm_id>> m_ways;
+    size_type m_batch=0;
+
+    statistics_type m_stats;
+
+    bool stitch( const std::vector<const std::vector<osm::osm_id> *> &ways, std::vector<ring_t> &rings ) const;
+
+public:
+    multipolygon_assembler( const node_store &nodes, size_type max_batch_members=(size_type)20*1000*1000 );
+
+    //If rel is a multipolygon, keep its member ways for later. Thread-safe.
+    bool add_relation( const OSMPBF::Relation &rel, const block_strings &strings, const osm_address_t &address );
+
+    //Split the relations collected so far into batches, and return how many there are
+    size_type plan_batches();
+
+    //The relations of the current batch are [0, batch_size())
+    void begin_batch( size_type batch );
+    size_type batch_size() const;
+
+    //Keep whichever of the block's ways the current batch needs. Thread-safe.
+    void add_ways( const OSMPBF::PrimitiveBlock &block );
+
+    //Put together the i'th relation of the current batch. Thread-safe.
+    //Returns false if nothing at all could be made of it.
+    bool assemble( size_type i, multipolygon &out );
+
+    void end_batch();
+
+    statistics_type statistics();
+
+    //For checkpoints, while nothing is being added: journal the relations from from onwards, in the
+    //order they were added, and read them back in. Relations are only collected before plan_batches().
+    size_type size();
+    void save( journal_writer &journal, size_type from );
+    void restore( journal_reader &journal );
+
+    //What assemble() had counted, as of a checkpoint between batches
+    void restore_statistics( const statistics_type &stats );
+};
+
+}
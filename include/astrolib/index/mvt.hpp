@@ -0,0 +1,115 @@
+#pragma once
+
+/*
+*
+* Mapbox Vector Tiles, straight out of a query
+*
+* A tile is a protobuf message, but it's written here byte by byte rather than built up as
+* generated message objects and serialized, which would allocate for every feature, point and
+* string. Features go into one layer per index_entry_type, since a tile's layers each have to be
+* contiguous, while a query turns up entries of every type in whatever order the tree has them.
+*
+* Geometry is Web Mercator, in integer tile coordinates from 0 to extent across with y pointing
+* down, and written as the spec's command stream: MoveTo, LineTo and ClosePath, each point as a
+* zigzag delta from the one before. Lines and rings are clipped to the tile plus a buffer all
+* around, points which round to the same tile coordinate as the one before are dropped, and
+* whatever is left too small to draw is dropped altogether. Outer rings are wound clockwise on
+* screen, and holes counterclockwise, as the spec wants.
+*
+* Tag keys and values are string_ids from the index's dictionary. Each layer's key and value
+* tables list the IDs it uses, and the strings are copied straight from the mapped dictionary
+* into the tile. Values are always strings, as they are in OSM.
+*
+* An encoder keeps its buffers from one tile to the next, so once it has warmed up, encoding
+* allocates nothing much. Keep one per thread.
+*
+*/
+
+#include <string>
+#include <vector>
+#include <utility>
+#include <string_view>
+#include <unordered_map>
+#include "astrolib/index.hpp"
+#include "astrolib/geometry.hpp"
+#include "astrolib/index/geometry_codec.hpp"
+#include "astrolib/index/string_dictionary.hpp"
+
+namespace leapus::astrolib::index{
+
+//The box covered by Web Mercator tile x, y at zoom z
+box_t tile_bounds( int z, int x, int y );
+
+class mvt_encoder{
+public:
+    using tag_type=std::pair<string_id, string_id>;
+
+private:
+    struct layer{
+        const char *name;
+        std::string features;
+        ::size_t feature_count=0;
+
+        //string_id to this layer's index for it, and the IDs in index order
+        std::unordered_map<string_id, ::uint32_t> key_index, value_index;
+        std::vector<string_id> keys, values;
+
+        void clear();
+    };
+
+    unsigned m_extent, m_buffer;
+    const string_dictionary *m_dictionary=nullptr;
+    layer m_layers[idx_widget+1];
+
+    //The tile being encoded, in Mercator fractions of the world across, and the clipping box
+    double m_x0=0, m_y0=0, m_scale_x=0, m_scale_y=0;
+    box_t m_clip{};
+
+    //Scratch, kept to save reallocating it for every feature
+    geometry_parts m_parts;
+    std::vector<polyline_t> m_pieces;
+    std::vector<::int32_t> m_points;
+    std::vector<::uint32_t> m_commands, m_tags;
+    std::string m_feature, m_tile;
+
+    void project( const coordinate_t &c, ::int32_t &x, ::int32_t &y ) const;
+
+    //Project pts into m_points as x, y pairs, dropping repeats, and return how many are left
+    ::size_t project_run( const coordinate_t *pts, ::size_t n );
+
+    void encode_line( const coordinate_t *pts, ::size_t n, ::int32_t &cx, ::int32_t &cy );
+    bool encode_ring( const ring_t &ring, bool outer, ::int32_t &cx, ::int32_t &cy );
+
+    //Append the geometry type, and m_commands, and m_tags, as a feature of layer l
+    void write_feature( layer &l, unsigned type, ::uint64_t id );
+
+public:
+    //Extent is the tile's width in tile coordinates, and buffer how far geometry may run outside it
+    mvt_encoder( unsigned extent=4096, unsigned buffer=64 );
+
+    mvt_encoder( const mvt_encoder & ) = delete;
+
+    //Start a tile covering bounds, with tags from dictionary, which must stay put until finish()
+    void begin( const box_t &bounds, const string_dictionary &dictionary );
+
+    //Add an entry found by a query, whose geometry is in the index mapped at base. Returns false
+    //if it came to nothing once clipped and rounded. id, if not zero, becomes the feature's ID.
+    bool add( const quadtree_square &sq, const index_entry &e, const char *base,
+        const tag_type *tags=nullptr, ::size_t tag_count=0, ::uint64_t id=0 );
+
+    //The finished tile, which stays valid until the next begin()
+    std::string_view finish();
+
+    ::size_t feature_count() const;
+
+    unsigned extent() const{
+        return m_extent;
+    }
+
+    //The tile begun, with the buffer around it, which is as far as anything added gets drawn
+    const box_t &clip() const{
+        return m_clip;
+    }
+};
+
+}
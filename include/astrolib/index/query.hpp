@@ -0,0 +1,74 @@
+#pragma once
+
+/*
+*
+* Finding what's in the index inside a box
+*
+*/
+
+#include "astrolib/index.hpp"
+#include "astrolib/geometry.hpp"
+#include "astrolib/index/labels.hpp"
+
+namespace leapus::astrolib::index{
+
+//Calls func(square, entry) for every entry whose bounds touch box, in the leaves below sq.
+//An entry belongs to exactly the square it's stored in, and its geometry (if any) is relative
+//to the corner of that square, hence passing both. Within a leaf, entries come in Hilbert order.
+template<typename Func>
+void for_each_entry( const quadtree_square &sq, const box_t &box, Func &&func ){
+    if(!intersects(sq.bounds, box))
+        return;
+
+    const index_entry *entries=sq.entries.data();
+
+    if(!sq.runs.empty() && !contains(box, sq.bounds)){
+        for(const entry_run &run: sq.runs){
+            if(!intersects(run.bounds, box))
+                continue;
+
+            const index_entry *e=entries + run.first;
+            for( ::uint32_t i=0; i < run.count; ++i )
+                if(intersects(e[i].bounds, box))
+                    func(sq, e[i]);
+        }
+    }
+    else{
+        for(const index_entry &e: sq.entries)
+            if(intersects(e.bounds, box))
+                func(sq, e);
+    }
+
+    for( auto *c: { sq.nw.get(), sq.ne.get(), sq.sw.get(), sq.se.get() } )
+        if(c)
+            for_each_entry(*c, box, func);
+}
+
+//Calls func(square, label) for every label and widget to show at the given level whose footprint there
+//touches box, which are those placed at or above that level in the squares from sq down, see index/labels.hpp.
+//None of them overlap, at that level's scale, at which label_footprint() gives their footprints.
+//Labels are found by the square they're anchored in, so one anchored just outside of box, whose
+//footprint reaches into it, isn't found unless box is padded to allow for that.
+template<typename Func>
+void for_each_label( const quadtree_square &sq, const box_t &box, int level, Func &&func, int depth=0 ){
+    if(!intersects(sq.bounds, box))
+        return;
+
+    //In a leaf, those from further down come last
+    for( const label_entry &l: sq.labels ){
+        if((int)l.level > level)
+            break;
+
+        if(intersects(label_footprint(l, level), box))
+            func(sq, l);
+    }
+
+    if(depth >= level)
+        return;
+
+    for( auto *c: { sq.nw.get(), sq.ne.get(), sq.sw.get(), sq.se.get() } )
+        if(c)
+            for_each_label(*c, box, level, func, depth+1);
+}
+
+}
@@ -0,0 +1,143 @@
+#pragma once
+
+/*
+*
+* One dictionary of strings for the whole index
+*
+* Every PrimitiveBlock has its own StringTable, so the same few hundred keys and values,
+* "highway", "name", "building", would otherwise be hashed and compared over and over, once
+* per block. Instead, each block's string indices are mapped onto global IDs in one pass, and
+* from then on, the indexer, the index file, and queries against it deal only in those.
+*
+* string_interner assigns the IDs while building, from any number of threads at once.
+* Its strings are written into the index file as a dictionary section, which string_dictionary
+* reads back, mapped straight out of the file.
+*
+*/
+
+#include <mutex>
+#include <memory>
+#include <atomic>
+#include <vector>
+#include <string_view>
+#include "astrolib/index.hpp"
+
+namespace leapus::astrolib::index{
+
+using string_id=::uint32_t;
+static constexpr string_id no_string=~(string_id)0;
+
+//The dictionary's hash table is on disk, so this has to stay the same everywhere, forever,
+//unlike std::hash. It's FNV-1a with a final mix, since FNV's top bits are weak and those are
+//the ones the tables use.
+inline ::uint64_t hash_string(std::string_view s){
+    ::uint64_t h=0xcbf29ce484222325ull;
+    for(unsigned char c: s){
+        h^=c;
+        h*=0x100000001b3ull;
+    }
+
+    h^=h >> 33;
+    h*=0xff51afd7ed558ccdull;
+    h^=h >> 33;
+    return h;
+}
+
+class string_interner{
+    //Strings are looked up by hash in shards, each with its own lock and arena,
+    //so that threads interning different blocks seldom contend
+    static constexpr int shard_bits=6;
+
+    struct shard{
+        std::mutex mutex;
+
+        //Open addressing, each slot the top 32 bits of the hash, followed by the ID + 1 in the bottom 32.
+        //0 is an empty slot.
+        std::vector<::uint64_t> slots;
+        ::size_t count=0;
+
+        //Where the strings themselves live. Chunks are never moved or freed, so views into them stay valid.
+        std::vector<std::unique_ptr<char[]>> chunks;
+        ::size_t chunk_used=0, chunk_size=0;
+
+        std::string_view store(std::string_view s);
+    };
+
+    //ID to string, in pages allocated as needed, so that IDs can be looked up without any lock
+    static constexpr int page_bits=16;
+    static constexpr ::size_t max_pages=(::size_t)1 << (32-page_bits);
+
+    std::unique_ptr<shard[]> m_shards;
+    std::unique_ptr<std::atomic<std::string_view *>[]> m_pages;
+    std::atomic<string_id> m_next_id=0;
+
+    string_id insert(shard &sh, std::string_view s, ::uint64_t hash);
+    void grow(shard &sh);
+    std::string_view *slot_for(string_id id);
+
+public:
+    string_interner();
+    ~string_interner();
+
+    string_interner(const string_interner &) = delete;
+
+    //Returns the ID of s, adding it if it's new. IDs are dense, starting from zero,
+    //and never change once assigned.
+    string_id intern(std::string_view s);
+
+    //Map every string of a block's table to its global ID, by table index. If wanted is given,
+    //only the strings it flags are interned, and the rest map to no_string.
+    //Each shard is locked just once per block.
+    std::vector<string_id> intern( const OSMPBF::StringTable &strings, const std::vector<bool> *wanted=nullptr );
+
+    //Only valid for IDs which have been returned by intern()
+    std::string_view str(string_id id) const;
+
+    ::size_t size() const{
+        return m_next_id.load();
+    }
+
+    //Append the dictionary section to the index file, returning its position.
+    //Nothing should be interning while this runs.
+    file_offs_t write( index_allocator<char> alloc ) const;
+};
+
+/*
+The dictionary section, as written:
+
+    dictionary_header
+    ::uint64_t offsets[count+1]         string i is the bytes [offsets[i], offsets[i+1]) from the section start
+    ::uint32_t hash_slots[slot_count]   open addressing by string hash, each the ID + 1 or 0 for empty
+    the string bytes
+*/
+struct dictionary_header{
+    ::uint32_t count;
+    ::uint32_t slot_count;
+};
+
+//A dictionary section mapped straight out of the index file
+class string_dictionary{
+    const char *m_base=nullptr;
+    const dictionary_header *m_header=nullptr;
+    const ::uint64_t *m_offsets=nullptr;
+    const ::uint32_t *m_slots=nullptr;
+
+public:
+    string_dictionary() = default;
+
+    //base is the start of the section inside the mapped file
+    string_dictionary(const char *base);
+
+    ::size_t size() const{
+        return m_header ? m_header->count : 0;
+    }
+
+    std::string_view operator[](string_id id) const{
+        return { m_base + m_offsets[id], m_offsets[id+1] - m_offsets[id] };
+    }
+
+    //The ID of s, or no_string if the index never saw it
+    string_id find(std::string_view s) const;
+};
+
+}
@@ -0,0 +1,121 @@
+#pragma once
+
+/*
+*
+* Deciding which OSM objects make it into the index, and as what
+*
+* Most of what's in the planet file never gets rendered, so the indexer classifies each object
+* by its tags against a list of rules, the style, and drops whatever doesn't match anything.
+* Tags are stored as indices into each block's StringTable, so rather than comparing strings
+* for every tag of every object, the style is resolved against the string table once per block,
+* and the hot loop compares integers.
+*
+* A style is a text file with one rule per line. The first rule that matches wins.
+*
+*   #kinds          tag                 result      priority
+*   way             building=no         drop
+*   way,relation    building=*          poly
+*   way             highway             line
+*   node            place=city          label       100
+*
+* kinds is a comma-separated list of node, way, relation, or any. A tag without a value, or with
+* the value *, matches any value. The result is one of line, poly, label, widget, or drop.
+* The priority, which is optional and 0 if not given, decides which of two labels or widgets
+* that would overlap on screen is kept (see labels.hpp). Higher wins.
+*
+*/
+
+#include <string>
+#include <vector>
+#include <istream>
+#include <optional>
+#include <unordered_map>
+#include "astrolib/index.hpp"
+
+namespace leapus::astrolib::index{
+
+enum element_kind:unsigned{
+    el_node=1,
+    el_way=2,
+    el_relation=4,
+    el_any=el_node | el_way | el_relation
+};
+
+struct tag_rule{
+    unsigned kinds=el_any;
+    std::string key;
+
+    //Empty matches any value
+    std::string value;
+
+    //nullopt drops whatever matches
+    std::optional<index_entry_type> type;
+
+    int priority=0;
+};
+
+class style_parse_exception:public exception::exception{
+public:
+    using exception::exception;
+};
+
+class tag_filter{
+    std::vector<tag_rule> m_rules;
+
+    //Rule indices, in order, by key and by value
+    std::vector<std::vector<int>> m_key_rules;
+    std::unordered_map<std::string, int> m_key_index;
+    std::unordered_map<std::string, std::vector<int>> m_value_rules;
+
+public:
+    using result_type=std::optional<index_entry_type>;
+    using string_id=::uint32_t;
+
+    //The style resolved against one block's string table
+    class resolved{
+        const tag_filter *m_filter;
+
+        //By string table index, which of m_key_rules has that string as its key, or -1
+        std::vector<int> m_key_group;
+
+        //By rule, the string table index of its value, or one of these
+        static constexpr ::int64_t any_value=-1, absent_value=-2;
+        std::vector<::int64_t> m_value_id;
+
+        //Returns the lowest-numbered rule matching the tag, but not if it's >= best
+        int match(element_kind kind, string_id key, string_id val, int best) const;
+        result_type result(int best, int *priority) const;
+
+    public:
+        resolved( const tag_filter &filter, const OSMPBF::StringTable &strings );
+
+        //Nodes, ways and relations, which have parallel keys and vals lists. If priority isn't null,
+        //it's set to the matching rule's priority, or 0 if nothing matched.
+        result_type classify( element_kind kind, const string_id *keys, const string_id *vals, ::size_t n,
+            int *priority=nullptr ) const;
+
+        template<class Element>
+        result_type classify( element_kind kind, const Element &e, int *priority=nullptr ) const{
+            return classify( kind, e.keys().data(), e.vals().data(), e.keys_size(), priority );
+        }
+
+        //One node's worth of DenseNodes::keys_vals, which is key/value pairs ending with a 0.
+        //kv is advanced past the terminator to the next node's tags.
+        result_type classify_dense( const ::int32_t *&kv, const ::int32_t *end, int *priority=nullptr ) const;
+    };
+
+    tag_filter() = default;
+    tag_filter( std::vector<tag_rule> rules );
+
+    //Parses the rule syntax described above, throwing style_parse_exception for nonsense
+    static tag_filter parse( std::istream &in, const std::string &source_name="style" );
+
+    //A reasonable general-purpose map style for when none is given
+    static tag_filter default_style();
+
+    resolved resolve( const OSMPBF::StringTable &strings ) const;
+
+    const std::vector<tag_rule> &rules() const{ return m_rules; }
+};
+
+}
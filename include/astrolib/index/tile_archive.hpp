@@ -0,0 +1,131 @@
+#pragma once
+
+/*
+*
+* Tile archives, a whole pre-rendered tile pyramid in one file
+*
+* Offline clients want every tile down to some zoom, which for a country is millions of them,
+* and millions of small files are slow to write, slow to copy and waste most of a disk block
+* apiece. So they all go into one file instead:
+*
+*     header                      offset 0, padded out to a page
+*     tile data                   appended as tiles are added, in whatever order they come
+*     directory                   a tile_entry per tile, sorted by tile ID
+*
+* Lots of tiles are exactly the same as each other, such as those in the middle of a forest, or
+* of a lake, so tile data is stored once for each distinct tile, and the directory entries of
+* identical tiles all point at the same bytes.
+*
+* Tile IDs number the tiles of each zoom in turn, and within a zoom, along a Hilbert curve, so the
+* directory, and the tile data too if tiles were added roughly in that order, keeps tiles that are
+* near each other on the map near each other in the file. A client panning about touches a few
+* pages of the directory, rather than one for every row of tiles on the screen.
+*
+* Like an index, an archive is written beside its final name and renamed into place once it's
+* complete, with the header, which vouches for the rest, written last.
+*
+*/
+
+#include <mutex>
+#include <vector>
+#include <optional>
+#include <string_view>
+#include <filesystem>
+#include <unordered_map>
+#include "astrolib/index.hpp"
+#include "astrolib/exception.hpp"
+#include "astrolib/io/mmap_file.hpp"
+
+namespace leapus::astrolib::index{
+
+class tile_archive_exception:public exception::exception{
+public:
+    using exception::exception;
+};
+
+inline constexpr char tile_archive_magic[8]={ 'A', 'S', 'T', 'R', 'T', 'I', 'L', '\0' };
+inline constexpr ::uint32_t tile_archive_version=1;
+
+//Every zoom's tiles come after all of those of the zooms above it, along a Hilbert curve
+::uint64_t tile_id( int z, int x, int y );
+
+struct tile_entry{
+    ::uint64_t id;
+    file_offs_t offset;
+    ::uint32_t length;
+    ::uint32_t reserved;
+};
+
+struct tile_archive_header{
+    char magic[8];
+    ::uint32_t version;
+    ::uint8_t min_zoom, max_zoom;
+    ::uint16_t reserved;
+    ::uint64_t file_size;
+
+    file_offs_t directory;
+    ::uint64_t tile_count;
+
+    //Distinct tiles, and the bytes they take up
+    ::uint64_t unique_count;
+    ::uint64_t data_bytes;
+
+    ::uint32_t directory_crc;
+
+    //Of everything above
+    ::uint32_t crc;
+};
+
+inline constexpr ::size_t tile_archive_header_size=4096;
+static_assert(sizeof(tile_archive_header) <= tile_archive_header_size);
+
+//Adds tiles, from any number of threads at once, and writes the archive out with finish()
+class tile_archive_writer{
+    std::filesystem::path m_path, m_temp;
+    io::mmap_file m_file;
+    io::mmap_allocator<char> m_alloc;
+    int m_min_zoom, m_max_zoom;
+
+    std::mutex m_mutex;
+    std::vector<tile_entry> m_directory;
+    ::uint64_t m_unique=0, m_data_bytes=0;
+
+    //Tile data already stored, by its checksum and length, which identical tiles share
+    std::unordered_multimap<::uint64_t, tile_entry> m_stored;
+
+    bool m_finished=false;
+
+public:
+    tile_archive_writer( const std::filesystem::path &path, int min_zoom, int max_zoom );
+    ~tile_archive_writer();
+
+    tile_archive_writer( const tile_archive_writer & ) = delete;
+
+    //Add tile z/x/y, whose bytes are copied. Returns false if an identical tile was already stored.
+    bool add( int z, int x, int y, std::string_view tile );
+
+    //Sort and write the directory, make it all durable, and rename the archive into place
+    tile_archive_header finish();
+};
+
+//An archive, opened and checked. Throws tile_archive_exception if it isn't one, or it's incomplete.
+class tile_archive{
+    io::mmap_file m_file;
+    const char *m_base=nullptr;
+    const tile_archive_header *m_header=nullptr;
+    const tile_entry *m_directory=nullptr;
+
+public:
+    explicit tile_archive( const std::filesystem::path &path );
+
+    tile_archive( const tile_archive & ) = delete;
+
+    const tile_archive_header &header() const{
+        return *m_header;
+    }
+
+    //Tile z/x/y's bytes, or nothing if the archive doesn't have it
+    std::optional<std::string_view> find( int z, int x, int y ) const;
+};
+
+}
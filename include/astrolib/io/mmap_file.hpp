@@ -84,14 +84,29 @@ public:
     size_type size() const override;
 
     virtual pos_type grow(offset_type d);
+
+    //Cut the file back to sz, which also puts allocation back to there. Nothing may be using what's cut off.
+    void truncate(size_type sz);
+
+    //Write dirty pages back and wait until they, and the file's size, are on the disk
+    void sync();
+
+    //The file position of an address inside the mapping, such as one handed out by an mmap_allocator
+    pos_type offset_of(const void *p) const;
     static mmap_file null_file;
 };
 
+//Sync a directory, which is what makes a file created or renamed in it durable
+void sync_directory( const std::filesystem::path &dir );
+
 template<typename T>
 class mmap_allocator:public std::allocator<T>{
     mmap_file *m_file;
     using base_type=std::allocator<T>;
 
+    template<typename U>
+    friend class mmap_allocator;
+
 public:
     using typename base_type::pointer;
     using typename base_type::reference;
@@ -125,7 +140,7 @@ public:
 
         void *p=std::addressof(*m_file->read( pos, chunksz ));
         std::align( alignof(T), sz, p, chunksz);
-        return { p };
+        return (pointer)p;
     }
 
     //This is no-op and the space goes to waste
@@ -133,6 +148,10 @@ public:
         assert(false);
     }
 
+    mmap_file &file() const{
+        return *m_file;
+    }
+
     size_type max_size() const noexcept{
         if( m_file->size() < sizeof(T) + alignof(T) )
             return 0;
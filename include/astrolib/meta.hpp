@@ -6,9 +6,16 @@
 
 #include <cstdint>
 #include <utility>
+#include <type_traits>
 
 namespace leapus::meta{
 
+//C++20's std::type_identity
+template<typename T>
+struct type_identity{
+    using type=T;
+};
+
 //An empty class which can be passed around to represent a type
 //without passing any actual content, and is hopefully readily optimized out
 template<typename T>
@@ -106,60 +113,62 @@ template<typename T, typename U>
 using copy_cv_t=typename copy_cv<T,U>::type;
 
 //
-// Realistically, this is probably dumb because if this were done in a loop, 
-// it would probably get unrolled but whatever.
-// Also, C++23 has native support for this, but I'm not cutting edge enough for that,
-// and neither is Debian.
+// C++20 has std::endian, and C++23 has std::byteswap, but I'm not cutting edge enough for that,
+// and neither is Debian. The compiler knows the target's byte order anyway, and has intrinsics
+// for swapping, which come out as a single instruction (bswap, rev, or a movbe load).
 //
-template<::size_t len, ::size_t i=len-1>
-struct reverse_bytes{
-
-protected:
-    static void reverse_impl( const char *from, char  *to ){
-        to[len-i-1]=from[i];
-    }
-
-public:
-    static void reverse( const char *from, char *to ){
-        reverse_impl(from, to);
-        reverse_bytes<len, i-1>::reverse(from,to);
-    }
-};
-
-template<::size_t len>
-struct reverse_bytes<len, 0>:public reverse_bytes<len, 1>{
-    static void reverse(const char *from, char *to){
-        reverse_bytes<len,1>::reverse_impl(from, to);
-    }
-};
 
+//v with its bytes in the opposite order, for any integer or enum
 template<typename T>
-struct reverse_endian{
-    static T reverse(const T &v){
-        T result;
-        reverse_bytes<sizeof(T)>::reverse( (const char *)&v, (char *)&result );
-        return result;        
+constexpr T byteswap( T v ){
+    static_assert(std::is_integral_v<T> || std::is_enum_v<T>, "Only integers have a byte order to swap");
+    using U=std::make_unsigned_t<typename std::conditional_t<std::is_enum_v<T>, std::underlying_type<T>, type_identity<T>>::type>;
+    auto u=(U)v;
+
+    if constexpr(sizeof(U) == 1)
+        return v;
+#if defined(__GNUC__)
+    else if constexpr(sizeof(U) == 2)
+        return (T)__builtin_bswap16(u);
+    else if constexpr(sizeof(U) == 4)
+        return (T)__builtin_bswap32(u);
+    else if constexpr(sizeof(U) == 8)
+        return (T)__builtin_bswap64(u);
+#endif
+    else{
+        //Which the compiler recognizes, and makes a bswap of, anyway
+        U result=0;
+        for( ::size_t i=0; i < sizeof(U); ++i, u>>=8 )
+            result=(U)(result << 8 | (u & 0xff));
+        return (T)result;
     }
-};
+}
 
 struct endian{
-    static inline bool is_big(){
-        static constexpr char x[]={ 0, 1 };
-        static const ::int16_t y= *(const ::int16_t *)x;
-        return y==1;
-    }
-
-    static inline bool is_little(){ return !is_big(); }
+#if defined(__BYTE_ORDER__) && defined(__ORDER_BIG_ENDIAN__) && defined(__ORDER_LITTLE_ENDIAN__)
+    static constexpr bool big=__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__;
+    static_assert(big || __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__, "Mixed-endian targets aren't supported");
+#elif defined(_WIN32)
+    static constexpr bool big=false;
+#else
+#error "Can't tell the target's byte order"
+#endif
+
+    static constexpr bool is_big(){ return big; }
+    static constexpr bool is_little(){ return !big; }
 
     /*
     *
     * Network byte order is assumed to be big-endian.
     * If the host is little-endian (PCs, for example, always are), perform a swap,
-    * otherwise, NOP.
+    * otherwise, NOP. Either way, it's decided at compile time.
     */
     template<typename T>
-    static T convert_endian(T v){
-        return is_little() ? reverse_endian<T>::reverse(v) : v; 
+    static constexpr T convert_endian(T v){
+        if constexpr(big)
+            return v;
+        else
+            return byteswap(v);
     }
 
 };
@@ -0,0 +1,176 @@
+#pragma once
+
+/*
+*
+* Counters and histograms for watching a long run
+*
+* Every thread counts into its own slots, with plain relaxed stores that never contend with
+* anybody, and the slots of all threads are only added up when somebody reads them, which is
+* rare: a progress report every few seconds. When a thread exits, its counts are folded into
+* a total kept for the threads that are gone, so nothing is lost.
+*
+* Metrics are declared once, by name, usually as statics next to the code they measure:
+*
+*     static metrics::counter blobs("pbf.blobs");
+*     blobs.add();
+*
+*     static metrics::histogram inflate("pbf.inflate_ns");
+*     { metrics::scoped_timer t(inflate); ...; }
+*
+* There is room for a fixed number of each, which is plenty.
+*
+*/
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <condition_variable>
+
+namespace leapus::metrics{
+
+using value_type=::uint64_t;
+
+inline constexpr ::size_t max_counters=256;
+inline constexpr ::size_t max_histograms=64;
+
+//Power-of-two buckets: bucket b holds values in [2^(b-1), 2^b), and bucket 0 holds zero
+inline constexpr ::size_t histogram_buckets=65;
+
+struct histogram_data{
+    value_type count=0, sum=0, max=0;
+    value_type buckets[histogram_buckets]={};
+
+    //An estimate of the value at the given fraction (0.5 for the median), to within a factor of two
+    value_type percentile( double p ) const;
+    double mean() const{ return count ? (double)sum / count : 0; }
+};
+
+//A thread's own slots. Only that thread writes them, but anybody may read them, hence the atomics.
+struct thread_slots{
+    std::atomic<value_type> counters[max_counters]={};
+
+    struct histogram_slots{
+        std::atomic<value_type> count, sum, max;
+        std::atomic<value_type> buckets[histogram_buckets];
+    } histograms[max_histograms]={};
+};
+
+thread_slots &local_slots();
+
+class counter{
+    ::size_t m_id;
+
+public:
+    explicit counter( const std::string &name );
+
+    void add( value_type n=1 ) const{
+        auto &c=local_slots().counters[m_id];
+        c.store( c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed );
+    }
+
+    //The sum over all threads, past and present
+    value_type read() const;
+};
+
+//A level rather than a count, like the depth of a queue, which goes up and down.
+//Each thread's slot may well go negative, but the sum over all of them is right.
+class gauge{
+    ::size_t m_id;
+
+public:
+    explicit gauge( const std::string &name );
+
+    void add( ::int64_t n ) const{
+        auto &c=local_slots().counters[m_id];
+        c.store( c.load(std::memory_order_relaxed) + (value_type)n, std::memory_order_relaxed );
+    }
+
+    ::int64_t read() const;
+};
+
+class histogram{
+    ::size_t m_id;
+
+public:
+    explicit histogram( const std::string &name );
+
+    void record( value_type v ) const{
+        auto &h=local_slots().histograms[m_id];
+        auto bump=[](std::atomic<value_type> &a, value_type n){
+            a.store( a.load(std::memory_order_relaxed) + n, std::memory_order_relaxed );
+        };
+
+        bump(h.count, 1);
+        bump(h.sum, v);
+        bump(h.buckets[ v ? 64 - __builtin_clzll(v) : 0 ], 1);
+        if(v > h.max.load(std::memory_order_relaxed))
+            h.max.store(v, std::memory_order_relaxed);
+    }
+
+    histogram_data read() const;
+};
+
+//Records how long it lived, in nanoseconds
+class scoped_timer{
+    const histogram &m_histogram;
+    std::chrono::steady_clock::time_point m_start;
+
+public:
+    scoped_timer( const histogram &h ):
+        m_histogram(h),
+        m_start(std::chrono::steady_clock::now()){}
+
+    ~scoped_timer(){
+        m_histogram.record( std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - m_start).count() );
+    }
+};
+
+//Everything at one moment, merged over threads
+struct snapshot{
+    std::chrono::steady_clock::time_point when;
+    std::vector<std::pair<std::string, value_type>> counters;
+    std::vector<std::pair<std::string, ::int64_t>> gauges;
+    std::vector<std::pair<std::string, histogram_data>> histograms;
+
+    //From getrusage(), for telling whether we're waiting on the disk
+    value_type major_faults=0, minor_faults=0;
+    double user_seconds=0, system_seconds=0;
+};
+
+snapshot take_snapshot();
+
+/*
+* Writes a report every interval from a thread of its own, until stopped, and once more when stopped.
+* To the console, that's a line of counters with their rates since the last report, and histogram
+* percentiles. To a JSON file, it's a line of JSON per report (JSON Lines), for plotting afterwards.
+*/
+class reporter{
+    std::chrono::milliseconds m_interval;
+    std::ofstream m_json;
+    bool m_console;
+
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    bool m_stop=false;
+    std::thread m_thread;
+
+    snapshot m_last;
+    std::chrono::steady_clock::time_point m_start;
+
+    void report( const snapshot &now );
+
+public:
+    //An empty json_path means no JSON
+    reporter( std::chrono::milliseconds interval, bool console=true, const std::string &json_path={} );
+    ~reporter();
+
+    void stop();
+};
+
+}
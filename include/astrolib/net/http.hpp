@@ -0,0 +1,80 @@
+#pragma once
+
+/*
+*
+* Just enough HTTP/1.1 for a local query server and the load generator that exercises it
+*
+* Both ends do their own non-blocking I/O. These only turn bytes into requests and responses and
+* back again, working on whatever has been read so far: a parse returns how many bytes made up one
+* complete message, or zero if there aren't enough yet, and leaves the buffer alone either way.
+* Pipelined messages are simply parsed one after another.
+*
+* No chunked encoding, no continuation lines, and no bodies bigger than max_body. It isn't a web
+* server, and anything it doesn't understand is a 400.
+*
+*/
+
+#include <string>
+#include <vector>
+#include <utility>
+#include <optional>
+#include <string_view>
+#include "astrolib/exception.hpp"
+
+namespace leapus::net{
+
+class http_exception:public exception::exception{
+public:
+    using exception::exception;
+};
+
+inline constexpr ::size_t max_header=16 * 1024;
+inline constexpr ::size_t max_body=1024 * 1024;
+
+struct http_request{
+    std::string method;
+
+    //The path without its query string, undecoded
+    std::string path;
+
+    //The query string's parameters, decoded, in order
+    std::vector<std::pair<std::string, std::string>> query;
+
+    std::string body;
+
+    //HTTP/1.1 keeps the connection open unless told otherwise, and 1.0 closes it unless told otherwise
+    bool keep_alive=true;
+
+    //The first parameter called name, if there is one
+    std::optional<std::string_view> param( std::string_view name ) const;
+};
+
+struct http_response{
+    int status=0;
+    std::string body;
+    bool keep_alive=true;
+};
+
+//Parse one request from the front of buffer into req, and return its length, or zero if it's incomplete.
+//Throws http_exception if it's malformed, or too big.
+::size_t parse_request( std::string_view buffer, http_request &req );
+
+//The same, for a response
+::size_t parse_response( std::string_view buffer, http_response &resp );
+
+//Append a complete response to out
+void write_response( std::string &out, int status, std::string_view content_type, std::string_view body, bool keep_alive );
+
+//Append a GET request for target, which is the path and query string, to out
+void write_request( std::string &out, std::string_view target, std::string_view host="localhost" );
+
+//"OK", "Not Found", and so on
+const char *status_text( int status );
+
+//Undo %-escapes, and + for space
+std::string url_decode( std::string_view s );
+
+//Escape s as the inside of a JSON string
+void json_escape( std::string &out, std::string_view s );
+
+}
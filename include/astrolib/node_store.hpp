@@ -0,0 +1,153 @@
+#pragma once
+
+/*
+*
+* Where nodes are, by ID
+*
+* Ways and relations only refer to nodes by ID, so drawing one means first looking up where
+* each of its nodes is. This is the simplest thing that could possibly work: a flat array
+* indexed by node ID in a sparse, memory-mapped file, so the operating system does the caching,
+* and ID ranges which were never written cost nothing on disk.
+*
+* For the planet, even that is 8 bytes for every ID ever handed out, deleted or not, which
+* is more than the machine has memory for. So there's also a compressed store, in pages of
+* page_nodes consecutive IDs:
+*
+*     directory                   a page's file offset, for every page, or zero if it's empty
+*     pages                       appended as they're written
+*
+* A page has a bitmap of which of its IDs are present, then the first present node's location,
+* and then, for each of the others, its difference from the node before it, zigzagged so that
+* small negative differences are small numbers, and bit-packed at the width of the largest,
+* latitudes and longitudes separately. Consecutive IDs were mostly created together, by the
+* same mapper, in the same place, so the differences are small.
+*
+* Pages are decoded whole, with AVX2 where the CPU has it, into a small cache of them per thread,
+* since one way's nodes are mostly in one or two pages.
+*
+* A page can't be packed until everything in it is known, so nodes are written through a
+* writer, which collects a page's worth of consecutive IDs before packing it. Nodes from the
+* same page arriving from different writers, such as at the ends of two PBF blocks, are merged,
+* by repacking the page, and the old copy is left behind as garbage.
+*
+*/
+
+#include <mutex>
+#include <filesystem>
+#include "astrolib/types.hpp"
+#include "astrolib/exception.hpp"
+#include "astrolib/io/mmap_file.hpp"
+
+namespace leapus::astrolib{
+
+class node_store_exception:public exception::exception{
+public:
+    using exception::exception;
+};
+
+class node_store{
+public:
+    using node_id=::int64_t;
+    using size_type=::size_t;
+
+    //Enough for the planet as of this writing, with room to spare. It's a sparse file, so it
+    //only costs address space.
+    static constexpr size_type default_capacity=(size_type)1 << 34;
+
+    static constexpr int page_bits=8;
+    static constexpr size_type page_nodes=(size_type)1 << page_bits;
+
+    //Collects the nodes of one page at a time, for a compressed store, and packs each page once the
+    //IDs move on from it. Nodes should come in order of ID, as they do in a PBF block, or pages get
+    //packed and merged over and over. One per thread, and whatever's left is written on destruction.
+    //For a flat store, set() simply sets.
+    class writer{
+        node_store &m_store;
+        ::uint64_t m_page=~(::uint64_t)0;
+        ::uint64_t m_present[page_nodes/64]={};
+        ::int32_t m_lat[page_nodes], m_lon[page_nodes];
+
+    public:
+        explicit writer( node_store &store ):
+            m_store(store){}
+
+        writer( const writer & ) = delete;
+
+        ~writer();
+
+        void set( node_id id, const coordinate_t &loc );
+
+        //Pack whatever page is pending
+        void flush();
+    };
+
+private:
+    //Hundred-nanodegree units, which is all the precision any OSM file actually carries,
+    //and biased by 2^31 so that a location is never all zeroes. That way, zero means "no node".
+    struct location{
+        ::uint32_t lat, lon;
+    };
+
+    struct header;
+    struct page_header;
+
+    io::mmap_file m_file;
+    location *m_locations=nullptr;
+    size_type m_capacity;
+
+    //Compressed only
+    bool m_compressed=false;
+    char *m_base=nullptr;
+    file_offs_t *m_directory=nullptr;
+
+    //Which thread caches belong to this store. Offsets are never reused by a store, so a cached
+    //page is current as long as the directory still has it at the offset it was decoded from.
+    ::uint64_t m_serial=0;
+
+    //Pages being merged are locked, by page number, modulo this
+    static constexpr int lock_stripes=64;
+    std::mutex m_locks[lock_stripes];
+
+    void open_compressed();
+
+    //Merge present nodes, in unbiased units and indexed by their position in the page, into page
+    void put_page( ::uint64_t page, const ::uint64_t *present, const ::int32_t *lat, const ::int32_t *lon );
+
+    //Unpack page's nodes into lat and lon, in order of ID, and return how many there are
+    ::size_t decode_page( const page_header *page, ::int32_t *lat, ::int32_t *lon ) const;
+
+public:
+    //Opens or creates the store, and holds node IDs in [0, capacity). A compressed store has to be
+    //reopened as a compressed one, and a flat one as a flat one.
+    node_store( const std::filesystem::path &path, size_type capacity=default_capacity, bool compressed=false );
+
+    node_store(const node_store &) = delete;
+
+    //Node locations are written once each, so distinct threads can set distinct nodes concurrently.
+    //A compressed store repacks the node's whole page each time, so use a writer for those.
+    void set( node_id id, const coordinate_t &loc );
+
+    //Returns false if the node was never set. Not to be called while the same page might be written.
+    bool get( node_id id, coordinate_t &loc ) const;
+
+    //Make every location set so far durable, for a checkpoint
+    void sync(){
+        m_file.sync();
+    }
+
+    size_type capacity() const{
+        return m_capacity;
+    }
+
+    bool compressed() const{
+        return m_compressed;
+    }
+
+    //How much of the file is in use, including the directory and any garbage. For a flat store,
+    //that's the whole sparse file, most of which may never have been written.
+    size_type size() const{
+        return m_file.size();
+    }
+};
+
+}
@@ -103,6 +103,11 @@ public:
         return &m_data;
     }
 
+    //Where this blob's frame begins, which is also what osm_address_t::blob_pos refers to
+    pos_type pos() const{
+        return m_pos;
+    }
+
     blob_iterator &operator++() {
         populate_header();
         m_pos = m_blob_pos + m_data.first.datasize();
@@ -112,6 +117,11 @@ public:
     }
 };
 
+//Inflate a blob's payload, whichever way it's stored, and parse it into target, which
+//would be a HeaderBlock or a PrimitiveBlock depending on the BlobHeader type.
+//Only raw and zlib blobs are supported, which is all that anybody seems to write in practice.
+void decode_blob( const OSMPBF::Blob &blob, google::protobuf::Message &target );
+
 //We have no need to ever write these, so they are treated read-only
 //We do write indices into separate files, sometimes using the same data types, though
 class osm_file:public leapus::pbf::protobuf_file{
@@ -137,6 +147,9 @@ public:
     //following the header.
     pos_type read_blob_header( pos_type pos, OSMPBF::BlobHeader &target ) const;
 
+    //Read, inflate, and parse the blob whose frame begins at pos (see blob_iterator::pos())
+    void read_block( pos_type pos, google::protobuf::Message &target ) const;
+
     blob_iterator_type begin();
     blob_iterator_type end();
     const_blob_iterator_type begin() const;
@@ -0,0 +1,118 @@
+#pragma once
+
+/*
+*
+* Reading OSM PBF files from a pipe
+*
+* osm_file maps the whole file in, so it has to be a file, and a planet downloaded or filtered
+* through osmium would have to be written out in full before indexing could start. osm_stream
+* reads the same frames (see osmwriter.hpp) from anything that can be read(2), front to back,
+* as they arrive.
+*
+* It's double-buffered: a thread of its own reads the stream in big chunks, one ahead of the
+* one frames are being cut out of. A frame lying within a chunk isn't copied out of it, but shares
+* it (stream_blob::data), so a worker can be handed the blob, and the chunk goes when the last
+* blob in it does. Only frames straddling two chunks are copied, into buffers of their own.
+*
+* Everything read can also be copied to a file, the tee, which is then an osm_file like any other,
+* with the blobs at the same positions as stream_blob::pos, for what can't be done in one pass.
+*
+*/
+
+#include <mutex>
+#include <memory>
+#include <thread>
+#include <string>
+#include <vector>
+#include <exception>
+#include <filesystem>
+#include <condition_variable>
+#include "protobuf/fileformat.pb.h"
+#include "astrolib/io/random_access.hpp"
+
+namespace leapus::osm{
+
+//One frame of a stream, as read
+struct stream_blob{
+    using pos_type=::size_t;
+    using size_type=::size_t;
+
+    //Where the frame begins, counting from the start of the stream, which is also where it would
+    //begin in an osm_file of the same data, and what osm_address_t::blob_pos refers to
+    pos_type pos=0;
+
+    OSMPBF::BlobHeader header;
+
+    //The serialized Blob, size bytes of it, sharing whichever buffer it was read into
+    std::shared_ptr<const char> data;
+    size_type size=0;
+
+    //Parse the Blob, for decode_blob()
+    void parse( OSMPBF::Blob &target ) const;
+};
+
+class osm_stream{
+public:
+    using pos_type=stream_blob::pos_type;
+    using size_type=stream_blob::size_type;
+    using chunk_type=std::shared_ptr<std::vector<char>>;
+
+    //How much is read at a time, which is what's in memory twice over, apart from blobs still held
+    static constexpr size_type default_chunk_size=16 * 1024 * 1024;
+
+private:
+    int m_fd;
+    bool m_owned;
+    int m_tee_fd=-1;
+    std::filesystem::path m_tee_path;
+    size_type m_chunk_size;
+
+    //The chunk frames are being cut out of, and how far into it they've got
+    chunk_type m_chunk;
+    size_type m_used=0;
+    pos_type m_pos=0;
+
+    //Handed over from the reading thread: the next chunk, an empty one at the end of the stream,
+    //or whatever it threw instead
+    std::mutex m_mut;
+    std::condition_variable m_cond;
+    chunk_type m_next;
+    std::exception_ptr m_error;
+    bool m_stop=false;
+    std::thread m_reader;
+
+    void reader_proc();
+
+    //The next chunk from the reading thread, or null once the stream has ended
+    chunk_type take_chunk();
+
+    //The next size bytes of the stream, in one piece. At the end of the stream, null if
+    //there weren't any left, and if there were some, but too few, it throws.
+    std::shared_ptr<const char> take( size_type size );
+
+public:
+    //Read fd, which is left open, unless owned. Copy everything read to tee_path, if there is one.
+    osm_stream( int fd, bool owned=false, const std::filesystem::path &tee_path={}, size_type chunk_size=default_chunk_size );
+
+    //Read the file, or the pipe, at path, or standard input, for "-"
+    osm_stream( const std::filesystem::path &path, const std::filesystem::path &tee_path={}, size_type chunk_size=default_chunk_size );
+
+    osm_stream( const osm_stream & )=delete;
+    osm_stream &operator=( const osm_stream & )=delete;
+
+    ~osm_stream();
+
+    //Read the next frame into target, or return false at the end of the stream. Throws
+    //io_exception if the stream can't be read, or the frames don't add up.
+    bool next( stream_blob &target );
+
+    //How much of the stream has been cut into frames
+    pos_type pos() const{
+        return m_pos;
+    }
+
+    //Flush the tee, once the stream has been read to the end, and throw if anything went wrong
+    void close_tee();
+};
+
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+/*
+*
+* Writing OSM PBF files
+*
+* We never write real map data, but synthetic files are handy for testing and benchmarking
+* without a planet download. Each block is framed as it is in any other PBF file: a raw int32
+* in network byte order giving the size of the BlobHeader, the BlobHeader, then the Blob.
+*
+* Framing a block (serializing and deflating it) is the expensive part and is thread-safe, so that
+* many blocks can be framed in parallel and then written out in order.
+*
+*/
+
+#include <string>
+#include <fstream>
+#include <filesystem>
+#include "protobuf/fileformat.pb.h"
+#include "protobuf/osmformat.pb.h"
+#include "astrolib/io/random_access.hpp"
+
+namespace leapus::osm{
+
+//Serialize msg into a complete frame of the given BlobHeader type ("OSMHeader" or "OSMData"),
+//zlib-compressed at the given level, or stored raw at level 0
+std::string encode_frame( const std::string &type, const google::protobuf::Message &msg, int level=6 );
+
+class osm_writer{
+    std::filesystem::path m_path;
+    std::ofstream m_out;
+
+public:
+    //Creates or truncates the file
+    osm_writer( const std::filesystem::path &path );
+
+    //The header block has to come first. These frame and write in one go.
+    void write_header( const OSMPBF::HeaderBlock &header, int level=6 );
+    void write_block( const OSMPBF::PrimitiveBlock &block, int level=6 );
+
+    //Write a frame made by encode_frame()
+    void write_frame( const std::string &frame );
+
+    //Flush everything to the file, and throw if anything went wrong along the way
+    void close();
+};
+
+}
@@ -28,6 +28,7 @@ class protobuf_file:public leapus::io::mmap_file{
 
 public:
     using mmap_file::mmap_file;
+    using mmap_file::read;
 
     //protobuf_file( const std::filesystem::path &, bool writeable, size_type mapping_size);
     //protobuf_file( const std::filesystem::path &, bool writeable);
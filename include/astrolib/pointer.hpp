@@ -4,63 +4,116 @@
 *
 * Pointer related stuff
 *
+* The index is a file that's mapped in wherever the OS likes, so nothing in it can hold an address.
+* What it holds instead are offsets, either from the pointer itself (relative_ptr), or from some base
+* the reader knows, like the start of the file (based_ptr). Both come in 32 and 64-bit flavours, so
+* that links which are known to be short, like those between squares of the tree, take half the room.
+*
+* They're all trivially copyable, so that whole blocks of them can be memcpy'd, into or out of a
+* file. A relative_ptr copied like that still points to whatever was copied along with it, which is
+* what's wanted when moving a block that links to itself, but a relative_ptr copied on its own points
+* somewhere else entirely, so one is only ever pointed at anything in place, by assigning it a T *.
+*
 */
 
+#include <limits>
+#include <string>
+#include <cstdint>
 #include <utility>
+#include <type_traits>
 #include "meta.hpp"
+#include "exception.hpp"
 
 namespace leapus::pointer{
 
 
 //Probably long int in practice, and most processors don't actually have 64 bits of address space anyway. 48, often.
 using offset_t =  decltype(std::declval<char *>() - std::declval<char *>());
-using int_addr_t = offset_t;
+using int_addr_t = std::intptr_t;
 
 template<typename T>
 int_addr_t int_addressof(T &obj){
-    //We're particular about constness because on some architectures const has a separate address space
-    return (( meta::copy_cv_t<T, char *> )std::addressof(obj)) - ( meta::copy_cv_t<T, char *> )nullptr;
+    return reinterpret_cast<int_addr_t>( std::addressof(obj) );
 }
 
 template<typename T>
 T *ptr_from_addr(int_addr_t addr){
-    return (T *)(((meta::copy_cv_t<T, char *>) nullptr)+addr);
+    return reinterpret_cast<T *>(addr);
 }
 
-template<typename T>
-class relative_ptr{
-    offset_t m_offset;
-    
+//When what a pointer is pointed at is further away than its offset can reach
+class pointer_range_exception:public exception::exception{
 public:
-    //Effectively points to address zero which is what NULL has traditionally meant in C-like settings
-    //It's unlikely to be a valid address on most if any machines
-    relative_ptr():
-        m_offset( int_addressof((T *)nullptr) - int_addressof(this) ){}
+    using exception::exception;
+};
 
-    relative_ptr(::nullptr_t nul):
-        relative_ptr(){}
+//d, as an Offset, if it fits
+template<typename Offset>
+Offset narrow_offset( offset_t d ){
+    bool fits=d < 0 ? std::is_signed_v<Offset> && d >= (offset_t)std::numeric_limits<Offset>::min() :
+        (::uint64_t)d <= (::uint64_t)std::numeric_limits<Offset>::max();
 
-    relative_ptr(T &obj):
-        m_offset( int_addressof(obj) - int_addressof(*this) ){}
+    if(!fits)
+        throw pointer_range_exception("Offset of " + std::to_string(d) + " is out of range of a " +
+            std::to_string(sizeof(Offset) * 8) + "-bit pointer");
 
-    relative_ptr(const relative_ptr &p):
-        relative_ptr( *p ){}
+    return (Offset)d;
+}
 
-    relative_ptr(relative_ptr &&) = delete;
+//A pointer to wherever it's pointed at, counted from where the pointer itself is
+template<typename T, typename Offset=::int64_t>
+class relative_ptr{
+    static_assert(std::is_signed_v<Offset>, "Relative pointers point both ways");
 
-    bool operator!() const{
-        return int_addressof(*this) + m_offset != 0;
+    //Null is an offset of zero, rather than the offset to address zero, which would only be null
+    //at the address it was written at, and not once it's been saved to a file and mapped in elsewhere.
+    //A pointer to itself is never of any use anyway.
+    Offset m_offset=0;
+
+public:
+    using element_type=T;
+    using offset_type=Offset;
+
+    relative_ptr()=default;
+
+    relative_ptr(::nullptr_t){}
+
+    //Point at target, from wherever this is. Throws pointer_range_exception if it's too far away.
+    relative_ptr &operator=( T *target ){
+        m_offset=target ? narrow_offset<Offset>( int_addressof(*target) - int_addressof(*this) ) : 0;
+        return *this;
+    }
+
+    relative_ptr &operator=( ::nullptr_t ){
+        m_offset=0;
+        return *this;
     }
 
     T *get() const{
-        return ptr_from_addr<T>(int_addressof(*this) + m_offset);
+        return m_offset ? ptr_from_addr<T>(int_addressof(*this) + m_offset) : nullptr;
+    }
+
+    Offset offset() const{
+        return m_offset;
+    }
+
+    explicit operator bool() const{
+        return m_offset;
+    }
+
+    bool operator!() const{
+        return !m_offset;
     }
 
     bool operator==( const relative_ptr &rhs ) const{
         return get() == rhs.get();
     }
 
-    T &operator[]( size_t i ) const{
+    bool operator!=( const relative_ptr &rhs ) const{
+        return get() != rhs.get();
+    }
+
+    T &operator[]( ::size_t i ) const{
         return get()[i];
     }
 
@@ -71,27 +124,153 @@ public:
     T &operator*() const{
         return *get();
     }
+};
 
-    relative_ptr &operator++(){
-        m_offset+=sizeof(T);
-        return *this;
+template<typename T>
+using relative_ptr32=relative_ptr<T, ::int32_t>;
+
+template<typename T>
+using relative_ptr64=relative_ptr<T, ::int64_t>;
+
+//A pointer to wherever it's pointed at, counted from a base that whoever uses it has to supply,
+//like the start of the file it's in. Unlike a relative_ptr, it can be copied anywhere, as long as
+//the base stays put, and it can be moved along with a block of whatever it points to by moving the base.
+//Null is an offset of zero, so nothing can be pointed to right at the base.
+template<typename T, typename Offset=::uint64_t>
+class based_ptr{
+    Offset m_offset=0;
+
+public:
+    using element_type=T;
+    using offset_type=Offset;
+
+    based_ptr()=default;
+
+    based_ptr(::nullptr_t){}
+
+    //Point at target, counting from base. Throws pointer_range_exception if it's too far away.
+    based_ptr( const void *base, T *target ):
+        m_offset( target ? narrow_offset<Offset>( int_addressof(*target) - (int_addr_t)base ) : 0 ){}
+
+    T *get( const void *base ) const{
+        return m_offset ? ptr_from_addr<T>( (int_addr_t)base + (offset_t)m_offset ) : nullptr;
     }
 
-    relative_ptr &operator--(){
-        m_offset-=sizeof(T);
-        return *this;
+    Offset offset() const{
+        return m_offset;
     }
 
-    relative_ptr operator+( offset_t offs ){
-        return { get() + offs }; 
+    explicit operator bool() const{
+        return m_offset;
     }
 
-    relative_ptr operator-( offset_t offs){
-        return { get() - offs };
+    bool operator!() const{
+        return !m_offset;
     }
 
+    bool operator==( const based_ptr &rhs ) const{
+        return m_offset == rhs.m_offset;
+    }
+
+    bool operator!=( const based_ptr &rhs ) const{
+        return m_offset != rhs.m_offset;
+    }
+};
+
+template<typename T>
+using based_ptr32=based_ptr<T, ::uint32_t>;
+
+template<typename T>
+using based_ptr64=based_ptr<T, ::uint64_t>;
+
+//Some number of T, one after the other, starting wherever a relative_ptr points, for an array in
+//a file, like the entries of a leaf. Like a relative_ptr, it's only pointed at anything in place.
+template<typename T, typename Offset=::int64_t, typename Size=::uint32_t>
+class relative_span{
+    relative_ptr<T, Offset> m_data;
+    Size m_size=0;
+
+public:
+    using element_type=T;
+    using size_type=Size;
+    using iterator=T *;
+
+    relative_span()=default;
+
+    //Throws pointer_range_exception if data is too far away, or there are too many of them
+    void assign( T *data, ::size_t size ){
+        if(size > std::numeric_limits<Size>::max())
+            throw pointer_range_exception("Span of " + std::to_string(size) + " is out of range of a " +
+                std::to_string(sizeof(Size) * 8) + "-bit size");
+
+        m_data=size ? data : nullptr;
+        m_size=size;
+    }
+
+    T *data() const{
+        return m_data.get();
+    }
+
+    Size size() const{
+        return m_size;
+    }
+
+    bool empty() const{
+        return !m_size;
+    }
+
+    T *begin() const{
+        return data();
+    }
+
+    T *end() const{
+        return data() + m_size;
+    }
+
+    T &operator[]( ::size_t i ) const{
+        return data()[i];
+    }
+};
+
+//Some number of T, one after the other, starting wherever a based_ptr points. It's the based_ptr's
+//equivalent of relative_span, for arrays kept track of outside of the file, and moved as part of it.
+template<typename T, typename Offset=::uint64_t, typename Size=::uint32_t>
+class based_span{
+    based_ptr<T, Offset> m_data;
+    Size m_size=0;
+
+public:
+    using element_type=T;
+    using size_type=Size;
+
+    based_span()=default;
+
+    //Throws pointer_range_exception if data is too far from base, or there are too many of them
+    based_span( const void *base, T *data, ::size_t size ):
+        m_data( base, size ? data : nullptr ),
+        m_size(size){
+
+        if(size > std::numeric_limits<Size>::max())
+            throw pointer_range_exception("Span of " + std::to_string(size) + " is out of range of a " +
+                std::to_string(sizeof(Size) * 8) + "-bit size");
+    }
+
+    T *data( const void *base ) const{
+        return m_data.get(base);
+    }
+
+    Size size() const{
+        return m_size;
+    }
+
+    bool empty() const{
+        return !m_size;
+    }
 };
 
+static_assert(std::is_trivially_copyable_v<relative_ptr32<int>> && sizeof(relative_ptr32<int>) == 4);
+static_assert(std::is_trivially_copyable_v<relative_ptr64<int>> && sizeof(relative_ptr64<int>) == 8);
+static_assert(std::is_trivially_copyable_v<based_ptr32<int>> && std::is_trivially_copyable_v<relative_span<int>>);
 
 //Provide a new-like interface to an allocator
 template<typename T, class Alloc, typename... Args>
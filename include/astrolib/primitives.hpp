@@ -0,0 +1,82 @@
+#pragma once
+
+/*
+*
+* Decoding the OSM primitives (nodes, ways, relations) out of a PrimitiveBlock
+*
+* The PBF format squeezes these pretty hard: coordinates are in block-specific units, and
+* IDs, DenseNodes coordinates, way node references and relation members are all delta-coded.
+*
+*/
+
+#include <vector>
+#include "astrolib/types.hpp"
+#include "protobuf/osmformat.pb.h"
+
+namespace leapus::osm{
+
+using osm_id=::int64_t;
+
+//Nanodegrees, from a block's raw units
+inline astrolib::coordinate_t block_location( const OSMPBF::PrimitiveBlock &block, ::int64_t lat, ::int64_t lon ){
+    return {
+        block.lat_offset() + (::int64_t)block.granularity() * lat,
+        block.lon_offset() + (::int64_t)block.granularity() * lon
+    };
+}
+
+//Calls func(id, coordinate_t) for every node in the group, whether plain or dense
+template<typename Func>
+void for_each_node( const OSMPBF::PrimitiveBlock &block, const OSMPBF::PrimitiveGroup &group, Func &&func ){
+    for(const auto &node: group.nodes())
+        func( (osm_id)node.id(), block_location(block, node.lat(), node.lon()) );
+
+    if(group.has_dense()){
+        const auto &dense=group.dense();
+        osm_id id=0;
+        ::int64_t lat=0, lon=0;
+
+        for( int i=0; i < dense.id_size(); ++i ){
+            id+=dense.id(i);
+            lat+=dense.lat(i);
+            lon+=dense.lon(i);
+            func( id, block_location(block, lat, lon) );
+        }
+    }
+}
+
+//How many objects of any kind the group holds, for numbering them as osm_address_t::item_pos does
+inline int element_count( const OSMPBF::PrimitiveGroup &group ){
+    return group.nodes_size() + (group.has_dense() ? group.dense().id_size() : 0) +
+        group.ways_size() + group.relations_size();
+}
+
+//A way's node references, undoing the delta coding
+inline void way_refs( const OSMPBF::Way &way, std::vector<osm_id> &out ){
+    out.resize(way.refs_size());
+
+    osm_id ref=0;
+    for( int i=0; i < way.refs_size(); ++i )
+        out[i]=ref+=way.refs(i);
+}
+
+//Calls func(member id, member type, role string index) for each of a relation's members
+template<typename Func>
+void for_each_member( const OSMPBF::Relation &rel, Func &&func ){
+    osm_id id=0;
+    for( int i=0; i < rel.memids_size(); ++i ){
+        id+=rel.memids(i);
+        func( id, rel.types(i), rel.roles_sid(i) );
+    }
+}
+
+//The string table index of s, or -1 if the block doesn't use it
+inline int find_string( const OSMPBF::StringTable &strings, const std::string &s ){
+    for( int i=0; i < strings.s_size(); ++i )
+        if(strings.s(i) == s)
+            return i;
+
+    return -1;
+}
+
+}
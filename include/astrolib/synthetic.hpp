@@ -0,0 +1,78 @@
+#pragma once
+
+/*
+*
+* Synthetic OSM PBF files
+*
+* For scaling tests at sizes nobody wants to download or ship around. The data is nonsense,
+* but plausible nonsense, shaped like the real thing where it matters to the indexer:
+*
+*   - Nodes are laid down as random walks, so that consecutive nodes are near each other,
+*     and each walk becomes a way, the way roads and rivers look
+*   - Most of them are bunched into towns (clusters), with a sprinkling over the countryside
+*   - Tag values are drawn from a vocabulary with a Zipf distribution, so that a few are very
+*     common and most are rare, which is what string tables and dictionaries see in practice
+*   - Some walks are closed into rings and made into multipolygon relations, some with holes
+*
+* Every block is generated from its own index and the seed alone, so blocks can be generated
+* in any order, on any number of threads, and the output is identical every time.
+*
+*/
+
+#include <string>
+#include <vector>
+#include <filesystem>
+#include "protobuf/osmformat.pb.h"
+#include "astrolib/types.hpp"
+
+namespace leapus::osm{
+
+struct synthetic_config{
+    ::uint64_t seed=1;
+
+    //How much to write. Generation stops at whichever comes first.
+    ::size_t blocks=64;
+    ::size_t max_bytes=~(::size_t)0;
+
+    //Where everything goes, in degrees
+    double min_lat=35, max_lat=60, min_lon=-10, max_lon=30;
+
+    //Node density: nodes per block, and how far apart neighbouring nodes on a way are, in degrees
+    int nodes_per_block=8000;
+    double step=0.0005;
+
+    //Way length distribution, in nodes: geometric with the given mean, clamped to [2, max]
+    double way_length_mean=12;
+    int way_length_max=2000;
+
+    //Fraction of ways which are closed into rings (buildings, landuse), and of those,
+    //how many become multipolygon relations instead, and how many of those get a hole
+    double closed_fraction=0.3;
+    double multipolygon_fraction=0.1;
+    double hole_fraction=0.3;
+
+    //One node in this many gets tags of its own, like a POI
+    int tagged_node_interval=20;
+
+    //Distinct values for name tags and the like. They follow a Zipf distribution with this exponent.
+    int vocabulary=10000;
+    double zipf_exponent=1.0;
+
+    //Spatial clustering: how many towns, how big (standard deviation, in degrees),
+    //and what fraction of walks start in one rather than anywhere at all
+    int clusters=64;
+    double cluster_radius=0.05;
+    double clustering=0.9;
+
+    //zlib level for the blobs, 0 for raw
+    int compression=6;
+};
+
+//Generate block number index. Node, way and relation IDs are allocated to blocks in fixed ranges, and are ascending.
+void generate_block( const synthetic_config &config, ::size_t index, OSMPBF::PrimitiveBlock &block );
+
+//Write a complete file, generating and compressing blocks on the given number of threads
+//(0 for all of them). Returns the number of data blocks written.
+::size_t write_synthetic( const std::filesystem::path &path, const synthetic_config &config, int threads=0 );
+
+}
@@ -0,0 +1,124 @@
+#pragma once
+
+/*
+*
+* Timeline tracing, for chrome://tracing or ui.perfetto.dev
+*
+* Where metrics.hpp says how much, this says who was doing what, when: which blob each worker
+* had, which stage it was in, and when it was asleep in lf_queue::nap() for lack of work. Load
+* imbalance, and the one giant relation blob that everybody waits on at the end of a pass,
+* are obvious at a glance.
+*
+*     TRACE_THREAD_NAME("worker");
+*     TRACE_SCOPE("inflate");
+*     TRACE_SCOPE_ARG("block", "blob", pos);
+*     TRACE_INSTANT("checkpoint");
+*
+* Names must be string literals, or anything else that lives forever, since only the pointer is kept.
+*
+* Each thread records into a ring buffer of its own, which only it writes, so recording is a few
+* stores and no locks. When a ring fills up, the oldest events are overwritten. A thread's ring is
+* handed on to the next thread to start once it exits, so pools come and go without rings piling up.
+* Nothing is recorded until start() is called, and write() dumps everything as Chrome trace JSON.
+* write() is meant for when the traced work is done; the newest events of a thread still recording
+* may come out torn.
+*
+* Tracing is only built in if ASTROLIB_TRACE is defined (the ASTROLIB_TRACE CMake option). Without it,
+* the macros expand to nothing at all, and start() and write() do nothing.
+*
+*/
+
+#include <string>
+#include <cstdint>
+
+namespace leapus::trace{
+
+#ifdef ASTROLIB_TRACE
+
+inline constexpr bool built_in=true;
+
+//Events per thread. Older events are overwritten past this.
+inline constexpr ::size_t ring_size=1 << 16;
+
+struct event{
+    const char *name;
+
+    //An optional integer argument, shown in the event's details
+    const char *arg_name;
+    ::int64_t arg;
+
+    //Nanoseconds since the trace epoch
+    ::uint64_t begin, duration;
+
+    //Chrome's phase: 'X' for a complete event with a duration, 'i' for an instant
+    char phase;
+};
+
+::uint64_t now();
+
+void start();
+void stop();
+bool recording();
+
+//Name the calling thread in the trace. Threads are otherwise numbered.
+void thread_name( const char *name );
+
+void record( const event &e );
+
+//Throws io_exception if the file can't be written. Returns the number of events written.
+::size_t write( const std::string &path );
+
+class scope{
+    const char *m_name, *m_arg_name;
+    ::int64_t m_arg;
+    ::uint64_t m_begin;
+    bool m_recording;
+
+public:
+    scope( const char *name, const char *arg_name=nullptr, ::int64_t arg=0 ):
+        m_name(name),
+        m_arg_name(arg_name),
+        m_arg(arg),
+        m_begin(0),
+        m_recording(recording()){
+
+        if(m_recording)
+            m_begin=now();
+    }
+
+    ~scope(){
+        if(m_recording)
+            record({ m_name, m_arg_name, m_arg, m_begin, now() - m_begin, 'X' });
+    }
+
+    scope( const scope & ) = delete;
+    scope &operator=( const scope & ) = delete;
+};
+
+#define ASTROLIB_TRACE_CONCAT2(a, b) a##b
+#define ASTROLIB_TRACE_CONCAT(a, b) ASTROLIB_TRACE_CONCAT2(a, b)
+
+#define TRACE_SCOPE(name) ::leapus::trace::scope ASTROLIB_TRACE_CONCAT(trace_scope_, __LINE__){ name }
+#define TRACE_SCOPE_ARG(name, arg_name, arg) \
+    ::leapus::trace::scope ASTROLIB_TRACE_CONCAT(trace_scope_, __LINE__){ name, arg_name, (::int64_t)(arg) }
+#define TRACE_INSTANT(name) do{ if(::leapus::trace::recording()) \
+    ::leapus::trace::record({ name, nullptr, 0, ::leapus::trace::now(), 0, 'i' }); }while(0)
+#define TRACE_THREAD_NAME(name) ::leapus::trace::thread_name(name)
+
+#else
+
+inline constexpr bool built_in=false;
+
+inline void start(){}
+inline void stop(){}
+inline bool recording(){ return false; }
+inline ::size_t write( const std::string & ){ return 0; }
+
+#define TRACE_SCOPE(name) ((void)0)
+#define TRACE_SCOPE_ARG(name, arg_name, arg) ((void)0)
+#define TRACE_INSTANT(name) ((void)0)
+#define TRACE_THREAD_NAME(name) ((void)0)
+
+#endif
+
+}
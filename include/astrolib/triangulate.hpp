@@ -0,0 +1,38 @@
+#pragma once
+
+/*
+*
+* Cutting polygons into triangles, for filling
+*
+* What a GPU fills is triangles, so a polygon has to be cut into them before it can be drawn filled,
+* holes and all. This is ear clipping: a corner of the outline whose triangle has nothing else
+* inside it is an "ear", which can be cut off, leaving a smaller polygon, until there's nothing left
+* but the last triangle. Holes are first joined to the outline by a bridge, a pair of edges there and
+* back from the hole's leftmost point to a point of the outline it can see, so that the outline
+* and its holes become a single ring which happens to touch itself.
+*
+* Looking for ears is quadratic in the number of points, so for bigger polygons, points are also
+* kept in a list in Morton (Z) order, and an ear only has to look at the points whose Morton
+* codes fall within its bounding box.
+*
+* It's the same algorithm as Mapbox's earcut, which is well known to cope with the self-touching,
+* degenerate and slightly broken polygons that real map data is full of. Where it can't find ears at
+* all, it tries to untangle local self-intersections, and then to split the polygon in two, and if
+* that fails too, what's left of the polygon goes untriangulated, rather than anything failing.
+*
+*/
+
+#include <vector>
+#include <cstdint>
+#include "astrolib/geometry.hpp"
+
+namespace leapus::astrolib{
+
+//Append the triangles of rings to triangles, as three indices into the rings' points apiece.
+//The first ring is the outline, and the rest are holes, all closed, each with its first point
+//repeated at the end. Points are numbered through all the rings in turn, repeated ones included,
+//so that they're numbered just as they are in a geometry record (see index/geometry_codec.hpp).
+//The triangles all wind the same way as each other, whichever way the rings did.
+void triangulate( const std::vector<ring_t> &rings, std::vector<::uint32_t> &triangles );
+
+}
@@ -13,10 +13,16 @@ namespace leapus::astrolib{
 
     //Info needed to address an OSM PBF object
     //First, you have to locate the oft-compressed blob,
-    //then you need the offset into its uncompressed data
+    //then you need the offset into its uncompressed data.
+    //That offset is the object's position within the decoded PrimitiveBlock, counting
+    //every object of every group, in the order nodes, dense nodes, ways, relations.
     struct osm_address_t{
         file_offs_t blob_pos;
         blob_offs_t item_pos;
+
+        //What would otherwise be padding, spelled out so that it's always zero, since addresses
+        //are stored in the index as they are, and it has to come out the same every time
+        ::int32_t reserved=0;
     };
 
     //Maximum OSM precision is in nano-degrees or billionths of a degree
@@ -0,0 +1,442 @@
+/*
+*
+* loadgen, for measuring astrolabe's latency under load
+*
+* Keeps a number of keep-alive connections to the server, each with at most one request outstanding,
+* and sends random bbox queries or tiles from within the bounds of the index's data, which it asks the
+* server for.
+*
+* With --rate, requests are scheduled at a fixed total rate, spread over the connections, and each
+* one's latency is measured from when it was due to be sent, not from when it was. A connection still
+* waiting on its last response sends the next one late, and the wait counts against the server, as it
+* would for a real client. Otherwise, the delays would hide exactly the stalls that p99 is about.
+* Without --rate, every connection sends its next request as soon as it has a response, which finds
+* the most the server can take, but says less about latency.
+*
+* Latencies are kept exactly, so the percentiles at the end are the real ones.
+*
+*/
+
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstring>
+#include <algorithm>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+#include "astrolib/console.hpp"
+#include "astrolib/net/http.hpp"
+
+using namespace std::string_literals;
+using namespace leapus;
+
+using clock_type=std::chrono::steady_clock;
+
+struct options{
+    int port=8080;
+    int connections=16;
+    double rate=0;
+    double duration=10;
+
+    //query, tile, or mixed
+    std::string mode="query";
+
+    //Query boxes are this fraction of the index's bounds across, and tiles are at this zoom
+    double box_fraction=0.01;
+    int zoom=12;
+    int lod=-1;
+    int limit=1000;
+};
+
+static void check( int r, const char *what ){
+    if(r == -1)
+        throw std::runtime_error(what + ": "s + std::strerror(errno));
+}
+
+static int connect_to( int port, bool nonblocking ){
+    int fd=::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    check(fd, "socket");
+
+    sockaddr_in addr{};
+    addr.sin_family=AF_INET;
+    addr.sin_port=htons(port);
+    addr.sin_addr.s_addr=htonl(INADDR_LOOPBACK);
+    check( ::connect(fd, (sockaddr *)&addr, sizeof(addr)), "connect" );
+
+    int one=1;
+    ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    if(nonblocking){
+        int flags=::fcntl(fd, F_GETFL);
+        ::fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+    }
+
+    return fd;
+}
+
+//One request, waiting for the whole response, for setting up
+static net::http_response fetch( int port, const std::string &target ){
+    int fd=connect_to(port, false);
+
+    std::string out;
+    net::write_request(out, target);
+    for( ::size_t sent=0; sent < out.size(); ){
+        auto n=::send(fd, out.data() + sent, out.size() - sent, MSG_NOSIGNAL);
+        if(n == -1){
+            ::close(fd);
+            check(-1, "send");
+        }
+        sent+=n;
+    }
+
+    std::string in;
+    net::http_response resp;
+    char buf[16384];
+    while(!net::parse_response(in, resp)){
+        auto n=::recv(fd, buf, sizeof(buf), 0);
+        if(n <= 0){
+            ::close(fd);
+            throw std::runtime_error("Server hung up on " + target);
+        }
+        in.append(buf, n);
+    }
+
+    ::close(fd);
+    return resp;
+}
+
+//w,s,e,n of where the data is, out of /info, which is all we need from it, so there's no call for a JSON parser
+static bool parse_bounds( const std::string &info, double b[4] ){
+    auto p=info.find("\"data_bounds\":[");
+    return p != std::string::npos &&
+        std::sscanf(info.c_str() + p + 15, "%lf,%lf,%lf,%lf", b, b+1, b+2, b+3) == 4;
+}
+
+class target_maker{
+    const options &m_opts;
+    double m_bounds[4];
+    std::mt19937_64 m_rng{ 12345 };
+    int m_tile_x0, m_tile_x1, m_tile_y0, m_tile_y1;
+    ::uint64_t m_count=0;
+
+    double uniform( double lo, double hi ){
+        return std::uniform_real_distribution<double>(lo, hi)(m_rng);
+    }
+
+    static int tile_x( double lon, int z ){
+        return std::clamp( (int)std::floor((lon + 180) / 360 * std::ldexp(1.0, z)), 0, (1 << z) - 1 );
+    }
+
+    static int tile_y( double lat, int z ){
+        double r=lat * M_PI / 180;
+        double y=(1 - std::log(std::tan(r) + 1 / std::cos(r)) / M_PI) / 2;
+        return std::clamp( (int)std::floor(y * std::ldexp(1.0, z)), 0, (1 << z) - 1 );
+    }
+
+public:
+    target_maker( const options &opts, const double bounds[4] ):
+        m_opts(opts){
+
+        std::copy(bounds, bounds+4, m_bounds);
+        m_tile_x0=tile_x(bounds[0], opts.zoom);
+        m_tile_x1=tile_x(bounds[2], opts.zoom);
+        m_tile_y0=tile_y(bounds[3], opts.zoom);
+        m_tile_y1=tile_y(bounds[1], opts.zoom);
+    }
+
+    std::string next(){
+        bool tile=m_opts.mode == "tile" || (m_opts.mode == "mixed" && (m_count & 1));
+        ++m_count;
+
+        if(tile){
+            int x=std::uniform_int_distribution<int>(m_tile_x0, m_tile_x1)(m_rng);
+            int y=std::uniform_int_distribution<int>(m_tile_y0, m_tile_y1)(m_rng);
+            return "/tile/" + std::to_string(m_opts.zoom) + "/" + std::to_string(x) + "/" + std::to_string(y);
+        }
+
+        double w=(m_bounds[2] - m_bounds[0]) * m_opts.box_fraction;
+        double h=(m_bounds[3] - m_bounds[1]) * m_opts.box_fraction;
+        double x=uniform(m_bounds[0], std::max(m_bounds[0], m_bounds[2] - w));
+        double y=uniform(m_bounds[1], std::max(m_bounds[1], m_bounds[3] - h));
+
+        char buf[256];
+        std::snprintf(buf, sizeof(buf), "/query?bbox=%.7f,%.7f,%.7f,%.7f&limit=%d", x, y, x+w, y+h, m_opts.limit);
+        std::string target=buf;
+        if(m_opts.lod >= 0)
+            target+="&lod=" + std::to_string(m_opts.lod);
+        return target;
+    }
+};
+
+struct connection{
+    int fd=-1;
+    std::string in, out;
+    ::size_t out_pos=0;
+
+    bool waiting=false;
+    clock_type::time_point due, sent;
+
+    //Scheduled, with --rate, but not yet sent because the last one hadn't come back yet
+    ::size_t backlog=0;
+};
+
+struct results{
+    std::vector<double> latencies;
+    ::size_t errors=0, bytes=0, late=0;
+
+    //Still in a connection's backlog when time ran out, which means the server wasn't keeping up
+    ::size_t unsent=0;
+};
+
+class load{
+    const options &m_opts;
+    target_maker &m_targets;
+    std::vector<connection> m_connections;
+    int m_epoll;
+    results m_results;
+
+    void send_next( connection &c, clock_type::time_point due ){
+        c.out.clear();
+        c.out_pos=0;
+        net::write_request(c.out, m_targets.next());
+        c.due=due;
+        c.sent=clock_type::now();
+        c.waiting=true;
+        flush(c);
+    }
+
+    void flush( connection &c ){
+        while(c.out_pos < c.out.size()){
+            auto n=::send(c.fd, c.out.data() + c.out_pos, c.out.size() - c.out_pos, MSG_NOSIGNAL);
+            if(n == -1){
+                if(errno == EAGAIN || errno == EWOULDBLOCK)
+                    return;
+                throw std::runtime_error("send: "s + std::strerror(errno));
+            }
+            c.out_pos+=n;
+        }
+    }
+
+    //Returns true once a whole response has come in
+    bool receive( connection &c ){
+        char buf[65536];
+        while(true){
+            auto n=::recv(c.fd, buf, sizeof(buf), 0);
+            if(n > 0){
+                c.in.append(buf, n);
+                continue;
+            }
+            if(n == 0)
+                throw std::runtime_error("Server hung up");
+            if(errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            throw std::runtime_error("recv: "s + std::strerror(errno));
+        }
+
+        net::http_response resp;
+        auto used=net::parse_response(c.in, resp);
+        if(!used)
+            return false;
+
+        c.in.erase(0, used);
+        m_results.bytes+=used;
+        if(resp.status != 200)
+            ++m_results.errors;
+
+        return true;
+    }
+
+public:
+    load( const options &opts, target_maker &targets ):
+        m_opts(opts),
+        m_targets(targets){
+
+        m_epoll=::epoll_create1(EPOLL_CLOEXEC);
+        check(m_epoll, "epoll_create1");
+
+        m_connections.resize(opts.connections);
+        for( ::size_t i=0; i < m_connections.size(); ++i ){
+            auto &c=m_connections[i];
+            c.fd=connect_to(opts.port, true);
+
+            epoll_event ev{};
+            ev.events=EPOLLIN;
+            ev.data.u64=i;
+            check( ::epoll_ctl(m_epoll, EPOLL_CTL_ADD, c.fd, &ev), "epoll_ctl" );
+        }
+    }
+
+    ~load(){
+        for(auto &c: m_connections)
+            ::close(c.fd);
+        ::close(m_epoll);
+    }
+
+    results run(){
+        auto start=clock_type::now();
+        auto end=start + std::chrono::duration_cast<clock_type::duration>(std::chrono::duration<double>(m_opts.duration));
+
+        //With a rate, each connection gets an even share, staggered so they don't all fire at once
+        clock_type::duration interval{};
+        std::vector<clock_type::time_point> next(m_connections.size(), start);
+        if(m_opts.rate > 0){
+            interval=std::chrono::duration_cast<clock_type::duration>(
+                std::chrono::duration<double>(m_connections.size() / m_opts.rate));
+            for( ::size_t i=0; i < next.size(); ++i )
+                next[i]=start + interval * i / next.size();
+        }
+        else{
+            for(auto &c: m_connections)
+                send_next(c, clock_type::now());
+        }
+
+        epoll_event events[256];
+        while(true){
+            auto now=clock_type::now();
+            bool finishing=now >= end;
+
+            if(m_opts.rate > 0 && !finishing){
+                for( ::size_t i=0; i < m_connections.size(); ++i ){
+                    auto &c=m_connections[i];
+                    while(next[i] <= now && next[i] < end){
+                        if(!c.waiting)
+                            send_next(c, next[i]);
+                        else
+                            ++c.backlog;
+                        next[i]+=interval;
+                    }
+                }
+            }
+
+            bool outstanding=std::any_of(m_connections.begin(), m_connections.end(),
+                [](const connection &c){ return c.waiting; });
+            if(finishing && !outstanding)
+                break;
+
+            //Sleep until the next request is due, or something comes back
+            int timeout=100;
+            if(m_opts.rate > 0 && !finishing){
+                auto soonest=*std::min_element(next.begin(), next.end());
+                timeout=std::clamp<long>( std::chrono::duration_cast<std::chrono::milliseconds>(soonest - now).count(), 0, 100 );
+            }
+
+            int n=::epoll_wait(m_epoll, events, 256, timeout);
+            if(n == -1 && errno != EINTR)
+                check(n, "epoll_wait");
+
+            now=clock_type::now();
+            for( int i=0; i < n; ++i ){
+                auto &c=m_connections[events[i].data.u64];
+                if(!receive(c))
+                    continue;
+
+                c.waiting=false;
+                m_results.latencies.push_back( std::chrono::duration<double, std::milli>(now - c.due).count() );
+                if(c.due < c.sent - std::chrono::milliseconds(1))
+                    ++m_results.late;
+
+                if(now >= end)
+                    continue;
+
+                if(m_opts.rate <= 0)
+                    send_next(c, now);
+                else if(c.backlog){
+                    //The oldest of the ones that piled up, which was due one interval after the last
+                    --c.backlog;
+                    send_next(c, c.due + interval);
+                }
+            }
+        }
+
+        for(auto &c: m_connections)
+            m_results.unsent+=c.backlog;
+
+        return std::move(m_results);
+    }
+};
+
+int main(int argc, char *argv[]){
+    options opts;
+
+    for( int i=1; i < argc; ++i ){
+        std::string arg=argv[i];
+        bool more=i+1 < argc;
+
+        if(arg == "--port" && more)
+            opts.port=std::stoi(argv[++i]);
+        else if(arg == "--connections" && more)
+            opts.connections=std::max(1, std::stoi(argv[++i]));
+        else if(arg == "--rate" && more)
+            opts.rate=std::stod(argv[++i]);
+        else if(arg == "--duration" && more)
+            opts.duration=std::stod(argv[++i]);
+        else if(arg == "--mode" && more)
+            opts.mode=argv[++i];
+        else if(arg == "--box" && more)
+            opts.box_fraction=std::stod(argv[++i]);
+        else if(arg == "--zoom" && more)
+            opts.zoom=std::clamp(std::stoi(argv[++i]), 0, 24);
+        else if(arg == "--lod" && more)
+            opts.lod=std::stoi(argv[++i]);
+        else if(arg == "--limit" && more)
+            opts.limit=std::stoi(argv[++i]);
+        else{
+            console::err("Usage: loadgen [--port <n>] [--connections <n>] [--rate <requests/s>] [--duration <seconds>] "
+                "[--mode query|tile|mixed] [--box <fraction>] [--zoom <z>] [--lod <n>] [--limit <n>]");
+            return 1;
+        }
+    }
+
+    if(opts.mode != "query" && opts.mode != "tile" && opts.mode != "mixed"){
+        console::err("--mode is query, tile or mixed");
+        return 1;
+    }
+
+    try{
+        auto info=fetch(opts.port, "/info");
+        double bounds[4];
+        if(info.status != 200 || !parse_bounds(info.body, bounds))
+            throw std::runtime_error("Couldn't make out the index's bounds from /info: " + info.body);
+
+        target_maker targets{ opts, bounds };
+        load runner{ opts, targets };
+
+        auto started=clock_type::now();
+        auto res=runner.run();
+        double elapsed=std::chrono::duration<double>(clock_type::now() - started).count();
+
+        auto &lat=res.latencies;
+        std::sort(lat.begin(), lat.end());
+        auto pct=[&lat](double p){
+            return lat.empty() ? 0.0 : lat[std::min(lat.size() - 1, (::size_t)(p * lat.size()))];
+        };
+
+        char line[512];
+        std::snprintf(line, sizeof(line), "%zu requests in %.1fs, %.0f/s, %zu errors, %.1f MiB received, %zu sent late",
+            lat.size(), elapsed, lat.size() / elapsed, res.errors, res.bytes / 1048576.0, res.late);
+        console::out(line);
+
+        if(res.unsent)
+            console::err( std::to_string(res.unsent) + " requests were never sent, so the server isn't keeping up with --rate" );
+
+        std::snprintf(line, sizeof(line), "Latency ms: p50=%.3f p90=%.3f p99=%.3f p99.9=%.3f max=%.3f",
+            pct(0.5), pct(0.9), pct(0.99), pct(0.999), lat.empty() ? 0.0 : lat.back());
+        console::out(line);
+    }
+    catch( const std::exception &ex ){
+        console::err(ex.what());
+        return 1;
+    }
+
+    return 0;
+}
@@ -4,19 +4,43 @@
 #include <exception>
 #include <fstream>
 #include <functional>
+#include <atomic>
+#include <vector>
+#include <memory>
+#include <chrono>
+#include <cstring>
+#include <sstream>
+#include <iterator>
+#include <optional>
+#include <filesystem>
+#include <mutex>
+#include <condition_variable>
 
 #include "astrolib/console.hpp"
 #include "astrolib/pbffile.hpp"
 #include "astrolib/osmfile.hpp"
+#include "astrolib/osmstream.hpp"
 #include "astrolib/concurrent.hpp"
+#include "astrolib/metrics.hpp"
+#include "astrolib/trace.hpp"
+#include "astrolib/checkpoint.hpp"
 
 #include "astrolib/index.hpp"
+#include "astrolib/index/tag_filter.hpp"
+#include "astrolib/index/string_dictionary.hpp"
+#include "astrolib/index/multipolygon.hpp"
+#include "astrolib/index/builder.hpp"
+#include "astrolib/index/layout.hpp"
+#include "astrolib/index/container.hpp"
+#include "astrolib/node_store.hpp"
+#include "astrolib/primitives.hpp"
 
 using namespace std::string_literals;
 using namespace google::protobuf;
 using namespace leapus;
 using namespace leapus::osm;
 using namespace leapus::concurrent;
+using namespace leapus::astrolib;
 using namespace leapus::astrolib::index;
 
 class worker_pool:public ThreadPool< std::function<void()>, lf_queue<std::function<void()>> >{
@@ -38,27 +62,782 @@ protected:
     }
 };
 
-static void blob_handler( const index_config &config, osm_file::const_blob_iterator_type it){
-    leapus::console::out( it->first.type() );
+//Everything the blob handlers share
+struct indexer{
+    index_config config;
+    tag_filter filter;
+    string_interner strings;
+    astrolib::node_store nodes;
+    multipolygon_assembler polygons;
+    index_builder builder;
+
+    //Objects that made it into the index, by index_entry_type, and those that didn't
+    std::atomic<::size_t> kept[idx_widget+1]={}, dropped=0;
+
+    //A resumable build keeps its spool, for carrying on from a checkpoint
+    indexer( const std::string &out_path, bool resumable, bool compress_nodes ):
+        nodes(out_path + ".nodes", astrolib::node_store::default_capacity, compress_nodes),
+        polygons(nodes),
+        builder(config, out_path + ".spool", resumable){}
+};
+
+//Where a build had got to, which is what a checkpoint's state holds. The rest is in its journal.
+struct progress_state{
+    enum stage_type: ::uint32_t{ nodes_stage, ways_stage, batches_stage, built_stage };
+
+    ::uint32_t stage=nodes_stage;
+
+    //The frame of the first blob not yet handed out, in the nodes and ways stages,
+    //and the first multipolygon batch not yet assembled
+    ::uint64_t next_blob=0, next_batch=0;
+
+    //What was being built from, which a resumed build must match
+    ::uint64_t input_size=0;
+    ::uint32_t input_crc=0, style_crc=0;
+
+    //The output and spool are only ever appended to, so anything past these is from after the checkpoint
+    ::uint64_t out_size=0, spool_size=0;
+
+    //How many index items, strings and multipolygon relations have been journaled
+    ::uint64_t items=0, strings=0, relations=0;
+
+    ::uint64_t kept[idx_widget+1]={}, dropped=0;
+    multipolygon_assembler::statistics_type polygons;
+
+    //Once built
+    ::uint64_t root=0;
+};
+
+//Takes checkpoints of a build, and restores one
+class checkpointer{
+    indexer &m_state;
+    pbf::protobuf_file &m_out;
+    checkpoint_file &m_file;
+    std::chrono::steady_clock::duration m_interval;
+    std::chrono::steady_clock::time_point m_last;
+
+    std::string describe() const{
+        std::string where;
+        switch(progress.stage){
+            case progress_state::nodes_stage:
+                where="nodes and relations, from the blob at " + std::to_string(progress.next_blob);
+                break;
+            case progress_state::ways_stage:
+                where="ways, from the blob at " + std::to_string(progress.next_blob);
+                break;
+            case progress_state::batches_stage:
+                where="multipolygons, from batch " + std::to_string(progress.next_batch);
+                break;
+            default:
+                where="built, with the root at " + std::to_string(progress.root);
+        }
+
+        return where + ", with " + std::to_string(progress.items) + " items";
+    }
+
+public:
+    progress_state progress;
+
+    checkpointer( indexer &state, pbf::protobuf_file &out, checkpoint_file &file, std::chrono::steady_clock::duration interval ):
+        m_state(state),
+        m_out(out),
+        m_file(file),
+        m_interval(interval),
+        m_last(std::chrono::steady_clock::now()){}
+
+    bool due() const{
+        return std::chrono::steady_clock::now() - m_last >= m_interval;
+    }
+
+    //Nothing may be adding to the index while this runs. Everything the files hold so far is made
+    //durable, the new items, strings and relations are journaled, and then the progress is committed.
+    void save(){
+        m_state.nodes.sync();
+
+        journal_writer journal;
+        journal.put('I');
+        progress.spool_size=m_state.builder.save(journal, progress.items);
+        progress.items=m_state.builder.size();
+
+        journal.put('S');
+        auto strings=m_state.strings.size();
+        journal.put<::uint64_t>(strings - progress.strings);
+        for( auto id=progress.strings; id < strings; ++id )
+            journal.put_string(m_state.strings.str(id));
+        progress.strings=strings;
+
+        journal.put('R');
+        m_state.polygons.save(journal, progress.relations);
+        progress.relations=m_state.polygons.size();
+
+        m_out.sync();
+        progress.out_size=m_out.size();
+
+        for( int t=0; t <= idx_widget; ++t )
+            progress.kept[t]=m_state.kept[t];
+        progress.dropped=m_state.dropped;
+        progress.polygons=m_state.polygons.statistics();
+
+        m_file.append(journal);
+        m_file.commit({ (const char *)&progress, sizeof(progress) });
+        m_last=std::chrono::steady_clock::now();
+
+        leapus::console::out( "Checkpoint: " + describe() );
+    }
+
+    //Mid-pass, once every blob before pos is done
+    void save_at_blob( file_offs_t pos ){
+        progress.next_blob=pos;
+        save();
+    }
+
+    //Pick up from a checkpoint's state, which must be of a build of the same input, with the same style.
+    //The indexer must be fresh, apart from the files it keeps.
+    void restore( const std::string &state ){
+        progress_state saved;
+        if(state.size() != sizeof(saved))
+            throw checkpoint_exception("Checkpoint is from a different version of mapindexer");
+        std::memcpy(&saved, state.data(), sizeof(saved));
+
+        if(saved.input_size != progress.input_size || saved.input_crc != progress.input_crc)
+            throw checkpoint_exception("Checkpoint is of a different input file");
+        if(saved.style_crc != progress.style_crc)
+            throw checkpoint_exception("Checkpoint was taken with a different style");
+        if(saved.stage > progress_state::built_stage)
+            throw checkpoint_exception("Checkpoint is corrupt");
+
+        //Mid-pass, the next blob has to be where a frame begins
+        const osm_file &in=m_state.config.in_file;
+        if(saved.stage <= progress_state::ways_stage && saved.next_blob < in.size()){
+            OSMPBF::BlobHeader header;
+            in.read_blob_header(saved.next_blob, header);
+            if(header.type() != "OSMData" && header.type() != "OSMHeader")
+                throw checkpoint_exception("Checkpoint's next blob isn't a blob");
+        }
+
+        if(m_out.size() < saved.out_size)
+            throw checkpoint_exception("Output is shorter than the checkpoint says");
+        m_out.truncate(saved.out_size);
+        m_state.builder.truncate_spool(saved.spool_size);
+
+        m_file.replay([this](journal_reader &journal){
+            while(!journal.done()){
+                switch(journal.get<char>()){
+                    case 'I':
+                        m_state.builder.restore(journal);
+                        break;
+
+                    case 'S':
+                        //Interned again in the same order, they get the same IDs
+                        for( auto n=journal.get<::uint64_t>(); n; --n ){
+                            auto expected=m_state.strings.size();
+                            if(m_state.strings.intern(journal.get_string()) != expected)
+                                throw checkpoint_exception("Checkpoint journal has a string twice");
+                        }
+                        break;
+
+                    case 'R':
+                        m_state.polygons.restore(journal);
+                        break;
+
+                    default:
+                        throw checkpoint_exception("Checkpoint journal is corrupt");
+                }
+            }
+        });
+
+        if(m_state.builder.size() != saved.items || m_state.strings.size() != saved.strings ||
+            m_state.polygons.size() != saved.relations)
+            throw checkpoint_exception("Checkpoint journal doesn't match the checkpoint");
+
+        for( int t=0; t <= idx_widget; ++t )
+            m_state.kept[t]=saved.kept[t];
+        m_state.dropped=saved.dropped;
+        m_state.polygons.restore_statistics(saved.polygons);
+
+        progress=saved;
+        m_last=std::chrono::steady_clock::now();
+
+        leapus::console::out( "Resuming from checkpoint: " + describe() );
+    }
+};
+
+//A stage of indexing, by name in the trace, and with a histogram of how long each piece of work
+//(a block, decoding included, or a relation) takes, for the progress report
+struct stage{
+    const char *name;
+    metrics::histogram time;
+
+    stage( const char *name ):
+        name(name),
+        time("stage."s + name + "_ns"){}
+};
+
+static const stage nodes_pass("nodes"), ways_pass("ways"), members_pass("member_ways"),
+    assemble_stage("assemble"), build_stage("build");
+
+//Run handler(block, blob position) on every data block of the file from the one at start onwards,
+//on a pool of workers, and wait for them all. With checkpoints, blocks are handed out a segment
+//at a time, and whenever one is due, it's taken between segments, once nothing is in flight.
+template<typename Func>
+static void for_each_block( const osm_file &file, const stage &stage, Func &&handler,
+    file_offs_t start=0, checkpointer *checkpoints=nullptr ){
+
+    static const metrics::counter blocks("index.blocks");
+    constexpr ::size_t segment_blobs=1024;
+
+    osm_file::const_blob_iterator_type it{ file, start };
+    while(it != file.end()){
+        worker_pool threads;
+
+        for( ::size_t n=0; it != file.end() && (!checkpoints || n < segment_blobs); ++it, ++n )
+            threads.push_front( [&handler, &stage, it](){
+            if(it->first.type() != "OSMData")
+                return;
+
+            metrics::scoped_timer timer(stage.time);
+            TRACE_SCOPE_ARG(stage.name, "blob", it.pos());
+            OSMPBF::PrimitiveBlock block;
+            decode_blob(it->second, block);
+            handler(block, it.pos());
+            blocks.add();
+        });
+
+        threads.shutdown();
+        if(checkpoints && it != file.end() && checkpoints->due())
+            checkpoints->save_at_blob(it.pos());
+    }
+}
+
+//Run handler(block, blob position) on every data block of a stream, on a pool of workers, as it
+//arrives, and wait for them all. What's been read is in memory until it's been handled, so the
+//stream isn't read more than a few blobs a worker ahead of them.
+template<typename Func>
+static void for_each_streamed_block( osm_stream &stream, const stage &stage, Func &&handler ){
+    static const metrics::counter blocks("index.blocks");
+    const ::size_t max_in_flight=4 * std::max(1u, std::thread::hardware_concurrency());
+
+    std::mutex mut;
+    std::condition_variable cond;
+    ::size_t in_flight=0;
+
+    worker_pool threads;
+    stream_blob blob;
+    while(stream.next(blob)){
+        if(blob.header.type() != "OSMData")
+            continue;
+
+        {
+            std::unique_lock lock(mut);
+            cond.wait(lock, [&](){ return in_flight < max_in_flight; });
+            ++in_flight;
+        }
+
+        //The blob shares the stream's buffer, so handing it over doesn't copy it
+        threads.push_front( [&handler, &stage, &mut, &cond, &in_flight, blob=std::move(blob)](){
+            //However its handling ends, it's no longer in flight
+            meta::guard done( [&mut, &cond, &in_flight](){
+                std::lock_guard lock(mut);
+                --in_flight;
+                cond.notify_one();
+            } );
+
+            metrics::scoped_timer timer(stage.time);
+            TRACE_SCOPE_ARG(stage.name, "blob", blob.pos);
+
+            OSMPBF::Blob raw;
+            blob.parse(raw);
+            OSMPBF::PrimitiveBlock block;
+            decode_blob(raw, block);
+            handler(block, blob.pos);
+            blocks.add();
+        });
+    }
+
+    threads.shutdown();
+}
+
+//Classifying the objects of one block, counting what's kept, and noting which strings the
+//kept objects use, which are the only ones worth interning. The totals are added up at the end.
+class block_tally{
+    indexer &m_state;
+    const OSMPBF::PrimitiveBlock &m_block;
+    ::size_t m_kept[idx_widget+1]={}, m_dropped=0;
+    std::vector<bool> m_wanted;
+
+    //The string table index of "name", or -1 if nothing in the block has one
+    int m_name;
+
+public:
+    const tag_filter::resolved filter;
+
+    block_tally( indexer &state, const OSMPBF::PrimitiveBlock &block ):
+        m_state(state),
+        m_block(block),
+        m_wanted(block.stringtable().s_size()),
+        m_name(osm::find_string(block.stringtable(), "name")),
+        filter(state.filter.resolve(block.stringtable())){}
+
+    ~block_tally(){
+        m_state.strings.intern(m_block.stringtable(), &m_wanted);
+
+        for( int t=0; t <= idx_widget; ++t )
+            m_state.kept[t]+=m_kept[t];
+        m_state.dropped+=m_dropped;
+    }
+
+    template<typename It>
+    void want( It first, It last ){
+        for(; first != last; ++first)
+            if( (::size_t)*first < m_wanted.size() )
+                m_wanted[*first]=true;
+    }
+
+    bool tally( const tag_filter::result_type &type ){
+        if(type)
+            ++m_kept[*type];
+        else
+            ++m_dropped;
+
+        return type.has_value();
+    }
+
+    template<typename Element>
+    tag_filter::result_type keep( element_kind kind, const Element &e, int *priority=nullptr ){
+        auto type=filter.classify(kind, e, priority);
+        if(tally(type)){
+            want(e.keys().begin(), e.keys().end());
+            want(e.vals().begin(), e.vals().end());
+        }
+
+        return type;
+    }
+
+    //How big a label or widget is on screen, going by its name, see labels.hpp
+    label_metrics measure( index_entry_type type, int priority, std::string_view name ) const{
+        return type == idx_label ? measure_label(name, priority) : measure_widget(priority);
+    }
+
+    template<typename Element>
+    label_metrics measure( index_entry_type type, int priority, const Element &e ) const{
+        std::string_view name;
+        for( int i=0; i < e.keys_size(); ++i )
+            if((int)e.keys(i) == m_name && (int)e.vals(i) < m_block.stringtable().s_size()){
+                name=m_block.stringtable().s(e.vals(i));
+                break;
+            }
+
+        return measure(type, priority, name);
+    }
+
+    //One node's worth of DenseNodes::keys_vals
+    label_metrics measure_dense( index_entry_type type, int priority, const ::int32_t *kv, const ::int32_t *end ) const{
+        std::string_view name;
+        for(; kv+1 < end && *kv; kv+=2 )
+            if(kv[0] == m_name && kv[1] >= 0 && kv[1] < m_block.stringtable().s_size()){
+                name=m_block.stringtable().s(kv[1]);
+                break;
+            }
+
+        return measure(type, priority, name);
+    }
+};
+
+//The first pass: nodes and relations. Ways need every node to have been stored first.
+static void blob_handler( indexer &state, const OSMPBF::PrimitiveBlock &block, file_offs_t blob_pos ){
+    block_tally tally(state, block);
+    multipolygon_assembler::block_strings mp_strings(block.stringtable());
+    int ordinal=0;
+
+    astrolib::node_store::writer nodes(state.nodes);
+
+    for(const auto &group: block.primitivegroup()){
+        osm::for_each_node(block, group, [&nodes](osm::osm_id id, const astrolib::coordinate_t &loc){
+            nodes.set(id, loc);
+        });
+
+        for(const auto &node: group.nodes()){
+            int priority;
+            if(auto type=tally.keep(el_node, node, &priority))
+                state.builder.add_point({ blob_pos, ordinal }, *type, block_location(block, node.lat(), node.lon()),
+                    tally.measure(*type, priority, node));
+            ++ordinal;
+        }
+
+        if(group.has_dense()){
+            const auto &dense=group.dense();
+            const auto &kv=dense.keys_vals();
+            const ::int32_t *p=kv.data(), *end=p+kv.size();
+            ::int64_t lat=0, lon=0;
+
+            for( int i=0; i < dense.id_size(); ++i, ++ordinal ){
+                lat+=dense.lat(i);
+                lon+=dense.lon(i);
+
+                auto *tags=p;
+                int priority;
+                auto type=tally.filter.classify_dense(p, end, &priority);
+                if(!tally.tally(type))
+                    continue;
+
+                tally.want(tags, p);
+                state.builder.add_point({ blob_pos, ordinal }, *type, block_location(block, lat, lon),
+                    tally.measure_dense(*type, priority, tags, p));
+            }
+        }
+
+        ordinal+=group.ways_size();
+
+        for(const auto &rel: group.relations()){
+            osm_address_t address{ blob_pos, ordinal++ };
+
+            //These are counted once they've been assembled
+            auto type=tally.filter.classify(el_relation, rel);
+            if(type == idx_poly && state.polygons.add_relation(rel, mp_strings, address)){
+                tally.want(rel.keys().begin(), rel.keys().end());
+                tally.want(rel.vals().begin(), rel.vals().end());
+                continue;
+            }
+
+            tally.keep(el_relation, rel);
+        }
+    }
+}
+
+//The second pass: ways, whose nodes are all known by now
+static void way_handler( indexer &state, const OSMPBF::PrimitiveBlock &block, file_offs_t blob_pos ){
+    block_tally tally(state, block);
+    std::vector<osm::osm_id> refs;
+    astrolib::ring_t points;
+    int ordinal=0;
+
+    for(const auto &group: block.primitivegroup()){
+        ordinal+=group.nodes_size() + (group.has_dense() ? group.dense().id_size() : 0);
+
+        for(const auto &way: group.ways()){
+            osm_address_t address{ blob_pos, ordinal++ };
+            int priority;
+            auto type=tally.keep(el_way, way, &priority);
+            if(!type)
+                continue;
+
+            //Nodes missing from an extract are simply skipped
+            osm::way_refs(way, refs);
+            points.clear();
+            for(auto ref: refs)
+                if(astrolib::coordinate_t loc; state.nodes.get(ref, loc))
+                    points.push_back(loc);
+
+            if(points.empty())
+                continue;
+
+            bool closed=points.size() >= 4 && refs.front() == refs.back();
+
+            if(*type == idx_poly && closed){
+                astrolib::polygon_t poly{ points };
+                astrolib::orient(poly.outer, true);
+                state.builder.add_polygon(address, poly);
+            }
+            else if(*type == idx_label || *type == idx_widget){
+                auto box=astrolib::bounds(points);
+                state.builder.add_point(address, *type, { box.sw.lat + (box.ne.lat - box.sw.lat)/2,
+                    box.sw.lon + (box.ne.lon - box.sw.lon)/2 }, tally.measure(*type, priority, way));
+            }
+            else{
+                state.builder.add_line(address, idx_line, points.data(), points.size());
+            }
+        }
+
+        ordinal+=group.relations_size();
+    }
 }
 
 int main(int argc, char *argv[]){
 
-    index_config config;
-    worker_pool threads(0);
+    //--progress <seconds>, --metrics <file.json>, --trace <file.json>, --checkpoint <seconds>,
+    //--build-threads <n>, --copy-input <file.osm.pbf>, --compress-nodes and --triangulate may go anywhere,
+    //and everything else is positional
+    std::vector<std::string> args;
+    double progress_interval=0, checkpoint_interval=0;
+    std::string metrics_path, trace_path, copy_path;
+    bool compress_nodes=false, triangulate=false;
+    int build_threads=0;
+
+    for( int i=1; i < argc; ++i ){
+        std::string arg=argv[i];
+        if(arg == "--progress" && i+1 < argc)
+            progress_interval=std::stod(argv[++i]);
+        else if(arg == "--metrics" && i+1 < argc)
+            metrics_path=argv[++i];
+        else if(arg == "--trace" && i+1 < argc)
+            trace_path=argv[++i];
+        else if(arg == "--checkpoint" && i+1 < argc)
+            checkpoint_interval=std::stod(argv[++i]);
+        else if(arg == "--build-threads" && i+1 < argc)
+            build_threads=std::stoi(argv[++i]);
+        else if(arg == "--copy-input" && i+1 < argc)
+            copy_path=argv[++i];
+        else if(arg == "--compress-nodes")
+            compress_nodes=true;
+        else if(arg == "--triangulate")
+            triangulate=true;
+        else
+            args.push_back(arg);
+    }
+
+    if(args.size() < 2){
+        leapus::console::err("Usage: mapindexer [--progress <seconds>] [--metrics <file.json>] [--trace <file.json>] [--checkpoint <seconds>] [--build-threads <n>] [--copy-input <file.osm.pbf>] [--compress-nodes] [--triangulate] <in.osm.pbf | -> <out.idx> [style]");
+        return 1;
+    }
+
+    //Standard input, or a pipe, can only be read once, front to back. The first pass is made as it
+    //arrives, while it's copied to a file, which the other passes, and the server, then read instead.
+    bool streaming=args[0] == "-" || (std::filesystem::exists(args[0]) && !std::filesystem::is_regular_file(args[0]));
+    if(streaming && copy_path.empty())
+        copy_path=args[1] + ".osm.pbf";
+
+    if(streaming && checkpoint_interval > 0){
+        leapus::console::err("A build from a stream can't be checkpointed; index the copy of it instead");
+        return 1;
+    }
+
+    //Metrics to a file without progress on the console still need an interval, so they get one
+    std::unique_ptr<metrics::reporter> reporter;
+    if(progress_interval > 0 || !metrics_path.empty())
+        reporter=std::make_unique<metrics::reporter>( std::chrono::milliseconds( (long)((progress_interval > 0 ? progress_interval : 10) * 1000) ),
+            progress_interval > 0, metrics_path );
+
+    if(!trace_path.empty()){
+        if(!trace::built_in)
+            leapus::console::err("Tracing isn't built in; configure with -DASTROLIB_TRACE=ON for --trace");
+        TRACE_THREAD_NAME("main");
+        trace::start();
+    }
+
+    //A checkpointed build picks up from the last checkpoint, if there is one. Otherwise, whatever
+    //a previous build left behind is of no use, since a resumed build would trust it, and so would
+    //the node store, which would hand out the old input's locations for nodes missing from this one.
+    std::unique_ptr<checkpoint_file> checkpoint;
+    std::optional<std::string> saved;
+    if(checkpoint_interval > 0){
+        checkpoint=std::make_unique<checkpoint_file>(args[1] + ".checkpoint");
+        saved=checkpoint->load();
+    }
+
+    if(!saved)
+        for( auto *suffix: { ".nodes", ".spool" } )
+            std::filesystem::remove(args[1] + suffix);
+
+    //The tree is built in a work file, full of scratch, and only copied out into the index proper
+    //once it's done, so whatever was at args[1] stays a usable index all along
+    const std::string work_path=args[1] + ".build";
+    if(!saved)
+        std::filesystem::remove(work_path);
+
+    //Only a resumed build reopens a node store, which has to be the same kind as it was
+    std::unique_ptr<indexer> state_ptr;
+    try{
+        state_ptr=std::make_unique<indexer>(args[1], checkpoint != nullptr, compress_nodes);
+    }
+    catch( const node_store_exception &ex ){
+        leapus::console::err( "Can't resume from the checkpoint: "s + ex.what() +
+            ". Resume with the same --compress-nodes as before, or remove " + args[1] + ".checkpoint to start over" );
+        return 1;
+    }
+
+    indexer &state=*state_ptr;
+    index_config &config=state.config;
     //const osm_file in( argv[1] );
-    pbf::protobuf_file out{ argv[2], true, (pbf::protobuf_file::size_type)130 * 1024 * 1024 * 1024 * 4 };
+    pbf::protobuf_file out{ work_path, true, (pbf::protobuf_file::size_type)130 * 1024 * 1024 * 1024 * 4 };
 
     //We go with a mapping size of four times the OSM planet file as of this writing
     //or about 520GB
-    config.in_file = std::move( osm::osm_file{ argv[1] } );
+    std::unique_ptr<osm_stream> stream;
+    if(streaming)
+        stream=std::make_unique<osm_stream>(args[0], copy_path);
+    else
+        config.in_file = std::move( osm::osm_file{ args[0] } );
 
     config.file_allocator={ out };
+    config.triangulate=triangulate;
+
+    std::string style_text;
+    if(args.size() > 2){
+        std::ifstream style(args[2]);
+        if(!style)
+            throw std::runtime_error("Could not open style: " + args[2]);
+        style_text.assign( std::istreambuf_iterator<char>(style), std::istreambuf_iterator<char>() );
+
+        std::istringstream parsed(style_text);
+        state.filter=tag_filter::parse(parsed, args[2]);
+    }
+    else{
+        state.filter=tag_filter::default_style();
+    }
+
+    const osm_file &in=config.in_file;
+
+    std::unique_ptr<checkpointer> checkpoints;
+    progress_state unsaved;
+    if(checkpoint){
+        checkpoints=std::make_unique<checkpointer>(state, out, *checkpoint,
+            std::chrono::milliseconds( (long)(checkpoint_interval * 1000) ));
+
+        //The first megabyte has the header and plenty of data, which is fingerprint enough along with the size
+        auto &p=checkpoints->progress;
+        p.input_size=in.size();
+        auto head=std::min<::size_t>(in.size(), 1 << 20);
+        p.input_crc=head ? checksum(std::addressof(*in.read(0, head)), head) : 0;
+        p.style_crc=checksum(style_text.data(), style_text.size());
+
+        if(saved)
+            checkpoints->restore(*saved);
+    }
+
+    progress_state &progress=checkpoints ? checkpoints->progress : unsaved;
+    auto save=[&checkpoints](){
+        if(checkpoints)
+            checkpoints->save();
+    };
 
     //Walk the blobs in the thread and create an indexing task for each one
-    for( auto it=meta::constify(config.in_file).begin(); it!=meta::constify(config.in_file).end(); ++it ){
-        threads.push_front( [&config, it](){ blob_handler(config, it); } );
-        //leapus::console::out( it->first.type() );
+    if(progress.stage == progress_state::nodes_stage){
+        auto handler=[&state](const OSMPBF::PrimitiveBlock &block, file_offs_t pos){ blob_handler(state, block, pos); };
+        if(stream){
+            for_each_streamed_block(*stream, nodes_pass, handler);
+            stream->close_tee();
+            stream.reset();
+
+            config.in_file = std::move( osm::osm_file{ copy_path } );
+            leapus::console::out( "Input copied to " + copy_path + ", " + std::to_string(in.size()) + " bytes" );
+        }
+        else{
+            for_each_block(in, nodes_pass, handler, progress.next_blob, checkpoints.get());
+        }
+
+        progress.stage=progress_state::ways_stage;
+        progress.next_blob=0;
+        save();
+    }
+
+    //Ways need their nodes, and multipolygons need their member ways, so those take passes of their own.
+    //The first batch of multipolygon member ways is picked up in the same pass as the ways themselves,
+    //unless that pass is being resumed partway through, since it would miss those from before.
+    auto batches=state.polygons.plan_batches();
+    bool first_batch_ready=false;
+
+    if(progress.stage == progress_state::ways_stage){
+        bool with_members=batches && !progress.next_blob;
+        if(with_members)
+            state.polygons.begin_batch(0);
+
+        for_each_block(in, ways_pass, [&state, with_members](const OSMPBF::PrimitiveBlock &block, file_offs_t pos){
+            way_handler(state, block, pos);
+            if(with_members)
+                state.polygons.add_ways(block);
+        }, progress.next_blob, checkpoints.get());
+
+        first_batch_ready=with_members;
+        progress.stage=progress_state::batches_stage;
+        progress.next_batch=0;
+        save();
+    }
+
+    for( ::size_t b=progress.stage == progress_state::batches_stage ? progress.next_batch : batches; b < batches; ++b ){
+        if(b || !first_batch_ready){
+            state.polygons.begin_batch(b);
+            for_each_block(in, members_pass, [&state](const OSMPBF::PrimitiveBlock &block, file_offs_t){ state.polygons.add_ways(block); });
+        }
+
+        worker_pool threads;
+        for( ::size_t i=0; i < state.polygons.batch_size(); ++i ){
+            threads.push_front( [&state, i](){
+                metrics::scoped_timer timer(assemble_stage.time);
+                TRACE_SCOPE_ARG(assemble_stage.name, "relation", i);
+                multipolygon mp;
+                if(!state.polygons.assemble(i, mp)){
+                    ++state.dropped;
+                    return;
+                }
+
+                ++state.kept[idx_poly];
+                for(const auto &poly: mp.polygons)
+                    state.builder.add_polygon(mp.address, poly);
+            });
+        }
+
+        threads.shutdown();
+        state.polygons.end_batch();
+
+        progress.next_batch=b+1;
+        save();
+    }
+
+    //Every node has been looked up by now. The store is a sparse file of the full capacity, which
+    //isn't worth leaving behind, and it goes once it's unmapped.
+    std::filesystem::remove(args[1] + ".nodes");
+
+    auto mp_stats=state.polygons.statistics();
+    leapus::console::out( "Multipolygons: " + std::to_string(mp_stats.assembled) + " of " +
+        std::to_string(mp_stats.relations) + " assembled into " + std::to_string(mp_stats.polygons) +
+        " polygons with " + std::to_string(mp_stats.holes) + " holes, " +
+        std::to_string(mp_stats.incomplete) + " incomplete" );
+
+    leapus::console::out( "Indexed lines: " + std::to_string(state.kept[idx_line]) +
+        ", polygons: " + std::to_string(state.kept[idx_poly]) +
+        ", labels: " + std::to_string(state.kept[idx_label]) +
+        ", widgets: " + std::to_string(state.kept[idx_widget]) +
+        ", dropped: " + std::to_string(state.dropped) );
+
+    if(progress.stage != progress_state::built_stage){
+        quadtree_square *root;
+        {
+            metrics::scoped_timer timer(build_stage.time);
+            TRACE_SCOPE(build_stage.name);
+            root=&state.builder.build(build_threads);
+        }
+
+        auto build_stats=state.builder.statistics();
+        leapus::console::out( "Quadtree: " + std::to_string(build_stats.items) + " items in " +
+            std::to_string(build_stats.squares) + " squares, " + std::to_string(build_stats.leaves) + " leaves, " +
+            std::to_string(build_stats.depth) + " deep, with " + std::to_string(build_stats.entries) + " entries of which " +
+            std::to_string(build_stats.fragments) + " are clipped fragments" );
+
+        if(config.triangulate)
+            leapus::console::out( "Polygons filled with " + std::to_string(build_stats.triangles) + " triangles" );
+
+        leapus::console::out( "Labels: " + std::to_string(build_stats.labels_placed) + " of " + std::to_string(build_stats.labels) +
+            " placed, over " + std::to_string(build_stats.label_levels) + " levels" );
+
+        progress.root=out.offset_of(root);
+        progress.stage=progress_state::built_stage;
+        save();
+    }
+    else{
+        leapus::console::out( "Quadtree: built before the checkpoint" );
+    }
+
+    auto &root=*(const quadtree_square *)std::addressof(*std::as_const(out).read(progress.root, sizeof(quadtree_square)));
+    auto summary=write_index(args[1], out, root, state.strings);
+    leapus::console::out( "Index: " + std::to_string(summary.squares) + " squares, " +
+        std::to_string(summary.entries) + " entries in " + std::to_string(summary.runs) + " runs, " + std::to_string(summary.labels) + " labels, " +
+        std::to_string(summary.reduction_bytes) + " bytes of geometry and " +
+        std::to_string(state.strings.size()) + " strings in " + std::to_string(summary.dictionary_bytes) + " bytes, " +
+        std::to_string(summary.file_size) + " bytes in all, root at offset " + std::to_string(summary.root) );
+
+    //Done, so there's nothing left to resume
+    if(checkpoint){
+        checkpoint->remove();
+        std::filesystem::remove(args[1] + ".spool");
+    }
+    std::filesystem::remove(work_path);
+
+    if(reporter)
+        reporter->stop();
+
+    if(!trace_path.empty() && trace::built_in){
+        trace::stop();
+        leapus::console::out( "Trace: " + std::to_string(trace::write(trace_path)) + " events written to " + trace_path );
     }
 
     /*
@@ -0,0 +1,104 @@
+/*
+*
+* osmgen: write a synthetic OSM PBF file for scaling tests
+*
+* Usage: osmgen <out.osm.pbf> [--size 10G] [--blocks N] [--threads N] [--seed N] [--option value...]
+*
+* See synthetic.hpp for what each option does. Without --size or --blocks, 64 blocks are written,
+* which is about 3MB.
+*
+*/
+
+#include <map>
+#include <string>
+#include <chrono>
+#include <functional>
+#include <exception>
+
+#include "astrolib/console.hpp"
+#include "astrolib/synthetic.hpp"
+
+using namespace std::string_literals;
+using namespace leapus;
+using namespace leapus::osm;
+
+//1024, 64K, 10M, 1G, 2T
+static ::size_t parse_size( const std::string &s ){
+    ::size_t pos;
+    double v=std::stod(s, &pos);
+    std::string unit=s.substr(pos);
+
+    const std::map<std::string, ::size_t> units{ { "", 1 }, { "K", 1ull << 10 }, { "M", 1ull << 20 }, { "G", 1ull << 30 }, { "T", 1ull << 40 } };
+    auto it=units.find(unit);
+    if(it == units.end())
+        throw std::invalid_argument("Bad size: " + s);
+
+    return (::size_t)(v * it->second);
+}
+
+static const char usage[]="Usage: osmgen <out.osm.pbf> [--size 10G] [--blocks N] [--threads N] [--seed N] [--option value...]";
+
+int main( int argc, char *argv[] ){
+    //The output comes first, so an option there is a mistake, or a request for help, and not a file name
+    if(argc < 2 || std::string(argv[1]).rfind("--", 0) == 0){
+        bool help=argc >= 2 && std::string(argv[1]) == "--help";
+        (help ? console::out : console::err)(usage);
+        return help ? 0 : 1;
+    }
+
+    synthetic_config config;
+    int threads=0;
+    bool sized=false, counted=false;
+
+    const std::map<std::string, std::function<void(const std::string &)>> options{
+        { "--size", [&](auto &v){ config.max_bytes=parse_size(v); sized=true; } },
+        { "--blocks", [&](auto &v){ config.blocks=std::stoull(v); counted=true; } },
+        { "--threads", [&](auto &v){ threads=std::stoi(v); } },
+        { "--seed", [&](auto &v){ config.seed=std::stoull(v); } },
+        { "--min-lat", [&](auto &v){ config.min_lat=std::stod(v); } },
+        { "--max-lat", [&](auto &v){ config.max_lat=std::stod(v); } },
+        { "--min-lon", [&](auto &v){ config.min_lon=std::stod(v); } },
+        { "--max-lon", [&](auto &v){ config.max_lon=std::stod(v); } },
+        { "--nodes-per-block", [&](auto &v){ config.nodes_per_block=std::stoi(v); } },
+        { "--step", [&](auto &v){ config.step=std::stod(v); } },
+        { "--way-length", [&](auto &v){ config.way_length_mean=std::stod(v); } },
+        { "--way-length-max", [&](auto &v){ config.way_length_max=std::stoi(v); } },
+        { "--closed", [&](auto &v){ config.closed_fraction=std::stod(v); } },
+        { "--multipolygons", [&](auto &v){ config.multipolygon_fraction=std::stod(v); } },
+        { "--holes", [&](auto &v){ config.hole_fraction=std::stod(v); } },
+        { "--poi-interval", [&](auto &v){ config.tagged_node_interval=std::stoi(v); } },
+        { "--vocabulary", [&](auto &v){ config.vocabulary=std::stoi(v); } },
+        { "--zipf", [&](auto &v){ config.zipf_exponent=std::stod(v); } },
+        { "--clusters", [&](auto &v){ config.clusters=std::stoi(v); } },
+        { "--cluster-radius", [&](auto &v){ config.cluster_radius=std::stod(v); } },
+        { "--clustering", [&](auto &v){ config.clustering=std::stod(v); } },
+        { "--compression", [&](auto &v){ config.compression=std::stoi(v); } }
+    };
+
+    try{
+        for( int i=2; i < argc; ++i ){
+            auto it=options.find(argv[i]);
+            if(it == options.end() || i+1 >= argc)
+                throw std::invalid_argument("Unknown option, or missing value: "s + argv[i]);
+
+            it->second(argv[++i]);
+        }
+
+        //A size on its own means as many blocks as it takes
+        if(sized && !counted)
+            config.blocks=~(::size_t)0;
+
+        auto start=std::chrono::steady_clock::now();
+        auto blocks=write_synthetic(argv[1], config, threads);
+        double seconds=std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        console::out( "Wrote " + std::to_string(blocks) + " blocks, " +
+            std::to_string(std::filesystem::file_size(argv[1]) >> 20) + "MiB in " + std::to_string(seconds) + "s" );
+    }
+    catch( const std::exception &ex ){
+        console::err(ex.what());
+        return 1;
+    }
+
+    return 0;
+}
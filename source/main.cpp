@@ -1,6 +1,1051 @@
-#include "astrolib/io/mmap_file.hpp"
+/*
+*
+* astrolabe, the query daemon
+*
+* Serves queries against a built index over HTTP on the loopback interface, for a renderer or
+* anything else on the same machine:
+*
+*     GET  /info                          the index's bounds, the bounds of what's in it, and sizes
+*     GET  /query?bbox=w,s,e,n            entries touching the box, in degrees. Optionally
+*              &lod=n                     drop lines and polygons under 1/2^n of the box across,
+*              &limit=n                   stop after n entries (1000 by default),
+*              &detail=1                  and look up each one's OSM ID and name (needs the .pbf).
+*     GET  /tile/z/x/y                    a Web Mercator tile, as a Mapbox vector tile. Optionally
+*              &tags=1                    with the tags the index has strings for (needs the .pbf).
+*     GET  /stats                         metrics, and how the block cache is doing
+*     POST /reload                        swap in the index file again, after a rebuild
+*
+* One thread runs an epoll loop which does all of the socket I/O and HTTP parsing, and hands each
+* complete request to a pool of workers to run. When a worker is done, it queues the response and
+* wakes the loop through an eventfd, and the loop writes it out. A connection has at most one request
+* at a time with the workers, so pipelined requests are answered in order.
+*
+* The index stays mapped, and decoded blocks stay cached, from one request to the next. SIGHUP
+* reloads the index, like POST /reload, and SIGINT or SIGTERM shut down cleanly.
+*
+* With --export, astrolabe serves nothing, and instead renders every tile in a range of zooms into
+* a tile archive (see tile_archive.hpp) for offline use, on the same pool of workers, and exits.
+*
+*/
+
+#include <cmath>
+#include <cstring>
+#include <mutex>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <memory>
+#include <chrono>
+#include <charconv>
+#include <thread>
+#include <functional>
+#include <condition_variable>
+#include <unordered_map>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+
+#include "astrolib/console.hpp"
 #include "astrolib/concurrent.hpp"
+#include "astrolib/metrics.hpp"
+#include "astrolib/block_cache.hpp"
+#include "astrolib/primitives.hpp"
+#include "astrolib/net/http.hpp"
+#include "astrolib/index/query.hpp"
+#include "astrolib/index/handle.hpp"
+#include "astrolib/index/mvt.hpp"
+#include "astrolib/index/tile_archive.hpp"
+
+using namespace std::string_literals;
+using namespace leapus;
+using namespace leapus::concurrent;
+using namespace leapus::astrolib;
+using namespace leapus::astrolib::index;
+
+class query_pool:public ThreadPool< std::function<void()>, lf_queue<std::function<void()>> >{
+public:
+    using ThreadPool::ThreadPool;
+
+protected:
+    void exception_handler( std::exception_ptr ptr) override{
+        try{
+            std::rethrow_exception(ptr);
+        }
+        catch( const std::exception &ex ){
+            console::err("Worker thread exception: "s + ex.what());
+        }
+        catch(...){
+            console::err( "Uncaught exception in worker thread" );
+        }
+    }
+};
+
+struct server_metrics{
+    metrics::counter requests{ "http.requests" };
+    metrics::counter errors{ "http.errors" };
+    metrics::counter bytes_out{ "http.bytes_out" };
+    metrics::gauge connections{ "http.connections" };
+
+    //From a complete request being parsed, to its response being queued for writing
+    metrics::histogram latency{ "http.request_ns" };
+
+    static const server_metrics &get(){
+        static const server_metrics m;
+        return m;
+    }
+};
+
+//What the request handlers work with, from any worker at once
+struct service{
+    index_handle index;
+
+    //Only if the .pbf was given, for detail=1
+    std::unique_ptr<osm::osm_file> osm;
+    std::unique_ptr<osm::block_cache> cache;
+
+    service( const std::string &index_path ):
+        index(index_path){}
+};
+
+struct reply{
+    int status=200;
+    std::string content_type="application/json";
+    std::string body;
+};
+
+//Degrees to the index's nanodegrees
+static ordinate_t to_ordinate( double degrees ){
+    return std::llround(degrees * 1e9);
+}
+
+static void append_degrees( std::string &out, ordinate_t v ){
+    char buf[32];
+    int n=std::snprintf(buf, sizeof(buf), "%.7f", v / 1e9);
+    out.append(buf, n);
+}
+
+static void append_box( std::string &out, const box_t &b ){
+    out+='[';
+    append_degrees(out, b.sw.lon);
+    out+=',';
+    append_degrees(out, b.sw.lat);
+    out+=',';
+    append_degrees(out, b.ne.lon);
+    out+=',';
+    append_degrees(out, b.ne.lat);
+    out+=']';
+}
+
+static const char *type_name( index_entry_type t ){
+    switch(t){
+        case idx_line: return "line";
+        case idx_poly: return "polygon";
+        case idx_label: return "label";
+        case idx_widget: return "widget";
+    }
+    return "unknown";
+}
+
+template<typename T>
+static T parse_number( std::string_view s, const char *what ){
+    T v{};
+    auto [p, ec]=std::from_chars(s.data(), s.data()+s.size(), v);
+    if(ec != std::errc{} || p != s.data()+s.size())
+        throw net::http_exception("Bad "s + what + ": " + std::string(s));
+    return v;
+}
+
+template<typename T>
+static T int_param( const net::http_request &req, const char *name, T fallback ){
+    auto v=req.param(name);
+    return v ? parse_number<T>(*v, name) : fallback;
+}
+
+//w,s,e,n in degrees
+static box_t parse_bbox( std::string_view s ){
+    double v[4];
+    for( int i=0; i < 4; ++i ){
+        auto comma=s.find(',');
+        if((i < 3) == (comma == std::string_view::npos))
+            throw net::http_exception("bbox wants four numbers, w,s,e,n");
+
+        std::string part(s.substr(0, comma));
+        char *end;
+        v[i]=std::strtod(part.c_str(), &end);
+        if(part.empty() || *end || !std::isfinite(v[i]))
+            throw net::http_exception("Bad bbox number: " + part);
+
+        //Longitudes first and third, latitudes second and fourth
+        double limit=i % 2 ? 90 : 180;
+        if(v[i] < -limit || v[i] > limit)
+            throw net::http_exception("bbox number out of range: " + part);
+
+        s.remove_prefix(i < 3 ? comma+1 : s.size());
+    }
+
+    if(v[0] > v[2] || v[1] > v[3])
+        throw net::http_exception("bbox is inside out");
+
+    return { { to_ordinate(v[1]), to_ordinate(v[0]) }, { to_ordinate(v[3]), to_ordinate(v[2]) } };
+}
+
+//Lines and polygons narrower than min_extent both ways are too small to see. Points are always kept.
+static bool big_enough( const index_entry &e, ordinate_t min_extent ){
+    if(e.type != idx_line && e.type != idx_poly)
+        return true;
+
+    return std::max(e.bounds.ne.lat - e.bounds.sw.lat, e.bounds.ne.lon - e.bounds.sw.lon) >= min_extent;
+}
+
+//The item_pos'th object in a block: its kind and ID, with its tags as string table indices
+struct element_info{
+    const char *kind=nullptr;
+    osm::osm_id id=0;
+    std::vector<std::pair<::uint32_t, ::uint32_t>> tags;
+};
+
+static void find_element( const OSMPBF::PrimitiveBlock &block, int item, element_info &out ){
+    out.kind=nullptr;
+    out.tags.clear();
+
+    auto tags=[&](const auto &obj){
+        for( int i=0; i < obj.keys_size() && i < obj.vals_size(); ++i )
+            out.tags.emplace_back(obj.keys(i), obj.vals(i));
+    };
+
+    for(const auto &group: block.primitivegroup()){
+        if(item >= osm::element_count(group)){
+            item-=osm::element_count(group);
+            continue;
+        }
+
+        if(item < group.nodes_size()){
+            const auto &node=group.nodes(item);
+            out.kind="node";
+            out.id=node.id();
+            tags(node);
+            return;
+        }
+        item-=group.nodes_size();
+
+        if(group.has_dense() && item < group.dense().id_size()){
+            const auto &dense=group.dense();
+            out.kind="node";
+            out.id=0;
+            for( int i=0; i <= item; ++i )
+                out.id+=dense.id(i);
+
+            //keys_vals is key, value, key, value, ..., 0 for each node in turn
+            int node=0, i=0;
+            for(; node < item && i < dense.keys_vals_size(); ++i)
+                if(!dense.keys_vals(i))
+                    ++node;
+            for(; i+1 < dense.keys_vals_size() && dense.keys_vals(i); i+=2)
+                out.tags.emplace_back(dense.keys_vals(i), dense.keys_vals(i+1));
+            return;
+        }
+        item-=group.has_dense() ? group.dense().id_size() : 0;
+
+        if(item < group.ways_size()){
+            const auto &way=group.ways(item);
+            out.kind="way";
+            out.id=way.id();
+            tags(way);
+            return;
+        }
+        item-=group.ways_size();
+
+        const auto &rel=group.relations(item);
+        out.kind="relation";
+        out.id=rel.id();
+        tags(rel);
+        return;
+    }
+}
+
+//The element's ID, kind, and name tag if it has one
+static void append_element( std::string &out, const OSMPBF::PrimitiveBlock &block, int item ){
+    element_info info;
+    find_element(block, item, info);
+    if(!info.kind)
+        return;
+
+    out+=",\"kind\":\""s + info.kind + "\",\"id\":" + std::to_string(info.id);
+
+    const auto &strings=block.stringtable();
+    auto name_tag=osm::find_string(strings, "name");
+    for(auto [k, v]: info.tags)
+        if((int)k == name_tag){
+            out+=",\"name\":\"";
+            net::json_escape(out, strings.s(v));
+            out+='"';
+        }
+}
+
+//The squares that hold anything, which is where a client wanting actual data should look.
+//Only the squares are read, so even for the planet it's a matter of milliseconds.
+static void data_bounds( const quadtree_square &sq, box_t &out, bool &any ){
+    if(!sq.entries.empty()){
+        if(!any)
+            out=sq.bounds;
+        out={ { std::min(out.sw.lat, sq.bounds.sw.lat), std::min(out.sw.lon, sq.bounds.sw.lon) },
+            { std::max(out.ne.lat, sq.bounds.ne.lat), std::max(out.ne.lon, sq.bounds.ne.lon) } };
+        any=true;
+    }
+
+    for( auto *c: { sq.nw.get(), sq.ne.get(), sq.sw.get(), sq.se.get() } )
+        if(c)
+            data_bounds(*c, out, any);
+}
+
+static reply error_reply( int status, const std::string &message ){
+    std::string body="{\"error\":\"";
+    net::json_escape(body, message);
+    body+="\"}";
+    return { status, "application/json", std::move(body) };
+}
+
+static reply handle_info( service &svc ){
+    auto idx=svc.index.acquire();
+    const auto &sb=idx->header();
+
+    std::string body="{\"generation\":" + std::to_string(idx.generation()) + ",\"bounds\":";
+    append_box(body, idx->root().bounds);
+
+    box_t data=idx->root().bounds;
+    bool any=false;
+    data_bounds(idx->root(), data, any);
+    body+=",\"data_bounds\":";
+    append_box(body, data);
+
+    body+=",\"squares\":" + std::to_string(idx->section(section_tree)->size / sizeof(quadtree_square)) +
+        ",\"entries\":" + std::to_string(idx->section(section_entries)->size / sizeof(index_entry)) +
+        ",\"strings\":" + std::to_string(idx->dictionary().size()) +
+        ",\"file_size\":" + std::to_string(sb.file_size) + "}";
+
+    return { 200, "application/json", std::move(body) };
+}
+
+static reply handle_query( service &svc, const net::http_request &req ){
+    auto bbox_param=req.param("bbox");
+    if(!bbox_param)
+        throw net::http_exception("query wants a bbox");
+
+    box_t box=parse_bbox(*bbox_param);
+    auto lod=int_param<int>(req, "lod", -1);
+    auto limit=int_param<::size_t>(req, "limit", 1000);
+    bool detail=req.param("detail") == "1";
+
+    if(detail && !svc.cache)
+        throw net::http_exception("detail=1 needs the server to have been given the .osm.pbf");
+
+    ordinate_t min_extent=0;
+    if(lod >= 0)
+        min_extent=std::max(box.ne.lat - box.sw.lat, box.ne.lon - box.sw.lon) >> std::min(lod, 62);
+
+    auto idx=svc.index.acquire();
+    std::string body="{\"generation\":" + std::to_string(idx.generation()) + ",\"entries\":[";
+    ::size_t count=0;
+    bool truncated=false;
+
+    for_each_entry(idx->root(), box, [&](const quadtree_square &, const index_entry &e){
+        if(!big_enough(e, min_extent))
+            return;
+
+        if(count == limit){
+            truncated=true;
+            return;
+        }
+
+        if(count++)
+            body+=',';
+
+        body+="{\"type\":\""s + type_name(e.type) + "\",\"bounds\":";
+        append_box(body, e.bounds);
+        body+=",\"blob\":" + std::to_string(e.address.blob_pos) + ",\"item\":" + std::to_string(e.address.item_pos);
+
+        if(detail)
+            append_element(body, *svc.cache->get(e.address), e.address.item_pos);
+
+        body+='}';
+    });
+
+    body+="],\"count\":" + std::to_string(count) + ",\"truncated\":" + (truncated ? "true" : "false") + "}";
+    return { 200, "application/json", std::move(body) };
+}
+
+//Tile z/x/y, encoded by this thread's encoder, so it stays valid until the thread renders another.
+//any says whether the query found anything at all, before small features were left out, since
+//if it didn't, none of the tiles under this one will either.
+static std::string_view render_tile( service &svc, const index_file &idx, int z, int x, int y, bool want_tags, bool &any ){
+    box_t box=tile_bounds(z, x, y);
+
+    //Anything under a pixel of a 256 pixel tile is left out
+    ordinate_t min_extent=(box.ne.lon - box.sw.lon) / 256;
+
+    //Encoders keep their buffers, so each worker has its own
+    thread_local mvt_encoder encoder;
+    thread_local element_info info;
+    thread_local std::vector<mvt_encoder::tag_type> tags;
+
+    const auto &dictionary=idx.dictionary();
+    encoder.begin(box, dictionary);
+    any=false;
+
+    auto add=[&](const quadtree_square &sq, const index_entry &e){
+        //Tags come from the .pbf, and only those the index kept strings for make it into the tile
+        tags.clear();
+        if(want_tags){
+            auto block=svc.cache->get(e.address);
+            find_element(*block, e.address.item_pos, info);
+
+            const auto &strings=block->stringtable();
+            for(auto [k, v]: info.tags)
+                tags.emplace_back(dictionary.find(strings.s(k)), dictionary.find(strings.s(v)));
+        }
+
+        encoder.add(sq, e, idx.base(), tags.data(), tags.size());
+    };
+
+    //If labels and widgets were placed while indexing, a tile has just those placed at its zoom, which
+    //don't overlap, rather than every one there is. A 512 pixel tile is as wide as a square at that level.
+    auto *placed=idx.section(section_labels);
+    bool use_placed=placed && placed->size;
+
+    for_each_entry(idx.root(), box, [&](const quadtree_square &sq, const index_entry &e){
+        any=true;
+        if(use_placed && (e.type == idx_label || e.type == idx_widget))
+            return;
+
+        if(big_enough(e, min_extent))
+            add(sq, e);
+    });
+
+    //A label anchored in a neighbouring tile's edge is drawn in the buffer of this one too, so that
+    //it isn't cut off at the seam. It has to be looked for in the buffer, since it's found by its anchor.
+    if(use_placed)
+        for_each_label(idx.root(), encoder.clip(), z, [&](const quadtree_square &sq, const label_entry &l){
+            add(sq, { label_footprint(l, z), l.address, 0, l.type, 0 });
+        });
+
+    return encoder.finish();
+}
+
+static reply handle_tile( service &svc, const net::http_request &req, std::string_view path ){
+    //z/x/y
+    int v[3];
+    for( int i=0; i < 3; ++i ){
+        auto slash=path.find('/');
+        v[i]=parse_number<int>(path.substr(0, slash), "tile");
+        path.remove_prefix(slash == std::string_view::npos ? path.size() : slash+1);
+    }
+
+    int z=v[0], x=v[1], y=v[2];
+    //Well formed, but outside the pyramid, which is as missing as a path that isn't there
+    if(z < 0 || z > 24 || x < 0 || y < 0 || x >= (1 << z) || y >= (1 << z))
+        return error_reply(404, "No such tile");
+
+    bool want_tags=req.param("tags") == "1";
+    if(want_tags && !svc.cache)
+        throw net::http_exception("tags=1 needs the server to have been given the .osm.pbf");
+
+    auto idx=svc.index.acquire();
+    bool any;
+    return { 200, "application/vnd.mapbox-vector-tile", std::string(render_tile(svc, *idx, z, x, y, want_tags, any)) };
+}
+
+static reply handle_stats( service &svc ){
+    auto snap=metrics::take_snapshot();
+    std::string body="{\"generation\":" + std::to_string(svc.index.generation()) +
+        ",\"retired_indexes\":" + std::to_string(svc.index.retired()) + ",\"counters\":{";
+
+    for( ::size_t i=0; i < snap.counters.size(); ++i )
+        body+=(i ? ",\"" : "\"") + snap.counters[i].first + "\":" + std::to_string(snap.counters[i].second);
+
+    body+="},\"gauges\":{";
+    for( ::size_t i=0; i < snap.gauges.size(); ++i )
+        body+=(i ? ",\"" : "\"") + snap.gauges[i].first + "\":" + std::to_string(snap.gauges[i].second);
+
+    body+="},\"histograms\":{";
+    for( ::size_t i=0; i < snap.histograms.size(); ++i ){
+        const auto &h=snap.histograms[i].second;
+        body+=(i ? ",\"" : "\"") + snap.histograms[i].first + "\":{\"count\":" + std::to_string(h.count) +
+            ",\"p50\":" + std::to_string(h.percentile(0.5)) + ",\"p99\":" + std::to_string(h.percentile(0.99)) +
+            ",\"max\":" + std::to_string(h.max) + "}";
+    }
+    body+='}';
+
+    if(svc.cache){
+        auto cs=svc.cache->statistics();
+        body+=",\"block_cache\":{\"hits\":" + std::to_string(cs.hits) + ",\"misses\":" + std::to_string(cs.misses) +
+            ",\"evictions\":" + std::to_string(cs.evictions) + ",\"blocks\":" + std::to_string(cs.blocks) +
+            ",\"bytes\":" + std::to_string(cs.bytes) + "}";
+    }
+
+    body+='}';
+    return { 200, "application/json", std::move(body) };
+}
+
+static reply handle_reload( service &svc ){
+    auto generation=svc.index.reload();
+    console::out( "Index reloaded, generation " + std::to_string(generation) );
+    return { 200, "application/json", "{\"generation\":" + std::to_string(generation) + "}" };
+}
+
+//Runs on a worker
+static reply handle( service &svc, const net::http_request &req ){
+    try{
+        std::string_view path=req.path;
+        bool get=req.method == "GET";
+
+        if(path == "/reload")
+            return req.method == "POST" ? handle_reload(svc) : error_reply(405, "reload wants POST");
+
+        if(!get)
+            return error_reply(405, "Only GET, except for POST /reload");
+
+        if(path == "/info")
+            return handle_info(svc);
+        if(path == "/query")
+            return handle_query(svc, req);
+        if(path.substr(0, 6) == "/tile/")
+            return handle_tile(svc, req, path.substr(6));
+        if(path == "/stats")
+            return handle_stats(svc);
+
+        return error_reply(404, "No such thing: " + std::string(path));
+    }
+    catch( const net::http_exception &ex ){
+        return error_reply(400, ex.what());
+    }
+    catch( const std::exception &ex ){
+        return error_reply(500, ex.what());
+    }
+}
+
+class server{
+    struct connection{
+        ::uint64_t id;
+        std::string in, out;
+        ::size_t out_pos=0;
+
+        //With a worker, so nothing more is parsed until its response has been queued
+        bool busy=false;
+
+        //Close once out has been written
+        bool closing=false;
+        bool writable_wanted=false;
+    };
+
+    struct completion{
+        int fd;
+        ::uint64_t id;
+        std::string response;
+        bool keep_alive;
+        std::chrono::steady_clock::time_point started;
+    };
+
+    service &m_service;
+    query_pool &m_pool;
+
+    int m_epoll=-1, m_listen=-1, m_wake=-1, m_signals=-1;
+    std::unordered_map<int, connection> m_connections;
+    ::uint64_t m_next_id=1;
+
+    std::mutex m_done_mutex;
+    std::vector<completion> m_done;
+
+    bool m_stop=false;
+
+    static void check( int r, const char *what ){
+        if(r == -1)
+            throw std::runtime_error(what + ": "s + std::strerror(errno));
+    }
+
+    void watch( int fd, ::uint32_t events, int op=EPOLL_CTL_ADD ){
+        epoll_event ev{};
+        ev.events=events;
+        ev.data.fd=fd;
+        check( ::epoll_ctl(m_epoll, op, fd, &ev), "epoll_ctl" );
+    }
+
+    void accept_all(){
+        while(true){
+            int fd=::accept4(m_listen, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if(fd == -1){
+                if(errno == EAGAIN || errno == EWOULDBLOCK)
+                    return;
+                if(errno == EINTR || errno == ECONNABORTED)
+                    continue;
+
+                //Out of descriptors, most likely. Leave the rest in the backlog until some close.
+                console::err("accept: "s + std::strerror(errno));
+                return;
+            }
+
+            int one=1;
+            ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+            m_connections[fd].id=m_next_id++;
+            watch(fd, EPOLLIN | EPOLLRDHUP);
+            server_metrics::get().connections.add(1);
+        }
+    }
+
+    void close_connection( int fd ){
+        ::close(fd);
+        m_connections.erase(fd);
+        server_metrics::get().connections.add(-1);
+    }
+
+    //Returns false if the connection was closed
+    bool read_from( int fd, connection &c ){
+        char buf[16384];
+        while(true){
+            auto n=::recv(fd, buf, sizeof(buf), 0);
+            if(n > 0){
+                c.in.append(buf, n);
+                continue;
+            }
+
+            if(n == -1 && errno == EINTR)
+                continue;
+
+            if(n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                return true;
+
+            //Hung up, or broken. A response still with a worker will find the connection gone.
+            close_connection(fd);
+            return false;
+        }
+    }
+
+    //Returns false if the connection was closed
+    bool write_to( int fd, connection &c ){
+        while(c.out_pos < c.out.size()){
+            auto n=::send(fd, c.out.data() + c.out_pos, c.out.size() - c.out_pos, MSG_NOSIGNAL);
+            if(n == -1){
+                if(errno == EINTR)
+                    continue;
+                if(errno == EAGAIN || errno == EWOULDBLOCK)
+                    break;
+
+                close_connection(fd);
+                return false;
+            }
+
+            c.out_pos+=n;
+            server_metrics::get().bytes_out.add(n);
+        }
+
+        if(c.out_pos == c.out.size()){
+            c.out.clear();
+            c.out_pos=0;
+
+            if(c.closing){
+                close_connection(fd);
+                return false;
+            }
+        }
+
+        //Only ask to hear about writability while there's something waiting to be written
+        bool want=!c.out.empty();
+        if(want != c.writable_wanted){
+            watch(fd, EPOLLIN | EPOLLRDHUP | (want ? EPOLLOUT : 0), EPOLL_CTL_MOD);
+            c.writable_wanted=want;
+        }
+
+        return true;
+    }
+
+    //Hand the next complete request, if there is one, to a worker
+    void dispatch( int fd, connection &c ){
+        if(c.busy || c.closing)
+            return;
+
+        auto req=std::make_shared<net::http_request>();
+        ::size_t used;
+        try{
+            used=net::parse_request(c.in, *req);
+        }
+        catch( const net::http_exception &ex ){
+            auto r=error_reply(400, ex.what());
+            net::write_response(c.out, r.status, r.content_type, r.body, false);
+            server_metrics::get().errors.add();
+            c.closing=true;
+            c.in.clear();
+            write_to(fd, c);
+            return;
+        }
+
+        if(!used)
+            return;
+
+        c.in.erase(0, used);
+        c.busy=true;
+
+        auto started=std::chrono::steady_clock::now();
+        m_pool.push_front( [this, fd, id=c.id, req, started](){
+            auto r=handle(m_service, *req);
+
+            completion done{ fd, id, {}, req->keep_alive, started };
+            net::write_response(done.response, r.status, r.content_type, r.body, req->keep_alive);
+            if(r.status != 200)
+                server_metrics::get().errors.add();
+
+            {
+                std::lock_guard lock(m_done_mutex);
+                m_done.push_back(std::move(done));
+            }
+
+            ::uint64_t one=1;
+            [[maybe_unused]] auto n=::write(m_wake, &one, sizeof(one));
+        });
+    }
+
+    void collect_completions(){
+        ::uint64_t count;
+        [[maybe_unused]] auto n=::read(m_wake, &count, sizeof(count));
+
+        std::vector<completion> done;
+        {
+            std::lock_guard lock(m_done_mutex);
+            std::swap(done, m_done);
+        }
+
+        auto now=std::chrono::steady_clock::now();
+        for(auto &d: done){
+            auto &sm=server_metrics::get();
+            sm.requests.add();
+            sm.latency.record( std::chrono::duration_cast<std::chrono::nanoseconds>(now - d.started).count() );
+
+            //Closed while the worker was at it, maybe even reused by a new connection since
+            auto it=m_connections.find(d.fd);
+            if(it == m_connections.end() || it->second.id != d.id)
+                continue;
+
+            auto &c=it->second;
+            c.busy=false;
+            c.closing=!d.keep_alive;
+            c.out+=d.response;
+
+            if(write_to(d.fd, c))
+                dispatch(d.fd, c);
+        }
+    }
+
+    void handle_signal(){
+        signalfd_siginfo info;
+        if(::read(m_signals, &info, sizeof(info)) != sizeof(info))
+            return;
+
+        if(info.ssi_signo == SIGHUP){
+            //Reading a whole index to verify it is no job for the event loop
+            m_pool.push_front( [this](){
+                try{
+                    handle_reload(m_service);
+                }
+                catch( const std::exception &ex ){
+                    console::err("Reload failed, carrying on with the old index: "s + ex.what());
+                }
+            });
+        }
+        else
+            m_stop=true;
+    }
+
+public:
+    server( service &svc, query_pool &pool, int port, const sigset_t &signals ):
+        m_service(svc),
+        m_pool(pool){
+
+        m_epoll=::epoll_create1(EPOLL_CLOEXEC);
+        check(m_epoll, "epoll_create1");
+
+        m_listen=::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        check(m_listen, "socket");
+
+        int one=1;
+        ::setsockopt(m_listen, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+        //Loopback only. It's for processes on the same machine, and has no business facing a network.
+        sockaddr_in addr{};
+        addr.sin_family=AF_INET;
+        addr.sin_port=htons(port);
+        addr.sin_addr.s_addr=htonl(INADDR_LOOPBACK);
+        check( ::bind(m_listen, (sockaddr *)&addr, sizeof(addr)), "bind" );
+        check( ::listen(m_listen, SOMAXCONN), "listen" );
+
+        m_wake=::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        check(m_wake, "eventfd");
+
+        m_signals=::signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+        check(m_signals, "signalfd");
+
+        watch(m_listen, EPOLLIN);
+        watch(m_wake, EPOLLIN);
+        watch(m_signals, EPOLLIN);
+    }
+
+    ~server(){
+        //Workers still at it would queue their responses into a server that isn't there
+        m_pool.shutdown();
+
+        for(auto &[fd, c]: m_connections)
+            ::close(fd);
+
+        for( int fd: { m_signals, m_wake, m_listen, m_epoll } )
+            if(fd != -1)
+                ::close(fd);
+    }
+
+    server( const server & ) = delete;
+
+    //Until SIGINT or SIGTERM
+    void run(){
+        epoll_event events[256];
+
+        while(!m_stop){
+            int n=::epoll_wait(m_epoll, events, 256, -1);
+            if(n == -1){
+                if(errno == EINTR)
+                    continue;
+                check(n, "epoll_wait");
+            }
+
+            for( int i=0; i < n; ++i ){
+                int fd=events[i].data.fd;
+                auto ev=events[i].events;
+
+                if(fd == m_listen)
+                    accept_all();
+                else if(fd == m_wake)
+                    collect_completions();
+                else if(fd == m_signals)
+                    handle_signal();
+                else{
+                    auto it=m_connections.find(fd);
+                    if(it == m_connections.end())
+                        continue;
+
+                    auto &c=it->second;
+                    if((ev & EPOLLOUT) && !write_to(fd, c))
+                        continue;
+
+                    if(ev & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)){
+                        if(!read_from(fd, c))
+                            continue;
+                        dispatch(fd, c);
+                    }
+                }
+            }
+        }
+    }
+};
+
+//Renders every tile from min_zoom to max_zoom into a tile archive, on the pool. Each tile is a task,
+//which queues its four children once it's done, so the pyramid is walked top-down, and below a tile
+//with nothing in it, the walk stops, which leaves out the oceans and deserts without looking at them.
+class tile_exporter{
+    service &m_svc;
+    query_pool &m_pool;
+    const index_file &m_index;
+    tile_archive_writer &m_archive;
+    int m_min_zoom, m_max_zoom;
+    bool m_tags;
+
+    //Tiles queued or running, and the first thing that went wrong, both under m_mutex. The last task
+    //to finish notifies with it held, so run() can't return, and the exporter go, while it still
+    //has m_mutex to unlock.
+    std::mutex m_mutex;
+    std::condition_variable m_done;
+    ::size_t m_pending=0;
+    std::exception_ptr m_error;
+
+    //Set along with m_error, for tasks to skip their tiles without taking the lock
+    std::atomic_bool m_failed=false;
+
+    metrics::counter m_tiles{ "export.tiles" };
+    metrics::counter m_unique{ "export.unique_tiles" };
+    metrics::counter m_bytes{ "export.bytes" };
+
+    void queue( int z, int x, int y ){
+        {
+            std::lock_guard lock(m_mutex);
+            ++m_pending;
+        }
+
+        m_pool.push_front( [this, z, x, y](){
+            try{
+                if(!m_failed)
+                    render(z, x, y);
+            }
+            catch(...){
+                std::lock_guard lock(m_mutex);
+                if(!m_error)
+                    m_error=std::current_exception();
+                m_failed=true;
+            }
+
+            std::lock_guard lock(m_mutex);
+            if(--m_pending == 0)
+                m_done.notify_all();
+        });
+    }
+
+    void render( int z, int x, int y ){
+        bool any;
+        auto tile=render_tile(m_svc, m_index, z, x, y, m_tags, any);
+        if(!any)
+            return;
+
+        if(z >= m_min_zoom){
+            m_tiles.add(1);
+            if(m_archive.add(z, x, y, tile)){
+                m_unique.add(1);
+                m_bytes.add(tile.size());
+            }
+        }
+
+        if(z < m_max_zoom)
+            for( int i=0; i < 4; ++i )
+                queue(z+1, x*2 + (i & 1), y*2 + (i >> 1));
+    }
+
+public:
+    tile_exporter( service &svc, query_pool &pool, const index_file &index, tile_archive_writer &archive,
+        int min_zoom, int max_zoom, bool tags ):
+        m_svc(svc),
+        m_pool(pool),
+        m_index(index),
+        m_archive(archive),
+        m_min_zoom(min_zoom),
+        m_max_zoom(max_zoom),
+        m_tags(tags){}
+
+    //Walk the whole pyramid, and rethrow the first thing that went wrong, if anything did
+    void run(){
+        queue(0, 0, 0);
+
+        std::unique_lock lock(m_mutex);
+        m_done.wait(lock, [this](){ return m_pending == 0; });
+
+        if(m_error)
+            std::rethrow_exception(m_error);
+    }
+};
+
+static int export_tiles( service &svc, query_pool &pool, const std::string &path, int min_zoom, int max_zoom ){
+    auto idx=svc.index.acquire();
+    tile_archive_writer archive{ path, min_zoom, max_zoom };
+
+    auto start=std::chrono::steady_clock::now();
+    tile_exporter exporter{ svc, pool, *idx, archive, min_zoom, max_zoom, (bool)svc.cache };
+    exporter.run();
+
+    auto h=archive.finish();
+    double seconds=std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    console::out( "Exported " + std::to_string(h.tile_count) + " tiles, " + std::to_string(h.unique_count) +
+        " distinct, zooms " + std::to_string(min_zoom) + " to " + std::to_string(max_zoom) + ", to " + path + ": " +
+        std::to_string(h.file_size) + " bytes in " + std::to_string(seconds) + "s, " +
+        std::to_string((::uint64_t)(h.tile_count / std::max(seconds, 1e-9))) + " tiles/s" );
+    return 0;
+}
+
+int main(int argc, char *argv[]){
+
+    //--port <n>, --threads <n>, --cache <MiB>, --progress <seconds>, --export <archive> and
+    //--zoom <min>-<max> may go anywhere, and everything else is positional
+    std::vector<std::string> args;
+    std::string export_path;
+    int min_zoom=0, max_zoom=14;
+    int port=8080;
+    int threads=std::thread::hardware_concurrency();
+    ::size_t cache_mib=256;
+    double progress_interval=0;
+
+    for( int i=1; i < argc; ++i ){
+        std::string arg=argv[i];
+        if(arg == "--port" && i+1 < argc)
+            port=std::stoi(argv[++i]);
+        else if(arg == "--threads" && i+1 < argc)
+            threads=std::stoi(argv[++i]);
+        else if(arg == "--cache" && i+1 < argc)
+            cache_mib=std::stoul(argv[++i]);
+        else if(arg == "--progress" && i+1 < argc)
+            progress_interval=std::stod(argv[++i]);
+        else if(arg == "--export" && i+1 < argc)
+            export_path=argv[++i];
+        else if(arg == "--zoom" && i+1 < argc){
+            std::string zooms=argv[++i];
+            auto dash=zooms.find('-');
+            min_zoom=std::stoi(zooms.substr(0, dash));
+            max_zoom=dash == std::string::npos ? min_zoom : std::stoi(zooms.substr(dash+1));
+        }
+        else
+            args.push_back(arg);
+    }
+
+    if(args.empty()){
+        console::err("Usage: astrolabe [--port <n>] [--threads <n>] [--cache <MiB>] [--progress <seconds>] <index> [in.osm.pbf]");
+        console::err("       astrolabe --export <archive> [--zoom <min>-<max>] [--threads <n>] [--cache <MiB>] [--progress <seconds>] <index> [in.osm.pbf]");
+        return 1;
+    }
+
+    //Blocked before any thread is started, so that they all inherit it, and only the signalfd sees them
+    sigset_t signals;
+    sigemptyset(&signals);
+    for( int s: { SIGINT, SIGTERM, SIGHUP } )
+        sigaddset(&signals, s);
+    ::pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+    try{
+        service svc{ args[0] };
+        if(args.size() > 1){
+            svc.osm=std::make_unique<osm::osm_file>(args[1]);
+            svc.cache=std::make_unique<osm::block_cache>(*svc.osm, cache_mib * 1024 * 1024);
+        }
+
+        std::unique_ptr<metrics::reporter> reporter;
+        if(progress_interval > 0)
+            reporter=std::make_unique<metrics::reporter>( std::chrono::milliseconds( (long)(progress_interval * 1000) ) );
+
+        query_pool pool{ std::max(threads, 1) };
+
+        if(!export_path.empty()){
+            int status=export_tiles(svc, pool, export_path, min_zoom, max_zoom);
+            if(reporter)
+                reporter->stop();
+            return status;
+        }
+
+        server srv{ svc, pool, port, signals };
+
+        {
+            auto idx=svc.index.acquire();
+            console::out( "Serving " + args[0] + " (" + std::to_string(idx->header().file_size) + " bytes) on 127.0.0.1:" +
+                std::to_string(port) + " with " + std::to_string(std::max(threads, 1)) + " workers" );
+        }
+
+        srv.run();
+
+        console::out("Shutting down");
+        if(reporter)
+            reporter->stop();
+    }
+    catch( const std::exception &ex ){
+        console::err(ex.what());
+        return 1;
+    }
 
-int main(){
     return 0;
 }